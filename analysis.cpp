@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <string.h>
+#include "analysis.h"
+#include "disasm.h"
+
+
+static inline uint16_t readWord(const chip8_t *chip8, uint32_t addr) {
+	return (chip8->memory[addr & 0xFFFF] << 8) | chip8->memory[(addr + 1) & 0xFFFF];
+}
+
+// F000 NNNN is the one 4 byte instruction, a skip over it skips all 4 bytes
+static inline uint32_t instructionSize(uint16_t opcode) {
+	return opcode == 0xF000 ? 4 : 2;
+}
+
+static inline bool isSkip(uint16_t opcode) {
+	switch (opcode >> 12) {
+		case 0x3: case 0x4: return true;
+		case 0x5: case 0x9: return (opcode & 0xF) == 0;
+		case 0xE: return (opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1;
+		default: return false;
+	}
+}
+
+// Last instruction of a block: it decides where to go next rather than falling through
+static inline bool endsBlock(uint16_t opcode) {
+	const uint8_t group = opcode >> 12;
+	return group == 0x1 || group == 0x2 || group == 0xB || opcode == 0x00EE || opcode == 0x00FD || isSkip(opcode);
+}
+
+
+// Marks the entry to a block and queues it for walking
+static void addLeader(analysis_t *analysis, uint16_t *work, uint32_t *pending, uint32_t addr, uint8_t flags) {
+	if (addr > 0xFFFE) return;
+	analysis->flags[addr] |= BYTE_LEADER | flags;
+	if (!(analysis->flags[addr] & BYTE_CODE)) work[(*pending)++] = (uint16_t)addr;
+}
+
+
+// Walks straight line code from each queued address, queueing every other way out as it goes
+static void findCode(analysis_t *analysis, const chip8_t *chip8) {
+	// Each address is queued at most once per flag it gains, a leader queued twice is walked once
+	uint16_t *work = (uint16_t *)malloc(4 * MEMORY_SIZE * sizeof *work);
+	uint32_t pending = 0;
+	if (!work) return;
+	addLeader(analysis, work, &pending, ENTRY_POINT, 0);
+
+	while (pending) {
+		uint32_t addr = work[--pending];
+		while (addr <= 0xFFFE && !(analysis->flags[addr] & BYTE_CODE) && pending < 4 * MEMORY_SIZE - 64) {
+			const uint16_t opcode = readWord(chip8, addr);
+			char text[32];
+			if (!disassemble(opcode, text, sizeof text)) {
+				analysis->invalid++;
+				break;
+			}
+			const uint32_t size = instructionSize(opcode);
+			analysis->flags[addr] |= BYTE_CODE;
+			for (uint32_t i = 1; i < size && addr + i < MEMORY_SIZE; i++) analysis->flags[addr + i] |= BYTE_OPERAND;
+			analysis->instructions++;
+
+			const uint16_t NNN = opcode & 0x0FFF;
+			const uint32_t next = addr + size;
+			if ((opcode >> 12) == 0x1) {
+				addLeader(analysis, work, &pending, NNN, 0);
+				break;
+			}
+			if ((opcode >> 12) == 0x2) {
+				addLeader(analysis, work, &pending, NNN, BYTE_CALLED);
+				addLeader(analysis, work, &pending, next, 0);	// Where it returns to
+				break;
+			}
+			if ((opcode >> 12) == 0xB) {
+				// Jump table: the base and the JPs right after it
+				analysis->flags[addr] |= BYTE_INDIRECT;
+				analysis->indirectJumps++;
+				addLeader(analysis, work, &pending, NNN, 0);
+				for (uint32_t entry = NNN + 2; entry <= 0xFFFE && (readWord(chip8, entry) >> 12) == 0x1; entry += 2)
+					addLeader(analysis, work, &pending, entry, 0);
+				break;
+			}
+			if (opcode == 0x00EE || opcode == 0x00FD) break;
+			if (isSkip(opcode)) {
+				addLeader(analysis, work, &pending, next, 0);
+				addLeader(analysis, work, &pending, next + instructionSize(readWord(chip8, next)), 0);
+				break;
+			}
+			addr = next;
+		}
+	}
+	free(work);
+}
+
+
+// Splits the code into blocks at every leader and after every instruction that ends one
+static void buildBlocks(analysis_t *analysis, const chip8_t *chip8) {
+	for (uint32_t addr = 0; addr < MEMORY_SIZE && analysis->blockCount < MAX_BASIC_BLOCKS;) {
+		if (!(analysis->flags[addr] & BYTE_CODE)) {
+			addr++;
+			continue;
+		}
+		// Code that isn't a leader here was only walked into through the middle of another instruction
+		analysis->flags[addr] |= BYTE_LEADER;
+		basic_block_t *block = &analysis->blocks[analysis->blockCount++];
+		memset(block, 0, sizeof *block);
+		block->start = (uint16_t)addr;
+
+		uint16_t opcode;
+		for (;;) {
+			opcode = readWord(chip8, addr);
+			addr += instructionSize(opcode);
+			block->count++;
+			if (endsBlock(opcode) || addr >= MEMORY_SIZE) break;
+			if (!(analysis->flags[addr] & BYTE_CODE) || (analysis->flags[addr] & BYTE_LEADER)) break;
+		}
+		block->end = addr;
+
+		const uint16_t NNN = opcode & 0x0FFF;
+		const uint32_t last = addr - instructionSize(opcode);
+		if ((opcode >> 12) == 0x1) block->next[block->nextCount++] = NNN;
+		else if ((opcode >> 12) == 0x2) {
+			block->call = true;
+			block->callee = NNN;
+			if (addr <= 0xFFFE) block->next[block->nextCount++] = (uint16_t)addr;
+		}
+		else if (isSkip(opcode)) {
+			const uint32_t skipTo = last + 2 + instructionSize(readWord(chip8, last + 2));
+			if (addr <= 0xFFFE) block->next[block->nextCount++] = (uint16_t)addr;
+			if (skipTo <= 0xFFFE) block->next[block->nextCount++] = (uint16_t)skipTo;
+		}
+		else if ((opcode >> 12) != 0xB && opcode != 0x00EE && opcode != 0x00FD && addr <= 0xFFFE &&
+				 (analysis->flags[addr] & BYTE_CODE)) {
+			block->next[block->nextCount++] = (uint16_t)addr;	// Falls into the next block
+		}
+	}
+	for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) analysis->subroutines += (analysis->flags[addr] & BYTE_CALLED) != 0;
+}
+
+
+static void markRange(analysis_t *analysis, uint32_t start, uint32_t length, uint8_t flag) {
+	for (uint32_t i = 0; i < length; i++) analysis->flags[(start + i) & 0xFFFF] |= flag;
+}
+
+
+// Follows I through each block, only values set by ANNN or F000 NNNN in the same block are known
+static void findData(analysis_t *analysis, const chip8_t *chip8) {
+	for (uint32_t b = 0; b < analysis->blockCount; b++) {
+		const basic_block_t *block = &analysis->blocks[b];
+		bool known = false;
+		uint32_t I = 0;
+		for (uint32_t addr = block->start; addr < block->end;) {
+			const uint16_t opcode = readWord(chip8, addr);
+			const uint8_t X = (opcode >> 8) & 0x0F;
+			const uint8_t Y = (opcode >> 4) & 0x0F;
+			const uint8_t N = opcode & 0x0F;
+			const uint8_t NN = opcode & 0xFF;
+			const uint8_t range = X > Y ? X - Y + 1 : Y - X + 1;
+			addr += instructionSize(opcode);
+
+			switch (opcode >> 12) {
+				case 0xA:
+					I = opcode & 0x0FFF;
+					known = true;
+					break;
+				case 0xD:
+					// DXY0 is a 16x16 sprite, two bytes a row
+					if (known) markRange(analysis, I, N ? N : 32, BYTE_DATA);
+					break;
+				case 0x5:
+					if (known && N == 2) markRange(analysis, I, range, BYTE_WRITTEN);
+					if (known && N == 3) markRange(analysis, I, range, BYTE_DATA);
+					break;
+				case 0xF:
+					if (opcode == 0xF000) {
+						I = readWord(chip8, addr - 2);
+						known = true;
+					}
+					else if (opcode == 0xF002) { if (known) markRange(analysis, I, 16, BYTE_DATA); }
+					else if (NN == 0x33) { if (known) markRange(analysis, I, 3, BYTE_WRITTEN); }
+					else if (NN == 0x55) {
+						// Where I ends up depends on the quirks
+						if (known) markRange(analysis, I, X + 1, BYTE_WRITTEN);
+						known = false;
+					}
+					else if (NN == 0x65) {
+						if (known) markRange(analysis, I, X + 1, BYTE_DATA);
+						known = false;
+					}
+					else if (NN == 0x1E || NN == 0x29 || NN == 0x30) known = false;
+					break;
+			}
+		}
+	}
+
+	for (uint32_t addr = ENTRY_POINT; addr < analysis->romEnd; addr++) {
+		const uint8_t flags = analysis->flags[addr];
+		analysis->dataBytes += (flags & BYTE_DATA) && !(flags & (BYTE_CODE | BYTE_OPERAND));
+	}
+	for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+		const uint8_t flags = analysis->flags[addr];
+		analysis->selfWrites += (flags & BYTE_WRITTEN) && (flags & (BYTE_CODE | BYTE_OPERAND));
+	}
+}
+
+
+// Analyzes memory as it is now, call right after initChip8. NULL if out of memory
+analysis_t *analyzeRom(const chip8_t *chip8) {
+	analysis_t *analysis = (analysis_t *)calloc(1, sizeof(analysis_t));
+	if (!analysis) return NULL;
+	memcpy(analysis->loaded, chip8->memory, sizeof analysis->loaded);
+	analysis->romEnd = ENTRY_POINT + chip8->romSize;
+	findCode(analysis, chip8);
+	buildBlocks(analysis, chip8);
+	findData(analysis, chip8);
+	return analysis;
+}
+
+
+void destroyAnalysis(analysis_t *analysis) {
+	free(analysis);
+}
+
+
+// Reachable code bytes that differ from when the rom was analyzed, first is set to the lowest one
+uint32_t rewrittenCode(const analysis_t *analysis, const chip8_t *chip8, uint16_t *first) {
+	uint32_t count = 0;
+	for (uint32_t addr = MEMORY_SIZE; addr-- > 0;) {
+		if (!(analysis->flags[addr] & (BYTE_CODE | BYTE_OPERAND)) || chip8->memory[addr] == analysis->loaded[addr]) continue;
+		*first = (uint16_t)addr;
+		count++;
+	}
+	return count;
+}
+
+
+// Summary, call graph, then the rom as a listing: labelled blocks of code, data bytes as sprite rows
+// and unclassified bytes 8 to a line
+void printAnalysis(const analysis_t *analysis, FILE *out) {
+	fprintf(out, "Analysis: %u instructions in %u blocks, %u subroutines, %u data bytes, %u indirect jumps\n",
+			analysis->instructions, analysis->blockCount, analysis->subroutines, analysis->dataBytes, analysis->indirectJumps);
+	if (analysis->invalid) fprintf(out, "  %u reachable words aren't instructions\n", analysis->invalid);
+	if (analysis->selfWrites) fprintf(out, "  %u code bytes are written through I, the rom modifies itself\n", analysis->selfWrites);
+
+	fprintf(out, "\nCall graph\n");
+	for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+		if (!(analysis->flags[addr] & BYTE_CALLED)) continue;
+		fprintf(out, "  sub_%04X called from", addr);
+		for (uint32_t b = 0; b < analysis->blockCount; b++) {
+			const basic_block_t *block = &analysis->blocks[b];
+			if (block->call && block->callee == addr) fprintf(out, " 0x%04X", (uint32_t)(block->end - 2));
+		}
+		fputc('\n', out);
+	}
+
+	fprintf(out, "\nListing\n");
+	uint32_t b = 0;
+	for (uint32_t addr = ENTRY_POINT; addr < analysis->romEnd;) {
+		const uint8_t flags = analysis->flags[addr];
+		if (flags & BYTE_CODE) {
+			while (b < analysis->blockCount && analysis->blocks[b].start < addr) b++;
+			if (b < analysis->blockCount && analysis->blocks[b].start == addr) {
+				const basic_block_t *block = &analysis->blocks[b];
+				fprintf(out, "\n%s_%04X:", flags & BYTE_CALLED ? "sub" : "loc", addr);
+				if (block->nextCount) fprintf(out, "%*s; next", 28 - 8, "");
+				for (uint32_t i = 0; i < block->nextCount; i++) fprintf(out, " 0x%04X", block->next[i]);
+				fputc('\n', out);
+			}
+			const uint16_t opcode = (analysis->loaded[addr] << 8) | analysis->loaded[(addr + 1) & 0xFFFF];
+			char text[32];
+			disassemble(opcode, text, sizeof text);
+			if (opcode == 0xF000) {
+				snprintf(text, sizeof text, "LD I, 0x%04X", (analysis->loaded[(addr + 2) & 0xFFFF] << 8) | analysis->loaded[(addr + 3) & 0xFFFF]);
+			}
+			const char *note = flags & BYTE_INDIRECT ? "; indirect" :
+							   (flags | analysis->flags[(addr + 1) & 0xFFFF]) & BYTE_WRITTEN ? "; rewritten" : NULL;
+			if (note) fprintf(out, "  0x%04X  %04X  %-20s%s\n", addr, opcode, text, note);
+			else fprintf(out, "  0x%04X  %04X  %s\n", addr, opcode, text);
+			addr += instructionSize(opcode);
+		}
+		else if (flags & BYTE_DATA) {
+			char row[9];
+			for (uint32_t bit = 0; bit < 8; bit++) row[bit] = (analysis->loaded[addr] >> (7 - bit)) & 1 ? '#' : '.';
+			row[8] = 0;
+			fprintf(out, "  0x%04X  %02X    DB 0x%02X              ; %s\n", addr, analysis->loaded[addr], analysis->loaded[addr], row);
+			addr++;
+		}
+		else {
+			fprintf(out, "  0x%04X        DB", addr);
+			for (uint32_t i = 0; i < 8 && addr < analysis->romEnd && !(analysis->flags[addr] & (BYTE_CODE | BYTE_DATA)); i++, addr++)
+				fprintf(out, "%s0x%02X", i ? ", " : " ", analysis->loaded[addr]);
+			fputc('\n', out);
+		}
+	}
+}
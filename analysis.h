@@ -0,0 +1,56 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "chip8.h"
+
+// Static analysis of a rom as it was loaded, before anything runs
+// Code is found by following every way out of every instruction reachable from ENTRY_POINT: jumps, calls
+// and the return to after them, and both ways out of a skip. BNNN goes through a register, so it is flagged
+// and only its jump table (NNN on, while the entries are JPs) is followed. Bytes the code points I at with
+// ANNN and then draws, reads or writes are data. Code only reached through self modification or an
+// unusual BNNN target is missed, and bytes that are neither code nor data are left unclassified.
+
+// Per byte flags
+#define BYTE_CODE		0x01	// First byte of a reachable instruction
+#define BYTE_OPERAND	0x02	// Other bytes of a reachable instruction
+#define BYTE_LEADER		0x04	// Starts a basic block
+#define BYTE_CALLED		0x08	// 2NNN target, a subroutine entry
+#define BYTE_DATA		0x10	// Drawn or read through I
+#define BYTE_WRITTEN	0x20	// Written through I by FX33, FX55 or 5XY2
+#define BYTE_INDIRECT	0x40	// BNNN, where it goes depends on a register
+
+#define MAX_BASIC_BLOCKS 32768	// One per reachable instruction at worst
+
+// Straight run of instructions entered only at the top and left only at the bottom
+typedef struct {
+	uint16_t start;			// Address of the first instruction
+	uint32_t end;			// One past the last byte of the last instruction
+	uint16_t count;			// Instructions
+	uint16_t next[2];		// Blocks control can go to next, the return address for a call
+	uint8_t nextCount;
+	bool call;				// Ends in 2NNN, callee is its target
+	uint16_t callee;
+} basic_block_t;
+
+typedef struct analysis_t {
+	uint8_t flags[MEMORY_SIZE];
+	uint8_t loaded[MEMORY_SIZE];		// Memory when it was analyzed, for spotting code rewritten later
+	uint32_t romEnd;					// One past the last rom byte
+	basic_block_t blocks[MAX_BASIC_BLOCKS];	// In address order
+	uint32_t blockCount;
+	uint32_t instructions;		// Reachable instructions
+	uint32_t subroutines;		// Distinct 2NNN targets
+	uint32_t dataBytes;			// Rom bytes used as data
+	uint32_t indirectJumps;		// Reachable BNNNs
+	uint32_t invalid;			// Reachable words that aren't instructions, usually data after a conditional JP
+	uint32_t selfWrites;		// Code bytes written through I, ie. static self modification
+} analysis_t;
+
+analysis_t *analyzeRom(const chip8_t *chip8);
+void destroyAnalysis(analysis_t *analysis);
+void printAnalysis(const analysis_t *analysis, FILE *out);
+uint32_t rewrittenCode(const analysis_t *analysis, const chip8_t *chip8, uint16_t *first);
+
+#endif
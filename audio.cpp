@@ -0,0 +1,121 @@
+#include <string.h>
+#include <math.h>
+#include <new>
+#include "chip8.h"
+
+
+// bufferSamples is the device's buffer, changes are heard about two of them after they happen
+void initAudioStream(audio_stream_t *stream, const config_t *config, uint32_t sampleRate, uint32_t bufferSamples) {
+	new (stream) audio_stream_t();	// Zeroed, the queue indices are atomics so it can't be a memset
+	stream->sampleRate = sampleRate;
+	stream->squareRate = 2.0f * config->sqrWaveFreq;
+	stream->sent.bitRate = stream->squareRate;
+	memset(stream->sent.pattern, AUDIO_SQUARE_PATTERN, sizeof stream->sent.pattern);
+	stream->tone = stream->sent;
+	stream->delay = 2 * bufferSamples;
+	stream->volume = config->volume;
+}
+
+
+// Called by the emulation thread at the start of every paced frame, budget is the frame's instruction count
+// Frame n covers samples n * rate / 60 up to (n + 1) * rate / 60 of the emulated sample clock
+void beginAudioFrame(audio_stream_t *stream, uint32_t budget) {
+	const uint64_t n = stream->frame++;
+	stream->frameStart = n * stream->sampleRate / 60;
+	stream->frameSamples = (uint32_t)((n + 1) * stream->sampleRate / 60 - stream->frameStart);
+	stream->frameBudget = budget;
+	stream->executed = 0;
+	stream->slice = (uint32_t)((uint64_t)budget * AUDIO_SLICE_SAMPLES / stream->frameSamples);
+	if (!stream->slice) stream->slice = 1;
+}
+
+
+// Queues the machine's tone if it changed since the last call, stamped with how far into the frame it got
+// Paused or rewinding machines are silent
+void noteTone(audio_stream_t *stream, const chip8_t *chip8) {
+	tone_t tone;
+	tone.on = chip8->sound_timer > 0 && chip8->state == RUNNING;
+	if (chip8->patternSet) {
+		// XO-CHIP: pitch 64 plays 4000 bits a second, 48 steps are an octave
+		tone.bitRate = 4000.0f * exp2f((chip8->pitch - 64) / 48.0f);
+		memcpy(tone.pattern, chip8->audioPattern, sizeof tone.pattern);
+	} else {
+		tone.bitRate = stream->squareRate;
+		memset(tone.pattern, AUDIO_SQUARE_PATTERN, sizeof tone.pattern);
+	}
+	if (tone.on == stream->sent.on && tone.bitRate == stream->sent.bitRate &&
+		!memcmp(tone.pattern, stream->sent.pattern, sizeof tone.pattern)) return;
+
+	const uint32_t executed = stream->executed < stream->frameBudget ? stream->executed : stream->frameBudget;
+	tone.sample = stream->frameStart + (stream->frameBudget ? (uint64_t)executed * stream->frameSamples / stream->frameBudget : 0);
+
+	const uint32_t tail = stream->tail.load(std::memory_order_relaxed);
+	if (tail - stream->head.load(std::memory_order_acquire) == AUDIO_QUEUE_SIZE) {
+		stream->dropped++;	// sent is left alone so the next call queues the change again
+		return;
+	}
+	stream->queue[tail & (AUDIO_QUEUE_SIZE - 1)] = tone;
+	stream->tail.store(tail + 1, std::memory_order_release);
+	stream->sent = tone;
+	stream->changes++;
+}
+
+
+static inline float toneLevel(const tone_t *tone, float volume, uint32_t bit) {
+	if (!tone->on) return 0;
+	bit &= AUDIO_PATTERN_BITS - 1;
+	return (tone->pattern[bit >> 3] >> (7 - (bit & 7))) & 1 ? volume : -volume;
+}
+
+
+// Fills count samples for the audio callback
+// Each step in the output, from the pattern or from the tone switching on or off, gets a two sample
+// polynomial band limited step (polyBLEP) instead of a hard edge, which is what keeps it from clicking
+void renderAudio(audio_stream_t *stream, int16_t *samples, uint32_t count) {
+	const uint32_t tail = stream->tail.load(std::memory_order_acquire);
+	uint32_t head = stream->head.load(std::memory_order_relaxed);
+	const float volume = stream->volume;
+	// Changes stamped further ahead than this mean the clocks slipped, eg. after the emulation thread stalled
+	const int64_t early = stream->delay + stream->sampleRate / 15;
+
+	for (uint32_t i = 0; i < count; i++) {
+		const int64_t now = (int64_t)stream->played++;
+		float y = toneLevel(&stream->tone, volume, (uint32_t)stream->phase) + stream->carry;
+		stream->carry = 0;
+
+		while (head != tail) {
+			const tone_t *change = &stream->queue[head & (AUDIO_QUEUE_SIZE - 1)];
+			int64_t at = (int64_t)change->sample + stream->shift;
+			if (!stream->synced || at < now - (int64_t)stream->delay || at > now + early) {
+				stream->resyncs += stream->synced;
+				stream->synced = true;
+				stream->shift = now + stream->delay - (int64_t)change->sample;
+				at = now + stream->delay;
+			}
+			if (at > now) break;
+
+			// The change lands half way to the next sample, so its step splits evenly over both
+			const float before = toneLevel(&stream->tone, volume, (uint32_t)stream->phase);
+			stream->tone = *change;
+			const float step = toneLevel(&stream->tone, volume, (uint32_t)stream->phase) - before;
+			y += step * 0.125f;
+			stream->carry -= step * 0.125f;
+			head++;
+		}
+
+		// Pattern bits that start before the next sample, f is how far between the two samples each one starts
+		const double advance = stream->tone.bitRate / stream->sampleRate;
+		const double end = stream->phase + advance;
+		for (double boundary = floor(stream->phase) + 1; boundary <= end; boundary++) {
+			const float step = toneLevel(&stream->tone, volume, (uint32_t)boundary) - toneLevel(&stream->tone, volume, (uint32_t)boundary - 1);
+			if (step == 0) continue;
+			const float f = (float)((boundary - stream->phase) / advance);
+			y += step * 0.5f * (1 - f) * (1 - f);
+			stream->carry -= step * 0.5f * f * f;
+		}
+		stream->phase = fmod(end, AUDIO_PATTERN_BITS);
+
+		samples[i] = (int16_t)(y > 32767 ? 32767 : y < -32768 ? -32768 : y);
+	}
+	stream->head.store(head, std::memory_order_release);
+}
@@ -0,0 +1,69 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <atomic>
+
+struct chip8_t;
+struct config_t;
+
+#define AUDIO_QUEUE_SIZE 1024		// Tone changes in flight, power of two
+#define AUDIO_SLICE_SAMPLES 32		// Bursts run in slices no longer than this, bounds how far off an edge's timestamp can be
+#define AUDIO_PATTERN_BITS 128		// XO-CHIP pattern buffer, 16 bytes played MSB first and looped
+#define AUDIO_SQUARE_PATTERN 0x55	// Pattern byte for the plain CHIP-8 buzzer, one bit per half period
+
+// What the speaker does from one sample on
+typedef struct {
+	uint64_t sample;		// Emulated sample clock the change happened at
+	float bitRate;			// Pattern bits per second
+	bool on;
+	uint8_t pattern[16];
+} tone_t;
+
+// Tone changes from the emulation thread to the audio callback
+// The producer stamps every change with the sample it happened on and queues it, the callback plays them
+// back a fixed delay later and band limits each edge, so neither side ever waits for the other and the
+// device never has to be paused or resumed
+typedef struct audio_stream_t {
+	// Emulation thread
+	uint32_t sampleRate;
+	float squareRate;		// Bit rate of the buzzer pattern, twice config->sqrWaveFreq
+	uint64_t frame;			// Frames begun
+	uint64_t frameStart;	// Sample clock at the start of the current frame
+	uint32_t frameSamples;
+	uint32_t frameBudget;	// Instructions in the current frame
+	uint32_t executed;		// Of those, run so far
+	uint32_t slice;			// Instructions per slice, about AUDIO_SLICE_SAMPLES worth
+	tone_t sent;			// Last change queued
+	uint64_t changes;
+	uint64_t dropped;		// Changes that found the queue full, the next one catches up
+
+	tone_t queue[AUDIO_QUEUE_SIZE];
+	alignas(64) std::atomic<uint32_t> head;	// Next change to play, only advanced by the callback
+	alignas(64) std::atomic<uint32_t> tail;	// Next free slot, only advanced by the emulation thread
+
+	// Audio callback
+	alignas(64) tone_t tone;	// Playing now
+	uint64_t played;		// Samples rendered so far
+	int64_t shift;			// A change stamped at sample s is played at output sample s + shift
+	bool synced;			// shift has been set from the first change
+	uint32_t delay;			// Samples between a change being stamped and heard, about two device buffers
+	double phase;			// Position in the pattern in bits
+	float carry;			// Band limiting correction owed to the next sample
+	int16_t volume;
+	uint64_t resyncs;		// Times the two clocks drifted apart far enough to line them up again
+} audio_stream_t;
+
+void initAudioStream(audio_stream_t *stream, const struct config_t *config, uint32_t sampleRate, uint32_t bufferSamples);
+void beginAudioFrame(audio_stream_t *stream, uint32_t budget);
+void noteTone(audio_stream_t *stream, const struct chip8_t *chip8);
+void renderAudio(audio_stream_t *stream, int16_t *samples, uint32_t count);
+
+// Called by emulateInstructions after each slice of a burst
+static inline void noteInstructions(audio_stream_t *stream, const struct chip8_t *chip8, uint32_t count) {
+	stream->executed += count;
+	noteTone(stream, chip8);
+}
+
+#endif
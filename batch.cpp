@@ -0,0 +1,878 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "batch.h"
+
+// Lockstep batch engine
+// Machines are stepped a group of BATCH_LANES at a time. The machines of a group that sit at the group's
+// most common pc with the same opcode there (all of them, for many copies of one rom that haven't drifted
+// apart) run the instruction as a single AVX2 kernel under a lane mask, and only the rest of the group is
+// stepped one machine at a time. Groups with too few machines in step, and opcodes with per machine
+// memory access (DXYN, FX33, FX55, ...), fall back to stepping each machine on its own.
+// Results are identical to emulateInstruction under the VIP quirks for every machine batchModels accepts:
+// lo-res, drawing on plane 0 only and no SUPER-CHIP flags. The whole 64K address space and the 12 entry
+// stack behave as they do there, SUPER-CHIP/XO-CHIP opcodes are no-ops as VIP has none.
+
+static_assert(BATCH_STACK == STACK_DEPTH, "batch machines have the chip8_t stack");
+static_assert(BATCH_LOW_MEMORY == 0x1000, "the high memory page starts at 0x1000");
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BATCH_AVX2
+#endif
+
+
+batch_t *createBatch(uint32_t count) {
+	if (count == 0) return NULL;
+
+	batch_t *batch = (batch_t *)calloc(1, sizeof(batch_t));
+	if (!batch) return NULL;
+
+	batch->count = count;
+	batch->stride = (count + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES;
+	const size_t s = batch->stride;
+
+	batch->memory = (uint8_t *)calloc(BATCH_MEMORY * s, sizeof(uint8_t));
+	batch->highMemory = (uint8_t **)calloc(s, sizeof(uint8_t *));
+	batch->display = (uint64_t *)calloc(LORES_HEIGHT * s, sizeof(uint64_t));
+	batch->dirtyRows = (uint64_t *)calloc(s, sizeof(uint64_t));
+	batch->stack = (uint16_t *)calloc(BATCH_STACK * s, sizeof(uint16_t));
+	batch->V = (uint8_t *)calloc(16 * s, sizeof(uint8_t));
+	batch->keys = (uint16_t *)calloc(s, sizeof(uint16_t));
+	batch->pc = (uint16_t *)calloc(s, sizeof(uint16_t));
+	batch->I = (uint16_t *)calloc(s, sizeof(uint16_t));
+	batch->sp = (uint8_t *)calloc(s, sizeof(uint8_t));
+	batch->delayTimer = (uint8_t *)calloc(s, sizeof(uint8_t));
+	batch->soundTimer = (uint8_t *)calloc(s, sizeof(uint8_t));
+	batch->waitKey = (uint8_t *)calloc(s, sizeof(uint8_t));
+	batch->waitKeyPressed = (uint8_t *)calloc(s, sizeof(uint8_t));
+	batch->rngState = (uint64_t *)calloc(s, sizeof(uint64_t));
+	batch->audioPattern = (uint8_t *)calloc(16 * s, sizeof(uint8_t));
+	batch->pitch = (uint8_t *)calloc(s, sizeof(uint8_t));
+	batch->patternSet = (uint8_t *)calloc(s, sizeof(uint8_t));
+
+	if (!batch->memory || !batch->highMemory || !batch->display || !batch->dirtyRows || !batch->stack || !batch->V || !batch->keys ||
+		!batch->pc || !batch->I || !batch->sp || !batch->delayTimer || !batch->soundTimer || !batch->waitKey ||
+		!batch->waitKeyPressed || !batch->rngState || !batch->audioPattern || !batch->pitch || !batch->patternSet) {
+		destroyBatch(batch);
+		return NULL;
+	}
+
+#ifdef BATCH_AVX2
+	batch->avx2 = __builtin_cpu_supports("avx2");
+#endif
+	return batch;
+}
+
+void destroyBatch(batch_t *batch) {
+	if (!batch) return;
+	for (uint32_t lane = 0; batch->highMemory && lane < batch->stride; lane++)
+		free(batch->highMemory[lane]);
+	free(batch->memory);
+	free(batch->highMemory);
+	free(batch->display);
+	free(batch->dirtyRows);
+	free(batch->stack);
+	free(batch->V);
+	free(batch->keys);
+	free(batch->pc);
+	free(batch->I);
+	free(batch->sp);
+	free(batch->delayTimer);
+	free(batch->soundTimer);
+	free(batch->waitKey);
+	free(batch->waitKeyPressed);
+	free(batch->rngState);
+	free(batch->audioPattern);
+	free(batch->pitch);
+	free(batch->patternSet);
+	free(batch);
+}
+
+static uint16_t packKeys(const chip8_t *chip8) {
+	uint16_t keys = 0;
+	for (uint8_t k = 0; k < 16; k++)
+		if (chip8->keys[k]) keys |= 1 << k;
+	return keys;
+}
+
+// Whether the batch can hold chip8 exactly, it keeps no hi-res, plane 2 or SUPER-CHIP flag state
+bool batchModels(const chip8_t *chip8) {
+	if (chip8->hires || chip8->planes != 1 || chip8->sp > BATCH_STACK || (chip8->waitKey != 0xFF && chip8->waitKey > 0xF))
+		return false;
+	for (uint32_t y = 0; y < DISPLAY_HEIGHT; y++) {
+		if (chip8->display[0][y][1] || chip8->display[1][y][0] || chip8->display[1][y][1]) return false;
+		if (y >= LORES_HEIGHT && chip8->display[0][y][0]) return false;
+	}
+	for (uint32_t i = 0; i < sizeof chip8->flags; i++)
+		if (chip8->flags[i]) return false;
+	return true;
+}
+
+// Gives a machine the memory above 4K of chip8, a page is only kept if some of it is not zero
+static bool setHighMemory(batch_t *batch, uint32_t lane, const chip8_t *chip8) {
+	const uint8_t *high = chip8->memory + BATCH_LOW_MEMORY;
+	const size_t size = MEMORY_SIZE - BATCH_LOW_MEMORY;
+	bool empty = true;
+	for (size_t i = 0; i < size && empty; i++) empty = high[i] == 0;
+
+	if (empty) {
+		free(batch->highMemory[lane]);
+		batch->highMemory[lane] = NULL;
+		return true;
+	}
+	if (!batch->highMemory[lane] && !(batch->highMemory[lane] = (uint8_t *)malloc(size))) return false;
+	memcpy(batch->highMemory[lane], high, size);
+	return true;
+}
+
+// Every machine, padding included, becomes a copy of chip8
+// Machine n gets rngState + n so each one draws its own CXNN sequence, the same one a single
+// machine started with seed + n would draw. False if chip8 is not batchModels or memory ran out
+bool resetBatch(batch_t *batch, const chip8_t *chip8) {
+	const uint32_t s = batch->stride;
+	if (!batchModels(chip8)) return false;
+
+	for (uint32_t lane = 0; lane < s; lane++) {
+		memcpy(&batch->memory[lane * BATCH_MEMORY], chip8->memory, BATCH_LOW_MEMORY);
+		if (!setHighMemory(batch, lane, chip8)) return false;
+	}
+	for (uint32_t r = 0; r < 16; r++)
+		memset(&batch->V[r * s], chip8->V[r], s);
+	memset(batch->sp, chip8->sp, s);
+	memset(batch->delayTimer, chip8->delay_timer, s);
+	memset(batch->soundTimer, chip8->sound_timer, s);
+	memset(batch->waitKey, chip8->waitKey, s);
+	memset(batch->waitKeyPressed, chip8->waitKeyPressed, s);
+	memset(batch->pitch, chip8->pitch, s);
+	memset(batch->patternSet, chip8->patternSet, s);
+
+	const uint16_t keys = packKeys(chip8);
+	for (uint32_t lane = 0; lane < s; lane++) {
+		for (uint32_t y = 0; y < LORES_HEIGHT; y++)
+			batch->display[y * s + lane] = chip8->display[0][y][0];
+		for (uint32_t d = 0; d < BATCH_STACK; d++)
+			batch->stack[d * s + lane] = chip8->stack[d];
+		batch->dirtyRows[lane] = chip8->dirtyRows;
+		batch->keys[lane] = keys;
+		batch->pc[lane] = chip8->pc;
+		batch->I[lane] = chip8->I;
+		batch->rngState[lane] = chip8->rngState + lane;
+		memcpy(&batch->audioPattern[lane * 16], chip8->audioPattern, 16);
+	}
+	batch->vectorSteps = 0;
+	batch->scalarSteps = 0;
+	return true;
+}
+
+// Copy one machine into the batch, cache/jit attachments are not used by the batch engine
+// False if chip8 is not batchModels or memory ran out
+bool setBatchMachine(batch_t *batch, uint32_t lane, const chip8_t *chip8) {
+	const uint32_t s = batch->stride;
+	if (!batchModels(chip8)) return false;
+
+	memcpy(&batch->memory[lane * BATCH_MEMORY], chip8->memory, BATCH_LOW_MEMORY);
+	if (!setHighMemory(batch, lane, chip8)) return false;
+	for (uint32_t y = 0; y < LORES_HEIGHT; y++)
+		batch->display[y * s + lane] = chip8->display[0][y][0];
+	for (uint32_t d = 0; d < BATCH_STACK; d++)
+		batch->stack[d * s + lane] = chip8->stack[d];
+	for (uint32_t r = 0; r < 16; r++)
+		batch->V[r * s + lane] = chip8->V[r];
+
+	batch->dirtyRows[lane] = chip8->dirtyRows;
+	batch->keys[lane] = packKeys(chip8);
+	batch->pc[lane] = chip8->pc;
+	batch->I[lane] = chip8->I;
+	batch->sp[lane] = chip8->sp;
+	batch->delayTimer[lane] = chip8->delay_timer;
+	batch->soundTimer[lane] = chip8->sound_timer;
+	batch->waitKey[lane] = chip8->waitKey;
+	batch->waitKeyPressed[lane] = chip8->waitKeyPressed;
+	batch->rngState[lane] = chip8->rngState;
+	memcpy(&batch->audioPattern[lane * 16], chip8->audioPattern, 16);
+	batch->pitch[lane] = chip8->pitch;
+	batch->patternSet[lane] = chip8->patternSet;
+	return true;
+}
+
+// Copy one machine out of the batch, eg. to hash or draw it with the single machine code
+void getBatchMachine(const batch_t *batch, uint32_t lane, chip8_t *chip8) {
+	const uint32_t s = batch->stride;
+
+	memset(chip8, 0, sizeof(chip8_t));
+	chip8->state = RUNNING;
+	chip8->planes = 1;
+	memcpy(chip8->memory, &batch->memory[lane * BATCH_MEMORY], BATCH_LOW_MEMORY);
+	if (batch->highMemory[lane])
+		memcpy(chip8->memory + BATCH_LOW_MEMORY, batch->highMemory[lane], MEMORY_SIZE - BATCH_LOW_MEMORY);
+	for (uint32_t y = 0; y < LORES_HEIGHT; y++)
+		chip8->display[0][y][0] = batch->display[y * s + lane];
+	for (uint32_t d = 0; d < BATCH_STACK; d++)
+		chip8->stack[d] = batch->stack[d * s + lane];
+	for (uint32_t r = 0; r < 16; r++)
+		chip8->V[r] = batch->V[r * s + lane];
+	for (uint8_t k = 0; k < 16; k++)
+		chip8->keys[k] = (batch->keys[lane] >> k) & 1;
+
+	chip8->dirtyRows = batch->dirtyRows[lane];
+	chip8->changedRows = ~0ull;
+	memset(chip8->dirtyPages, 1, sizeof chip8->dirtyPages);
+	chip8->pc = batch->pc[lane];
+	chip8->I = batch->I[lane];
+	chip8->sp = batch->sp[lane];
+	chip8->delay_timer = batch->delayTimer[lane];
+	chip8->sound_timer = batch->soundTimer[lane];
+	chip8->waitKey = batch->waitKey[lane];
+	chip8->waitKeyPressed = batch->waitKeyPressed[lane];
+	chip8->rngState = batch->rngState[lane];
+	memcpy(chip8->audioPattern, &batch->audioPattern[lane * 16], 16);
+	chip8->pitch = batch->pitch[lane];
+	chip8->patternSet = batch->patternSet[lane];
+}
+
+void setBatchKey(batch_t *batch, uint32_t lane, uint8_t key, bool pressed) {
+	if (pressed) batch->keys[lane] |= 1 << (key & 0xF);
+	else batch->keys[lane] &= ~(1 << (key & 0xF));
+}
+
+
+static inline uint8_t readLaneMemory(const batch_t *batch, uint32_t lane, uint16_t addr) {
+	if (addr < BATCH_LOW_MEMORY) return batch->memory[lane * BATCH_MEMORY + addr];
+	const uint8_t *high = batch->highMemory[lane];
+	return high ? high[addr - BATCH_LOW_MEMORY] : 0;
+}
+
+// Stores above 4K give the machine its high memory page on the first one that isn't zero
+static inline void writeLaneMemory(batch_t *batch, uint32_t lane, uint16_t addr, uint8_t value) {
+	if (addr < BATCH_LOW_MEMORY) {
+		batch->memory[lane * BATCH_MEMORY + addr] = value;
+		return;
+	}
+	uint8_t *high = batch->highMemory[lane];
+	if (!high) {
+		if (!value) return;
+		high = batch->highMemory[lane] = (uint8_t *)calloc(MEMORY_SIZE - BATCH_LOW_MEMORY, 1);
+		if (!high) {
+			fprintf(stderr, "Out of memory, machine %u loses a store to %04X\n", lane, addr);
+			return;
+		}
+	}
+	high[addr - BATCH_LOW_MEMORY] = value;
+}
+
+// Run steps instructions on a single machine, mirrors emulateInstruction
+static void runLane(batch_t *batch, uint32_t lane, uint32_t steps) {
+	const uint32_t s = batch->stride;
+
+	#define LOAD(addr)			readLaneMemory(batch, lane, (uint16_t)(addr))
+	#define STORE(addr, value)	writeLaneMemory(batch, lane, (uint16_t)(addr), value)
+	#define V(r)				batch->V[(r) * s + lane]
+	#define ROW(y)				batch->display[(y) * s + lane]
+	#define STACK(d)			batch->stack[(d) * s + lane]
+
+	uint16_t &pc = batch->pc[lane];
+	uint16_t &I = batch->I[lane];
+	uint8_t &sp = batch->sp[lane];
+	uint64_t &rng = batch->rngState[lane];
+	uint64_t &dirty = batch->dirtyRows[lane];
+	const uint16_t keys = batch->keys[lane];
+
+	for (uint32_t step = 0; step < steps; step++) {
+		const uint16_t opcode = (LOAD(pc) << 8) | LOAD(pc + 1);
+		pc += 2;
+
+		const uint16_t NNN = opcode & 0x0FFF;
+		const uint8_t NN = opcode & 0xFF;
+		const uint8_t N = opcode & 0x0F;
+		const uint8_t X = (opcode >> 8) & 0x0F;
+		const uint8_t Y = (opcode >> 4) & 0x0F;
+		bool carry;
+
+		switch ((opcode >> 12) & 0x0F) {
+			case 0x00:
+				if (NN == 0xE0) {
+					// 0x00E0: clear screen
+					for (uint32_t y = 0; y < LORES_HEIGHT; y++) {
+						dirty |= (uint64_t)(ROW(y) != 0) << y;
+						ROW(y) = 0;
+					}
+				} else if (NN == 0xEE) {
+					// 0x00EE: Return from subroutine, halts here with the stack empty
+					if (sp == 0 || sp > BATCH_STACK) pc -= 2;
+					else pc = STACK(--sp);
+				}
+				break;
+
+			case 0x01:
+				// 0x1NNN jump to adress NNN
+				pc = NNN;
+				break;
+
+			case 0x02:
+				// 0x2NNN: call subroutine at NNN, halts here with the stack full
+				if (sp >= BATCH_STACK) {
+					pc -= 2;
+					break;
+				}
+				STACK(sp++) = pc;
+				pc = NNN;
+				break;
+
+			case 0x03:
+				// 0x3XNN: skip next inst if VX == NN
+				if (V(X) == NN) pc += 2;
+				break;
+
+			case 0x04:
+				// 0x4XNN: skip next inst if VX != NN
+				if (V(X) != NN) pc += 2;
+				break;
+
+			case 0x05:
+				// 0x5XY0: skip next inst if VX == VY
+				if (N == 0 && V(X) == V(Y)) pc += 2;
+				break;
+
+			case 0x06:
+				// 0x6XNN: VX = NN
+				V(X) = NN;
+				break;
+
+			case 0x07:
+				// 0x7XNN: VX += NN
+				V(X) += NN;
+				break;
+
+			case 0x08:
+				switch (N) {
+					case 0x0: V(X) = V(Y); break;
+					case 0x1: V(X) |= V(Y); V(0xF) = 0; break;	// CHIP8 Quirk (NO SCHIP)
+					case 0x2: V(X) &= V(Y); V(0xF) = 0; break;
+					case 0x3: V(X) ^= V(Y); V(0xF) = 0; break;
+					case 0x4:
+						carry = ((uint16_t)(V(X) + V(Y)) > 255);
+						V(X) += V(Y);
+						V(0xF) = carry;
+						break;
+					case 0x5:
+						carry = V(X) >= V(Y);
+						V(X) -= V(Y);
+						V(0xF) = carry;
+						break;
+					case 0x6:
+						carry = V(Y) & 1;
+						V(X) = V(Y) >> 1;
+						V(0xF) = carry;
+						break;
+					case 0x7:
+						carry = V(X) <= V(Y);
+						V(X) = V(Y) - V(X);
+						V(0xF) = carry;
+						break;
+					case 0xE:
+						carry = (V(Y) & 0x80) >> 7;
+						V(X) = V(Y) << 1;
+						V(0xF) = carry;
+						break;
+					default:
+						break;
+				}
+				break;
+
+			case 0x09:
+				// 0x9XY0: skip next inst if VX != VY
+				if (V(X) != V(Y)) pc += 2;
+				break;
+
+			case 0x0A:
+				// 0xANNN: I = NNN
+				I = NNN;
+				break;
+
+			case 0x0B:
+				// 0xBNNN: Jump to V0 + NNN
+				pc = V(0) + NNN;
+				break;
+
+			case 0x0C:
+				// 0xCXNN: VX = rand() & NN, from this machine's own generator
+				V(X) = nextRandom(&rng) & NN;
+				break;
+
+			case 0x0D: {
+				// 0xDXYN, same as drawSprite on this machine's rows
+				const uint8_t x = V(X) % LORES_WIDTH;
+				const uint8_t y = V(Y) % LORES_HEIGHT;
+				const uint8_t n = N > LORES_HEIGHT - y ? LORES_HEIGHT - y : N;
+
+				uint64_t collision = 0;
+				for (uint8_t i = 0; i < n; i++) {
+					const uint64_t row = ((uint64_t)LOAD(I + i) << (LORES_WIDTH - 8)) >> x;
+					collision |= ROW(y + i) & row;
+					ROW(y + i) ^= row;
+					dirty |= (uint64_t)(row != 0) << (y + i);
+				}
+				V(0xF) = collision != 0;
+				break;
+			}
+
+			case 0x0E:
+				if (NN == 0x9E) {
+					// 0xEX9E: Skip next inst if key in VX is pressed
+					if ((keys >> (V(X) & 0xF)) & 1) pc += 2;
+				} else if (NN == 0xA1) {
+					// 0xEXA1: Skip next inst if key in VX is not pressed
+					if (!((keys >> (V(X) & 0xF)) & 1)) pc += 2;
+				}
+				break;
+
+			case 0x0F:
+				switch (NN) {
+					case 0x0A: {
+						// 0xFX0A: VX = get_key(), waits for a press and its release
+						uint8_t *waitKey = &batch->waitKey[lane];
+						uint8_t *waitKeyPressed = &batch->waitKeyPressed[lane];
+						for (uint8_t k = 0; *waitKey == 0xFF && k < 16; k++)
+							if ((keys >> k) & 1) {
+								*waitKey = k;
+								*waitKeyPressed = true;
+								break;
+							}
+
+						if (!*waitKeyPressed || ((keys >> *waitKey) & 1)) {
+							pc -= 2;
+						} else {
+							V(X) = *waitKey;
+							*waitKey = 0xFF;
+							*waitKeyPressed = false;
+						}
+						break;
+					}
+					case 0x1E: I += V(X); break;
+					case 0x07: V(X) = batch->delayTimer[lane]; break;
+					case 0x15: batch->delayTimer[lane] = V(X); break;
+					case 0x18: batch->soundTimer[lane] = V(X); break;
+					case 0x29: I = V(X) * 5; break;
+					case 0x33: {
+						// 0xFX33: BCD of VX at I, I+1, I+2
+						const uint8_t bcd = V(X);
+						STORE(I + 2, bcd % 10);
+						STORE(I + 1, (bcd / 10) % 10);
+						STORE(I, bcd / 100);
+						break;
+					}
+					case 0x55:
+						// 0xFX55: Register dump V0-VX, CHIP8 increments I
+						for (uint8_t i = 0; i <= X; i++) {
+							STORE(I, V(i));
+							I++;
+						}
+						break;
+					case 0x65:
+						// 0xFX65: Register load V0-VX, CHIP8 increments I
+						for (uint8_t i = 0; i <= X; i++) {
+							V(i) = LOAD(I);
+							I++;
+						}
+						break;
+					default:
+						break;
+				}
+				break;
+		}
+
+	}
+
+
+	#undef LOAD
+	#undef STORE
+	#undef V
+	#undef ROW
+	#undef STACK
+}
+
+
+// What a group step did, anything but GROUP_STEPPED leaves the machines untouched
+typedef enum {
+	GROUP_STEPPED,		// The machines in step ran one vector kernel, the rest still have to step
+	GROUP_NO_KERNEL,	// Enough machines agree on the opcode but it has no kernel
+	GROUP_DIVERGED,		// Fewer than BATCH_MIN_LANES machines agree on the pc and opcode
+} group_step_t;
+
+#ifdef BATCH_AVX2
+// Byte i of the result is 0xFF where bit i of lanes is set
+__attribute__((target("avx2,popcnt")))
+static inline __m256i laneBytes(uint32_t lanes) {
+	const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+											2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	const __m256i bits = _mm256_set1_epi64x(0x8040201008040201ll);
+	const __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(lanes), spread);
+	return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bits), bits);
+}
+
+// Bit i set where machine i of the group (32 words at pcs) is at pc
+__attribute__((target("avx2,popcnt")))
+static inline uint32_t lanesAt(const uint16_t *pcs, uint16_t pc) {
+	const __m256i all = _mm256_set1_epi16(pc);
+	const __m256i lo = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)pcs), all);
+	const __m256i hi = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(pcs + 16)), all);
+	// Packing interleaves the 128 bit halves, the permute puts the machines back in order
+	return (uint32_t)_mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8));
+}
+
+// Stores under a mask, machines left out keep what they had
+__attribute__((target("avx2,popcnt")))
+static inline void storeMasked(__m256i *p, __m256i value, __m256i mask) {
+	_mm256_storeu_si256(p, _mm256_blendv_epi8(_mm256_loadu_si256(p), value, mask));
+}
+
+// Run one instruction as a single vector kernel on the machines of the group starting at base that are
+// at its most common pc with the same opcode there, *stepped gets a bit set for each of them
+__attribute__((target("avx2,popcnt")))
+static group_step_t stepGroupAvx2(batch_t *batch, uint32_t base, uint32_t *stepped) {
+	const uint32_t s = batch->stride;
+	uint16_t *pcs = batch->pc + base;
+
+	// The pc most machines are at, trying the pc of the first machine not yet counted a few times
+	// finds it whenever one pc has a majority and usually otherwise
+	uint16_t pc = pcs[0];
+	uint32_t lanes = lanesAt(pcs, pc);
+	if (lanes != ~0u) {
+		uint32_t unseen = ~lanes;
+		for (uint32_t tries = 1; tries < 4 && __builtin_popcount(unseen) > __builtin_popcount(lanes); tries++) {
+			const uint16_t candidate = pcs[__builtin_ctz(unseen)];
+			const uint32_t at = lanesAt(pcs, candidate);
+			if (__builtin_popcount(at) > __builtin_popcount(lanes)) {
+				lanes = at;
+				pc = candidate;
+			}
+			unseen &= ~at;
+		}
+		if (__builtin_popcount(lanes) < BATCH_MIN_LANES) return GROUP_DIVERGED;
+	}
+
+	// Those with the same opcode there, memory can differ after self modifying stores
+	// Opcode bytes are gathered 8 machines at a time as the low half of a dword, so the last 3 bytes
+	// of memory (and everything above 4K) are left to the scalar path
+	if (pc > BATCH_LOW_MEMORY - 4) return GROUP_NO_KERNEL;
+	const uint8_t *mem = batch->memory + base * BATCH_MEMORY + pc;
+	const uint8_t *lead = mem + __builtin_ctz(lanes) * BATCH_MEMORY;
+	const __m256i offsets = _mm256_setr_epi32(0, BATCH_MEMORY, 2 * BATCH_MEMORY, 3 * BATCH_MEMORY, 4 * BATCH_MEMORY, 5 * BATCH_MEMORY, 6 * BATCH_MEMORY, 7 * BATCH_MEMORY);
+	const __m256i opAll = _mm256_set1_epi32(lead[0] | (lead[1] << 8));
+	const __m256i opMask = _mm256_set1_epi32(0xFFFF);
+	__m256i same[4];
+	for (uint32_t g = 0; g < 4; g++) {
+		const __m256i ops = _mm256_i32gather_epi32((const int *)(mem + g * 8 * BATCH_MEMORY), offsets, 1);
+		same[g] = _mm256_cmpeq_epi32(_mm256_and_si256(ops, opMask), opAll);
+	}
+	// Packing down to bytes leaves groups of 4 machines in the order 0 8 16 24 4 12 20 28
+	const __m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(same[0], same[1]), _mm256_packs_epi32(same[2], same[3]));
+	const uint32_t sameOp = (uint32_t)_mm256_movemask_epi8(_mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+	if (sameOp != ~0u) {
+		lanes &= sameOp;
+		if (__builtin_popcount(lanes) < BATCH_MIN_LANES) return GROUP_DIVERGED;
+	}
+
+	const uint16_t opcode = (lead[0] << 8) | lead[1];
+	const uint16_t NNN = opcode & 0x0FFF;
+	const uint8_t NN = opcode & 0xFF;
+	const uint8_t N = opcode & 0x0F;
+	const uint8_t X = (opcode >> 8) & 0x0F;
+	const uint8_t Y = (opcode >> 4) & 0x0F;
+
+	__m256i *vx = (__m256i *)(batch->V + X * s + base);
+	__m256i *vy = (__m256i *)(batch->V + Y * s + base);
+	__m256i *vf = (__m256i *)(batch->V + 0xF * s + base);
+	__m256i *iLo = (__m256i *)(batch->I + base);
+	__m256i *iHi = (__m256i *)(batch->I + base + 16);
+	__m256i *sp = (__m256i *)(batch->sp + base);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi8(-1);
+	const __m256i one = _mm256_set1_epi8(1);
+
+	// Stores go through the mask of the machines in step, as bytes for byte fields and widened for word
+	// fields (machines 0-15 and 16-31)
+	const __m256i mask = lanes == ~0u ? ones : laneBytes(lanes);
+	const __m256i maskLo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(mask));
+	const __m256i maskHi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(mask, 1));
+
+	__m256i skip = zero;	// Byte mask of machines that skip the next instruction
+	uint16_t next = pc + 2;
+	bool perMachine = false;	// nextLo/nextHi hold a pc per machine instead of next and skip
+	__m256i nextLo = zero, nextHi = zero;
+
+	switch ((opcode >> 12) & 0x0F) {
+		case 0x00:
+			if (NN == 0xE0) {
+				// 0x00E0: clear screen, marking rows that had pixels lit
+				alignas(32) int8_t maskBytes[BATCH_LANES];
+				_mm256_store_si256((__m256i *)maskBytes, mask);
+				for (uint32_t g = 0; g < BATCH_LANES; g += 4) {
+					int32_t quad;
+					memcpy(&quad, maskBytes + g, sizeof quad);
+					const __m256i mask64 = _mm256_cvtepi8_epi64(_mm_cvtsi32_si128(quad));
+					__m256i *dirty = (__m256i *)(batch->dirtyRows + base + g);
+					__m256i rows = _mm256_loadu_si256(dirty);
+					for (uint32_t y = 0; y < LORES_HEIGHT; y++) {
+						__m256i *row = (__m256i *)(batch->display + y * s + base + g);
+						const __m256i old = _mm256_loadu_si256(row);
+						const __m256i lit = _mm256_xor_si256(_mm256_cmpeq_epi64(old, zero), ones);
+						rows = _mm256_or_si256(rows, _mm256_and_si256(_mm256_and_si256(lit, mask64), _mm256_set1_epi64x(1ll << y)));
+						_mm256_storeu_si256(row, _mm256_andnot_si256(mask64, old));
+					}
+					_mm256_storeu_si256(dirty, rows);
+				}
+			} else if (NN == 0xEE) {
+				// 0x00EE: pop the return address, machines with the stack empty halt here
+				const __m256i depth = _mm256_sub_epi8(_mm256_loadu_si256(sp), one);
+				const __m256i empty = _mm256_cmpeq_epi8(_mm256_max_epu8(depth, _mm256_set1_epi8(BATCH_STACK)), depth);
+				const __m256i pop = _mm256_andnot_si256(empty, mask);
+				nextLo = nextHi = _mm256_set1_epi16(pc);
+				for (uint32_t d = 0; d < BATCH_STACK; d++) {
+					const __m256i at = _mm256_and_si256(_mm256_cmpeq_epi8(depth, _mm256_set1_epi8(d)), pop);
+					nextLo = _mm256_blendv_epi8(nextLo, _mm256_loadu_si256((const __m256i *)(batch->stack + d * s + base)),
+												_mm256_cvtepi8_epi16(_mm256_castsi256_si128(at)));
+					nextHi = _mm256_blendv_epi8(nextHi, _mm256_loadu_si256((const __m256i *)(batch->stack + d * s + base + 16)),
+												_mm256_cvtepi8_epi16(_mm256_extracti128_si256(at, 1)));
+				}
+				storeMasked(sp, depth, pop);
+				perMachine = true;
+			}
+			break;
+
+		case 0x01:
+			next = NNN;
+			break;
+
+		case 0x02: {
+			// 0x2NNN: push the return address, machines with the stack full halt here
+			const __m256i depth = _mm256_loadu_si256(sp);
+			const __m256i full = _mm256_cmpeq_epi8(_mm256_max_epu8(depth, _mm256_set1_epi8(BATCH_STACK)), depth);
+			const __m256i push = _mm256_andnot_si256(full, mask);
+			const __m256i ret = _mm256_set1_epi16(pc + 2);
+			for (uint32_t d = 0; d < BATCH_STACK; d++) {
+				const __m256i at = _mm256_and_si256(_mm256_cmpeq_epi8(depth, _mm256_set1_epi8(d)), push);
+				storeMasked((__m256i *)(batch->stack + d * s + base), ret, _mm256_cvtepi8_epi16(_mm256_castsi256_si128(at)));
+				storeMasked((__m256i *)(batch->stack + d * s + base + 16), ret, _mm256_cvtepi8_epi16(_mm256_extracti128_si256(at, 1)));
+			}
+			storeMasked(sp, _mm256_add_epi8(depth, one), push);
+			nextLo = _mm256_blendv_epi8(_mm256_set1_epi16(pc), _mm256_set1_epi16(NNN), _mm256_cvtepi8_epi16(_mm256_castsi256_si128(push)));
+			nextHi = _mm256_blendv_epi8(_mm256_set1_epi16(pc), _mm256_set1_epi16(NNN), _mm256_cvtepi8_epi16(_mm256_extracti128_si256(push, 1)));
+			perMachine = true;
+			break;
+		}
+
+		case 0x03:
+			skip = _mm256_cmpeq_epi8(_mm256_loadu_si256(vx), _mm256_set1_epi8(NN));
+			break;
+
+		case 0x04:
+			skip = _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(vx), _mm256_set1_epi8(NN)), ones);
+			break;
+
+		case 0x05:
+			if (N == 0) skip = _mm256_cmpeq_epi8(_mm256_loadu_si256(vx), _mm256_loadu_si256(vy));
+			break;
+
+		case 0x06:
+			storeMasked(vx, _mm256_set1_epi8(NN), mask);
+			break;
+
+		case 0x07:
+			storeMasked(vx, _mm256_add_epi8(_mm256_loadu_si256(vx), _mm256_set1_epi8(NN)), mask);
+			break;
+
+		case 0x08: {
+			// Flags are computed from the old values and VF is stored last, as in emulateInstruction
+			const __m256i a = _mm256_loadu_si256(vx);
+			const __m256i b = _mm256_loadu_si256(vy);
+			switch (N) {
+				case 0x0:
+					storeMasked(vx, b, mask);
+					break;
+				case 0x1:
+					storeMasked(vx, _mm256_or_si256(a, b), mask);
+					storeMasked(vf, zero, mask);
+					break;
+				case 0x2:
+					storeMasked(vx, _mm256_and_si256(a, b), mask);
+					storeMasked(vf, zero, mask);
+					break;
+				case 0x3:
+					storeMasked(vx, _mm256_xor_si256(a, b), mask);
+					storeMasked(vf, zero, mask);
+					break;
+				case 0x4: {
+					// Carry where the saturating sum differs from the wrapping one
+					const __m256i sum = _mm256_add_epi8(a, b);
+					const __m256i carry = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(a, b), sum), one);
+					storeMasked(vx, sum, mask);
+					storeMasked(vf, carry, mask);
+					break;
+				}
+				case 0x5: {
+					const __m256i carry = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), one);
+					storeMasked(vx, _mm256_sub_epi8(a, b), mask);
+					storeMasked(vf, carry, mask);
+					break;
+				}
+				case 0x6: {
+					const __m256i carry = _mm256_and_si256(b, one);
+					storeMasked(vx, _mm256_and_si256(_mm256_srli_epi16(b, 1), _mm256_set1_epi8(0x7F)), mask);
+					storeMasked(vf, carry, mask);
+					break;
+				}
+				case 0x7: {
+					const __m256i carry = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), one);
+					storeMasked(vx, _mm256_sub_epi8(b, a), mask);
+					storeMasked(vf, carry, mask);
+					break;
+				}
+				case 0xE: {
+					const __m256i carry = _mm256_and_si256(_mm256_srli_epi16(b, 7), one);
+					storeMasked(vx, _mm256_add_epi8(b, b), mask);
+					storeMasked(vf, carry, mask);
+					break;
+				}
+				default:
+					break;
+			}
+			break;
+		}
+
+		case 0x09:
+			skip = _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(vx), _mm256_loadu_si256(vy)), ones);
+			break;
+
+		case 0x0A:
+			storeMasked(iLo, _mm256_set1_epi16(NNN), maskLo);
+			storeMasked(iHi, _mm256_set1_epi16(NNN), maskHi);
+			break;
+
+		case 0x0B: {
+			// 0xBNNN: jump to V0 + NNN, V0 widened into two halves of 16 machines
+			const __m256i v0 = _mm256_loadu_si256((const __m256i *)(batch->V + base));
+			nextLo = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v0)), _mm256_set1_epi16(NNN));
+			nextHi = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(v0, 1)), _mm256_set1_epi16(NNN));
+			perMachine = true;
+			break;
+		}
+
+		case 0x0E: {
+			// 0xEX9E / 0xEXA1: skip if key VX & 0xF is / is not down
+			// The key masks are split into their low and high bytes per machine, and the bit of the key
+			// in each comes from a table lookup on the key number
+			if (NN != 0x9E && NN != 0xA1) break;
+			const __m256i keysLo = _mm256_loadu_si256((const __m256i *)(batch->keys + base));
+			const __m256i keysHi = _mm256_loadu_si256((const __m256i *)(batch->keys + base + 16));
+			const __m256i low = _mm256_set1_epi16(0xFF);
+			const __m256i keyLow = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(keysLo, low), _mm256_and_si256(keysHi, low)), 0xD8);
+			const __m256i keyHigh = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(keysLo, 8), _mm256_srli_epi16(keysHi, 8)), 0xD8);
+			const __m256i key = _mm256_and_si256(_mm256_loadu_si256(vx), _mm256_set1_epi8(0x0F));
+			const __m256i bitLow = _mm256_shuffle_epi8(_mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+																		1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0), key);
+			const __m256i bitHigh = _mm256_shuffle_epi8(_mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128,
+																		 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128), key);
+			const __m256i released = _mm256_cmpeq_epi8(_mm256_or_si256(_mm256_and_si256(keyLow, bitLow), _mm256_and_si256(keyHigh, bitHigh)), zero);
+			skip = NN == 0x9E ? _mm256_xor_si256(released, ones) : released;
+			break;
+		}
+
+		case 0x0F: {
+			__m256i *delay = (__m256i *)(batch->delayTimer + base);
+			__m256i *sound = (__m256i *)(batch->soundTimer + base);
+			switch (NN) {
+				case 0x07:
+					storeMasked(vx, _mm256_loadu_si256(delay), mask);
+					break;
+				case 0x15:
+					storeMasked(delay, _mm256_loadu_si256(vx), mask);
+					break;
+				case 0x18:
+					storeMasked(sound, _mm256_loadu_si256(vx), mask);
+					break;
+				case 0x1E:
+				case 0x29: {
+					// I is 16 bits wide, so VX is widened into two halves of 16 machines
+					const __m256i v = _mm256_loadu_si256(vx);
+					const __m256i vLo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+					const __m256i vHi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+					if (NN == 0x1E) {
+						storeMasked(iLo, _mm256_add_epi16(_mm256_loadu_si256(iLo), vLo), maskLo);
+						storeMasked(iHi, _mm256_add_epi16(_mm256_loadu_si256(iHi), vHi), maskHi);
+					} else {
+						storeMasked(iLo, _mm256_mullo_epi16(vLo, _mm256_set1_epi16(5)), maskLo);
+						storeMasked(iHi, _mm256_mullo_epi16(vHi, _mm256_set1_epi16(5)), maskHi);
+					}
+					break;
+				}
+				case 0x0A:
+				case 0x33:
+				case 0x55:
+				case 0x65:
+					return GROUP_NO_KERNEL;	// Touch per machine memory or key wait state
+				default:
+					break;					// SUPER-CHIP/XO-CHIP, no-ops under VIP
+			}
+			break;
+		}
+
+		default:
+			return GROUP_NO_KERNEL;	// CXNN, DXYN
+	}
+
+	// pc = next, plus 2 on machines that skip, unless the kernel worked out a pc per machine
+	if (!perMachine) {
+		const __m256i two = _mm256_set1_epi16(2);
+		const __m256i nextAll = _mm256_set1_epi16(next);
+		nextLo = _mm256_add_epi16(nextAll, _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(skip)), two));
+		nextHi = _mm256_add_epi16(nextAll, _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(skip, 1)), two));
+	}
+	storeMasked((__m256i *)pcs, nextLo, maskLo);
+	storeMasked((__m256i *)(pcs + 16), nextHi, maskHi);
+	*stepped = lanes;
+	return GROUP_STEPPED;
+}
+#endif
+
+
+// Run count instructions on every machine in the batch
+// Groups are independent, so each one runs all of its steps while its registers are in cache.
+// Machines never interact, so the machines a vector step left out can take that step right after it,
+// and a group too diverged to vectorize can step each machine a short burst on its own (far kinder
+// to the branch predictor than interleaving them) and still end where lockstep would
+void emulateBatch(batch_t *batch, uint32_t count) {
+	for (uint32_t base = 0; base < batch->stride; base += BATCH_LANES) {
+		for (uint32_t n = 0; n < count; ) {
+#ifdef BATCH_AVX2
+			uint32_t stepped = 0;
+			const group_step_t step = batch->avx2 ? stepGroupAvx2(batch, base, &stepped) : GROUP_DIVERGED;
+			if (step == GROUP_STEPPED) {
+				for (uint32_t rest = ~stepped; rest; rest &= rest - 1)
+					runLane(batch, base + __builtin_ctz(rest), 1);
+				const uint32_t vectorized = stepped == ~0u ? BATCH_LANES : __builtin_popcount(stepped);
+				batch->vectorSteps += vectorized;
+				batch->scalarSteps += BATCH_LANES - vectorized;
+				n++;
+				continue;
+			}
+#else
+			const group_step_t step = GROUP_DIVERGED;
+#endif
+			const uint32_t burst = step == GROUP_NO_KERNEL ? 1 : count - n < BATCH_BURST ? count - n : BATCH_BURST;
+			for (uint32_t lane = base; lane < base + BATCH_LANES; lane++)
+				runLane(batch, lane, burst);
+			batch->scalarSteps += BATCH_LANES * burst;
+			n += burst;
+		}
+	}
+}
+
+void updateBatchTimers(batch_t *batch) {
+	for (uint32_t lane = 0; lane < batch->stride; lane++) {
+		batch->delayTimer[lane] -= batch->delayTimer[lane] != 0;
+		batch->soundTimer[lane] -= batch->soundTimer[lane] != 0;
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct chip8_t;
+
+#define BATCH_LANES 32		// Machines stepped together by one vector kernel, per machine arrays are padded to a multiple of this
+#define BATCH_STACK 12		// Stack depth per machine, STACK_DEPTH like chip8_t
+#define BATCH_LOW_MEMORY 4096		// Bytes of each machine kept in the batch, the rest of 64K is in a page of its own
+#define BATCH_MEMORY (BATCH_LOW_MEMORY + 64)	// Bytes between machines' memory, the extra cache line keeps the same
+												// address of neighbouring machines out of the same L1 set
+#define BATCH_BURST 64		// Steps a diverged group runs per machine before checking whether it converged again
+#define BATCH_MIN_LANES 16	// Machines that have to share a pc and opcode for a group step to run vectorized
+
+// Many machines in structure of arrays form
+// Every field is stored as [element][machine], so the same register/row of neighbouring machines is
+// contiguous and one vector load covers BATCH_LANES machines. Memory is the exception, machines that
+// diverged read it one at a time so each machine keeps its 4K in one piece. Memory above 4K is only
+// allocated for a machine once it holds something other than zeros
+typedef struct batch_t {
+	uint32_t count;			// Machines in the batch
+	uint32_t stride;		// count rounded up to BATCH_LANES, length of every per machine array
+
+	uint8_t *memory;		// [stride][BATCH_MEMORY], BATCH_LOW_MEMORY used
+	uint8_t **highMemory;	// [stride] MEMORY_SIZE - BATCH_LOW_MEMORY bytes from 0x1000 up, NULL while all zero
+	uint64_t *display;		// [LORES_HEIGHT][stride] packed rows, word 0 of plane 0 of chip8_t::display
+	uint64_t *dirtyRows;	// [stride]
+	uint16_t *stack;		// [BATCH_STACK][stride]
+	uint8_t *V;				// [16][stride]
+	uint16_t *keys;			// [stride] bit k set while key k is down
+	uint16_t *pc;			// [stride]
+	uint16_t *I;			// [stride]
+	uint8_t *sp;			// [stride]
+	uint8_t *delayTimer;	// [stride]
+	uint8_t *soundTimer;	// [stride]
+	uint8_t *waitKey;		// [stride] FX0A key being waited on, 0xFF if none yet
+	uint8_t *waitKeyPressed;// [stride]
+	uint64_t *rngState;		// [stride] CXNN generator, one per machine
+	uint8_t *audioPattern;	// [stride][16] XO-CHIP pattern buffer, carried through unchanged since VIP has no F002/FX3A
+	uint8_t *pitch;			// [stride]
+	uint8_t *patternSet;	// [stride]
+
+	bool avx2;				// Host can run the vector kernels
+	uint64_t vectorSteps;	// Machine steps executed by a vector kernel
+	uint64_t scalarSteps;	// Machine steps executed one machine at a time
+} batch_t;
+
+batch_t *createBatch(uint32_t count);
+void destroyBatch(batch_t *batch);
+bool batchModels(const struct chip8_t *chip8);
+bool resetBatch(batch_t *batch, const struct chip8_t *chip8);
+bool setBatchMachine(batch_t *batch, uint32_t lane, const struct chip8_t *chip8);
+void getBatchMachine(const batch_t *batch, uint32_t lane, struct chip8_t *chip8);
+void setBatchKey(batch_t *batch, uint32_t lane, uint8_t key, bool pressed);
+void emulateBatch(batch_t *batch, uint32_t count);
+void updateBatchTimers(batch_t *batch);
+
+#endif
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "output.h"
+#include "rewind.h"
+
+// Benchmark: times the instruction engines on every rom in a directory and on synthetic opcode
+// kernels, plus the frontend's screen and audio fill paths and the rewind snapshot, with no frame pacing
+// Usage: bench [romdir] [-engine NAME] [-insts N] [-reps N] [-ips N] [-only roms|kernels|output] [-json]
+//
+// Every emulation workload restarts from reset on each repetition and runs the same instruction count,
+// timers tick once per frame like in the window. The first repetition is a warmup and isn't counted.
+
+
+// Synthetic kernels, each loops forever over one class of instructions
+typedef struct {
+	const char *name;
+	uint8_t code[32];
+	uint32_t size;
+} kernel_t;
+
+static const kernel_t kernels[] = {
+	// 8XYN/7XNN register arithmetic
+	{ "kernel:alu", { 0x60,0x00, 0x61,0x01, 0x80,0x14, 0x81,0x04, 0x82,0x02, 0x83,0x13, 0x84,0x26, 0x70,0x01, 0x12,0x04 }, 18 },
+	// DXYN of 15 row font sprites marching across the screen
+	{ "kernel:draw", { 0xA0,0x00, 0x60,0x00, 0x61,0x00, 0xD0,0x1F, 0x70,0x03, 0x71,0x05, 0x12,0x06 }, 14 },
+	// FX55/FX65 of all sixteen registers, the stores land away from the code
+	{ "kernel:copy", { 0xA3,0x00, 0xFF,0x55, 0xA3,0x00, 0xFF,0x65, 0x70,0x01, 0x12,0x00 }, 12 },
+	// FX33 of a changing value
+	{ "kernel:bcd", { 0xA3,0x00, 0x75,0x13, 0xF5,0x33, 0x12,0x02 }, 8 },
+	// 2NNN/00EE with a skip in the subroutine
+	{ "kernel:call", { 0x22,0x06, 0x70,0x01, 0x12,0x00, 0x30,0x00, 0x61,0x01, 0x00,0xEE }, 12 },
+};
+
+typedef struct {
+	std::string workload;
+	const char *kind;		// rom, kernel or output
+	const char *engine;		// "-" for output paths
+	const char *unit;		// What one op is: inst, call
+	uint64_t ops;			// Per repetition
+	double nsPerOp;			// Mean over the counted repetitions
+	double opsPerSec;
+	double framesPerSec;	// Emulated 60hz frames per host second, calls per second for output paths
+	double stddevPct;		// Standard deviation of the per repetition throughput, percent of the mean
+	double varianceNs;		// Variance of ns/op across repetitions
+} result_t;
+
+typedef struct {
+	uint64_t insts;
+	uint32_t reps;
+} bench_opts_t;
+
+
+static void printUsage(void) {
+	printf("Usage: bench [romdir] [-engine NAME] [-insts N] [-reps N] [-ips N] [-only roms|kernels|output] [-json]\n"
+		   "  romdir     Directory of .ch8 roms to time (default roms)\n"
+		   "  -engine N  Only time engine N: switch, cached, jit or threaded (default all)\n"
+		   "  -insts N   Instructions per repetition (default 2000000)\n"
+		   "  -reps N    Counted repetitions per workload, after one warmup (default 5)\n"
+		   "  -ips N     Instructions per emulated second, sets how often timers tick (default 700)\n"
+		   "  -only W    Only run the roms, the kernels or the output paths (screen, audio, scrolls, rewind)\n"
+		   "  -json      Print the results as JSON instead of a table\n");
+}
+
+
+static double elapsedNs(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// Mean, spread and throughput from the per repetition times
+static void summarize(result_t *result, const std::vector<double> &ns, double opsPerFrame) {
+	double mean = 0;
+	for (double t : ns) mean += t / result->ops;
+	mean /= ns.size();
+
+	double variance = 0, rateMean = 0, rateVariance = 0;
+	for (double t : ns) {
+		variance += (t / result->ops - mean) * (t / result->ops - mean);
+		rateMean += result->ops / t;
+	}
+	rateMean /= ns.size();
+	for (double t : ns) rateVariance += (result->ops / t - rateMean) * (result->ops / t - rateMean);
+
+	result->nsPerOp = mean;
+	result->varianceNs = variance / ns.size();
+	result->opsPerSec = 1e9 / mean;
+	result->framesPerSec = result->opsPerSec / opsPerFrame;
+	result->stddevPct = rateMean > 0 ? 100.0 * sqrt(rateVariance / ns.size()) / rateMean : 0;
+}
+
+
+static result_t benchEmulation(const char *workload, const char *kind, const uint8_t *rom, size_t size,
+							   const config_t *config, const bench_opts_t *opts) {
+	chip8_t chip8 = {};
+	decode_cache_t *cache = createDecodeCache();
+	chip8.cache = cache;
+	if (config->engine == ENGINE_JIT) chip8.jit = createJit();
+
+	const uint64_t instPerFrame = config->instPerSec / 60 ? config->instPerSec / 60 : 1;
+	std::vector<double> ns;
+	for (uint32_t rep = 0; rep <= opts->reps; rep++) {
+		initChip8Rom(&chip8, config, rom, size, (char *)workload);
+		const auto start = std::chrono::steady_clock::now();
+		for (uint64_t executed = 0; executed < opts->insts; executed += instPerFrame) {
+			const uint64_t burst = opts->insts - executed < instPerFrame ? opts->insts - executed : instPerFrame;
+			emulateInstructions(&chip8, config, burst);
+			updateTimers(&chip8);
+		}
+		if (rep) ns.push_back(elapsedNs(start));
+	}
+	destroyJit(chip8.jit);
+	destroyDecodeCache(cache);
+
+	result_t result = { workload, kind, engineName(config->engine), "inst", opts->insts, 0, 0, 0, 0, 0 };
+	summarize(&result, ns, instPerFrame);
+	return result;
+}
+
+
+// Times fn over enough calls to take about 20ms, the count is picked during the warmup
+template <typename F>
+static result_t benchOutput(const char *workload, const bench_opts_t *opts, F fn) {
+	uint64_t calls = 1;
+	for (;;) {
+		const auto start = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < calls; i++) fn();
+		if (elapsedNs(start) > 20e6 || calls >= (1ull << 30)) break;
+		calls *= 2;
+	}
+
+	std::vector<double> ns;
+	for (uint32_t rep = 0; rep < opts->reps; rep++) {
+		const auto start = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < calls; i++) fn();
+		ns.push_back(elapsedNs(start));
+	}
+	result_t result = { workload, "output", "-", "call", calls, 0, 0, 0, 0, 0 };
+	summarize(&result, ns, 1);
+	return result;
+}
+
+
+static void benchOutputs(std::vector<result_t> &results, const config_t *defaults, const bench_opts_t *opts) {
+	chip8_t chip8 = {};
+	chip8.planes = 1;
+	for (uint32_t y = 0; y < DISPLAY_HEIGHT; y++)
+		for (uint32_t w = 0; w < DISPLAY_WORDS; w++)
+			chip8.display[0][y][w] = (y & 1) ? 0xAAAAAAAAAAAAAAAAull : 0x5555555555555555ull;
+
+	// Same sizes the window uses, the texture is scaled up when outlines are drawn into it
+	config_t config = *defaults;
+	config.pixelOutlines = true;
+	const uint32_t cell = textureCell(&config);
+	const int pitch = DISPLAY_WIDTH * cell * 4;
+	std::vector<uint32_t> texels((size_t)DISPLAY_WIDTH * cell * DISPLAY_HEIGHT * cell);
+	volatile uint32_t sink = 0;		// Keeps the texture writes observable
+
+	results.push_back(benchOutput("updateScreen:full,outlines", opts, [&] {
+		renderRows(&chip8, &config, 0, LORES_HEIGHT - 1, texels.data(), pitch);
+		sink = sink + texels[texels.size() / 2];
+	}));
+	results.push_back(benchOutput("updateScreen:1row,outlines", opts, [&] {
+		renderRows(&chip8, &config, 7, 7, texels.data(), pitch);
+		sink = sink + texels[0];
+	}));
+	config.pixelOutlines = false;
+	results.push_back(benchOutput("updateScreen:full", opts, [&] {
+		renderRows(&chip8, &config, 0, LORES_HEIGHT - 1, texels.data(), DISPLAY_WIDTH * 4);
+		sink = sink + texels[DISPLAY_WIDTH * 7];
+	}));
+
+	// Hi-res, two planes, and the scrolls games run every frame
+	chip8.hires = true;
+	memcpy(chip8.display[1], chip8.display[0], sizeof chip8.display[1]);
+	results.push_back(benchOutput("updateScreen:hires", opts, [&] {
+		renderRows(&chip8, &config, 0, DISPLAY_HEIGHT - 1, texels.data(), DISPLAY_WIDTH * 4);
+		sink = sink + texels[DISPLAY_WIDTH * 7];
+	}));
+	chip8.planes = 3;
+	results.push_back(benchOutput("scroll:left+right", opts, [&] {
+		scrollLeft(&chip8);
+		scrollRight(&chip8);
+		sink = sink + (uint32_t)chip8.display[1][7][1];
+	}));
+	results.push_back(benchOutput("scroll:down+up", opts, [&] {
+		scrollDown(&chip8, 4);
+		scrollUp(&chip8, 4);
+		sink = sink + (uint32_t)chip8.display[1][7][0];
+	}));
+
+	// One SDL audio buffer of the buzzer sounding, the window asks for 512 samples at a time
+	static audio_stream_t stream;
+	initAudioStream(&stream, &config, 44100, 512);
+	stream.tone.on = true;
+	int16_t samples[512];
+	results.push_back(benchOutput("audioCallback:512", opts, [&] {
+		renderAudio(&stream, samples, 512);
+		sink = sink + samples[stream.played & 511];
+	}));
+
+	// A rewind snapshot after a frame that drew a sprite row and stored a byte, keyframes included, in the
+	// window's default history size
+	rewind_t *rewind = createRewind(defaults->rewindSize);
+	if (rewind) {
+		chip8.memory[0x200] = 0xF0;
+		chip8.I = 0x200;
+		uint8_t n = 0;
+		results.push_back(benchOutput("rewind:push", opts, [&] {
+			drawSprite<false, false>(&chip8, n, 5, 1);
+			writeMemory(&chip8, 0x300 + (n & 7), n);
+			chip8.V[n & 15] = n;
+			n++;
+			pushRewind(rewind, &chip8);
+		}));
+		destroyRewind(rewind);
+	}
+}
+
+
+static void printJsonString(const std::string &s) {
+	putchar('"');
+	for (char c : s) {
+		if (c == '"' || c == '\\') putchar('\\');
+		putchar(c);
+	}
+	putchar('"');
+}
+
+
+static void printJson(const std::vector<result_t> &results, const config_t *config, const bench_opts_t *opts) {
+	printf("{\n  \"ips\": %u,\n  \"insts\": %llu,\n  \"reps\": %u,\n  \"results\": [\n",
+		   config->instPerSec, (unsigned long long)opts->insts, opts->reps);
+	for (size_t i = 0; i < results.size(); i++) {
+		const result_t &r = results[i];
+		printf("    {\"workload\": ");
+		printJsonString(r.workload);
+		printf(", \"kind\": \"%s\", \"engine\": \"%s\", \"unit\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f, "
+			   "\"variance_ns\": %.6f, \"mops\": %.3f, \"fps\": %.1f, \"stddev_pct\": %.2f}%s\n",
+			   r.kind, r.engine, r.unit, (unsigned long long)r.ops, r.nsPerOp, r.varianceNs, r.opsPerSec / 1e6,
+			   r.framesPerSec, r.stddevPct, i + 1 < results.size() ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+
+static void printTable(const std::vector<result_t> &results) {
+	bool header = false;
+	for (const result_t &r : results) {
+		if (strcmp(r.kind, "output") == 0) continue;
+		if (!header) printf("%-40s %-9s %10s %10s %12s %8s\n", "workload", "engine", "ns/inst", "MIPS", "frames/s", "stddev");
+		header = true;
+		printf("%-40.40s %-9s %10.2f %10.2f %12.0f %7.1f%%\n", r.workload.c_str(), r.engine, r.nsPerOp,
+			   r.opsPerSec / 1e6, r.framesPerSec, r.stddevPct);
+	}
+	if (header) putchar('\n');
+	header = false;
+	for (const result_t &r : results) {
+		if (strcmp(r.kind, "output") != 0) continue;
+		if (!header) printf("%-40s %12s %12s %8s\n", "output path", "ns/call", "calls/s", "stddev");
+		header = true;
+		printf("%-40.40s %12.1f %12.0f %7.1f%%\n", r.workload.c_str(), r.nsPerOp, r.opsPerSec, r.stddevPct);
+	}
+}
+
+
+int main(int argc, char **argv) {
+	const char *romDir = "roms";
+	const char *only = NULL;
+	bool json = false;
+	bool allEngines = true;
+	bench_opts_t opts = { .insts = 2000000, .reps = 5 };
+
+	config_t config;
+	setDefaultConfig(&config);
+	config.idleSkip = false;	// Engines are timed on every instruction, spin loops included
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-engine") && i + 1 < argc && parseEngine(argv[i + 1], &config.engine)) {
+			allEngines = false;
+			i++;
+		}
+		else if (!strcmp(argv[i], "-insts") && i + 1 < argc) opts.insts = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-reps") && i + 1 < argc) opts.reps = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-ips") && i + 1 < argc) config.instPerSec = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-only") && i + 1 < argc) only = argv[++i];
+		else if (!strcmp(argv[i], "-json")) json = true;
+		else if (argv[i][0] != '-') romDir = argv[i];
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	if (opts.reps == 0) opts.reps = 1;
+	if (opts.insts == 0) opts.insts = 1;
+	const bool runRoms = !only || !strcmp(only, "roms");
+	const bool runKernels = !only || !strcmp(only, "kernels");
+	const bool runOutput = !only || !strcmp(only, "output");
+
+	// Rom images are read once, every repetition resets from the copy in memory
+	std::vector<std::pair<std::string, std::vector<uint8_t>>> roms;
+	if (runRoms) {
+		std::error_code error;
+		for (const auto &entry : std::filesystem::directory_iterator(romDir, error)) {
+			if (!entry.is_regular_file() || entry.path().extension() != ".ch8") continue;
+			FILE *file = fopen(entry.path().string().c_str(), "rb");
+			if (!file) continue;
+			std::vector<uint8_t> image(MEMORY_SIZE - ENTRY_POINT);
+			image.resize(fread(image.data(), 1, image.size(), file));
+			fclose(file);
+			roms.emplace_back("rom:" + entry.path().filename().string(), image);
+		}
+		if (error) {
+			fprintf(stderr, "Could not read rom directory %s: %s\n", romDir, error.message().c_str());
+			return 1;
+		}
+		std::sort(roms.begin(), roms.end());
+	}
+
+	std::vector<result_t> results;
+	for (uint32_t e = 0; e < ENGINE_COUNT; e++) {
+		if (!allEngines && e != (uint32_t)config.engine) continue;
+		config_t engineConfig = config;
+		engineConfig.engine = (engine_t)e;
+
+		for (const auto &rom : roms)
+			results.push_back(benchEmulation(rom.first.c_str(), "rom", rom.second.data(), rom.second.size(), &engineConfig, &opts));
+		if (runKernels) {
+			for (const kernel_t &kernel : kernels)
+				results.push_back(benchEmulation(kernel.name, "kernel", kernel.code, kernel.size, &engineConfig, &opts));
+		}
+	}
+	if (runOutput) benchOutputs(results, &config, &opts);
+
+	if (json) printJson(results, &config, &opts);
+	else printTable(results);
+	return 0;
+}
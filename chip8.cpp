@@ -0,0 +1,739 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "analysis.h"
+
+
+static const uint8_t font[] = {
+	0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0   
+	0x20, 0x60, 0x20, 0x20, 0x70,   // 1  
+	0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2 
+	0xF0, 0x10, 0xF0, 0x10, 0xF0,   // 3
+	0x90, 0x90, 0xF0, 0x10, 0x10,   // 4    
+	0xF0, 0x80, 0xF0, 0x10, 0xF0,   // 5
+	0xF0, 0x80, 0xF0, 0x90, 0xF0,   // 6
+	0xF0, 0x10, 0x20, 0x40, 0x40,   // 7
+	0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 8
+	0xF0, 0x90, 0xF0, 0x10, 0xF0,   // 9
+	0xF0, 0x90, 0xF0, 0x90, 0x90,   // A
+	0xE0, 0x90, 0xE0, 0x90, 0xE0,   // B
+	0xF0, 0x80, 0x80, 0x80, 0xF0,   // C
+	0xE0, 0x90, 0x90, 0x90, 0xE0,   // D
+	0xF0, 0x80, 0xF0, 0x80, 0xF0,   // E
+	0xF0, 0x80, 0xF0, 0x80, 0x80,   // F
+};
+
+// SUPER-CHIP FX30 digits, 8x10, loaded at HIRES_FONT. SUPER-CHIP only had 0-9, A-F are XO-CHIP's
+static const uint8_t hiresFont[] = {
+	0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF,	// 0
+	0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF,	// 1
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,	// 2
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,	// 3
+	0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03,	// 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,	// 5
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,	// 6
+	0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18,	// 7
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,	// 8
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,	// 9
+	0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,	// A
+	0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC,	// B
+	0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C,	// C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,	// D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,	// E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0,	// F
+};
+
+static_assert(sizeof font <= HIRES_FONT && HIRES_FONT + sizeof hiresFont <= ENTRY_POINT, "fonts must fit below the rom");
+
+
+void setDefaultConfig(config_t *config) {
+	*config = (config_t){
+		.windowWidth = 64,		// Chip8 original x resolution
+		.windowHeight = 32,		// Chip8 original y resolution
+		.fgColor = 0x00FF00FF,	// GREEN
+		.bgColor = 0x000000FF,	// WHITE
+		.fg2Color = 0xFF6600FF,	// ORANGE
+		.blendColor = 0xFFFF00FF,// YELLOW
+		.scaleFactor = 20,		// Resolution will be 1280x640
+		.instPerSec = 700,  	// # of instructions to emulate per second
+		.sqrWaveFreq = 440,		// Frequency of sound waves
+		.volume = 3000,			// Volume
+		.audSampleRate = 44100,	// CD Quality
+		.pixelOutlines = true,	// Draw pixel outlines
+		.rngSeed = 0,			// Frontends pick their own seed (e.g. time(NULL))
+		.engine = ENGINE_SWITCH,// Reference interpreter
+		.quirks = QUIRKS_VIP,	// Original CHIP-8 behaviour
+		.rewindSize = 4 << 20,	// About two minutes of history, a typical frame costs ~600 bytes
+		.recordMovie = NULL,
+		.replayMovie = NULL,
+		.traceFile = NULL,
+		.traceSize = 1 << 16,	// The last 65536 instructions, 1.5 MB
+		.profile = false,
+		.heatmap = false,
+		.runAhead = 0,			// Show the real machine
+		.audioBuffer = 512,		// ~12ms at 44100hz
+		.idleSkip = true,		// Timer polls and key waits cost nothing
+		.turbo = 4,				// Turbo runs 4x
+	};
+}
+
+
+// Command line names, indexed by engine_t
+static const char *const engineNames[ENGINE_COUNT] = { "switch", "cached", "jit", "threaded" };
+
+// Map an engine name from the command line to its engine_t
+bool parseEngine(const char *name, engine_t *engine) {
+	for (uint32_t i = 0; i < ENGINE_COUNT; i++) {
+		if (!strcmp(name, engineNames[i])) {
+			*engine = (engine_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// Turbo speed from the command line, a multiple of the normal speed or max
+bool parseTurbo(const char *name, uint32_t *turbo) {
+	if (!strcmp(name, "max")) {
+		*turbo = 0;
+		return true;
+	}
+	char *end;
+	const unsigned long speed = strtoul(name, &end, 0);
+	if (*end || !speed || speed > 1000) return false;
+	*turbo = (uint32_t)speed;
+	return true;
+}
+
+
+const char *engineName(engine_t engine) {
+	return engine < ENGINE_COUNT ? engineNames[engine] : "unknown";
+}
+
+
+// Command line names, indexed by quirk_profile_t
+static const char *const quirksNames[QUIRKS_COUNT] = { "vip", "chip48", "schip", "xochip" };
+
+bool parseQuirks(const char *name, quirk_profile_t *quirks) {
+	for (uint32_t i = 0; i < QUIRKS_COUNT; i++) {
+		if (!strcmp(name, quirksNames[i])) {
+			*quirks = (quirk_profile_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+const char *quirksName(quirk_profile_t quirks) {
+	return quirks < QUIRKS_COUNT ? quirksNames[quirks] : "unknown";
+}
+
+
+// Reset machine, load font and rom into memory
+bool initChip8(chip8_t *chip8, const config_t *config, char romName[]) {
+	uint8_t image[sizeof chip8->memory - ENTRY_POINT];
+
+	// Load ROM
+	FILE *rom = fopen(romName, "rb");
+	if (!rom) {
+		fprintf(stderr, "Romfile %s is invalid or does not exist\n", romName);
+		return false;
+	}
+	fseek(rom, 0, SEEK_END);		// Go to end of file
+	const size_t romSize = ftell(rom);// Get number of bytes we need read into memory
+	const size_t maxSize = sizeof image;
+	rewind(rom);					// Go back to behgining of file 
+	if (romSize > maxSize) {
+		fprintf(stderr, "Romfile %s is too big! Rom size: %zu\nMax size allowed: %zu\n", romName, romSize, maxSize);
+		fclose(rom);
+		return false;
+	}
+	if (fread(image, romSize, 1, rom) != 1) {
+		fprintf(stderr, "Could not read Rom file %s into memory\n", romName);
+		fclose(rom);
+		return false;
+	}
+	fclose(rom);
+	return initChip8Rom(chip8, config, image, romSize, romName);
+}
+
+
+// Reset machine with a rom image that is already in memory, romName is only kept for display
+bool initChip8Rom(chip8_t *chip8, const config_t *config, const uint8_t *rom, size_t romSize, char romName[]) {
+	if (romSize > sizeof chip8->memory - ENTRY_POINT) {
+		fprintf(stderr, "Rom %s is too big! Rom size: %zu\nMax size allowed: %zu\n", romName, romSize, sizeof chip8->memory - ENTRY_POINT);
+		return false;
+	}
+	decode_cache_t *cache = chip8->cache;	// Attached caches survive a reset but start empty
+	jit_t *jit = chip8->jit;
+	profile_t *profile = chip8->profile;
+	trace_t *trace = chip8->trace;
+	debug_t *debug = chip8->debug;
+	audio_stream_t *audio = chip8->audio;
+	memset(chip8, 0, sizeof(chip8_t));
+	chip8->cache = cache;
+	chip8->jit = jit;
+	chip8->profile = profile;
+	chip8->trace = trace;
+	chip8->debug = debug;
+	chip8->audio = audio;
+	if (chip8->cache) flushDecodeCache(chip8->cache);
+	if (chip8->jit) flushJit(chip8->jit);
+	if (chip8->trace) chip8->trace->cycle = 0;
+	memcpy(&chip8->memory[0], font, sizeof(font));
+	memcpy(&chip8->memory[HIRES_FONT], hiresFont, sizeof(hiresFont));
+	memcpy(&chip8->memory[ENTRY_POINT], rom, romSize);
+	chip8->romName = romName;
+	chip8->romSize = (uint32_t)romSize;
+
+	chip8->state = RUNNING;
+	chip8->pc = ENTRY_POINT;
+	chip8->sp = 0;
+	chip8->waitKey = 0xFF;
+	chip8->rngState = config->rngSeed;
+	chip8->pitch = 64;				// 4000 bits a second
+	chip8->planes = 1;				// Plain CHIP-8 drawing only touches plane 0
+	chip8->dirtyRows = ~0ull;		// Frontend redraws the whole screen after a reset
+	chip8->changedRows = ~0ull;		// and the rewind history takes it all again
+	memset(chip8->dirtyPages, 1, sizeof chip8->dirtyPages);
+
+	if (chip8->jit) {
+		// The recompiler starts from the load time block map instead of finding every block as it runs into it
+		chip8->jit->quirks = config->quirks;
+		analysis_t *analysis = analyzeRom(chip8);
+		if (analysis) pretranslateJit(chip8->jit, chip8, analysis);
+		destroyAnalysis(analysis);
+	}
+	return true;
+}
+
+
+// Reference interpreter, one instantiation per quirk profile
+template <quirk_profile_t P>
+static void interpret(chip8_t *chip8) {
+	constexpr quirk_set_t quirks = quirkSets[P];
+	bool carry;   // Save carry flag/VF value for some instructions
+
+	// get next opcode from ram
+	if (chip8->state != PAUSE) {
+		chip8->inst.opcode = (chip8->memory[chip8->pc] << 8) | chip8->memory[(uint16_t)(chip8->pc+1)];
+		chip8->pc += 2;
+
+		// Fill out instruction format
+		chip8->inst.NNN = chip8->inst.opcode & 0x0FFF;
+		chip8->inst.NN = chip8->inst.opcode & 0x0FF;
+		chip8->inst.N = chip8->inst.opcode & 0x0F;
+		chip8->inst.X = (chip8->inst.opcode >> 8) & 0x0F;
+		chip8->inst.Y = (chip8->inst.opcode >> 4) & 0x0F;
+
+		// Emulate opcode
+		switch ((chip8->inst.opcode >> 12) & 0x0F)
+		{
+		case 0x00:
+			if (chip8->inst.NN == 0xE0) {
+				// 0x00E0: clear screen
+				clearDisplay(chip8);
+			} else if (chip8->inst.NN == 0xEE) {
+				// 0x00EE: Return from subroutine
+				returnFromSubroutine(chip8);
+			} else if (quirks.superChip && (chip8->inst.opcode & 0xFFF0) == 0x00C0) {
+				// 0x00CN: SUPER-CHIP, scroll down N pixels
+				scrollDown(chip8, chip8->inst.N);
+			} else if (quirks.xoChip && (chip8->inst.opcode & 0xFFF0) == 0x00D0) {
+				// 0x00DN: XO-CHIP, scroll up N pixels
+				scrollUp(chip8, chip8->inst.N);
+			} else if (quirks.superChip && chip8->inst.opcode == 0x00FB) {
+				// 0x00FB: SUPER-CHIP, scroll right 4 pixels
+				scrollRight(chip8);
+			} else if (quirks.superChip && chip8->inst.opcode == 0x00FC) {
+				// 0x00FC: SUPER-CHIP, scroll left 4 pixels
+				scrollLeft(chip8);
+			} else if (quirks.superChip && chip8->inst.opcode == 0x00FD) {
+				// 0x00FD: SUPER-CHIP, exit. The machine stays on this instruction
+				chip8->pc -= 2;
+			} else if (quirks.superChip && (chip8->inst.opcode == 0x00FE || chip8->inst.opcode == 0x00FF)) {
+				// 0x00FE/0x00FF: SUPER-CHIP, lo-res/hi-res
+				setResolution(chip8, chip8->inst.opcode == 0x00FF);
+			} else {
+				// Unimplemented /invalid opcode, may be 0xNNN for callling machine code for RCA1802
+			}
+			break;
+		
+		case 0x01:
+			// 0x1NNN jump to adress NNN
+			chip8->pc = chip8->inst.NNN;
+			break;
+		
+		case 0x02:
+			// 0x2NNN: call subroutine at NNN
+			callSubroutine(chip8, chip8->inst.NNN);
+			break;
+		
+		case 0x03:
+			// 0x3XNN: check if VX == NN, if so, skip next inst
+			if (chip8->V[chip8->inst.X] == chip8->inst.NN)
+				skipInstruction<P>(chip8);
+			break;
+
+		case 0x04:
+			// 0x4XNN: check if VX != NN, if so, skip next inst
+			if (chip8->V[chip8->inst.X] != chip8->inst.NN)
+				skipInstruction<P>(chip8);
+			break;
+		
+		case 0x05:
+			if (quirks.xoChip && chip8->inst.N == 2) {
+				// 0x5XY2: XO-CHIP, store VX to VY at I
+				storeRange(chip8, chip8->inst.X, chip8->inst.Y);
+				break;
+			}
+			if (quirks.xoChip && chip8->inst.N == 3) {
+				// 0x5XY3: XO-CHIP, load VX to VY from I
+				loadRange(chip8, chip8->inst.X, chip8->inst.Y);
+				break;
+			}
+			// 0x5XY0: check if VX == VY, skip next inst if so
+			if (chip8->inst.N != 0) break; // wrong opcode
+
+			if (chip8->V[chip8->inst.X] == chip8->V[chip8->inst.Y])
+				skipInstruction<P>(chip8);
+			break;
+
+		case 0x06:
+			// 0x6XNN: Set register VX to NN
+			chip8->V[chip8->inst.X] = chip8->inst.NN;
+			break;
+		
+		case 0x07:
+			// 076XNN: Set register VX += NN
+			chip8->V[chip8->inst.X] += chip8->inst.NN;
+			break;
+
+		case 0x08:
+			switch(chip8->inst.N) {
+				case 0:
+					// 0x8XY0: Set register VX = VY
+					chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y];
+					break;
+				case 1:
+					// 0x8XY1: Set register VX |= VY
+					chip8->V[chip8->inst.X] |= chip8->V[chip8->inst.Y];
+					if constexpr (quirks.vfReset) chip8->V[0xF] = 0;
+					break;
+				case 2:
+					// 0x8XY2: Set register VX &= VY
+					chip8->V[chip8->inst.X] &= chip8->V[chip8->inst.Y];
+					if constexpr (quirks.vfReset) chip8->V[0xF] = 0;
+					break;
+				case 3:
+					// 0x8XY3: Set register VX ^= VY
+					chip8->V[chip8->inst.X] ^= chip8->V[chip8->inst.Y];
+					if constexpr (quirks.vfReset) chip8->V[0xF] = 0;
+					break;
+				case 4:
+					// 0x8XY4: Set register VX += VY, set VF to 1 if carry
+					carry = ((uint16_t)(chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255);
+
+                    chip8->V[chip8->inst.X] += chip8->V[chip8->inst.Y];
+                    chip8->V[0xF] = carry; 
+					break;
+				case 5:
+					// 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive)
+					// if (chip8->V[chip8->inst.X] >= chip8->V[chip8->inst.Y])
+					// 	chip8->V[0xF] = 1;
+					carry = chip8->V[chip8->inst.X] >= chip8->V[chip8->inst.Y];
+
+					chip8->V[chip8->inst.X] -= chip8->V[chip8->inst.Y];
+					chip8->V[0xF] = carry; 
+					break;
+				case 6: {
+					// 0x8XY6: Set register VX >>= 1, Store shifted off bit in VF
+					// NOTE: Shifting VY into VX is the VIP's behaviour, CHIP-48 and SUPER-CHIP shift VX
+					const uint8_t source = chip8->V[quirks.shiftVY ? chip8->inst.Y : chip8->inst.X];
+					carry = source & 1;
+					chip8->V[chip8->inst.X] = source >> 1;
+
+					chip8->V[0xF] = carry; 
+					break;
+				}
+				case 7:
+					// 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive)
+					carry = chip8->V[chip8->inst.X] <= chip8->V[chip8->inst.Y];
+
+					chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X];
+					chip8->V[0xF] = carry;
+					break;
+				case 0xE: {
+					// 0x8XYE: Set register VX <<= 1, Store shifted off bit in VF
+					const uint8_t source = chip8->V[quirks.shiftVY ? chip8->inst.Y : chip8->inst.X];
+					carry = (source & 0x80) >> 7;
+					chip8->V[chip8->inst.X] = source << 1;
+
+					chip8->V[0xF] = carry;
+					break;
+				}
+				default:
+				 	// Wong/unimplemeted
+					break;
+			}
+			break;
+		
+		case 0x09:
+			// Check if VX != VY; skip next inst if so
+			if (chip8->V[chip8->inst.X] != chip8->V[chip8->inst.Y])
+				skipInstruction<P>(chip8);
+			break;
+
+		case 0x0A:
+			// 0xANNN: Set index register I to NNN
+			chip8->I = chip8->inst.NNN;
+			break;
+		
+		case 0x0B:
+			// 0xBNNN: Jump to V0 + NNN, CHIP-48 and SUPER-CHIP read it as BXNN and jump to VX + XNN
+			chip8->pc = chip8->V[quirks.jumpVX ? chip8->inst.X : 0] + chip8->inst.NNN;
+			break;
+
+		case 0x0C:
+			// 0xCXNN: Sets VX = rand(% 256 & NN) bitwise and
+			chip8->V[chip8->inst.X] = nextRandom(&chip8->rngState) & chip8->inst.NN;
+			break;
+
+		case 0x0D: {
+			// 0xDXYN, draws N height sprite at coord X,Y, read from mem location I 
+			// Screen pixels are XOR'd with sprite bits, 
+			// VF (carry flag) is set if any screen pixels are set off; useful for collision detection
+			drawSprite<quirks.wrap, quirks.superChip>(chip8, chip8->V[chip8->inst.X], chip8->V[chip8->inst.Y], chip8->inst.N);
+			break;
+		}
+
+		case 0x0E:
+			if (chip8->inst.NN == 0x9E) {
+				// 0xEX9E: Skip next inst if key in VX is pressed, only the low nibble of VX picks the key
+				if (chip8->keys[chip8->V[chip8->inst.X] & 0xF])
+					skipInstruction<P>(chip8);
+			} else if (chip8->inst.NN == 0xA1) {
+				// 0xEXA1: Skip next inst if key in VX is not pressed
+				if (!chip8->keys[chip8->V[chip8->inst.X] & 0xF])
+					skipInstruction<P>(chip8);
+			}
+			break;
+		
+		case 0x0F:
+			switch(chip8->inst.NN) {
+				case 0x00:
+					// 0xF000 NNNN: XO-CHIP, I = NNNN
+					if (quirks.xoChip && chip8->inst.X == 0) loadLongI(chip8);
+					break;
+
+				case 0x01:
+					// 0xFN01: XO-CHIP, select the planes drawing acts on
+					if (quirks.xoChip) chip8->planes = chip8->inst.X & 3;
+					break;
+
+				case 0x0A: {
+					// 0xFX0A: VX = get_key(); Await until a keypress, and store in VX
+                    // Wait state is kept in the machine (not statics) so each chip8_t waits on its own
+                    for (uint8_t i = 0; chip8->waitKey == 0xFF && i < sizeof chip8->keys; i++) 
+                        if (chip8->keys[i]) {
+                            chip8->waitKey = i;    // Save pressed key to check until it is released
+                            chip8->waitKeyPressed = true;
+                            break;
+                        }
+
+                    // If no key has been pressed yet, keep getting the current opcode & running this instruction
+                    if (!chip8->waitKeyPressed) chip8->pc -= 2; 
+                    else {
+                        // A key has been pressed, also wait until it is released to set the key in VX
+                        if (chip8->keys[chip8->waitKey])     // "Busy loop" CHIP8 emulation until key is released
+                            chip8->pc -= 2;
+                        else {
+                            chip8->V[chip8->inst.X] = chip8->waitKey;	// VX = key 
+                            chip8->waitKey = 0xFF;                 	// Reset key to not found 
+                            chip8->waitKeyPressed = false;         	// Reset to nothing pressed yet
+                        }
+                    }
+                    break;
+				}
+				
+				case 0x1E:
+					// 0xFX1E: I += VX; For non Amiga Chip-8, does not affect VF
+					chip8->I += chip8->V[chip8->inst.X];
+					break;
+				
+				case 0x07:
+					// 0xFX07: VX = Delay timer
+					chip8->V[chip8->inst.X] = chip8->delay_timer;
+					break;
+				
+				case 0x15:
+					// 0xFX07: Delay timer = VX
+					chip8->delay_timer = chip8->V[chip8->inst.X];
+					break;
+				
+				case 0x18:
+					// 0xFX07: sound timer = VX
+					chip8->sound_timer = chip8->V[chip8->inst.X];
+					break;
+
+				case 0x02:
+					// 0xF002: XO-CHIP, load the 16 byte audio pattern from memory at I
+					if (quirks.xoChip && chip8->inst.X == 0) setAudioPattern(chip8);
+					break;
+
+				case 0x3A:
+					// 0xFX3A: XO-CHIP, pattern playback pitch = VX
+					if (quirks.xoChip) chip8->pitch = chip8->V[chip8->inst.X];
+					break;
+				
+				case 0x29:
+					// 0xFX29: Set register I to sprite location in memory for char in VX (0x0-0xF) 
+					chip8->I = chip8->V[chip8->inst.X] * 5;
+					break;
+
+				case 0x30:
+					// 0xFX30: SUPER-CHIP, I = 10 byte sprite for the digit in VX
+					if (quirks.superChip) chip8->I = HIRES_FONT + chip8->V[chip8->inst.X] * 10;
+					break;
+				
+				case 0x33: {
+					// 0xFX33: Store BCD representation at memory offset from I
+					// I = Hundreds place, I+1 = tens, I+2 = one's
+					uint8_t bcd = chip8->V[chip8->inst.X];
+					writeMemory(chip8, chip8->I+2, bcd % 10);
+					bcd /= 10;
+					writeMemory(chip8, chip8->I+1, bcd % 10);
+					bcd /= 10;
+					writeMemory(chip8, chip8->I, bcd);
+					break;
+				}
+				case 0x55:
+					// 0xFX55: Register dump V0-VX inclusive to memory offset from I, CHIP8 increments I, SCHIP DOES NOT
+					storeRegisters<P>(chip8, chip8->inst.X);
+					break;
+
+				case 0x65:
+					// 0xFX65: Register load V0-VX inclusive to memory offset from I, CHIP8 increments I
+					loadRegisters<P>(chip8, chip8->inst.X);
+					break;
+
+				case 0x75:
+					// 0xFX75: SUPER-CHIP, save V0-VX to the user flags
+					if (quirks.superChip) memcpy(chip8->flags, chip8->V, chip8->inst.X + 1);
+					break;
+
+				case 0x85:
+					// 0xFX85: SUPER-CHIP, load V0-VX from the user flags
+					if (quirks.superChip) memcpy(chip8->V, chip8->flags, chip8->inst.X + 1);
+					break;
+				default:
+					break;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+template <quirk_profile_t P>
+static void interpretInstructions(chip8_t *chip8, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++)
+		interpret<P>(chip8);
+}
+
+// Indexed by quirk_profile_t
+static void (*const interpreters[QUIRKS_COUNT])(chip8_t *) = {
+	interpret<QUIRKS_VIP>, interpret<QUIRKS_CHIP48>, interpret<QUIRKS_SCHIP>, interpret<QUIRKS_XOCHIP>,
+};
+
+static void (*const bursts[QUIRKS_COUNT])(chip8_t *, uint32_t) = {
+	interpretInstructions<QUIRKS_VIP>, interpretInstructions<QUIRKS_CHIP48>,
+	interpretInstructions<QUIRKS_SCHIP>, interpretInstructions<QUIRKS_XOCHIP>,
+};
+
+
+// Single step on the reference interpreter with the configured quirks
+void emulateInstruction(chip8_t *chip8, const config_t *config) {
+	interpreters[config->quirks](chip8);
+}
+
+
+// Run count instructions on the engine selected in config, or the profiler's counting interpreter
+static void runInstructions(chip8_t *chip8, const config_t *config, uint32_t count) {
+	// Profiling, tracing and debugging see every instruction on the reference interpreter whatever the
+	// engine, a debugger takes precedence over the other two
+	if (chip8->profile || chip8->trace || chip8->debug) {
+		if (chip8->debug) debugInstructions(chip8->debug, chip8, config, count);
+		else if (chip8->trace) traceInstructions(chip8->trace, chip8, config, count);
+		else profileInstructions(chip8->profile, chip8, config, count);
+		return;
+	}
+	switch (config->engine) {
+		case ENGINE_CACHED:
+			if (chip8->cache) {
+				emulateInstructionsCached(chip8, config, count);
+				return;
+			}
+			break;	// No cache attached, fall back to the reference interpreter
+		case ENGINE_JIT:
+			if (chip8->jit) {
+				emulateInstructionsJit(chip8, config, count);
+				return;
+			}
+			break;
+		case ENGINE_THREADED:
+			emulateInstructionsThreaded(chip8, config, count);
+			return;
+		default:
+			break;
+	}
+	bursts[config->quirks](chip8, count);
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+// Idle loop detection
+// A burst starts with a probe that steps the reference interpreter while the instructions it meets only
+// touch registers, the stack and I (a timer poll, a key wait, a busy loop). Keys and timers can't change
+// inside a burst, so if the probed state ever repeats the machine is in a cycle it can't leave before the
+// burst ends, and the rest of the burst is skipped. Anything that writes memory, draws, uses the random
+// generator or sets a timer ends the probe and the burst runs on the engine as usual.
+
+#define IDLE_PROBE_INSTS 64	// Steps before a probe gives up, catches cycles up to half this long
+
+// Everything the instructions a probe runs can change
+typedef struct {
+	uint16_t pc, I, sp;
+	uint16_t stack[STACK_DEPTH];
+	uint8_t V[16];
+	uint8_t waitKey;
+	bool waitKeyPressed;
+} idle_state_t;
+
+static inline void captureIdleState(const chip8_t *chip8, idle_state_t *state) {
+	memset(state, 0, sizeof *state);	// Padding is compared too
+	state->pc = chip8->pc;
+	state->I = chip8->I;
+	state->sp = chip8->sp;
+	memcpy(state->stack, chip8->stack, sizeof state->stack);
+	memcpy(state->V, chip8->V, sizeof state->V);
+	state->waitKey = chip8->waitKey;
+	state->waitKeyPressed = chip8->waitKeyPressed;
+}
+
+// Instructions that only read memory, display, keys and timers and only write idle_state_t fields
+static bool isIdleOpcode(uint16_t opcode) {
+	const uint8_t N = opcode & 0x0F;
+	const uint8_t NN = opcode & 0xFF;
+	switch (opcode >> 12) {
+		case 0x0: return opcode == 0x00EE;
+		case 0x5: return N == 0 || N == 3;
+		case 0x8: return N <= 7 || N == 0xE;
+		case 0xC: case 0xD: return false;
+		case 0xE: return NN == 0x9E || NN == 0xA1;
+		case 0xF: return opcode == 0xF000 || NN == 0x07 || NN == 0x0A || NN == 0x1E || NN == 0x29 || NN == 0x30 ||
+						 NN == 0x65 || NN == 0x85;
+		default: return true;
+	}
+}
+
+// Steps up to count instructions looking for a cycle, returns how many ran and sets *idle if one was found
+// A cycle has to come back round, so the state is only looked at after a jump back (or an instruction that
+// stays put, like a waiting FX0A). Brent's method: it is compared with a mark that moves to the current
+// state every power of two looks. Once found, the cycle is stepped round to where the whole burst would
+// have left it, so skipping the rest of the burst leaves the machine exactly as running it would
+template <quirk_profile_t P>
+static uint32_t probeIdle(chip8_t *chip8, uint32_t count, bool *idle) {
+	idle_state_t mark, now;
+	captureIdleState(chip8, &mark);
+	uint32_t power = 1, length = 0, markedAt = 0;
+	const uint32_t limit = count < IDLE_PROBE_INSTS ? count : IDLE_PROBE_INSTS;
+	for (uint32_t i = 1; i <= limit; i++) {
+		const uint16_t pc = chip8->pc;
+		if (!isIdleOpcode((chip8->memory[pc] << 8) | chip8->memory[(uint16_t)(pc + 1)])) return i - 1;
+		interpret<P>(chip8);
+		if (chip8->pc > pc) continue;
+
+		captureIdleState(chip8, &now);
+		if (!memcmp(&now, &mark, sizeof now)) {
+			const uint32_t phase = (count - i) % (i - markedAt);
+			for (uint32_t step = 0; step < phase; step++) interpret<P>(chip8);
+			*idle = true;
+			return i + phase;
+		}
+		if (++length == power) {
+			mark = now;
+			markedAt = i;
+			power *= 2;
+			length = 0;
+		}
+	}
+	return limit;
+}
+
+// Indexed by quirk_profile_t
+static uint32_t (*const idleProbes[QUIRKS_COUNT])(chip8_t *, uint32_t, bool *) = {
+	probeIdle<QUIRKS_VIP>, probeIdle<QUIRKS_CHIP48>, probeIdle<QUIRKS_SCHIP>, probeIdle<QUIRKS_XOCHIP>,
+};
+
+
+// Run count instructions, the entry point every frontend and engine test uses
+// A paused machine runs nothing, and with config->idleSkip a burst the machine spends spinning is skipped
+// and counted in idleInstructions. The profiler, the tracer and a debugger always see every instruction.
+void emulateInstructions(chip8_t *chip8, const config_t *config, uint32_t count) {
+	if (chip8->state == PAUSE) return;
+	if (config->idleSkip && !chip8->profile && !chip8->trace && !chip8->debug) {
+		bool idle = false;
+		const uint32_t probed = idleProbes[config->quirks](chip8, count, &idle);
+		if (chip8->audio) noteInstructions(chip8->audio, chip8, probed);
+		count -= probed;
+		if (idle) {
+			chip8->idleInstructions += count;
+			if (chip8->audio) noteInstructions(chip8->audio, chip8, count);
+			return;
+		}
+	}
+	if (!chip8->audio) {
+		runInstructions(chip8, config, count);
+		return;
+	}
+	// With a tone stream attached the burst runs in slices, so each tone change is stamped with the sample
+	// its instruction ran at to within AUDIO_SLICE_SAMPLES
+	while (count && chip8->state != PAUSE) {
+		const uint32_t slice = count < chip8->audio->slice ? count : chip8->audio->slice;
+		runInstructions(chip8, config, slice);
+		noteInstructions(chip8->audio, chip8, slice);
+		count -= slice;
+	}
+}
+
+
+// Run 60hz frame number frame then tick the timers, no pacing
+void emulateFrame(chip8_t *chip8, const config_t *config, uint64_t frame) {
+	emulateInstructions(chip8, config, frameInstructions(config, frame));
+	updateTimers(chip8);
+}
+
+
+void updateTimers(chip8_t *chip8) {
+	if (chip8->delay_timer > 0) chip8->delay_timer--;
+	if (chip8->sound_timer > 0) chip8->sound_timer--;
+	if (chip8->audio) noteTone(chip8->audio, chip8);
+}
+
+
+// FNV-1a over the framebuffer at the current resolution, used to compare runs without a window
+uint64_t hashDisplay(const chip8_t *chip8) {
+	uint64_t hash = 0xCBF29CE484222325ull;
+	// Hashed a pixel color at a time so values of plain CHIP-8 screens stay comparable with older builds
+	for (uint32_t y = 0; y < displayHeight(chip8); y++)
+		for (uint32_t x = 0; x < displayWidth(chip8); x++) {
+			hash ^= getPixel(chip8, x, y);
+			hash *= 0x100000001B3ull;
+		}
+	return hash;
+}
@@ -0,0 +1,324 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "decode.h"
+#include "jit.h"
+#include "threaded.h"
+#include "profile.h"
+#include "trace.h"
+#include "debug.h"
+#include "audio.h"
+#include "display.h"
+#include "quirks.h"
+
+
+typedef enum {
+	QUIT,
+	RUNNING,
+	PAUSE,
+	RESTART,
+	REWIND,		// Stepping back through the rewind history instead of running
+} emu_state_t;
+
+// Instruction execution backends, selectable at runtime
+typedef enum {
+	ENGINE_SWITCH,		// Reference interpreter: fetch, decode and switch every instruction
+	ENGINE_CACHED,		// Run from the predecoded instruction cache
+	ENGINE_JIT,			// x86-64 basic block recompiler, falls back to ENGINE_SWITCH elsewhere
+	ENGINE_THREADED,	// Threaded code interpreter dispatching through a 64K opcode table
+	ENGINE_COUNT,
+} engine_t;
+
+typedef struct config_t {
+	uint32_t windowWidth;	//	Emulator window width
+	uint32_t windowHeight;	//	Emulator window height
+	uint32_t fgColor;		// 	Foreground Color RGBA8888
+	uint32_t bgColor; 		//	Backgorund Color RGBA8888
+	uint32_t fg2Color;		//	XO-CHIP plane 2 color RGBA8888
+	uint32_t blendColor;	//	XO-CHIP color where both planes are set RGBA8888
+	int32_t scaleFactor;	// 	Amount to scale chip8 pixel
+	uint32_t instPerSec; 	// 	Chip8 CPU Clockrate
+	uint32_t sqrWaveFreq;	// 	Freq of square wave sound
+	int16_t volume;			// 	Sound volume
+	uint32_t audSampleRate;	// 	Audio sample rate
+	bool pixelOutlines;		// 	Draw pixel outlines?
+	uint64_t rngSeed;		//	Seed for the per machine CXNN random generator
+	engine_t engine;		//	Instruction execution backend
+	quirk_profile_t quirks;	//	Platform whose behaviour the ambiguous instructions follow
+	uint32_t rewindSize;	//	Bytes of rewind history to keep, 0 disables rewind
+	const char *recordMovie;//	Record keypad input to this movie file
+	const char *replayMovie;//	Drive the keypad from this movie file
+	const char *traceFile;	//	Trace instructions into a ring of traceSize records, written here on exit
+	uint32_t traceSize;
+	bool profile;			//	Count executions per address and time each part of the frame, report on exit
+	bool heatmap;			//	Tint the window with a live heatmap of executed addresses (needs profile)
+	uint32_t runAhead;		//	Frames to run ahead of the real machine for display, 0 disables it
+	uint32_t audioBuffer;	//	Audio device buffer in samples, smaller is less latency and more callbacks
+	bool idleSkip;			//	Skip the rest of a burst spent spinning in a timer poll or key wait loop
+	uint32_t turbo;			//	Emulated frames per 60hz frame in turbo, 0 runs as many as fit
+} config_t;
+
+// CHIP8 instruction format
+typedef struct {
+	uint16_t opcode;
+	uint16_t NNN;		// 12 bit constant
+	uint8_t NN;			// 8 bit contsant
+	uint8_t N;			// 4 bit contsant
+	uint8_t X;			// 4 bit register identifier
+	uint8_t Y;			// 4 bit register identifier
+} instruction_t;
+
+#define DISPLAY_WIDTH 128	// Framebuffer size in pixels, SUPER-CHIP hi-res
+#define DISPLAY_HEIGHT 64	// dirtyRows has one bit per row, so this can't grow past 64
+#define DISPLAY_WORDS 2		// uint64_t per row
+#define DISPLAY_PLANES 2	// XO-CHIP bit planes, a pixel's color is plane 0 | plane 1 << 1
+#define LORES_WIDTH 64		// CHIP-8 resolution, lo-res uses word 0 of the top LORES_HEIGHT rows
+#define LORES_HEIGHT 32
+#define MEMORY_SIZE 65536	// XO-CHIP address space, CHIP-8 and SUPER-CHIP roms only use the first 4K
+#define HIRES_FONT 0x50		// SUPER-CHIP FX30 10 byte digits, stored right after the 5 byte ones
+#define STACK_DEPTH 12		// Nested calls, a call with the stack full or a return with it empty halts the machine
+#define MEMORY_PAGE 256		// Bytes per dirtyPages flag
+
+// CHIP8 Machine object
+// Everything a running machine needs lives in here so several can run side by side in one process
+typedef struct chip8_t {
+	emu_state_t state;
+	uint8_t memory[MEMORY_SIZE];
+	// Framebuffer planes, DISPLAY_WORDS words per row with bit 63 of word 0 as the leftmost pixel
+	// In lo-res only word 0 of the first LORES_HEIGHT rows is used, the rest stays clear
+	uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS];
+	uint64_t dirtyRows;		// Bit y set when row y of the current resolution changed, cleared by the frontend once drawn
+	uint64_t changedRows;	// Bit y set when row y of either plane changed, cleared by the rewind history once taken
+	uint8_t dirtyPages[MEMORY_SIZE / MEMORY_PAGE];	// Non zero for each memory page written, cleared by the rewind history
+	bool hires;				// SUPER-CHIP 00FF: 128x64, 00FE goes back to 64x32
+	uint8_t planes;			// XO-CHIP FN01: bit p set when drawing, clearing and scrolling act on plane p
+	uint16_t stack[STACK_DEPTH];	// Subroutine stack
+	uint8_t V[16];			// Data registers
+	bool keys[16];			// Hexadecimal keypad 0x0-0xF
+
+	uint16_t pc;			// Program counter
+	uint16_t I;				// Index register
+	uint16_t sp;			// Stack pointer
+	uint8_t delay_timer;	// Decrements at 60hz when >0
+	uint8_t sound_timer;	// Decrements at 60hz and plays tone when >0
+	instruction_t inst;		// currently executing instruction
+
+	bool waitKeyPressed;	// FX0A: a key went down and we are waiting for its release
+	uint8_t waitKey;		// FX0A: key being waited on, 0xFF if none yet
+	uint64_t rngState;		// CXNN random generator state
+	uint8_t audioPattern[16];	// XO-CHIP F002: 128 bits the buzzer plays in a loop
+	uint8_t pitch;			// XO-CHIP FX3A: pattern playback rate, 4000 * 2^((pitch - 64) / 48) bits a second
+	bool patternSet;		// F002 ran, until then the buzzer is the plain CHIP-8 square wave
+	uint8_t flags[16];		// SUPER-CHIP FX75/FX85 user flags, not kept across runs
+	uint64_t idleInstructions;	// Instructions idle loop detection skipped instead of running, see emulateInstructions
+
+	decode_cache_t *cache;	// Optional predecoded instructions, owned by the caller and kept across initChip8
+	jit_t *jit;				// Optional recompiler state, owned by the caller and kept across initChip8
+	profile_t *profile;		// Optional execution counts, owned by the caller and kept across initChip8
+	trace_t *trace;			// Optional instruction trace, owned by the caller and kept across initChip8
+	debug_t *debug;			// Optional breakpoints and watchpoints, owned by the caller and kept across initChip8
+	audio_stream_t *audio;	// Optional tone change stream, owned by the caller and kept across initChip8
+
+	bool startup;
+
+	char *romName;			// Currently running rom filepath
+	uint32_t romSize;		// Bytes of rom loaded at ENTRY_POINT
+
+} chip8_t;
+
+
+#define ENTRY_POINT 0x200	// Roms loaded into 0x200
+
+void setDefaultConfig(config_t *config);
+bool initChip8(chip8_t *chip8, const config_t *config, char romName[]);
+bool initChip8Rom(chip8_t *chip8, const config_t *config, const uint8_t *rom, size_t romSize, char romName[]);
+bool parseEngine(const char *name, engine_t *engine);
+bool parseTurbo(const char *name, uint32_t *turbo);
+const char *engineName(engine_t engine);
+void emulateInstruction(chip8_t *chip8, const config_t *config);
+void emulateInstructions(chip8_t *chip8, const config_t *config, uint32_t count);
+void emulateFrame(chip8_t *chip8, const config_t *config, uint64_t frame);
+void updateTimers(chip8_t *chip8);
+uint64_t hashDisplay(const chip8_t *chip8);
+
+// Instructions to run in 60hz frame number frame, the fraction instPerSec / 60 drops is carried from frame
+// to frame so every 60 frames run exactly instPerSec (700 gives 11, 12, 12, 11, 12, 12, ...)
+static inline uint32_t frameInstructions(const config_t *config, uint64_t frame) {
+	return (uint32_t)((frame + 1) * config->instPerSec / 60 - frame * config->instPerSec / 60);
+}
+
+// SplitMix64 step, returns the next random byte for CXNN
+static inline uint8_t nextRandom(uint64_t *state) {
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return (z ^ (z >> 31)) & 0xFF;
+}
+
+// XO-CHIP F002, the pattern is read from memory at I
+static inline void setAudioPattern(chip8_t *chip8) {
+	for (uint32_t i = 0; i < 16; i++) chip8->audioPattern[i] = chip8->memory[(chip8->I + i) & 0xFFFF];
+	chip8->patternSet = true;
+}
+
+// Stores a byte without marking its page, for the register stores that mark the pages of the whole run at once
+static inline void writeMemoryUnmarked(chip8_t *chip8, uint16_t addr, uint8_t value) {
+	chip8->memory[addr] = value;
+	if (chip8->cache) invalidateDecodeCache(chip8->cache, addr);
+	if (chip8->jit) jitWriteHook(chip8->jit, addr);
+}
+
+// Marks the pages of the count bytes from addr, count is at most a page so that is the first and last byte's
+static inline void markPages(chip8_t *chip8, uint16_t addr, uint32_t count) {
+	chip8->dirtyPages[addr / MEMORY_PAGE] = 1;
+	chip8->dirtyPages[(uint16_t)(addr + count - 1) / MEMORY_PAGE] = 1;
+}
+
+// All stores to chip8 memory go through here so cached decodes and translated blocks of the written bytes are
+// dropped and the rewind history knows the page changed
+static inline void writeMemory(chip8_t *chip8, uint16_t addr, uint8_t value) {
+	writeMemoryUnmarked(chip8, addr, value);
+	chip8->dirtyPages[addr / MEMORY_PAGE] = 1;
+}
+
+// Skips the next instruction, which is 4 bytes long when it is XO-CHIP's F000 NNNN and the profile has it
+template <quirk_profile_t P>
+static inline void skipInstruction(chip8_t *chip8) {
+	const uint16_t pc = chip8->pc;
+	chip8->pc += quirkSets[P].xoChip && chip8->memory[pc] == 0xF0 && chip8->memory[(uint16_t)(pc + 1)] == 0x00 ? 4 : 2;
+}
+
+// 0x2NNN, pushes the return address and jumps to addr
+// With the stack full the machine halts on the call instead, pc stays on it like 00FD, so a runaway
+// recursion can't write past the stack into the rest of the machine
+static inline void callSubroutine(chip8_t *chip8, uint16_t addr) {
+	if (chip8->sp >= STACK_DEPTH) {
+		chip8->pc -= 2;
+		return;
+	}
+	chip8->stack[chip8->sp++] = chip8->pc;
+	chip8->pc = addr;
+}
+
+// 0x00EE, pops the return address, with the stack empty the machine halts on the return
+static inline void returnFromSubroutine(chip8_t *chip8) {
+	if (chip8->sp == 0 || chip8->sp > STACK_DEPTH) {
+		chip8->pc -= 2;
+		return;
+	}
+	chip8->pc = chip8->stack[--chip8->sp];
+}
+
+// XO-CHIP F000 NNNN, I = the word after the opcode, which pc points at
+static inline void loadLongI(chip8_t *chip8) {
+	chip8->I = (chip8->memory[chip8->pc] << 8) | chip8->memory[(uint16_t)(chip8->pc + 1)];
+	chip8->pc += 2;
+}
+
+// XO-CHIP 5XY2, stores VX to VY at I in either direction, I is left alone
+static inline void storeRange(chip8_t *chip8, uint8_t x, uint8_t y) {
+	const uint32_t count = (x <= y ? y - x : x - y) + 1;
+	for (uint32_t i = 0; i < count; i++) writeMemoryUnmarked(chip8, chip8->I + i, chip8->V[x <= y ? x + i : x - i]);
+	markPages(chip8, chip8->I, count);
+}
+
+// XO-CHIP 5XY3, loads VX to VY from I in either direction, I is left alone
+static inline void loadRange(chip8_t *chip8, uint8_t x, uint8_t y) {
+	const uint32_t count = (x <= y ? y - x : x - y) + 1;
+	for (uint32_t i = 0; i < count; i++) chip8->V[x <= y ? x + i : x - i] = chip8->memory[(uint16_t)(chip8->I + i)];
+}
+
+// 0xFX55, V0-VX to memory at I, I is left where the profile leaves it
+template <quirk_profile_t P>
+static inline void storeRegisters(chip8_t *chip8, uint8_t x) {
+	for (uint8_t i = 0; i <= x; i++) writeMemoryUnmarked(chip8, chip8->I + i, chip8->V[i]);
+	markPages(chip8, chip8->I, x + 1);
+	if constexpr (quirkSets[P].index == INDEX_PAST) chip8->I += x + 1;
+	else if constexpr (quirkSets[P].index == INDEX_LAST) chip8->I += x;
+}
+
+// 0xFX65, V0-VX from memory at I, I is left where the profile leaves it
+template <quirk_profile_t P>
+static inline void loadRegisters(chip8_t *chip8, uint8_t x) {
+	for (uint8_t i = 0; i <= x; i++) chip8->V[i] = chip8->memory[(uint16_t)(chip8->I + i)];
+	if constexpr (quirkSets[P].index == INDEX_PAST) chip8->I += x + 1;
+	else if constexpr (quirkSets[P].index == INDEX_LAST) chip8->I += x;
+}
+
+static inline uint32_t displayWidth(const chip8_t *chip8) {
+	return chip8->hires ? DISPLAY_WIDTH : LORES_WIDTH;
+}
+
+static inline uint32_t displayHeight(const chip8_t *chip8) {
+	return chip8->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+}
+
+// Color of the pixel at x,y, 0 is background and 1 the plain CHIP-8 foreground
+static inline uint8_t getPixel(const chip8_t *chip8, uint32_t x, uint32_t y) {
+	const uint32_t word = x >> 6;
+	const uint32_t shift = 63 - (x & 63);
+	return ((chip8->display[0][y][word] >> shift) & 1) | (((chip8->display[1][y][word] >> shift) & 1) << 1);
+}
+
+// 0x00E0, clears the selected planes, only rows that had pixels lit are marked dirty
+static inline void clearDisplay(chip8_t *chip8) {
+	const uint32_t height = displayHeight(chip8);
+	for (uint32_t p = 0; p < DISPLAY_PLANES; p++) {
+		if (!((chip8->planes >> p) & 1)) continue;
+		uint64_t lit = 0;
+		for (uint32_t y = 0; y < height; y++)
+			lit |= (uint64_t)((chip8->display[p][y][0] | chip8->display[p][y][1]) != 0) << y;
+		chip8->dirtyRows |= lit;
+		chip8->changedRows |= lit;
+		memset(chip8->display[p], 0, sizeof chip8->display[p]);
+	}
+}
+
+// 0xDXYN, XORs a sprite from I onto the selected planes at x,y, VF is set if any pixel was turned off
+// The sprite is N rows of 8 pixels, or 16 rows of 16 for N = 0 when Wide (SUPER-CHIP). With more than one plane
+// selected each plane's sprite follows the previous one's in memory (XO-CHIP). Each sprite row is shifted
+// into place across the two words of a row. Clipped, bits pushed past the right edge fall off the shift and
+// rows past the bottom edge are not drawn. Wrapped (XO-CHIP), they come back in on the other side
+template <bool Wrap, bool Wide>
+static inline void drawSprite(chip8_t *chip8, uint8_t x, uint8_t y, uint8_t n) {
+	const bool wide = Wide && n == 0;
+	const uint32_t rows = wide ? 16 : n;
+	const uint32_t height = displayHeight(chip8);
+	x %= displayWidth(chip8);
+	y %= height;
+	const uint32_t visible = Wrap || rows < height - y ? rows : height - y;
+
+	const uint32_t word = x >> 6;
+	const uint32_t shift = x & 63;
+	// Where the bits shifted out of word go: clipped, into word 1 if that is still on screen, wrapped, into
+	// the other word or round to the start of word 0 in lo-res
+	const uint32_t other = Wrap && !chip8->hires ? 0 : word ^ 1;
+	const uint64_t spill = Wrap || (chip8->hires && word == 0) ? ~0ull : 0;
+	uint64_t collision = 0;
+	uint16_t addr = chip8->I;
+	for (uint32_t p = 0; p < DISPLAY_PLANES; p++) {
+		if (!((chip8->planes >> p) & 1)) continue;
+		for (uint32_t i = 0; i < visible; i++) {
+			const uint64_t bits = wide ? ((uint64_t)chip8->memory[(uint16_t)(addr + 2 * i)] << 56) |
+										 ((uint64_t)chip8->memory[(uint16_t)(addr + 2 * i + 1)] << 48)
+									   : (uint64_t)chip8->memory[(uint16_t)(addr + i)] << 56;
+			const uint32_t rowY = Wrap ? (y + i) & (height - 1) : y + i;
+			uint64_t *row = chip8->display[p][rowY];
+			const uint64_t left = bits >> shift;
+			const uint64_t right = (bits << (63 - shift) << 1) & spill;
+			collision |= (row[word] & left) | (row[other] & right);
+			row[word] ^= left;
+			row[other] ^= right;
+			const uint64_t dirty = (uint64_t)((left | right) != 0) << rowY;
+			chip8->dirtyRows |= dirty;
+			chip8->changedRows |= dirty;
+		}
+		addr += wide ? 32 : rows;
+	}
+	chip8->V[0xF] = collision != 0;
+}
+
+#endif
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+
+// ROM corpus runner: runs every rom in a directory headless on all cores and checks the final
+// framebuffer against golden hashes from the directory's manifest
+// Usage: corpus romdir [-manifest FILE] [-j N] [-engine NAME] [-frames N] [-record]
+//
+// Manifest lines are "name | frames | keys | hash", empty fields take the defaults, # starts a comment
+// keys is a comma separated script of frame+key (press) and frame-key (release), key in hex, eg. 30+1,34-1
+// Roms in the directory without a manifest line run with the defaults and no golden hash
+
+
+#define MAX_KEY_EVENTS 64
+
+typedef struct {
+	uint32_t frame;			// Applied before this frame's instructions run
+	uint8_t key;
+	bool pressed;
+} key_event_t;
+
+typedef struct {
+	char name[256];			// File name inside the rom directory
+	char path[1024];
+	uint64_t frames;
+	key_event_t keys[MAX_KEY_EVENTS];
+	uint32_t keyCount;
+	char keyScript[512];	// As written in the manifest, echoed back by -record
+	bool hasGolden;
+	uint64_t golden;
+
+	// Filled in by the worker that ran it
+	bool loaded;
+	uint64_t instructions;
+	double seconds;
+	uint64_t hash;
+} rom_job_t;
+
+// One deque per worker, the owner pops from the back and idle workers steal from the front
+typedef struct {
+	std::mutex lock;
+	std::deque<size_t> jobs;
+} work_queue_t;
+
+
+static void printUsage(void) {
+	printf("Usage: corpus romdir [-manifest FILE] [-j N] [-engine NAME] [-frames N] [-record]\n"
+		   "  -manifest F  Per rom settings and golden hashes (default romdir/corpus.txt)\n"
+		   "  -j N         Worker threads (default all cores)\n"
+		   "  -engine N    Instruction engine: switch, cached, jit or threaded (default switch)\n"
+		   "  -frames N    Frames for roms the manifest gives no count (default 600)\n"
+		   "  -record      Print a manifest with the hashes from this run instead of the report\n");
+}
+
+static char *trim(char *s) {
+	while (*s == ' ' || *s == '\t') s++;
+	char *end = s + strlen(s);
+	while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) end--;
+	*end = '\0';
+	return s;
+}
+
+// "30+1,34-1" -> press key 1 on frame 30, release it on frame 34
+static bool parseKeyScript(const char *script, rom_job_t *job) {
+	const char *p = script;
+	job->keyCount = 0;
+	while (*p) {
+		char *end;
+		const unsigned long frame = strtoul(p, &end, 10);
+		if (end == p || (*end != '+' && *end != '-') || job->keyCount == MAX_KEY_EVENTS) return false;
+		const bool pressed = *end == '+';
+		p = end + 1;
+		const unsigned long key = strtoul(p, &end, 16);
+		if (end == p || key > 0xF) return false;
+		job->keys[job->keyCount++] = (key_event_t){.frame = (uint32_t)frame, .key = (uint8_t)key, .pressed = pressed};
+		p = end;
+		if (*p == ',') p++;
+		else if (*p) return false;
+	}
+	return true;
+}
+
+static rom_job_t *findJob(std::vector<rom_job_t> &jobs, const char *name) {
+	for (rom_job_t &job : jobs)
+		if (!strcmp(job.name, name)) return &job;
+	return NULL;
+}
+
+static bool loadManifest(const char *manifest, std::vector<rom_job_t> &jobs) {
+	FILE *f = fopen(manifest, "r");
+	if (!f) return true;	// No manifest, every rom runs with the defaults
+
+	char line[2048];
+	uint32_t lineNo = 0;
+	while (fgets(line, sizeof line, f)) {
+		lineNo++;
+		char *s = trim(line);
+		if (*s == '\0' || *s == '#') continue;
+
+		char *fields[4] = {s, (char *)"", (char *)"", (char *)""};
+		for (uint32_t i = 1; i < 4; i++) {
+			char *bar = strchr(fields[i - 1], '|');
+			if (!bar) break;
+			*bar = '\0';
+			fields[i] = bar + 1;
+		}
+		for (uint32_t i = 0; i < 4; i++) fields[i] = trim(fields[i]);
+
+		rom_job_t *job = findJob(jobs, fields[0]);
+		if (!job) {
+			fprintf(stderr, "%s:%u: %s is not in the rom directory, skipped\n", manifest, lineNo, fields[0]);
+			continue;
+		}
+		if (*fields[1]) job->frames = strtoull(fields[1], NULL, 10);
+		if (!parseKeyScript(fields[2], job)) {
+			fprintf(stderr, "%s:%u: bad key script \"%s\"\n", manifest, lineNo, fields[2]);
+			fclose(f);
+			return false;
+		}
+		snprintf(job->keyScript, sizeof job->keyScript, "%s", fields[2]);
+		if (*fields[3]) {
+			job->hasGolden = true;
+			job->golden = strtoull(fields[3], NULL, 16);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+// Run one rom for its frame count, applying its key script at frame boundaries
+static void runJob(rom_job_t *job, chip8_t *chip8, const config_t *config) {
+	if (!initChip8(chip8, config, job->path)) return;
+	job->loaded = true;
+
+	uint32_t nextKey = 0;
+	job->instructions = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+	for (uint64_t frame = 0; frame < job->frames; frame++) {
+		while (nextKey < job->keyCount && job->keys[nextKey].frame <= frame) {
+			chip8->keys[job->keys[nextKey].key] = job->keys[nextKey].pressed;
+			nextKey++;
+		}
+		// Idle loop skipping passes over part of the budget without running it, only what ran counts
+		const uint32_t budget = frameInstructions(config, frame);
+		const uint64_t idle = chip8->idleInstructions;
+		emulateInstructions(chip8, config, budget);
+		updateTimers(chip8);
+		job->instructions += budget - (chip8->idleInstructions - idle);
+	}
+	job->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	job->hash = hashDisplay(chip8);
+}
+
+static bool takeJob(std::vector<work_queue_t> &queues, size_t self, size_t *job) {
+	{
+		std::lock_guard<std::mutex> guard(queues[self].lock);
+		if (!queues[self].jobs.empty()) {
+			*job = queues[self].jobs.back();
+			queues[self].jobs.pop_back();
+			return true;
+		}
+	}
+	// Own queue is empty, steal the oldest job of the next worker that has one
+	for (size_t i = 1; i < queues.size(); i++) {
+		work_queue_t &victim = queues[(self + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.jobs.empty()) {
+			*job = victim.jobs.front();
+			victim.jobs.pop_front();
+			return true;
+		}
+	}
+	return false;	// Nothing left anywhere, no new jobs are ever added so the worker can exit
+}
+
+static void worker(std::vector<work_queue_t> *queues, size_t self, std::vector<rom_job_t> *jobs, const config_t *config) {
+	chip8_t *chip8 = (chip8_t *)calloc(1, sizeof(chip8_t));
+	decode_cache_t *cache = createDecodeCache();
+	if (!chip8 || !cache) {
+		fprintf(stderr, "Worker %zu could not allocate a machine\n", self);
+		free(chip8);
+		destroyDecodeCache(cache);
+		return;
+	}
+	chip8->cache = cache;
+	if (config->engine == ENGINE_JIT) chip8->jit = createJit();
+
+	size_t job;
+	while (takeJob(*queues, self, &job))
+		runJob(&(*jobs)[job], chip8, config);
+
+	destroyJit(chip8->jit);
+	destroyDecodeCache(cache);
+	free(chip8);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printUsage();
+		return 1;
+	}
+
+	config_t config;
+	setDefaultConfig(&config);
+
+	const char *romDir = argv[1];
+	char manifest[1024];
+	snprintf(manifest, sizeof manifest, "%s/corpus.txt", romDir);
+	uint32_t threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+	uint64_t defaultFrames = 600;
+	bool record = false;
+
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "-manifest") && i + 1 < argc) snprintf(manifest, sizeof manifest, "%s", argv[++i]);
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc) threads = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-engine") && i + 1 < argc && parseEngine(argv[i + 1], &config.engine)) i++;
+		else if (!strcmp(argv[i], "-frames") && i + 1 < argc) defaultFrames = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-record")) record = true;
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	if (threads == 0) threads = 1;
+
+	// Every .ch8 in the directory is a job
+	std::vector<rom_job_t> jobs;
+	std::error_code error;
+	for (const auto &entry : std::filesystem::directory_iterator(romDir, error)) {
+		if (!entry.is_regular_file() || entry.path().extension() != ".ch8") continue;
+		rom_job_t job = {};
+		snprintf(job.name, sizeof job.name, "%s", entry.path().filename().string().c_str());
+		snprintf(job.path, sizeof job.path, "%s", entry.path().string().c_str());
+		job.frames = defaultFrames;
+		jobs.push_back(job);
+	}
+	if (error) {
+		fprintf(stderr, "Could not read rom directory %s: %s\n", romDir, error.message().c_str());
+		return 1;
+	}
+	if (!loadManifest(manifest, jobs)) return 1;
+
+	// Longest roms are dealt out first so they do not end up as the tail of the run
+	std::vector<size_t> order(jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++) order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return jobs[a].frames != jobs[b].frames ? jobs[a].frames > jobs[b].frames : strcmp(jobs[a].name, jobs[b].name) < 0;
+	});
+
+	if (threads > jobs.size() && !jobs.empty()) threads = jobs.size();
+	std::vector<work_queue_t> queues(threads);
+	for (size_t i = 0; i < order.size(); i++)
+		queues[i % threads].jobs.push_front(order[i]);	// Owners pop from the back, so each starts on its longest
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (uint32_t t = 0; t < threads; t++)
+		pool.emplace_back(worker, &queues, t, &jobs, &config);
+	for (std::thread &thread : pool) thread.join();
+	const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::sort(jobs.begin(), jobs.end(), [](const rom_job_t &a, const rom_job_t &b) { return strcmp(a.name, b.name) < 0; });
+
+	if (record) {
+		printf("# name | frames | keys | hash\n");
+		for (const rom_job_t &job : jobs) {
+			if (job.loaded) printf("%s | %llu | %s | %016llx\n", job.name, (unsigned long long)job.frames, job.keyScript, (unsigned long long)job.hash);
+			else printf("%s | %llu | %s |\n", job.name, (unsigned long long)job.frames, job.keyScript);
+		}
+		return 0;
+	}
+
+	uint32_t passed = 0, failed = 0, unchecked = 0, errors = 0;
+	uint64_t totalInstructions = 0;
+	printf("%-40s %8s %12s %10s %-16s  %s\n", "rom", "frames", "insts", "MIPS", "hash", "result");
+	for (const rom_job_t &job : jobs) {
+		const char *result;
+		if (!job.loaded) {
+			result = "ERROR";
+			errors++;
+		} else if (!job.hasGolden) {
+			result = "no golden";
+			unchecked++;
+		} else if (job.hash == job.golden) {
+			result = "pass";
+			passed++;
+		} else {
+			result = "FAIL";
+			failed++;
+		}
+		totalInstructions += job.instructions;
+		printf("%-40.40s %8llu %12llu %10.2f %016llx  %s\n", job.name, (unsigned long long)job.frames,
+			(unsigned long long)job.instructions, job.seconds > 0 ? job.instructions / job.seconds / 1e6 : 0.0,
+			(unsigned long long)job.hash, result);
+	}
+	printf("%zu roms: %u passed, %u failed, %u without golden hash, %u not loaded\n", jobs.size(), passed, failed, unchecked, errors);
+	printf("%u threads, %.3f s wall, %.2f MIPS combined\n", threads, wall, wall > 0 ? totalInstructions / wall / 1e6 : 0.0);
+	return failed || errors ? 1 : 0;
+}
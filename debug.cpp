@@ -0,0 +1,117 @@
+#include <string.h>
+#include "chip8.h"
+#include "debug.h"
+
+
+void setBreakpoint(debug_t *debug, uint16_t addr, bool set) {
+	if (set) debug->breakpoints[addr >> 6] |= 1ull << (addr & 63);
+	else debug->breakpoints[addr >> 6] &= ~(1ull << (addr & 63));
+}
+
+
+// Watches length bytes from addr for reads, writes or both, wrapping at the end of memory
+// Bits are shared, clearing a range clears it for any other watchpoint that overlaps it
+void setWatchpoint(debug_t *debug, uint16_t addr, uint32_t length, bool read, bool write, bool set) {
+	for (uint32_t i = 0; i < length && i < 65536; i++) {
+		const uint16_t a = addr + i;
+		const uint64_t bit = 1ull << (a & 63);
+		if (read) debug->readWatch[a >> 6] = set ? debug->readWatch[a >> 6] | bit : debug->readWatch[a >> 6] & ~bit;
+		if (write) debug->writeWatch[a >> 6] = set ? debug->writeWatch[a >> 6] | bit : debug->writeWatch[a >> 6] & ~bit;
+	}
+	uint64_t any = 0;
+	for (uint32_t w = 0; w < DEBUG_WORDS; w++) any |= debug->readWatch[w] | debug->writeWatch[w];
+	debug->watching = any != 0;
+}
+
+
+// Bytes from I the instruction at pc reads or writes, 0 if it doesn't touch memory through I
+// F000 NNNN reads its operand as part of the instruction, that is a fetch rather than a data read
+static uint32_t memoryAccess(const chip8_t *chip8, uint16_t opcode, bool *write) {
+	const uint8_t X = (opcode >> 8) & 0x0F;
+	const uint8_t Y = (opcode >> 4) & 0x0F;
+	const uint8_t N = opcode & 0x0F;
+	const uint8_t NN = opcode & 0xFF;
+	*write = false;
+	switch (opcode >> 12) {
+		case 0x5:
+			if (N != 2 && N != 3) return 0;
+			*write = N == 2;
+			return (X <= Y ? Y - X : X - Y) + 1;
+		case 0xD: {
+			// Each selected plane's sprite follows the previous one's
+			const uint32_t planes = (chip8->planes & 1) + ((chip8->planes >> 1) & 1);
+			return (N ? N : 32) * planes;
+		}
+		case 0xF:
+			if (opcode == 0xF002) return 16;
+			if (NN == 0x33) {
+				*write = true;
+				return 3;
+			}
+			if (NN == 0x55 || NN == 0x65) {
+				*write = NN == 0x55;
+				return X + 1;
+			}
+			return 0;
+		default:
+			return 0;
+	}
+}
+
+
+// Runs the instruction at pc, then pauses the machine if it touched a watched byte
+static void runWatched(debug_t *debug, chip8_t *chip8, const config_t *config) {
+	const uint16_t pc = chip8->pc;
+	bool write;
+	const uint32_t length = memoryAccess(chip8, (chip8->memory[pc] << 8) | chip8->memory[(uint16_t)(pc + 1)], &write);
+	const uint16_t I = chip8->I;	// FX55/FX65 can move it
+	emulateInstruction(chip8, config);
+
+	const uint64_t *watch = write ? debug->writeWatch : debug->readWatch;
+	for (uint32_t i = 0; i < length; i++) {
+		const uint16_t addr = I + i;
+		if (!testAddress(watch, addr)) continue;
+		const bool both = testAddress(debug->readWatch, addr) && testAddress(debug->writeWatch, addr);
+		haltDebug(debug, chip8, both ? STOP_WATCH_ACCESS : write ? STOP_WATCH_WRITE : STOP_WATCH_READ, addr);
+		return;
+	}
+}
+
+
+// Runs up to count instructions on the reference interpreter, stopping at the first breakpoint or watchpoint hit
+void debugInstructions(debug_t *debug, chip8_t *chip8, const config_t *config, uint32_t count) {
+	for (uint32_t i = 0; i < count && chip8->state != PAUSE; i++) {
+		if (testAddress(debug->breakpoints, chip8->pc) && !debug->resuming) {
+			haltDebug(debug, chip8, STOP_BREAK, chip8->pc);
+			return;
+		}
+		debug->resuming = false;
+		if (debug->watching) runWatched(debug, chip8, config);
+		else emulateInstruction(chip8, config);
+	}
+}
+
+
+// Runs the one instruction at pc of a stopped machine, breakpoints don't apply but watchpoints do
+// The interpreter doesn't run a paused machine, so it runs for the one instruction and then stops again
+void stepDebug(debug_t *debug, chip8_t *chip8, const config_t *config) {
+	chip8->state = RUNNING;
+	debug->stop = STOP_NONE;
+	runWatched(debug, chip8, config);
+	if (debug->stop == STOP_NONE) haltDebug(debug, chip8, STOP_STEP, chip8->pc);
+}
+
+
+void haltDebug(debug_t *debug, chip8_t *chip8, stop_reason_t reason, uint16_t addr) {
+	chip8->state = PAUSE;
+	debug->stop = reason;
+	debug->stopAddress = addr;
+}
+
+
+// Lets a stopped machine run again from pc, stepping off a breakpoint there first
+void resumeDebug(debug_t *debug, chip8_t *chip8) {
+	chip8->state = RUNNING;
+	debug->stop = STOP_NONE;
+	debug->resuming = true;
+}
@@ -0,0 +1,50 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct chip8_t;
+struct config_t;
+
+// Breakpoints and watchpoints, attached to a machine like the tracer
+// Each is one bit per byte of the 64K address space. While a debugger is attached every instruction runs
+// through the reference interpreter, the fetch tests the breakpoint bit for pc and, only while some watch
+// bit is set, an instruction that reads or writes through I tests the bits of the bytes it touches. A hit
+// pauses the machine, which stays paused until the debugger resumes it.
+
+#define DEBUG_WORDS (65536 / 64)	// uint64_t per bitmap
+
+// Why the machine last stopped
+typedef enum {
+	STOP_NONE,			// Running
+	STOP_STEP,			// Single step finished
+	STOP_BREAK,			// pc reached a breakpoint, the instruction there hasn't run
+	STOP_INTERRUPT,		// The debugger asked it to stop
+	STOP_WATCH_READ,	// An instruction read a watched byte, it has run
+	STOP_WATCH_WRITE,
+	STOP_WATCH_ACCESS,	// Read or wrote a byte watched both ways
+} stop_reason_t;
+
+typedef struct debug_t {
+	uint64_t breakpoints[DEBUG_WORDS];
+	uint64_t readWatch[DEBUG_WORDS];
+	uint64_t writeWatch[DEBUG_WORDS];
+	bool watching;			// Any watch bit set
+	bool resuming;			// The next instruction runs even if it is on a breakpoint, to step off one
+	stop_reason_t stop;
+	uint16_t stopAddress;	// Breakpoint or first watched byte hit
+} debug_t;
+
+void setBreakpoint(debug_t *debug, uint16_t addr, bool set);
+void setWatchpoint(debug_t *debug, uint16_t addr, uint32_t length, bool read, bool write, bool set);
+void debugInstructions(debug_t *debug, struct chip8_t *chip8, const struct config_t *config, uint32_t count);
+void stepDebug(debug_t *debug, struct chip8_t *chip8, const struct config_t *config);
+void haltDebug(debug_t *debug, struct chip8_t *chip8, stop_reason_t reason, uint16_t addr);
+void resumeDebug(debug_t *debug, struct chip8_t *chip8);
+
+static inline bool testAddress(const uint64_t *bitmap, uint16_t addr) {
+	return (bitmap[addr >> 6] >> (addr & 63)) & 1;
+}
+
+#endif
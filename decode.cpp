@@ -0,0 +1,459 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+// Predecoded "fast" interpreter
+// Each address is decoded the first time it runs into a handler plus operands, after that executing
+// it is a single indirect call. Handlers mirror the cases in emulateInstruction exactly, the ones for
+// instructions the quirk profiles disagree on are templates and decoding picks the profile's instantiation.
+
+
+static void opNop(chip8_t *, const config_t *, const decoded_t *) {
+	// Unimplemented /invalid opcode
+}
+
+static void opCLS(chip8_t *chip8, const config_t *, const decoded_t *) {
+	// 0x00E0: clear screen
+	clearDisplay(chip8);
+}
+
+static void opRET(chip8_t *chip8, const config_t *, const decoded_t *) {
+	// 0x00EE: Return from subroutine
+	returnFromSubroutine(chip8);
+}
+
+static void opSCD(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x00CN: SUPER-CHIP, scroll down N pixels
+	scrollDown(chip8, op->N);
+}
+
+static void opSCU(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x00DN: XO-CHIP, scroll up N pixels
+	scrollUp(chip8, op->N);
+}
+
+static void opSCR(chip8_t *chip8, const config_t *, const decoded_t *) {
+	// 0x00FB: SUPER-CHIP, scroll right 4 pixels
+	scrollRight(chip8);
+}
+
+static void opSCL(chip8_t *chip8, const config_t *, const decoded_t *) {
+	// 0x00FC: SUPER-CHIP, scroll left 4 pixels
+	scrollLeft(chip8);
+}
+
+static void opEXIT(chip8_t *chip8, const config_t *, const decoded_t *) {
+	// 0x00FD: SUPER-CHIP, exit. The machine stays on this instruction
+	chip8->pc -= 2;
+}
+
+static void opLOW(chip8_t *chip8, const config_t *, const decoded_t *) {
+	// 0x00FE: SUPER-CHIP, lo-res 64x32
+	setResolution(chip8, false);
+}
+
+static void opHIGH(chip8_t *chip8, const config_t *, const decoded_t *) {
+	// 0x00FF: SUPER-CHIP, hi-res 128x64
+	setResolution(chip8, true);
+}
+
+static void opJP(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x1NNN jump to adress NNN
+	chip8->pc = op->NNN;
+}
+
+static void opCALL(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x2NNN: call subroutine at NNN
+	callSubroutine(chip8, op->NNN);
+}
+
+template <quirk_profile_t P>
+static void opSEImm(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x3XNN: check if VX == NN, if so, skip next inst
+	if (chip8->V[op->X] == op->NN) skipInstruction<P>(chip8);
+}
+
+template <quirk_profile_t P>
+static void opSNEImm(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x4XNN: check if VX != NN, if so, skip next inst
+	if (chip8->V[op->X] != op->NN) skipInstruction<P>(chip8);
+}
+
+template <quirk_profile_t P>
+static void opSEReg(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x5XY0: check if VX == VY, skip next inst if so
+	if (chip8->V[op->X] == chip8->V[op->Y]) skipInstruction<P>(chip8);
+}
+
+static void opSTRange(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x5XY2: XO-CHIP, store VX to VY at I
+	storeRange(chip8, op->X, op->Y);
+}
+
+static void opLDRange(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x5XY3: XO-CHIP, load VX to VY from I
+	loadRange(chip8, op->X, op->Y);
+}
+
+static void opLDImm(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x6XNN: Set register VX to NN
+	chip8->V[op->X] = op->NN;
+}
+
+static void opADDImm(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x7XNN: Set register VX += NN
+	chip8->V[op->X] += op->NN;
+}
+
+static void opLDReg(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x8XY0: Set register VX = VY
+	chip8->V[op->X] = chip8->V[op->Y];
+}
+
+template <quirk_profile_t P>
+static void opOR(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x8XY1: Set register VX |= VY
+	chip8->V[op->X] |= chip8->V[op->Y];
+	if constexpr (quirkSets[P].vfReset) chip8->V[0xF] = 0;
+}
+
+template <quirk_profile_t P>
+static void opAND(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x8XY2: Set register VX &= VY
+	chip8->V[op->X] &= chip8->V[op->Y];
+	if constexpr (quirkSets[P].vfReset) chip8->V[0xF] = 0;
+}
+
+template <quirk_profile_t P>
+static void opXOR(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x8XY3: Set register VX ^= VY
+	chip8->V[op->X] ^= chip8->V[op->Y];
+	if constexpr (quirkSets[P].vfReset) chip8->V[0xF] = 0;
+}
+
+static void opADDReg(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x8XY4: Set register VX += VY, set VF to 1 if carry
+	const bool carry = ((uint16_t)(chip8->V[op->X] + chip8->V[op->Y]) > 255);
+	chip8->V[op->X] += chip8->V[op->Y];
+	chip8->V[0xF] = carry;
+}
+
+static void opSUB(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow
+	const bool carry = chip8->V[op->X] >= chip8->V[op->Y];
+	chip8->V[op->X] -= chip8->V[op->Y];
+	chip8->V[0xF] = carry;
+}
+
+template <quirk_profile_t P>
+static void opSHR(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x8XY6: Set register VX = VY >> 1 (VX >> 1 without shiftVY), Store shifted off bit in VF
+	const uint8_t source = chip8->V[quirkSets[P].shiftVY ? op->Y : op->X];
+	const bool carry = source & 1;
+	chip8->V[op->X] = source >> 1;
+	chip8->V[0xF] = carry;
+}
+
+static void opSUBN(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow
+	const bool carry = chip8->V[op->X] <= chip8->V[op->Y];
+	chip8->V[op->X] = chip8->V[op->Y] - chip8->V[op->X];
+	chip8->V[0xF] = carry;
+}
+
+template <quirk_profile_t P>
+static void opSHL(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x8XYE: Set register VX = VY << 1 (VX << 1 without shiftVY), Store shifted off bit in VF
+	const uint8_t source = chip8->V[quirkSets[P].shiftVY ? op->Y : op->X];
+	const bool carry = (source & 0x80) >> 7;
+	chip8->V[op->X] = source << 1;
+	chip8->V[0xF] = carry;
+}
+
+template <quirk_profile_t P>
+static void opSNEReg(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0x9XY0: Check if VX != VY; skip next inst if so
+	if (chip8->V[op->X] != chip8->V[op->Y]) skipInstruction<P>(chip8);
+}
+
+static void opLDI(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xANNN: Set index register I to NNN
+	chip8->I = op->NNN;
+}
+
+template <quirk_profile_t P>
+static void opJPV0(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xBNNN: Jump to V0 + NNN, or BXNN: VX + XNN with jumpVX
+	chip8->pc = chip8->V[quirkSets[P].jumpVX ? op->X : 0] + op->NNN;
+}
+
+static void opRND(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xCXNN: Sets VX = rand() & NN
+	chip8->V[op->X] = nextRandom(&chip8->rngState) & op->NN;
+}
+
+template <quirk_profile_t P>
+static void opDRW(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xDXYN, draws N height sprite at coord X,Y, read from mem location I
+	drawSprite<quirkSets[P].wrap, quirkSets[P].superChip>(chip8, chip8->V[op->X], chip8->V[op->Y], op->N);
+}
+
+template <quirk_profile_t P>
+static void opSKP(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xEX9E: Skip next inst if key in VX is pressed, only the low nibble of VX picks the key
+	if (chip8->keys[chip8->V[op->X] & 0xF]) skipInstruction<P>(chip8);
+}
+
+template <quirk_profile_t P>
+static void opSKNP(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xEXA1: Skip next inst if key in VX is not pressed
+	if (!chip8->keys[chip8->V[op->X] & 0xF]) skipInstruction<P>(chip8);
+}
+
+static void opLDVxDT(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX07: VX = Delay timer
+	chip8->V[op->X] = chip8->delay_timer;
+}
+
+static void opLDKey(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX0A: VX = get_key(); Await until a keypress and its release, and store in VX
+	for (uint8_t i = 0; chip8->waitKey == 0xFF && i < sizeof chip8->keys; i++)
+		if (chip8->keys[i]) {
+			chip8->waitKey = i;
+			chip8->waitKeyPressed = true;
+			break;
+		}
+
+	if (!chip8->waitKeyPressed || chip8->keys[chip8->waitKey]) {
+		chip8->pc -= 2;	// Keep re-running this instruction
+	} else {
+		chip8->V[op->X] = chip8->waitKey;
+		chip8->waitKey = 0xFF;
+		chip8->waitKeyPressed = false;
+	}
+}
+
+static void opLDDTVx(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX15: Delay timer = VX
+	chip8->delay_timer = chip8->V[op->X];
+}
+
+static void opLDSTVx(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX18: sound timer = VX
+	chip8->sound_timer = chip8->V[op->X];
+}
+
+static void opLDAudio(chip8_t *chip8, const config_t *, const decoded_t *) {
+	// 0xF002: XO-CHIP, load the audio pattern from memory at I
+	setAudioPattern(chip8);
+}
+
+static void opLDPitch(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX3A: XO-CHIP, pattern playback pitch = VX
+	chip8->pitch = chip8->V[op->X];
+}
+
+static void opLDILong(chip8_t *chip8, const config_t *, const decoded_t *) {
+	// 0xF000 NNNN: XO-CHIP, I = NNNN, read from memory each time so it can be patched
+	loadLongI(chip8);
+}
+
+static void opPLANE(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFN01: XO-CHIP, select the planes drawing acts on
+	chip8->planes = op->X & 3;
+}
+
+static void opADDI(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX1E: I += VX; does not affect VF
+	chip8->I += chip8->V[op->X];
+}
+
+static void opLDF(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX29: Set register I to sprite location in memory for char in VX
+	chip8->I = chip8->V[op->X] * 5;
+}
+
+static void opLDHF(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX30: SUPER-CHIP, I = 10 byte sprite for the digit in VX
+	chip8->I = HIRES_FONT + chip8->V[op->X] * 10;
+}
+
+static void opBCD(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX33: Store BCD representation at memory offset from I
+	uint8_t bcd = chip8->V[op->X];
+	writeMemory(chip8, chip8->I+2, bcd % 10);
+	bcd /= 10;
+	writeMemory(chip8, chip8->I+1, bcd % 10);
+	bcd /= 10;
+	writeMemory(chip8, chip8->I, bcd);
+}
+
+template <quirk_profile_t P>
+static void opSTORE(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX55: Register dump V0-VX inclusive to memory offset from I, CHIP8 increments I
+	storeRegisters<P>(chip8, op->X);
+}
+
+template <quirk_profile_t P>
+static void opLOAD(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX65: Register load V0-VX inclusive from memory offset from I, CHIP8 increments I
+	loadRegisters<P>(chip8, op->X);
+}
+
+static void opSTFlags(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX75: SUPER-CHIP, save V0-VX to the user flags
+	memcpy(chip8->flags, chip8->V, op->X + 1);
+}
+
+static void opLDFlags(chip8_t *chip8, const config_t *, const decoded_t *op) {
+	// 0xFX85: SUPER-CHIP, load V0-VX from the user flags
+	memcpy(chip8->V, chip8->flags, op->X + 1);
+}
+
+
+// Pick the handler for an opcode, same decode tree as emulateInstruction
+template <quirk_profile_t P>
+static op_handler_t selectHandler(uint16_t opcode) {
+	const uint8_t N = opcode & 0x0F;
+	const uint8_t NN = opcode & 0xFF;
+	constexpr quirk_set_t quirks = quirkSets[P];
+
+	switch ((opcode >> 12) & 0x0F) {
+		case 0x00:
+			if (NN == 0xE0) return opCLS;
+			if (NN == 0xEE) return opRET;
+			if (quirks.xoChip && (opcode & 0xFFF0) == 0x00D0) return opSCU;
+			if (!quirks.superChip) return opNop;
+			if ((opcode & 0xFFF0) == 0x00C0) return opSCD;
+			if (opcode == 0x00FB) return opSCR;
+			if (opcode == 0x00FC) return opSCL;
+			if (opcode == 0x00FD) return opEXIT;
+			if (opcode == 0x00FE) return opLOW;
+			if (opcode == 0x00FF) return opHIGH;
+			return opNop;
+		case 0x01: return opJP;
+		case 0x02: return opCALL;
+		case 0x03: return opSEImm<P>;
+		case 0x04: return opSNEImm<P>;
+		case 0x05:
+			if (N == 0) return opSEReg<P>;
+			if (!quirks.xoChip) return opNop;
+			return N == 2 ? opSTRange : N == 3 ? opLDRange : opNop;
+		case 0x06: return opLDImm;
+		case 0x07: return opADDImm;
+		case 0x08:
+			switch (N) {
+				case 0x0: return opLDReg;
+				case 0x1: return opOR<P>;
+				case 0x2: return opAND<P>;
+				case 0x3: return opXOR<P>;
+				case 0x4: return opADDReg;
+				case 0x5: return opSUB;
+				case 0x6: return opSHR<P>;
+				case 0x7: return opSUBN;
+				case 0xE: return opSHL<P>;
+				default: return opNop;
+			}
+		case 0x09: return opSNEReg<P>;
+		case 0x0A: return opLDI;
+		case 0x0B: return opJPV0<P>;
+		case 0x0C: return opRND;
+		case 0x0D: return opDRW<P>;
+		case 0x0E:
+			if (NN == 0x9E) return opSKP<P>;
+			if (NN == 0xA1) return opSKNP<P>;
+			return opNop;
+		case 0x0F:
+			switch (NN) {
+				case 0x00: return quirks.xoChip && opcode == 0xF000 ? opLDILong : opNop;
+				case 0x01: return quirks.xoChip ? opPLANE : opNop;
+				case 0x07: return opLDVxDT;
+				case 0x0A: return opLDKey;
+				case 0x15: return opLDDTVx;
+				case 0x18: return opLDSTVx;
+				case 0x02: return quirks.xoChip && opcode == 0xF002 ? opLDAudio : opNop;
+				case 0x3A: return quirks.xoChip ? opLDPitch : opNop;
+				case 0x1E: return opADDI;
+				case 0x29: return opLDF;
+				case 0x30: return quirks.superChip ? opLDHF : opNop;
+				case 0x33: return opBCD;
+				case 0x55: return opSTORE<P>;
+				case 0x65: return opLOAD<P>;
+				case 0x75: return quirks.superChip ? opSTFlags : opNop;
+				case 0x85: return quirks.superChip ? opLDFlags : opNop;
+				default: return opNop;
+			}
+	}
+	return opNop;
+}
+
+
+// Indexed by quirk_profile_t
+static op_handler_t (*const selectors[QUIRKS_COUNT])(uint16_t) = {
+	selectHandler<QUIRKS_VIP>, selectHandler<QUIRKS_CHIP48>, selectHandler<QUIRKS_SCHIP>, selectHandler<QUIRKS_XOCHIP>,
+};
+
+
+// Split an opcode into its handler for the quirk profile and operands
+void decodeInstruction(uint16_t opcode, quirk_profile_t quirks, decoded_t *op) {
+	op->NNN = opcode & 0x0FFF;
+	op->NN = opcode & 0x0FF;
+	op->N = opcode & 0x0F;
+	op->X = (opcode >> 8) & 0x0F;
+	op->Y = (opcode >> 4) & 0x0F;
+	op->fn = selectors[quirks](opcode);
+}
+
+
+static void decodeAt(decode_cache_t *cache, const chip8_t *chip8, uint16_t addr) {
+	const uint16_t opcode = (chip8->memory[addr] << 8) | chip8->memory[(uint16_t)(addr + 1)];
+	decodeInstruction(opcode, cache->quirks, &cache->ops[addr]);
+	cache->ops[addr].generation = cache->generation;
+	cache->decodes++;
+}
+
+
+// The cache is about 1 MB, too big for the stack of a MinGW main thread
+decode_cache_t *createDecodeCache(void) {
+	decode_cache_t *cache = (decode_cache_t *)calloc(1, sizeof(decode_cache_t));
+	if (cache) cache->generation = 1;
+	return cache;
+}
+
+
+void destroyDecodeCache(decode_cache_t *cache) {
+	free(cache);
+}
+
+
+// Empties the cache, it stays on the same profile
+// Resets, loads and rewinds flush often, so this only moves to the next generation and every older
+// entry reads as empty. The entries are only cleared when the counter wraps.
+void flushDecodeCache(decode_cache_t *cache) {
+	cache->decodes = 0;
+	if (++cache->generation == 0) {
+		memset(cache->ops, 0, sizeof cache->ops);
+		cache->generation = 1;
+	}
+}
+
+
+void emulateInstructionsCached(chip8_t *chip8, const config_t *config, uint32_t count) {
+	// Only input handling can pause the machine, so checking once per burst is enough
+	if (chip8->state == PAUSE) return;
+
+	// Decoded handlers are specific to a profile, switching profiles starts over
+	decode_cache_t *cache = chip8->cache;
+	if (cache->quirks != config->quirks) {
+		flushDecodeCache(cache);
+		cache->quirks = config->quirks;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		const uint16_t addr = chip8->pc;
+		if (!cache->ops[addr].fn || cache->ops[addr].generation != cache->generation) decodeAt(cache, chip8, addr);
+
+		const decoded_t *op = &cache->ops[addr];
+		chip8->pc += 2;
+		op->fn(chip8, config, op);
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+#include "quirks.h"
+
+struct chip8_t;
+struct config_t;
+struct decoded_t;
+
+typedef void (*op_handler_t)(struct chip8_t *chip8, const struct config_t *config, const struct decoded_t *op);
+
+// One predecoded instruction: the handler to run and its operands already split out
+typedef struct decoded_t {
+	op_handler_t fn;	// NULL until the address is first executed or after a write invalidates it
+	uint16_t NNN;		// 12 bit constant
+	uint8_t NN;			// 8 bit constant
+	uint8_t N;			// 4 bit constant
+	uint8_t X;			// 4 bit register identifier
+	uint8_t Y;			// 4 bit register identifier
+	uint16_t generation;	// Cache generation the entry was decoded in, older entries are stale
+} decoded_t;
+
+// Predecoded copy of memory, one entry per byte address since code can start on odd addresses
+typedef struct decode_cache_t {
+	decoded_t ops[65536];
+	uint64_t decodes;	// Number of entries (re)built, useful to spot self modifying roms
+	quirk_profile_t quirks;	// Profile the handlers in ops were picked for
+	uint16_t generation;	// Bumped by a flush instead of clearing all of ops, never 0
+} decode_cache_t;
+
+void decodeInstruction(uint16_t opcode, quirk_profile_t quirks, decoded_t *op);
+decode_cache_t *createDecodeCache(void);
+void destroyDecodeCache(decode_cache_t *cache);
+void flushDecodeCache(decode_cache_t *cache);
+void emulateInstructionsCached(struct chip8_t *chip8, const struct config_t *config, uint32_t count);
+
+// A write to addr changes the instruction starting at addr and the one starting the byte before it
+static inline void invalidateDecodeCache(decode_cache_t *cache, uint16_t addr) {
+	cache->ops[addr].fn = 0;
+	cache->ops[(uint16_t)(addr - 1)].fn = 0;
+}
+
+#endif
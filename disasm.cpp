@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include "disasm.h"
+
+
+bool disassemble(uint16_t opcode, char *out, size_t size) {
+	const uint16_t NNN = opcode & 0x0FFF;
+	const uint8_t NN = opcode & 0xFF;
+	const uint8_t N = opcode & 0x0F;
+	const uint8_t X = (opcode >> 8) & 0x0F;
+	const uint8_t Y = (opcode >> 4) & 0x0F;
+
+	switch (opcode >> 12) {
+		case 0x0:
+			if (opcode == 0x00E0) snprintf(out, size, "CLS");
+			else if (opcode == 0x00EE) snprintf(out, size, "RET");
+			else if ((opcode & 0xFFF0) == 0x00C0) snprintf(out, size, "SCD %u", N);
+			else if ((opcode & 0xFFF0) == 0x00D0) snprintf(out, size, "SCU %u", N);
+			else if (opcode == 0x00FB) snprintf(out, size, "SCR");
+			else if (opcode == 0x00FC) snprintf(out, size, "SCL");
+			else if (opcode == 0x00FD) snprintf(out, size, "EXIT");
+			else if (opcode == 0x00FE) snprintf(out, size, "LOW");
+			else if (opcode == 0x00FF) snprintf(out, size, "HIGH");
+			else snprintf(out, size, "SYS 0x%03X", NNN);
+			return true;
+		case 0x1: snprintf(out, size, "JP 0x%03X", NNN); return true;
+		case 0x2: snprintf(out, size, "CALL 0x%03X", NNN); return true;
+		case 0x3: snprintf(out, size, "SE V%X, 0x%02X", X, NN); return true;
+		case 0x4: snprintf(out, size, "SNE V%X, 0x%02X", X, NN); return true;
+		case 0x5:
+			if (N == 0) snprintf(out, size, "SE V%X, V%X", X, Y);
+			else if (N == 2) snprintf(out, size, "LD [I], V%X-V%X", X, Y);
+			else if (N == 3) snprintf(out, size, "LD V%X-V%X, [I]", X, Y);
+			else break;
+			return true;
+		case 0x6: snprintf(out, size, "LD V%X, 0x%02X", X, NN); return true;
+		case 0x7: snprintf(out, size, "ADD V%X, 0x%02X", X, NN); return true;
+		case 0x8: {
+			static const char *const alu[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+												 NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL };
+			if (!alu[N]) break;
+			snprintf(out, size, "%s V%X, V%X", alu[N], X, Y);
+			return true;
+		}
+		case 0x9:
+			if (N != 0) break;
+			snprintf(out, size, "SNE V%X, V%X", X, Y);
+			return true;
+		case 0xA: snprintf(out, size, "LD I, 0x%03X", NNN); return true;
+		case 0xB: snprintf(out, size, "JP V0, 0x%03X", NNN); return true;
+		case 0xC: snprintf(out, size, "RND V%X, 0x%02X", X, NN); return true;
+		case 0xD: snprintf(out, size, "DRW V%X, V%X, %u", X, Y, N); return true;
+		case 0xE:
+			if (NN == 0x9E) snprintf(out, size, "SKP V%X", X);
+			else if (NN == 0xA1) snprintf(out, size, "SKNP V%X", X);
+			else break;
+			return true;
+		case 0xF:
+			switch (NN) {
+				case 0x00:
+					if (X) break;
+					snprintf(out, size, "LD I, long");	// The address is the next word
+					return true;
+				case 0x01: snprintf(out, size, "PLANE %u", X & 3); return true;
+				case 0x07: snprintf(out, size, "LD V%X, DT", X); return true;
+				case 0x0A: snprintf(out, size, "LD V%X, K", X); return true;
+				case 0x15: snprintf(out, size, "LD DT, V%X", X); return true;
+				case 0x18: snprintf(out, size, "LD ST, V%X", X); return true;
+				case 0x02:
+					if (X) break;
+					snprintf(out, size, "AUDIO [I]");
+					return true;
+				case 0x3A: snprintf(out, size, "PITCH V%X", X); return true;
+				case 0x1E: snprintf(out, size, "ADD I, V%X", X); return true;
+				case 0x29: snprintf(out, size, "LD F, V%X", X); return true;
+				case 0x30: snprintf(out, size, "LD HF, V%X", X); return true;
+				case 0x33: snprintf(out, size, "LD B, V%X", X); return true;
+				case 0x55: snprintf(out, size, "LD [I], V%X", X); return true;
+				case 0x65: snprintf(out, size, "LD V%X, [I]", X); return true;
+				case 0x75: snprintf(out, size, "LD R, V%X", X); return true;
+				case 0x85: snprintf(out, size, "LD V%X, R", X); return true;
+				default: break;
+			}
+			break;
+	}
+	snprintf(out, size, "DW 0x%04X", opcode);
+	return false;
+}
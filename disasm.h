@@ -0,0 +1,12 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Writes the mnemonic for opcode into out (Cowgod's notation, eg. "DRW V0, V1, 5")
+// Returns false for opcodes that aren't instructions, those come out as "DW 0xNNNN"
+bool disassemble(uint16_t opcode, char *out, size_t size);
+
+#endif
@@ -0,0 +1,102 @@
+#include <string.h>
+#include "chip8.h"
+
+// A 128 pixel row is two words, which is one SSE2 register: a horizontal scroll is two shifts, a byte
+// shift to carry bits across the middle and a mask per row, the same few instructions for a lo-res
+// row as for a hi-res one. Vertical scrolls are a memmove of whole rows per plane.
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DISPLAY_SSE2
+#endif
+
+typedef uint64_t row_t[DISPLAY_WORDS];
+
+
+static inline void markRows(chip8_t *chip8) {
+	const uint64_t rows = ~0ull >> (64 - displayHeight(chip8));
+	chip8->dirtyRows |= rows;
+	chip8->changedRows |= rows;
+}
+
+
+void scrollDown(chip8_t *chip8, uint8_t n) {
+	const uint32_t height = displayHeight(chip8);
+	if (n == 0) return;
+	for (uint32_t p = 0; p < DISPLAY_PLANES; p++) {
+		if (!((chip8->planes >> p) & 1)) continue;
+		row_t *rows = chip8->display[p];
+		memmove(rows + n, rows, (height - n) * sizeof(row_t));
+		memset(rows, 0, n * sizeof(row_t));
+	}
+	markRows(chip8);
+}
+
+
+void scrollUp(chip8_t *chip8, uint8_t n) {
+	const uint32_t height = displayHeight(chip8);
+	if (n == 0) return;
+	for (uint32_t p = 0; p < DISPLAY_PLANES; p++) {
+		if (!((chip8->planes >> p) & 1)) continue;
+		row_t *rows = chip8->display[p];
+		memmove(rows, rows + n, (height - n) * sizeof(row_t));
+		memset(rows + height - n, 0, n * sizeof(row_t));
+	}
+	markRows(chip8);
+}
+
+
+// Word 0 is the left half of a row and is the low lane of a vector, so moving pixels right is a right
+// shift of each word with word 0's low bits carried into the top of word 1
+void scrollRight(chip8_t *chip8) {
+	const uint32_t height = displayHeight(chip8);
+	const uint64_t keep = chip8->hires ? ~0ull : 0;		// Lo-res rows end after word 0
+	for (uint32_t p = 0; p < DISPLAY_PLANES; p++) {
+		if (!((chip8->planes >> p) & 1)) continue;
+		row_t *rows = chip8->display[p];
+#ifdef DISPLAY_SSE2
+		const __m128i mask = _mm_set_epi64x((long long)keep, -1);
+		for (uint32_t y = 0; y < height; y++) {
+			const __m128i row = _mm_loadu_si128((const __m128i *)rows[y]);
+			const __m128i carry = _mm_slli_si128(_mm_slli_epi64(row, 60), 8);
+			_mm_storeu_si128((__m128i *)rows[y], _mm_and_si128(_mm_or_si128(_mm_srli_epi64(row, 4), carry), mask));
+		}
+#else
+		for (uint32_t y = 0; y < height; y++) {
+			rows[y][1] = ((rows[y][1] >> 4) | (rows[y][0] << 60)) & keep;
+			rows[y][0] >>= 4;
+		}
+#endif
+	}
+	markRows(chip8);
+}
+
+
+void scrollLeft(chip8_t *chip8) {
+	const uint32_t height = displayHeight(chip8);
+	for (uint32_t p = 0; p < DISPLAY_PLANES; p++) {
+		if (!((chip8->planes >> p) & 1)) continue;
+		row_t *rows = chip8->display[p];
+#ifdef DISPLAY_SSE2
+		for (uint32_t y = 0; y < height; y++) {
+			const __m128i row = _mm_loadu_si128((const __m128i *)rows[y]);
+			const __m128i carry = _mm_srli_si128(_mm_srli_epi64(row, 60), 8);
+			_mm_storeu_si128((__m128i *)rows[y], _mm_or_si128(_mm_slli_epi64(row, 4), carry));
+		}
+#else
+		for (uint32_t y = 0; y < height; y++) {
+			rows[y][0] = (rows[y][0] << 4) | (rows[y][1] >> 60);
+			rows[y][1] <<= 4;
+		}
+#endif
+	}
+	markRows(chip8);
+}
+
+
+void setResolution(chip8_t *chip8, bool hires) {
+	chip8->hires = hires;
+	memset(chip8->display, 0, sizeof chip8->display);
+	chip8->dirtyRows = ~0ull;
+	chip8->changedRows = ~0ull;
+}
@@ -0,0 +1,17 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct chip8_t;
+
+// SUPER-CHIP/XO-CHIP operations that move whole framebuffer rows
+// They act on the planes selected with FN01 at the current resolution and mark every row they move dirty
+void scrollDown(struct chip8_t *chip8, uint8_t n);	// 00CN
+void scrollUp(struct chip8_t *chip8, uint8_t n);	// 00DN, XO-CHIP
+void scrollRight(struct chip8_t *chip8);			// 00FB, by 4 pixels
+void scrollLeft(struct chip8_t *chip8);				// 00FC, by 4 pixels
+void setResolution(struct chip8_t *chip8, bool hires);	// 00FE/00FF, clears every plane
+
+#endif
@@ -0,0 +1,944 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+#include "batch.h"
+#include "savestate.h"
+#include "disasm.h"
+
+// Differential fuzzer: runs random and mutated programs from random machine states on the reference
+// interpreter and the fast engines in lockstep on all cores, and minimizes any program an engine diverges on
+// Usage: fuzz [romdir] [-engine NAME|NAME-idle|batch|all] [-quirks NAME|all] [-j N] [-seconds N] [-insts N] [-seed N] [-out DIR]
+//        fuzz -replay ROM -seed N -quirks NAME -insts N [-engine NAME|NAME-idle|batch|all]
+//
+// A case is a program at ENTRY_POINT and a seed. The seed fills the rest of memory, the registers, stack,
+// timers, keys and screen, and the schedule the run follows: the reference steps emulateInstruction through a
+// window of 1 to 24 instructions, every candidate engine runs the same count through emulateInstructions (so
+// a recompiled block runs whole whenever it fits), then every candidate's state and framebuffer is compared
+// with the reference's. Between windows the timers may tick and a key may change, on every machine alike.
+// The batch engine is a candidate for vip cases: a group of BATCH_LANES machines where the lanes holding the
+// case are compared and the others start from a decoy seed, so the kernels also run under partial lane masks.
+// Each engine is a candidate a second time with idle loop skipping in front of it. Skipping is only exact at
+// the end of a burst, so those run each frame, the windows from one timer tick or key change to the next, as
+// one burst and are compared with the reference when it ends.
+//
+// A divergence is pinned to the first instruction of its window the engine goes wrong after, by rerunning the
+// case cut short inside that window. Each new one (by engine, that instruction's family and the kind of field
+// that differed) is minimized by replacing ever smaller chunks of the program with 0000, which every engine
+// ignores, as long as the same engine still diverges on the same kind of field. It is printed with its program
+// and written out as a rom and a save state of the machine it starts from, along with the fuzz -replay
+// command that reruns it with the same window, timer and key schedule and prints every field that differs.
+
+
+#define MAX_PROGRAM (0x1000 - ENTRY_POINT)	// Program bytes, jumps and calls can reach all of it
+#define MAX_WINDOW 24			// Instructions between compares
+#define MAX_MINIMIZE_RUNS 4000	// Reruns one minimization may take
+#define PROGRESS_SECONDS 10		// Between progress lines
+#define CANDIDATE_BATCH ENGINE_COUNT		// Candidates are the engines, then the batch engine, then the engines
+#define CANDIDATE_IDLE (ENGINE_COUNT + 1)	// again with idle loop skipping
+#define CANDIDATE_COUNT (2 * ENGINE_COUNT + 1)
+
+typedef struct {
+	uint8_t program[MAX_PROGRAM];
+	uint32_t size;			// Program bytes, even
+	uint64_t seed;			// Everything else the run starts from and does
+	quirk_profile_t quirks;
+	uint32_t insts;			// Reference instructions to run at most
+} fuzz_case_t;
+
+// The first difference between a candidate and the reference
+typedef struct {
+	uint64_t executed;		// Reference instructions run when it was found
+	char field[32];			// eg. "V3", "memory 0x0345", "display 1,12,0"
+	char kind[16];			// field without where, eg. "V", "memory"
+	uint64_t reference, candidate;
+	uint32_t differences;	// Fields that differ, all of them only when listed
+	uint16_t window[MAX_WINDOW][2];		// pc and opcode of each instruction of the window it showed up after
+	uint32_t windowSize;
+} divergence_t;
+
+// Per thread machines, one per candidate being fuzzed next to the reference
+typedef struct {
+	chip8_t *reference;
+	chip8_t *machines[CANDIDATE_COUNT];	// The batch's is a lane copied out of batch to compare
+	batch_t *batch;
+	uint8_t *image;			// Memory from ENTRY_POINT up as a case loads it
+	uint64_t rng;
+} fuzz_worker_t;
+
+typedef struct {
+	uint32_t engines;		// Bit e set when candidate e is fuzzed
+	bool allQuirks;			// Each case picks a profile, otherwise every case runs quirks
+	quirk_profile_t quirks;
+	uint32_t insts;
+	uint64_t seed;
+	const char *outDir;
+	std::vector<std::vector<uint8_t>> seeds;	// Roms to mutate
+	std::atomic<bool> stop;
+	std::atomic<uint64_t> execs, instructions, divergences;
+	std::mutex lock;		// Guards what follows and stdout
+	std::vector<std::string> signatures;
+} fuzz_shared_t;
+
+
+static void printUsage(void) {
+	printf("Usage: fuzz [romdir] [-engine NAME|NAME-idle|batch|all] [-quirks NAME|all] [-j N] [-seconds N] [-insts N] [-seed N] [-out DIR]\n"
+		   "       fuzz -replay ROM -seed N -quirks NAME -insts N [-engine NAME|NAME-idle|batch|all]\n"
+		   "  romdir      Roms to mutate along with purely random programs (default none)\n"
+		   "  -engine N   Engine to check against the reference: switch, cached, jit, threaded, one of those with\n"
+		   "              -idle for it behind idle loop skipping, batch (vip cases only) or all (default all)\n"
+		   "  -quirks N   Platform quirks: vip, chip48, schip, xochip or all, picked per case (default all)\n"
+		   "  -j N        Worker threads (default all cores)\n"
+		   "  -seconds N  Stop after N seconds, 0 runs until interrupted (default 60)\n"
+		   "  -insts N    Reference instructions per case at most (default 1000)\n"
+		   "  -seed N     Seed for the whole run, the same seed and -j generate the same cases (default 1)\n"
+		   "  -out DIR    Where minimized divergences are written (default .)\n"
+		   "  -replay ROM Rerun one case the fuzzer printed and list every field each engine gets wrong\n");
+}
+
+
+static const char *const idleNames[ENGINE_COUNT] = { "switch-idle", "cached-idle", "jit-idle", "threaded-idle" };
+
+static const char *candidateName(uint32_t candidate) {
+	if (candidate == CANDIDATE_BATCH) return "batch";
+	return candidate > CANDIDATE_BATCH ? idleNames[candidate - CANDIDATE_IDLE] : engineName((engine_t)candidate);
+}
+
+// Engine a candidate other than the batch runs on
+static engine_t candidateEngine(uint32_t candidate) {
+	return (engine_t)(candidate > CANDIDATE_BATCH ? candidate - CANDIDATE_IDLE : candidate);
+}
+
+// Map a candidate name from the command line, an engine's, an idle one's or batch
+static bool parseCandidate(const char *name, uint32_t *candidate) {
+	engine_t engine;
+	if (parseEngine(name, &engine)) *candidate = engine;
+	else if (!strcmp(name, "batch")) *candidate = CANDIDATE_BATCH;
+	else {
+		uint32_t e = 0;
+		while (e < ENGINE_COUNT && strcmp(name, idleNames[e])) e++;
+		if (e == ENGINE_COUNT) return false;
+		*candidate = CANDIDATE_IDLE + e;
+	}
+	return true;
+}
+
+
+// SplitMix64, the same mixer CXNN uses, 64 bits at a time
+static inline uint64_t nextWord(uint64_t *state) {
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+// Programs
+
+// Instruction families a program is drawn from, the bits in fields are random
+typedef struct {
+	uint16_t base;
+	uint16_t fields;
+} instruction_template_t;
+
+static const instruction_template_t templates[] = {
+	{ 0x00E0, 0 }, { 0x00EE, 0 }, { 0x00C0, 0x000F }, { 0x00D0, 0x000F }, { 0x00FB, 0 }, { 0x00FC, 0 },
+	{ 0x00FD, 0 }, { 0x00FE, 0 }, { 0x00FF, 0 },
+	{ 0x1000, 0 }, { 0x2000, 0 }, { 0xB000, 0 },	// Targets are picked separately
+	{ 0x3000, 0x0FFF }, { 0x4000, 0x0FFF }, { 0x5000, 0x0FF0 }, { 0x5002, 0x0FF0 }, { 0x5003, 0x0FF0 },
+	{ 0x6000, 0x0FFF }, { 0x7000, 0x0FFF },
+	{ 0x8000, 0x0FF0 }, { 0x8001, 0x0FF0 }, { 0x8002, 0x0FF0 }, { 0x8003, 0x0FF0 }, { 0x8004, 0x0FF0 },
+	{ 0x8005, 0x0FF0 }, { 0x8006, 0x0FF0 }, { 0x8007, 0x0FF0 }, { 0x800E, 0x0FF0 }, { 0x9000, 0x0FF0 },
+	{ 0xA000, 0x0FFF }, { 0xC000, 0x0FFF }, { 0xD000, 0x0FFF }, { 0xE09E, 0x0F00 }, { 0xE0A1, 0x0F00 },
+	{ 0xF000, 0 }, { 0xF002, 0 }, { 0xF001, 0x0300 }, { 0xF007, 0x0F00 }, { 0xF00A, 0x0F00 }, { 0xF015, 0x0F00 },
+	{ 0xF018, 0x0F00 }, { 0xF01E, 0x0F00 }, { 0xF029, 0x0F00 }, { 0xF030, 0x0F00 }, { 0xF033, 0x0F00 },
+	{ 0xF03A, 0x0F00 }, { 0xF055, 0x0F00 }, { 0xF065, 0x0F00 }, { 0xF075, 0x0F00 }, { 0xF085, 0x0F00 },
+};
+
+// Writes a random instruction for a program of words words and returns how many words it took
+// Jumps and calls mostly land on one of the program's words, F000 NNNN takes two words when there is room
+static uint32_t randomInstruction(uint64_t *rng, uint32_t words, uint32_t room, uint16_t *out) {
+	const uint64_t r = nextWord(rng);
+	if ((r & 15) == 0) {
+		out[0] = (uint16_t)(r >> 16);		// Anything at all, undefined opcodes included
+		return 1;
+	}
+	const instruction_template_t *t = &templates[(r >> 4) % (sizeof templates / sizeof templates[0])];
+	out[0] = t->base | ((uint16_t)(r >> 16) & t->fields);
+	const uint8_t group = t->base >> 12;
+	if (group == 0x1 || group == 0x2 || group == 0xB)
+		out[0] |= (r >> 32) & 7 ? ENTRY_POINT + 2 * ((r >> 36) % words) : (r >> 48) & 0x0FFF;
+	if (t->base == 0xF000 && room >= 2) {
+		out[1] = (uint16_t)(r >> 40);
+		return 2;
+	}
+	return 1;
+}
+
+static void storeWord(fuzz_case_t *c, uint32_t word, uint16_t value) {
+	c->program[2 * word] = value >> 8;
+	c->program[2 * word + 1] = value & 0xFF;
+}
+
+static void randomProgram(uint64_t *rng, fuzz_case_t *c) {
+	const uint32_t words = 4 + nextWord(rng) % 509;
+	c->size = 2 * words;
+	for (uint32_t w = 0; w < words;) {
+		uint16_t inst[2];
+		const uint32_t n = randomInstruction(rng, words, words - w, inst);
+		for (uint32_t i = 0; i < n; i++) storeWord(c, w++, inst[i]);
+	}
+}
+
+// A few bit flips, replaced, inserted, deleted and copied words
+static void mutateProgram(uint64_t *rng, fuzz_case_t *c) {
+	const uint32_t mutations = 1 + nextWord(rng) % 8;
+	for (uint32_t m = 0; m < mutations; m++) {
+		const uint64_t r = nextWord(rng);
+		const uint32_t words = c->size / 2;
+		const uint32_t at = (r >> 8) % words;
+		uint16_t inst[2];
+		switch (r & 7) {
+			case 0:
+			case 1:
+				c->program[(r >> 8) % c->size] ^= 1 << ((r >> 40) & 7);
+				break;
+			case 2:
+			case 3: {
+				const uint32_t n = randomInstruction(rng, words, words - at, inst);
+				for (uint32_t i = 0; i < n; i++) storeWord(c, at + i, inst[i]);
+				break;
+			}
+			case 4:
+				if (c->size + 2 > MAX_PROGRAM) break;
+				memmove(&c->program[2 * at + 2], &c->program[2 * at], c->size - 2 * at);
+				c->size += 2;
+				randomInstruction(rng, words + 1, 1, inst);
+				storeWord(c, at, inst[0]);
+				break;
+			case 5:
+				if (words <= 1) break;
+				memmove(&c->program[2 * at], &c->program[2 * at + 2], c->size - 2 * at - 2);
+				c->size -= 2;
+				break;
+			case 6: {
+				const uint32_t from = (r >> 32) % words;
+				uint32_t count = 1 + (r >> 56) % 8;
+				if (count > words - from) count = words - from;
+				if (count > words - at) count = words - at;
+				memmove(&c->program[2 * at], &c->program[2 * from], 2 * count);
+				break;
+			}
+			default:
+				c->program[(r >> 8) % c->size] = (uint8_t)(r >> 40);
+				break;
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+// Running a case
+
+// Random registers, stack, timers, keys, audio and screen, the same on every machine for the same seed
+static void seedMachine(chip8_t *chip8, uint64_t seed) {
+	uint64_t rng = seed;
+	uint64_t r = nextWord(&rng);
+	for (uint32_t v = 0; v < 16; v++) {
+		if (v == 8) r = nextWord(&rng);
+		chip8->V[v] = (uint8_t)(r >> (8 * (v & 7)));
+	}
+	r = nextWord(&rng);
+	chip8->I = (uint16_t)r;
+	chip8->sp = (r >> 16) % 13;
+	chip8->delay_timer = (uint8_t)(r >> 24);
+	chip8->sound_timer = (uint8_t)(r >> 32);
+	for (uint32_t k = 0; k < 16; k++) chip8->keys[k] = (r >> (40 + k)) & 1;
+	chip8->hires = (r >> 56) & 1;
+	chip8->planes = (r >> 57) & 3;
+	chip8->patternSet = (r >> 59) & 1;
+	// Mostly not in the middle of an FX0A
+	chip8->waitKey = (r >> 60) ? 0xFF : (r >> 16) & 0xF;
+	chip8->waitKeyPressed = chip8->waitKey != 0xFF && ((r >> 24) & 1);
+
+	r = nextWord(&rng);
+	for (uint32_t i = 0; i < 12; i++) {
+		if (i == 4 || i == 8) r = nextWord(&rng);
+		chip8->stack[i] = (uint16_t)(r >> (16 * (i & 3)));
+	}
+	chip8->rngState = nextWord(&rng);
+	r = nextWord(&rng);
+	chip8->pitch = (uint8_t)r;
+	for (uint32_t i = 0; i < 16; i++) {
+		if (i == 8) r = nextWord(&rng);
+		chip8->audioPattern[i] = (uint8_t)(r >> (8 * (i & 7)));
+		chip8->flags[i] = (uint8_t)(r >> (8 * ((i + 3) & 7)));
+	}
+	// Lo-res only ever lights word 0 of its rows
+	for (uint32_t p = 0; p < DISPLAY_PLANES; p++)
+		for (uint32_t y = 0; y < displayHeight(chip8); y++) {
+			chip8->display[p][y][0] = nextWord(&rng);
+			if (chip8->hires) chip8->display[p][y][1] = nextWord(&rng);
+		}
+}
+
+// Loads the case with the given seed into chip8, the same way on every machine
+// A VIP program can't reach hi-res, plane 2 or the flag registers, so vip machines start without them
+static void setupMachine(chip8_t *chip8, const config_t *config, uint64_t seed, const uint8_t *image) {
+	initChip8Rom(chip8, config, image, MEMORY_SIZE - ENTRY_POINT, (char *)"fuzz");
+	uint64_t rng = seed;
+	nextWord(&rng);				// The memory fill's seed
+	seedMachine(chip8, nextWord(&rng));
+	if (config->quirks != QUIRKS_VIP) return;
+	chip8->hires = false;
+	chip8->planes = 1;
+	memset(chip8->flags, 0, sizeof chip8->flags);
+	for (uint32_t y = 0; y < DISPLAY_HEIGHT; y++) {
+		for (uint32_t w = 0; w < DISPLAY_WORDS; w++)
+			if (w || y >= LORES_HEIGHT) chip8->display[0][y][w] = 0;
+		memset(chip8->display[1][y], 0, sizeof chip8->display[1][y]);
+	}
+}
+
+// Fills the batch with the case for the reference's config, returns the lanes holding it, 0 when the batch
+// can't hold it. Lane 0 always does, the others are now and then started from a decoy seed instead, so the
+// machines in step are sometimes the whole group, sometimes most of it and sometimes a minority of it
+static uint32_t setupBatch(fuzz_worker_t *worker, const config_t *config, const fuzz_case_t *c) {
+	if (config->quirks != QUIRKS_VIP) return 0;
+	chip8_t *chip8 = worker->machines[CANDIDATE_BATCH];
+	uint64_t rng = c->seed ^ 0x6A09E667F3BCC908ull;
+	const uint64_t r = nextWord(&rng);
+	const uint32_t decoys = (r & 3) ? (uint32_t)(r >> 32) & ~1u : 0;
+
+	setupMachine(chip8, config, c->seed, worker->image);
+	for (uint32_t lane = 0; lane < BATCH_LANES; lane++)
+		if (!(decoys >> lane & 1) && !setBatchMachine(worker->batch, lane, chip8)) return 0;
+	if (!decoys) return ~0u;
+	setupMachine(chip8, config, nextWord(&rng), worker->image);
+	for (uint32_t lane = 0; lane < BATCH_LANES; lane++)
+		if ((decoys >> lane & 1) && !setBatchMachine(worker->batch, lane, chip8)) return 0;
+	return ~decoys;
+}
+
+// Memory from ENTRY_POINT up: the program, then random bytes
+static void buildImage(uint8_t *image, const fuzz_case_t *c) {
+	uint64_t rng = c->seed;
+	uint64_t fill = nextWord(&rng);
+	memcpy(image, c->program, c->size);
+	for (uint32_t i = c->size; i < MEMORY_SIZE - ENTRY_POINT; i += 8) {
+		const uint64_t r = nextWord(&fill);
+		memcpy(&image[i], &r, MEMORY_SIZE - ENTRY_POINT - i < 8 ? MEMORY_SIZE - ENTRY_POINT - i : 8);
+	}
+}
+
+// Records the first difference, and prints every one when list is set. True when the compare can stop
+static bool differs(divergence_t *d, bool list, const char *kind, const char *field, uint64_t reference, uint64_t candidate) {
+	if (reference == candidate) return false;
+	if (list) printf("    %-16s 0x%llX, reference 0x%llX\n", field, (unsigned long long)candidate, (unsigned long long)reference);
+	if (!d->differences++) {
+		snprintf(d->kind, sizeof d->kind, "%s", kind);
+		snprintf(d->field, sizeof d->field, "%s", field);
+		d->reference = reference;
+		d->candidate = candidate;
+	}
+	return !list;
+}
+
+// Everything a save state holds except the keys, which every machine is given alike
+// Stops at the first difference unless list is set
+static bool compareMachines(const chip8_t *a, const chip8_t *b, divergence_t *d, bool list) {
+	char field[32];
+	d->differences = 0;
+	if (differs(d, list, "pc", "pc", a->pc, b->pc) || differs(d, list, "I", "I", a->I, b->I) ||
+		differs(d, list, "sp", "sp", a->sp, b->sp)) return true;
+	for (uint32_t v = 0; v < 16; v++) {
+		snprintf(field, sizeof field, "V%X", v);
+		if (differs(d, list, "V", field, a->V[v], b->V[v])) return true;
+	}
+	for (uint32_t i = 0; i < 12; i++) {
+		snprintf(field, sizeof field, "stack[%u]", i);
+		if (differs(d, list, "stack", field, a->stack[i], b->stack[i])) return true;
+	}
+	if (differs(d, list, "timer", "delay timer", a->delay_timer, b->delay_timer) ||
+		differs(d, list, "timer", "sound timer", a->sound_timer, b->sound_timer) ||
+		differs(d, list, "waitKey", "waitKey", a->waitKey, b->waitKey) ||
+		differs(d, list, "waitKey", "waitKeyPressed", a->waitKeyPressed, b->waitKeyPressed) ||
+		differs(d, list, "rngState", "rngState", a->rngState, b->rngState) ||
+		differs(d, list, "hires", "hires", a->hires, b->hires) ||
+		differs(d, list, "planes", "planes", a->planes, b->planes) ||
+		differs(d, list, "audio", "pitch", a->pitch, b->pitch) ||
+		differs(d, list, "audio", "patternSet", a->patternSet, b->patternSet)) return true;
+	for (uint32_t i = 0; i < 16; i++) {
+		snprintf(field, sizeof field, "audioPattern[%u]", i);
+		if (differs(d, list, "audio", field, a->audioPattern[i], b->audioPattern[i])) return true;
+		snprintf(field, sizeof field, "flags[%u]", i);
+		if (differs(d, list, "flags", field, a->flags[i], b->flags[i])) return true;
+	}
+	if (memcmp(a->display, b->display, sizeof a->display)) {
+		for (uint32_t p = 0; p < DISPLAY_PLANES; p++)
+			for (uint32_t y = 0; y < DISPLAY_HEIGHT; y++)
+				for (uint32_t w = 0; w < DISPLAY_WORDS; w++) {
+					snprintf(field, sizeof field, "display %u,%u,%u", p, y, w);
+					if (differs(d, list, "display", field, a->display[p][y][w], b->display[p][y][w])) return true;
+				}
+	}
+	if (memcmp(a->memory, b->memory, sizeof a->memory)) {
+		for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+			snprintf(field, sizeof field, "memory 0x%04X", addr);
+			if (differs(d, list, "memory", field, a->memory[addr], b->memory[addr])) return true;
+		}
+	}
+	return d->differences != 0;
+}
+
+// Whether a batch lane differs from another in anything compareMachines looks at, without copying them out
+// Memory above 4K only when high is set, only the scalar path stores there and comparing it is most of the cost
+static bool laneDiffers(const batch_t *batch, uint32_t lane, uint32_t other, bool high) {
+	static const uint8_t zeros[MEMORY_SIZE - BATCH_LOW_MEMORY] = {};
+	const uint32_t s = batch->stride;
+	const uint8_t *page = batch->highMemory[lane] ? batch->highMemory[lane] : zeros;
+	const uint8_t *otherPage = batch->highMemory[other] ? batch->highMemory[other] : zeros;
+	if (memcmp(&batch->memory[lane * BATCH_MEMORY], &batch->memory[other * BATCH_MEMORY], BATCH_LOW_MEMORY) ||
+		(high && page != otherPage && memcmp(page, otherPage, sizeof zeros)) ||
+		memcmp(&batch->audioPattern[lane * 16], &batch->audioPattern[other * 16], 16)) return true;
+	for (uint32_t r = 0; r < 16; r++)
+		if (batch->V[r * s + lane] != batch->V[r * s + other]) return true;
+	for (uint32_t d = 0; d < BATCH_STACK; d++)
+		if (batch->stack[d * s + lane] != batch->stack[d * s + other]) return true;
+	for (uint32_t y = 0; y < LORES_HEIGHT; y++)
+		if (batch->display[y * s + lane] != batch->display[y * s + other]) return true;
+	return batch->pc[lane] != batch->pc[other] || batch->I[lane] != batch->I[other] || batch->sp[lane] != batch->sp[other] ||
+		batch->delayTimer[lane] != batch->delayTimer[other] || batch->soundTimer[lane] != batch->soundTimer[other] ||
+		batch->waitKey[lane] != batch->waitKey[other] || batch->waitKeyPressed[lane] != batch->waitKeyPressed[other] ||
+		batch->rngState[lane] != batch->rngState[other] || batch->pitch[lane] != batch->pitch[other] ||
+		batch->patternSet[lane] != batch->patternSet[other];
+}
+
+// Compares the lanes of the batch holding the case with the reference, the machine of the batch is left
+// holding the first lane that differs. Lane 0 is compared whole, the others' memory above 4K only when high is set
+static bool compareBatch(fuzz_worker_t *worker, uint32_t lanes, bool high, divergence_t *d) {
+	chip8_t *chip8 = worker->machines[CANDIDATE_BATCH];
+	getBatchMachine(worker->batch, 0, chip8);
+	if (compareMachines(worker->reference, chip8, d, false)) return true;
+	for (uint32_t lane = 1; lane < BATCH_LANES; lane++) {
+		if (!(lanes >> lane & 1) || !laneDiffers(worker->batch, lane, 0, high)) continue;
+		getBatchMachine(worker->batch, lane, chip8);
+		if (compareMachines(worker->reference, chip8, d, false)) return true;
+	}
+	return false;
+}
+
+// Records d as showing up after the window just run
+static void noteDivergence(divergence_t *d, uint64_t executed, const uint16_t window[MAX_WINDOW][2], uint32_t taken) {
+	d->executed = executed;
+	d->windowSize = taken;
+	memcpy(d->window, window, sizeof d->window);
+}
+
+// Runs the case on the reference and every candidate in engines, returns the candidates that diverged with
+// each one's first difference in diverged[candidate]. *executed is how many reference instructions ran
+static uint32_t runCase(fuzz_worker_t *worker, const fuzz_case_t *c, uint32_t engines, divergence_t *diverged, uint64_t *executed) {
+	config_t configs[CANDIDATE_COUNT];
+	config_t reference;
+	setDefaultConfig(&reference);
+	reference.quirks = c->quirks;
+	reference.idleSkip = false;		// The engines themselves are under test, not the skipping in front of them
+	buildImage(worker->image, c);
+	setupMachine(worker->reference, &reference, c->seed, worker->image);
+	for (uint32_t e = 0; e < CANDIDATE_COUNT; e++) {
+		if (!(engines >> e & 1) || e == CANDIDATE_BATCH) continue;
+		configs[e] = reference;
+		configs[e].engine = candidateEngine(e);
+		configs[e].idleSkip = e > CANDIDATE_BATCH;
+		setupMachine(worker->machines[e], &configs[e], c->seed, worker->image);
+	}
+	// The batch only runs cases it can hold
+	const uint32_t batchLanes = engines >> CANDIDATE_BATCH & 1 ? setupBatch(worker, &reference, c) : 0;
+	if (!batchLanes) engines &= ~(1u << CANDIDATE_BATCH);
+
+	uint64_t schedule = c->seed;
+	nextWord(&schedule);
+	nextWord(&schedule);
+	uint32_t alive = engines, failed = 0;
+	uint16_t window[MAX_WINDOW][2];
+	uint32_t frame = 0;		// Instructions the idle candidates have yet to run as one burst
+	*executed = 0;
+	while (alive && *executed < c->insts) {
+		uint32_t taken = 1 + nextWord(&schedule) % MAX_WINDOW;
+		if (taken > c->insts - *executed) taken = (uint32_t)(c->insts - *executed);
+		for (uint32_t i = 0; i < taken; i++) {
+			chip8_t *chip8 = worker->reference;
+			window[i][0] = chip8->pc;
+			window[i][1] = (chip8->memory[chip8->pc] << 8) | chip8->memory[(uint16_t)(chip8->pc + 1)];
+			emulateInstruction(chip8, &reference);
+		}
+		*executed += taken;
+		frame += taken;
+
+		for (uint32_t e = 0; e < CANDIDATE_IDLE; e++) {
+			if (!(alive >> e & 1)) continue;
+			divergence_t *d = &diverged[e];
+			if (e == CANDIDATE_BATCH) {
+				emulateBatch(worker->batch, taken);
+				if (!compareBatch(worker, batchLanes, *executed >= c->insts, d)) continue;
+			}
+			else {
+				emulateInstructions(worker->machines[e], &configs[e], taken);
+				if (!compareMachines(worker->reference, worker->machines[e], d, false)) continue;
+			}
+			noteDivergence(d, *executed, window, taken);
+			alive &= ~(1u << e);
+			failed |= 1u << e;
+		}
+
+		// Timers tick about as often as at 700 instructions a second, keys change now and then
+		const uint64_t event = nextWord(&schedule);
+		const bool tick = (event & 7) == 0;
+		const bool key = ((event >> 3) & 15) == 0;
+		if (tick || key || *executed >= c->insts) {
+			// The frame ends, the idle candidates run it
+			for (uint32_t e = CANDIDATE_IDLE; e < CANDIDATE_COUNT; e++) {
+				if (!(alive >> e & 1)) continue;
+				emulateInstructions(worker->machines[e], &configs[e], frame);
+				if (!compareMachines(worker->reference, worker->machines[e], &diverged[e], false)) continue;
+				noteDivergence(&diverged[e], *executed, window, taken);
+				alive &= ~(1u << e);
+				failed |= 1u << e;
+			}
+			frame = 0;
+		}
+		if (!alive) break;		// The reference stays where the last candidate diverged
+
+		if (tick) updateTimers(worker->reference);
+		if (key) worker->reference->keys[(event >> 8) & 0xF] ^= 1;
+		for (uint32_t e = 0; e < CANDIDATE_COUNT; e++) {
+			if (!(alive >> e & 1) || e == CANDIDATE_BATCH) continue;
+			if (tick) updateTimers(worker->machines[e]);
+			if (key) worker->machines[e]->keys[(event >> 8) & 0xF] ^= 1;
+		}
+		if (alive >> CANDIDATE_BATCH & 1) {
+			if (tick) updateBatchTimers(worker->batch);
+			for (uint32_t lane = 0; key && lane < BATCH_LANES; lane++)
+				setBatchKey(worker->batch, lane, (event >> 8) & 0xF, worker->reference->keys[(event >> 8) & 0xF]);
+		}
+	}
+	return failed;
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+// Reporting
+
+// Instruction family in the usual notation, eg. 8XY6 or FX33
+static void opcodePattern(uint16_t opcode, char *out, size_t size) {
+	const uint8_t N = opcode & 0x0F;
+	const uint8_t NN = opcode & 0xFF;
+	switch (opcode >> 12) {
+		case 0x0:
+			if ((opcode & 0xFFF0) == 0x00C0) snprintf(out, size, "00CN");
+			else if ((opcode & 0xFFF0) == 0x00D0) snprintf(out, size, "00DN");
+			else if (opcode == 0x00E0 || opcode == 0x00EE || (opcode >= 0x00FB && opcode <= 0x00FF)) snprintf(out, size, "%04X", opcode);
+			else snprintf(out, size, "0NNN");
+			return;
+		case 0x1: snprintf(out, size, "1NNN"); return;
+		case 0x2: snprintf(out, size, "2NNN"); return;
+		case 0x3: snprintf(out, size, "3XNN"); return;
+		case 0x4: snprintf(out, size, "4XNN"); return;
+		case 0x5: snprintf(out, size, "5XY%X", N); return;
+		case 0x6: snprintf(out, size, "6XNN"); return;
+		case 0x7: snprintf(out, size, "7XNN"); return;
+		case 0x8: snprintf(out, size, "8XY%X", N); return;
+		case 0x9: snprintf(out, size, "9XY%X", N); return;
+		case 0xA: snprintf(out, size, "ANNN"); return;
+		case 0xB: snprintf(out, size, "BNNN"); return;
+		case 0xC: snprintf(out, size, "CXNN"); return;
+		case 0xD: snprintf(out, size, N ? "DXYN" : "DXY0"); return;
+		case 0xE: snprintf(out, size, "EX%02X", NN); return;
+		default:
+			if (opcode == 0xF000 || opcode == 0xF002) snprintf(out, size, "%04X", opcode);
+			else snprintf(out, size, "FX%02X", NN);
+			return;
+	}
+}
+
+// Instruction families that can change each kind of field, to blame the right one of a recompiled block
+static const struct {
+	const char *kind;
+	const char *patterns;
+} changes[] = {
+	{ "pc", "00EE 1NNN 2NNN 3XNN 4XNN 5XY0 9XY0 BNNN EX9E EXA1 F000 FX0A" },
+	{ "I", "ANNN BNNN FX1E FX29 FX30 FX55 FX65 F000" },
+	{ "sp", "2NNN 00EE" },
+	{ "stack", "2NNN" },
+	{ "V", "5XY3 6XNN 7XNN 8XY0 8XY1 8XY2 8XY3 8XY4 8XY5 8XY6 8XY7 8XYE CXNN DXYN DXY0 FX07 FX0A FX65 FX85" },
+	{ "timer", "FX15 FX18" },
+	{ "waitKey", "FX0A" },
+	{ "rngState", "CXNN" },
+	{ "hires", "00FE 00FF" },
+	{ "planes", "FX01" },
+	{ "audio", "F002 FX3A" },
+	{ "flags", "FX75" },
+	{ "display", "00E0 00CN 00DN 00FB 00FC 00FE 00FF DXYN DXY0" },
+	{ "memory", "5XY2 FX33 FX55" },
+};
+
+static bool canChange(uint16_t opcode, const char *kind) {
+	char pattern[8];
+	opcodePattern(opcode, pattern, sizeof pattern);
+	for (const auto &c : changes)
+		if (!strcmp(c.kind, kind)) return strstr(c.patterns, pattern) != NULL;
+	return false;
+}
+
+// Cuts the case short inside the window d showed up after, one instruction further each rerun, until candidate
+// diverges too. d and the case then end right there, returns which instruction of the window is to blame:
+// the last one that can change the field, as the jit only runs a block whole when it fits
+static uint32_t locateDivergence(fuzz_worker_t *worker, fuzz_case_t *c, uint32_t candidate, divergence_t *d) {
+	divergence_t trial[CANDIDATE_COUNT];
+	const uint64_t start = d->executed - d->windowSize;
+	for (uint32_t k = 1; k < d->windowSize; k++) {
+		uint64_t executed;
+		c->insts = (uint32_t)(start + k);
+		if (runCase(worker, c, 1u << candidate, trial, &executed)) {
+			*d = trial[candidate];
+			break;
+		}
+	}
+	c->insts = (uint32_t)d->executed;
+	for (uint32_t i = d->windowSize; i-- > 0;)
+		if (canChange(d->window[i][1], d->kind)) return i;
+	return d->windowSize ? d->windowSize - 1 : 0;
+}
+
+// Candidate, the family of the instruction to blame and the kind of field, to tell one divergence from another
+static std::string divergenceSignature(uint32_t candidate, const divergence_t *d, uint32_t blame) {
+	char pattern[8] = "none";
+	if (d->windowSize) opcodePattern(d->window[blame][1], pattern, sizeof pattern);
+	return std::string(candidateName(candidate)) + " " + pattern + " " + d->kind;
+}
+
+// Records a signature, returns how many there are with it or 0 when it was already seen
+static size_t claimSignature(fuzz_shared_t *shared, const std::string &signature) {
+	std::lock_guard<std::mutex> guard(shared->lock);
+	for (const std::string &seen : shared->signatures)
+		if (seen == signature) return 0;
+	shared->signatures.push_back(signature);
+	return shared->signatures.size();
+}
+
+// Replaces ever smaller chunks of the program with 0000 while candidate still diverges on the same kind of field,
+// returns the reruns taken
+static uint32_t minimizeCase(fuzz_worker_t *worker, fuzz_case_t *c, uint32_t candidate, divergence_t *d) {
+	divergence_t trial[CANDIDATE_COUNT];
+	uint8_t saved[MAX_PROGRAM];
+	uint32_t runs = 0;
+	const uint32_t words = c->size / 2;
+	for (uint32_t chunk = words / 2 ? words / 2 : 1; runs < MAX_MINIMIZE_RUNS; chunk /= 2) {
+		for (uint32_t start = 0; start < words && runs < MAX_MINIMIZE_RUNS; start += chunk) {
+			const uint32_t count = chunk < words - start ? chunk : words - start;
+			memcpy(saved, &c->program[2 * start], 2 * count);
+			bool blank = true;
+			for (uint32_t i = 0; i < 2 * count; i++) blank &= saved[i] == 0;
+			if (blank) continue;
+			memset(&c->program[2 * start], 0, 2 * count);
+
+			uint64_t executed;
+			runs++;
+			if (runCase(worker, c, 1u << candidate, trial, &executed) && !strcmp(trial[candidate].kind, d->kind)) {
+				*d = trial[candidate];
+				c->insts = (uint32_t)d->executed;
+			}
+			else memcpy(&c->program[2 * start], saved, 2 * count);
+		}
+		if (chunk == 1) break;
+	}
+	return runs;
+}
+
+static void printWindow(const divergence_t *d) {
+	printf("  window it showed up after:");
+	for (uint32_t i = 0; i < d->windowSize; i++) printf(" %04X@%04X", d->window[i][1], d->window[i][0]);
+	printf("\n");
+}
+
+// Prints a new divergence with its program and writes the rom and its starting state to outDir
+static void reportDivergence(fuzz_shared_t *shared, fuzz_worker_t *worker, uint32_t candidate, const fuzz_case_t *c,
+							 const divergence_t *d, uint32_t blame, const std::string &signature, size_t number, uint32_t runs) {
+	char base[1024];
+	snprintf(base, sizeof base, "%s/%s-%s-%zu", shared->outDir, candidateName(candidate), quirksName(c->quirks), number);
+	std::string romPath = std::string(base) + ".ch8";
+	std::string statePath = std::string(base) + ".state";
+	FILE *rom = fopen(romPath.c_str(), "wb");
+	const bool wroteRom = rom && fwrite(c->program, 1, c->size, rom) == c->size;
+	if (rom) fclose(rom);
+	// The state holds the random memory and registers the program starts from
+	config_t config;
+	setDefaultConfig(&config);
+	config.quirks = c->quirks;
+	buildImage(worker->image, c);
+	setupMachine(worker->reference, &config, c->seed, worker->image);
+	const bool wroteState = saveState(worker->reference, statePath.c_str());
+
+	std::lock_guard<std::mutex> guard(shared->lock);
+	printf("DIVERGENCE %s (quirks %s, seed 0x%016llx): %s is 0x%llX, reference 0x%llX, after %llu instructions\n",
+		candidateName(candidate), quirksName(c->quirks), (unsigned long long)c->seed, d->field, (unsigned long long)d->candidate,
+		(unsigned long long)d->reference, (unsigned long long)d->executed);
+	printf("  %s, first wrong after %04X@%04X\n", signature.c_str(), d->window[blame][1], d->window[blame][0]);
+	if (wroteRom && wroteState) {
+		printf("  minimized in %u runs, starts from %s, replay with: fuzz -replay %s -seed 0x%016llx -quirks %s -insts %u -engine %s\n",
+			runs, statePath.c_str(), romPath.c_str(), (unsigned long long)c->seed, quirksName(c->quirks), c->insts, candidateName(candidate));
+	}
+	else printf("  minimized in %u runs, could not write %s\n", runs, base);
+
+	printWindow(d);
+	printf("  program (0000 left out):\n");
+	for (uint32_t w = 0; w < c->size / 2; w++) {
+		const uint16_t opcode = (c->program[2 * w] << 8) | c->program[2 * w + 1];
+		if (!opcode) continue;
+		char text[32];
+		disassemble(opcode, text, sizeof text);
+		printf("    0x%04X  %04X  %s\n", ENTRY_POINT + 2 * w, opcode, text);
+	}
+	fflush(stdout);
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+
+static bool createWorker(fuzz_worker_t *worker, uint32_t engines) {
+	worker->reference = (chip8_t *)calloc(1, sizeof(chip8_t));
+	worker->image = (uint8_t *)malloc(MEMORY_SIZE - ENTRY_POINT);
+	bool ok = worker->reference && worker->image;
+	for (uint32_t e = 0; e < CANDIDATE_COUNT && ok; e++) {
+		if (!(engines >> e & 1)) continue;
+		chip8_t *chip8 = worker->machines[e] = (chip8_t *)calloc(1, sizeof(chip8_t));
+		if (!chip8) ok = false;
+		else if (e == CANDIDATE_BATCH) ok = (worker->batch = createBatch(BATCH_LANES)) != NULL;
+		else if (candidateEngine(e) == ENGINE_CACHED) ok = (chip8->cache = createDecodeCache()) != NULL;
+		else if (candidateEngine(e) == ENGINE_JIT) ok = (chip8->jit = createJit()) != NULL;
+	}
+	return ok;
+}
+
+static void destroyWorker(fuzz_worker_t *worker) {
+	destroyBatch(worker->batch);
+	for (uint32_t e = 0; e < CANDIDATE_COUNT; e++) {
+		if (!worker->machines[e]) continue;
+		destroyDecodeCache(worker->machines[e]->cache);
+		destroyJit(worker->machines[e]->jit);
+		free(worker->machines[e]);
+	}
+	free(worker->image);
+	free(worker->reference);
+}
+
+static void worker(fuzz_shared_t *shared, uint32_t self) {
+	fuzz_worker_t worker = {};
+	worker.rng = shared->seed ^ (0xD1B54A32D192ED03ull * (self + 1));
+	const bool ok = createWorker(&worker, shared->engines);
+
+	fuzz_case_t *c = (fuzz_case_t *)calloc(1, sizeof(fuzz_case_t));
+	fuzz_case_t *failing = (fuzz_case_t *)malloc(sizeof(fuzz_case_t));
+	divergence_t diverged[CANDIDATE_COUNT];
+	if (!ok || !c || !failing) {
+		fprintf(stderr, "Worker %u could not allocate its machines\n", self);
+		shared->stop = true;
+	}
+
+	while (!shared->stop) {
+		// Half fresh programs, the rest mutations of a seed rom or of the last program
+		const uint64_t r = nextWord(&worker.rng);
+		if (!c->size || (r & 1)) randomProgram(&worker.rng, c);
+		else {
+			if ((r & 2) && !shared->seeds.empty()) {
+				const std::vector<uint8_t> &seed = shared->seeds[(r >> 8) % shared->seeds.size()];
+				c->size = (uint32_t)(seed.size() < MAX_PROGRAM ? seed.size() : MAX_PROGRAM) & ~1u;
+				memcpy(c->program, seed.data(), c->size);
+			}
+			if (c->size) mutateProgram(&worker.rng, c);
+			else randomProgram(&worker.rng, c);
+		}
+		c->seed = nextWord(&worker.rng);
+		c->quirks = shared->allQuirks ? (quirk_profile_t)((r >> 32) % QUIRKS_COUNT) : shared->quirks;
+		c->insts = shared->insts;
+
+		uint64_t executed;
+		const uint32_t failed = runCase(&worker, c, shared->engines, diverged, &executed);
+		shared->execs++;
+		shared->instructions += executed;
+		for (uint32_t e = 0; e < CANDIDATE_COUNT; e++) {
+			if (!(failed >> e & 1)) continue;
+			shared->divergences++;
+			// Only a new kind of divergence is worth minimizing
+			memcpy(failing, c, sizeof *failing);
+			divergence_t *d = &diverged[e];
+			const std::string signature = divergenceSignature(e, d, locateDivergence(&worker, failing, e, d));
+			const size_t number = claimSignature(shared, signature);
+			if (!number) continue;
+			const uint32_t runs = minimizeCase(&worker, failing, e, d);
+			const uint32_t blame = locateDivergence(&worker, failing, e, d);
+			reportDivergence(shared, &worker, e, failing, d, blame, signature, number, runs);
+		}
+	}
+
+	free(failing);
+	free(c);
+	destroyWorker(&worker);
+}
+
+// Reruns a case as the fuzzer printed it on each engine and lists every field the engine gets wrong
+static int replayCase(const char *romPath, uint32_t engines, quirk_profile_t quirks, uint32_t insts, uint64_t seed) {
+	fuzz_case_t *c = (fuzz_case_t *)calloc(1, sizeof(fuzz_case_t));
+	fuzz_worker_t worker = {};
+	if (!c || !createWorker(&worker, engines)) {
+		fprintf(stderr, "Could not allocate the machines\n");
+		free(c);
+		destroyWorker(&worker);
+		return 1;
+	}
+	FILE *rom = fopen(romPath, "rb");
+	if (rom) {
+		c->size = (uint32_t)fread(c->program, 1, MAX_PROGRAM, rom) & ~1u;
+		fclose(rom);
+	}
+	if (!c->size) {
+		fprintf(stderr, "Could not read %s\n", romPath);
+		free(c);
+		destroyWorker(&worker);
+		return 1;
+	}
+	c->seed = seed;
+	c->quirks = quirks;
+	c->insts = insts;
+
+	// One engine at a time, so the reference is left where that engine diverged
+	uint32_t diverged = 0;
+	for (uint32_t e = 0; e < CANDIDATE_COUNT; e++) {
+		if (!(engines >> e & 1)) continue;
+		divergence_t d[CANDIDATE_COUNT];
+		uint64_t executed;
+		if (!runCase(&worker, c, 1u << e, d, &executed)) {
+			printf("%s matches the reference over %llu instructions\n", candidateName(e), (unsigned long long)executed);
+			continue;
+		}
+		diverged |= 1u << e;
+		printf("%s diverges after %llu instructions, quirks %s\n", candidateName(e), (unsigned long long)executed,
+			quirksName(quirks));
+		printWindow(&d[e]);
+		printf("  fields that differ:\n");
+		compareMachines(worker.reference, worker.machines[e], &d[e], true);
+	}
+	fflush(stdout);
+	free(c);
+	destroyWorker(&worker);
+	return diverged ? 1 : 0;
+}
+
+
+// Every .ch8 in the directory, to mutate
+static bool loadSeeds(const char *romDir, std::vector<std::vector<uint8_t>> &seeds) {
+	std::error_code error;
+	for (const auto &entry : std::filesystem::directory_iterator(romDir, error)) {
+		if (!entry.is_regular_file() || entry.path().extension() != ".ch8") continue;
+		FILE *f = fopen(entry.path().string().c_str(), "rb");
+		if (!f) continue;
+		std::vector<uint8_t> rom(MAX_PROGRAM);
+		rom.resize(fread(rom.data(), 1, rom.size(), f));
+		fclose(f);
+		if (rom.size() >= 2) seeds.push_back(rom);
+	}
+	if (error) fprintf(stderr, "Could not read rom directory %s: %s\n", romDir, error.message().c_str());
+	return !error;
+}
+
+int main(int argc, char **argv) {
+	static fuzz_shared_t shared;
+	shared.engines = (1u << CANDIDATE_COUNT) - 1;
+	shared.allQuirks = true;
+	shared.insts = 1000;
+	shared.seed = 1;
+	shared.outDir = ".";
+	uint32_t threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+	uint64_t seconds = 60;
+
+	const char *replay = NULL;
+	int first = 1;
+	const char *romDir = argc > 1 && argv[1][0] != '-' ? argv[first++] : NULL;
+	for (int i = first; i < argc; i++) {
+		uint32_t candidate;
+		if (!strcmp(argv[i], "-engine") && i + 1 < argc && !strcmp(argv[i + 1], "all")) i++;
+		else if (!strcmp(argv[i], "-engine") && i + 1 < argc && parseCandidate(argv[i + 1], &candidate)) {
+			shared.engines = 1u << candidate;
+			i++;
+		}
+		else if (!strcmp(argv[i], "-quirks") && i + 1 < argc && !strcmp(argv[i + 1], "all")) i++;
+		else if (!strcmp(argv[i], "-quirks") && i + 1 < argc && parseQuirks(argv[i + 1], &shared.quirks)) {
+			shared.allQuirks = false;
+			i++;
+		}
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc) threads = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-seconds") && i + 1 < argc) seconds = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-insts") && i + 1 < argc) shared.insts = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-seed") && i + 1 < argc) shared.seed = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-out") && i + 1 < argc) shared.outDir = argv[++i];
+		else if (!strcmp(argv[i], "-replay") && i + 1 < argc) replay = argv[++i];
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	if (replay) {
+		if (romDir || shared.allQuirks) {
+			printUsage();
+			return 1;
+		}
+		return replayCase(replay, shared.engines, shared.quirks, shared.insts, shared.seed);
+	}
+	if (threads == 0) threads = 1;
+	if (romDir && !loadSeeds(romDir, shared.seeds)) return 1;
+	std::error_code error;
+	std::filesystem::create_directories(shared.outDir, error);
+
+	printf("fuzzing");
+	for (uint32_t e = 0; e < CANDIDATE_COUNT; e++)
+		if (shared.engines >> e & 1) printf(" %s", candidateName(e));
+	printf(" against the reference, %s quirks, %u threads, %zu seed roms\n",
+		shared.allQuirks ? "all" : quirksName(shared.quirks), threads, shared.seeds.size());
+	fflush(stdout);
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (uint32_t t = 0; t < threads; t++) pool.emplace_back(worker, &shared, t);
+
+	double elapsed = 0;
+	uint64_t lastExecs = 0;
+	double lastReport = 0;
+	while (!shared.stop) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (seconds && elapsed >= seconds) shared.stop = true;
+		if (elapsed - lastReport >= PROGRESS_SECONDS || shared.stop) {
+			std::lock_guard<std::mutex> guard(shared.lock);
+			const uint64_t execs = shared.execs;
+			printf("[%6.0f s] %12llu execs, %9.0f execs/s, %8.2f M instructions/s, %llu divergences (%zu distinct)\n",
+				elapsed, (unsigned long long)execs, (execs - lastExecs) / (elapsed - lastReport),
+				shared.instructions / elapsed / 1e6, (unsigned long long)shared.divergences.load(), shared.signatures.size());
+			fflush(stdout);
+			lastExecs = execs;
+			lastReport = elapsed;
+		}
+	}
+	for (std::thread &thread : pool) thread.join();
+
+	printf("%llu execs in %.1f s, %.0f execs/s, %llu divergences (%zu distinct)\n", (unsigned long long)shared.execs.load(),
+		elapsed, shared.execs / elapsed, (unsigned long long)shared.divergences.load(), shared.signatures.size());
+	return shared.divergences ? 1 : 0;
+}
@@ -0,0 +1,502 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "gdbstub.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define GDB_REGISTERS 21	// V0-VF, I, pc, sp, dt, st
+#define INPUT_CLOSED -1		// readByte: gdb went away
+#define INPUT_NONE -2		// readByte: nothing has arrived
+
+static const char *const registerNames[GDB_REGISTERS] = {
+	"v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "v8", "v9", "va", "vb", "vc", "vd", "ve", "vf",
+	"i", "pc", "sp", "dt", "st",
+};
+
+// What handlePacket wants done once the packet is dealt with
+typedef enum {
+	GDB_REPLY,		// Send the reply and wait for the next packet
+	GDB_RESUME,		// Let the machine run, the stop reply comes when it stops
+	GDB_DETACH,		// Reply, then let the machine run with gdb gone
+	GDB_KILL,		// Stop the machine for good, no reply
+} gdb_action_t;
+
+
+// address is a port number on 127.0.0.1, or a Unix socket path when it has a / in it
+// Waits for gdb to connect, NULL if the socket couldn't be set up
+gdb_stub_t *createGdbStub(const char *address) {
+	const bool unixSocket = strchr(address, '/') != NULL;
+	const int listener = socket(unixSocket ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+	if (listener < 0) {
+		fprintf(stderr, "Could not create a socket for gdb: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	bool bound;
+	if (unixSocket) {
+		struct sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if (strlen(address) >= sizeof addr.sun_path) {
+			fprintf(stderr, "Socket path %s is too long\n", address);
+			close(listener);
+			return NULL;
+		}
+		strcpy(addr.sun_path, address);
+		bound = bind(listener, (struct sockaddr *)&addr, sizeof addr) == 0;
+	}
+	else {
+		char *end;
+		const unsigned long port = strtoul(address, &end, 10);
+		if (*end || !port || port > 65535) {
+			fprintf(stderr, "gdb port %s should be 1 to 65535, or a socket path\n", address);
+			close(listener);
+			return NULL;
+		}
+		// Only this machine can connect, the stub can read and write anything in the emulator
+		const int on = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t)port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bound = bind(listener, (struct sockaddr *)&addr, sizeof addr) == 0;
+	}
+	if (!bound || listen(listener, 1) != 0) {
+		fprintf(stderr, "Could not listen on %s: %s\n", address, strerror(errno));
+		close(listener);
+		return NULL;
+	}
+
+	fprintf(stderr, "Waiting for gdb on %s\n", address);
+	const int fd = accept(listener, NULL, NULL);
+	close(listener);
+	if (fd < 0) {
+		fprintf(stderr, "Could not accept gdb's connection: %s\n", strerror(errno));
+		if (unixSocket) unlink(address);
+		return NULL;
+	}
+	if (!unixSocket) {
+		// Packets are small and every one waits for an answer
+		const int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+	}
+
+	gdb_stub_t *stub = (gdb_stub_t *)calloc(1, sizeof(gdb_stub_t));
+	if (!stub) {
+		close(fd);
+		return NULL;
+	}
+	stub->fd = fd;
+	stub->unixPath = unixSocket ? strdup(address) : NULL;
+	return stub;
+}
+
+
+void destroyGdbStub(gdb_stub_t *stub) {
+	if (!stub) return;
+	close(stub->fd);
+	if (stub->unixPath) unlink(stub->unixPath);
+	free(stub->unixPath);
+	free(stub);
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+// Packet framing: $data#checksum, each packet acknowledged with + (or - to ask for it again) until
+// QStartNoAckMode. A lone 0x03 outside a packet is Ctrl-C.
+
+// Next received byte, INPUT_CLOSED once gdb went away and INPUT_NONE if wait is false and nothing has arrived
+static int readByte(gdb_stub_t *stub, bool wait) {
+	if (stub->inputStart == stub->inputEnd) {
+		struct pollfd ready = { stub->fd, POLLIN, 0 };
+		if (!wait && poll(&ready, 1, 0) == 0) return INPUT_NONE;
+		const ssize_t received = recv(stub->fd, stub->input, sizeof stub->input, 0);
+		if (received <= 0) return INPUT_CLOSED;
+		stub->inputStart = 0;
+		stub->inputEnd = (uint32_t)received;
+	}
+	return (uint8_t)stub->input[stub->inputStart++];
+}
+
+static bool sendAll(gdb_stub_t *stub, const char *data, size_t length) {
+	while (length) {
+		const ssize_t sent = send(stub->fd, data, length, MSG_NOSIGNAL);
+		if (sent <= 0) return false;
+		data += sent;
+		length -= sent;
+	}
+	return true;
+}
+
+static int hexValue(int c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// Reads the next packet's data into out, NUL terminated, skipping acks and asking again for corrupt ones
+// Returns 1 for a packet, 0 for a Ctrl-C and -1 once gdb went away
+static int readPacket(gdb_stub_t *stub, char *out) {
+	for (;;) {
+		int c = readByte(stub, true);
+		if (c < 0) return -1;
+		if (c == 0x03) return 0;
+		if (c != '$') continue;
+
+		uint32_t length = 0;
+		uint8_t sum = 0;
+		while ((c = readByte(stub, true)) >= 0 && c != '#') {
+			if (length < GDB_PACKET_SIZE - 1) out[length++] = (char)c;
+			sum += (uint8_t)c;
+		}
+		const int high = c < 0 ? c : readByte(stub, true);
+		const int low = high < 0 ? high : readByte(stub, true);
+		if (low < 0) return -1;
+		out[length] = 0;
+		if (stub->noAck) return 1;
+		const bool intact = hexValue(high) * 16 + hexValue(low) == sum;
+		if (!sendAll(stub, intact ? "+" : "-", 1)) return -1;
+		if (intact) return 1;
+	}
+}
+
+// Sends data as a packet, resending it until gdb acknowledges it
+static bool sendPacket(gdb_stub_t *stub, const char *data) {
+	static char frame[GDB_PACKET_SIZE + 4];
+	const size_t length = strlen(data);
+	uint8_t sum = 0;
+	for (size_t i = 0; i < length; i++) sum += (uint8_t)data[i];
+	frame[0] = '$';
+	memcpy(frame + 1, data, length);
+	snprintf(frame + 1 + length, 4, "#%02x", sum);
+
+	for (;;) {
+		if (!sendAll(stub, frame, length + 4)) return false;
+		if (stub->noAck) return true;
+		int c;
+		while ((c = readByte(stub, true)) >= 0 && c != '+' && c != '-');
+		if (c < 0) return false;
+		if (c == '+') return true;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+// Requests
+
+// Hex number at *text, leaves *text on the first character after it
+static uint32_t parseHex(const char **text) {
+	uint32_t value = 0;
+	for (int digit; (digit = hexValue(**text)) >= 0; (*text)++) value = (value << 4) | digit;
+	return value;
+}
+
+// Writes value as bytes * 2 hex digits, most significant first, and returns where they end
+static char *putHex(char *out, uint32_t value, uint32_t bytes) {
+	for (uint32_t i = bytes * 2; i-- > 0;) *out++ = "0123456789abcdef"[(value >> (4 * i)) & 0xF];
+	*out = 0;
+	return out;
+}
+
+static uint32_t registerSize(uint32_t n) {
+	return n == 16 || n == 17 ? 2 : 1;
+}
+
+static uint32_t readRegister(const chip8_t *chip8, uint32_t n) {
+	if (n < 16) return chip8->V[n];
+	switch (n) {
+		case 16: return chip8->I;
+		case 17: return chip8->pc;
+		case 18: return chip8->sp;
+		case 19: return chip8->delay_timer;
+		default: return chip8->sound_timer;
+	}
+}
+
+// False if the value doesn't fit, sp can't point past the 12 entry stack
+static bool writeRegister(chip8_t *chip8, uint32_t n, uint32_t value) {
+	if (n < 16) chip8->V[n] = (uint8_t)value;
+	else if (n == 16) chip8->I = (uint16_t)value;
+	else if (n == 17) chip8->pc = (uint16_t)value;
+	else if (n == 18) {
+		if (value > sizeof chip8->stack / sizeof chip8->stack[0]) return false;
+		chip8->sp = (uint16_t)value;
+	}
+	else if (n == 19) chip8->delay_timer = (uint8_t)value;
+	else chip8->sound_timer = (uint8_t)value;
+	return true;
+}
+
+// Reads a register value written by putHex, false if the digits are short
+static bool parseRegister(const char **text, uint32_t bytes, uint32_t *value) {
+	*value = 0;
+	for (uint32_t i = 0; i < bytes * 2; i++) {
+		const int digit = hexValue((*text)[i]);
+		if (digit < 0) return false;
+		*value = (*value << 4) | digit;
+	}
+	*text += bytes * 2;
+	return true;
+}
+
+// The register layout, so gdb needs no CHIP-8 support built in to name them
+static size_t targetDescription(char *out, size_t size) {
+	size_t length = snprintf(out, size, "<?xml version=\"1.0\"?>\n<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+										"<target version=\"1.0\">\n<feature name=\"org.chip8.core\">\n");
+	for (uint32_t n = 0; n < GDB_REGISTERS && length < size; n++) {
+		const char *type = n == 16 ? "data_ptr" : n == 17 ? "code_ptr" : "uint8";
+		length += snprintf(out + length, size - length, "<reg name=\"%s\" bitsize=\"%u\" type=\"%s\" regnum=\"%u\"/>\n",
+						   registerNames[n], registerSize(n) * 8, type, n);
+	}
+	if (length < size) length += snprintf(out + length, size - length, "</feature>\n</target>\n");
+	return length < size ? length : size - 1;
+}
+
+static void stopReply(const debug_t *debug, char *reply, size_t size) {
+	switch (debug->stop) {
+		case STOP_INTERRUPT: snprintf(reply, size, "S02"); break;
+		case STOP_WATCH_READ: snprintf(reply, size, "T05rwatch:%x;", debug->stopAddress); break;
+		case STOP_WATCH_WRITE: snprintf(reply, size, "T05watch:%x;", debug->stopAddress); break;
+		case STOP_WATCH_ACCESS: snprintf(reply, size, "T05awatch:%x;", debug->stopAddress); break;
+		default: snprintf(reply, size, "S05"); break;
+	}
+}
+
+// Z and z: type 0 and 1 are breakpoints, 2 write, 3 read and 4 access watchpoints, kind is the length watched
+static bool setPoint(debug_t *debug, const char *args, bool set) {
+	const uint32_t type = parseHex(&args);
+	if (*args++ != ',') return false;
+	const uint32_t addr = parseHex(&args);
+	if (*args++ != ',' || addr >= MEMORY_SIZE || type > 4) return false;
+	const uint32_t kind = parseHex(&args);
+	if (type <= 1) setBreakpoint(debug, (uint16_t)addr, set);
+	else setWatchpoint(debug, (uint16_t)addr, kind ? kind : 1, type != 2, type != 3, set);
+	return true;
+}
+
+// qXfer:features:read:target.xml:offset,length, answered a slice at a time
+static void readFeatures(const char *args, char *reply, size_t size) {
+	static char xml[2048];
+	static size_t xmlLength;
+	if (!xmlLength) xmlLength = targetDescription(xml, sizeof xml);
+	if (strncmp(args, "target.xml:", 11)) {
+		snprintf(reply, size, "E00");
+		return;
+	}
+	args += 11;
+	const uint32_t offset = parseHex(&args);
+	if (*args++ != ',') {
+		snprintf(reply, size, "E00");
+		return;
+	}
+	uint32_t length = parseHex(&args);
+	if (offset >= xmlLength) {
+		snprintf(reply, size, "l");
+		return;
+	}
+	if (length > xmlLength - offset) length = (uint32_t)(xmlLength - offset);
+	if (length > size - 2) length = (uint32_t)(size - 2);
+	reply[0] = offset + length < xmlLength ? 'm' : 'l';
+	memcpy(reply + 1, xml + offset, length);
+	reply[1 + length] = 0;
+}
+
+// Handles one packet while the machine is stopped, leaving any reply in reply
+static gdb_action_t handlePacket(gdb_stub_t *stub, chip8_t *chip8, const config_t *config, const char *packet, char *reply, size_t size) {
+	const char *args = packet + 1;
+	reply[0] = 0;	// Empty reply, what gdb expects for anything the stub doesn't support
+
+	switch (packet[0]) {
+		case '?':
+			stopReply(&stub->debug, reply, size);
+			return GDB_REPLY;
+
+		case 'g': {
+			char *out = reply;
+			for (uint32_t n = 0; n < GDB_REGISTERS; n++) out = putHex(out, readRegister(chip8, n), registerSize(n));
+			return GDB_REPLY;
+		}
+
+		case 'G':
+			for (uint32_t n = 0; n < GDB_REGISTERS; n++) {
+				uint32_t value;
+				if (!parseRegister(&args, registerSize(n), &value) || !writeRegister(chip8, n, value)) {
+					snprintf(reply, size, "E01");
+					return GDB_REPLY;
+				}
+			}
+			snprintf(reply, size, "OK");
+			return GDB_REPLY;
+
+		case 'p': {
+			const uint32_t n = parseHex(&args);
+			if (n >= GDB_REGISTERS) snprintf(reply, size, "E01");
+			else putHex(reply, readRegister(chip8, n), registerSize(n));
+			return GDB_REPLY;
+		}
+
+		case 'P': {
+			const uint32_t n = parseHex(&args);
+			uint32_t value;
+			const bool ok = n < GDB_REGISTERS && *args++ == '=' && parseRegister(&args, registerSize(n), &value) &&
+							writeRegister(chip8, n, value);
+			snprintf(reply, size, ok ? "OK" : "E01");
+			return GDB_REPLY;
+		}
+
+		case 'm': {
+			// Reads past the end of memory come back short
+			const uint32_t addr = parseHex(&args);
+			uint32_t length = *args++ == ',' ? parseHex(&args) : 0;
+			if (addr >= MEMORY_SIZE || !length) {
+				snprintf(reply, size, "E01");
+				return GDB_REPLY;
+			}
+			if (length > MEMORY_SIZE - addr) length = MEMORY_SIZE - addr;
+			if (length > (size - 1) / 2) length = (uint32_t)((size - 1) / 2);
+			char *out = reply;
+			for (uint32_t i = 0; i < length; i++) out = putHex(out, chip8->memory[addr + i], 1);
+			return GDB_REPLY;
+		}
+
+		case 'M': {
+			// Written through writeMemory, so cached decodes and translated blocks of the bytes are dropped
+			const uint32_t addr = parseHex(&args);
+			const uint32_t length = *args++ == ',' ? parseHex(&args) : 0;
+			if (*args++ != ':' || addr + length > MEMORY_SIZE || strlen(args) != length * 2) {
+				snprintf(reply, size, "E01");
+				return GDB_REPLY;
+			}
+			for (uint32_t i = 0; i < length; i++) {
+				uint32_t value;
+				if (!parseRegister(&args, 1, &value)) {
+					snprintf(reply, size, "E01");
+					return GDB_REPLY;
+				}
+				writeMemory(chip8, (uint16_t)(addr + i), (uint8_t)value);
+			}
+			snprintf(reply, size, "OK");
+			return GDB_REPLY;
+		}
+
+		case 'c':
+		case 's':
+			// An address resumes from there instead of pc
+			if (*args) chip8->pc = (uint16_t)parseHex(&args);
+			if (packet[0] == 'c') return GDB_RESUME;
+			stepDebug(&stub->debug, chip8, config);
+			stopReply(&stub->debug, reply, size);
+			return GDB_REPLY;
+
+		case 'v':
+			if (!strcmp(packet, "vCont?")) snprintf(reply, size, "vCont;c;C;s;S");
+			else if (!strncmp(packet, "vCont;", 6)) {
+				// One thread, so the first action is the one for it, signals are ignored
+				const char action = packet[6];
+				if (action == 'c' || action == 'C') return GDB_RESUME;
+				if (action == 's' || action == 'S') {
+					stepDebug(&stub->debug, chip8, config);
+					stopReply(&stub->debug, reply, size);
+				}
+				else snprintf(reply, size, "E01");
+			}
+			else if (!strncmp(packet, "vKill", 5)) return GDB_KILL;
+			return GDB_REPLY;
+
+		case 'Z':
+		case 'z':
+			snprintf(reply, size, setPoint(&stub->debug, args, packet[0] == 'Z') ? "OK" : "E01");
+			return GDB_REPLY;
+
+		case 'q':
+			if (!strncmp(packet, "qSupported", 10)) {
+				snprintf(reply, size, "PacketSize=%x;QStartNoAckMode+;qXfer:features:read+;vContSupported+", GDB_PACKET_SIZE);
+			}
+			else if (!strncmp(packet, "qXfer:features:read:", 20)) readFeatures(packet + 20, reply, size);
+			else if (!strcmp(packet, "qAttached")) snprintf(reply, size, "1");
+			else if (!strcmp(packet, "qC")) snprintf(reply, size, "QC1");
+			else if (!strcmp(packet, "qfThreadInfo")) snprintf(reply, size, "m1");
+			else if (!strcmp(packet, "qsThreadInfo")) snprintf(reply, size, "l");
+			return GDB_REPLY;
+
+		case 'Q':
+			if (!strcmp(packet, "QStartNoAckMode")) snprintf(reply, size, "OK");
+			return GDB_REPLY;
+
+		case 'H':
+		case 'T':
+			// Thread selection and liveness, there is only thread 1
+			snprintf(reply, size, "OK");
+			return GDB_REPLY;
+
+		case 'D':
+			snprintf(reply, size, "OK");
+			return GDB_DETACH;
+
+		case 'k':
+			return GDB_KILL;
+
+		default:
+			return GDB_REPLY;
+	}
+}
+
+
+// Call once a frame on the emulation thread, false once gdb detached, killed the machine or went away
+// Reports a breakpoint or watchpoint the last frame stopped at, or stops the machine for a Ctrl-C, then
+// serves gdb until it resumes the machine. On return the machine is running, paused while gdb holds it
+bool serveGdb(gdb_stub_t *stub, chip8_t *chip8, const config_t *config) {
+	static char packet[GDB_PACKET_SIZE];
+	static char reply[GDB_PACKET_SIZE];
+
+	if (stub->running) {
+		if (stub->debug.stop == STOP_NONE) {
+			// In all-stop mode gdb sends nothing but Ctrl-C while the machine runs
+			const int c = readByte(stub, false);
+			if (c == INPUT_CLOSED) return false;
+			if (c != 0x03) return true;
+			haltDebug(&stub->debug, chip8, STOP_INTERRUPT, chip8->pc);
+		}
+		stub->running = false;
+		stopReply(&stub->debug, reply, sizeof reply);
+		if (!sendPacket(stub, reply)) return false;
+	}
+	// Just connected, gdb expects to find the machine stopped
+	else if (chip8->state != PAUSE) haltDebug(&stub->debug, chip8, STOP_STEP, chip8->pc);
+
+	for (;;) {
+		const int got = readPacket(stub, packet);
+		if (got < 0) return false;
+		if (got == 0) continue;		// Ctrl-C with the machine already stopped
+
+		switch (handlePacket(stub, chip8, config, packet, reply, sizeof reply)) {
+			case GDB_REPLY:
+				if (!sendPacket(stub, reply)) return false;
+				if (!strcmp(packet, "QStartNoAckMode")) stub->noAck = true;
+				break;
+			case GDB_RESUME:
+				stub->running = true;
+				resumeDebug(&stub->debug, chip8);
+				return true;
+			case GDB_DETACH:
+				sendPacket(stub, reply);
+				resumeDebug(&stub->debug, chip8);
+				return false;
+			case GDB_KILL:
+				chip8->state = QUIT;
+				return false;
+		}
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+#include "debug.h"
+
+// GDB remote serial protocol server for one machine, over a localhost TCP port or a Unix socket
+// gdb sees a single thread with registers V0-VF (8 bits), I and pc (16 bits, big endian like the machine's
+// words), sp, dt and st (8 bits), in that order, described by the target.xml it can read. It can read and
+// write memory, single step, continue, interrupt with Ctrl-C, and set breakpoints (Z0/Z1) and read, write
+// and access watchpoints (Z2/Z3/Z4) held in the stub's debug_t, which the frontend attaches to the machine.
+// The stub runs on the emulation thread: the frontend calls serveGdb once a frame, and while the machine is
+// stopped serveGdb blocks handling gdb's requests until gdb resumes it.
+
+#define GDB_PACKET_SIZE 4096	// Largest packet either side sends, PacketSize in qSupported
+
+typedef struct gdb_stub_t {
+	int fd;					// Connection to gdb
+	char *unixPath;			// Socket file to remove when done, NULL for TCP
+	bool noAck;				// QStartNoAckMode, neither side acknowledges packets any more
+	bool running;			// gdb resumed the machine and waits for a stop reply
+	char input[GDB_PACKET_SIZE];	// Received and not parsed yet
+	uint32_t inputStart, inputEnd;
+	debug_t debug;
+} gdb_stub_t;
+
+gdb_stub_t *createGdbStub(const char *address);
+void destroyGdbStub(gdb_stub_t *stub);
+bool serveGdb(gdb_stub_t *stub, chip8_t *chip8, const config_t *config);
+
+#endif
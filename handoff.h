@@ -0,0 +1,104 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <atomic>
+#include "chip8.h"
+
+// Lock free handoff between the emulation thread and the window thread
+// Finished frames go to the window through a triple buffer, input comes back through a single
+// producer/single consumer queue. Neither side ever waits on the other. Sound skips the window
+// thread entirely, see audio.h
+
+// What the window needs from one emulated frame
+typedef struct {
+	uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS];
+	bool hires;
+	float heat[HEAT_SLOTS];		// Profiler heatmap, only filled in when one is shown
+} frame_t;
+
+#define FRAME_FRESH 4			// Set in middle when it holds a frame the reader hasn't taken yet
+
+// The writer fills back and swaps it with middle, the reader swaps front with middle when there's a
+// fresh frame. The writer never blocks and the reader always gets the newest complete frame.
+typedef struct {
+	frame_t buffers[3];
+	alignas(64) std::atomic<uint8_t> middle;	// Buffer index | FRAME_FRESH
+	alignas(64) uint8_t back;				// Only touched by the writer
+	alignas(64) uint8_t front;				// Only touched by the reader
+} triple_buffer_t;
+
+static inline void initTripleBuffer(triple_buffer_t *buffer) {
+	buffer->back = 0;
+	buffer->middle.store(1, std::memory_order_relaxed);
+	buffer->front = 2;
+}
+
+// Frame the writer fills in next
+static inline frame_t *backFrame(triple_buffer_t *buffer) {
+	return &buffer->buffers[buffer->back];
+}
+
+static inline void publishFrame(triple_buffer_t *buffer) {
+	buffer->back = buffer->middle.exchange(buffer->back | FRAME_FRESH, std::memory_order_acq_rel) & 3;
+}
+
+// Newest frame published since the last call, NULL if there is none
+static inline const frame_t *takeFrame(triple_buffer_t *buffer) {
+	if (!(buffer->middle.load(std::memory_order_relaxed) & FRAME_FRESH)) return NULL;
+	buffer->front = buffer->middle.exchange(buffer->front, std::memory_order_acq_rel) & 3;
+	return &buffer->buffers[buffer->front];
+}
+
+
+typedef enum {
+	INPUT_KEYPAD,		// key went down or up
+	INPUT_QUIT,
+	INPUT_PAUSE,		// Toggles pause
+	INPUT_RESTART,
+	INPUT_REWIND,		// Rewind key went down or up
+	INPUT_SAVE_STATE,
+	INPUT_LOAD_STATE,
+	INPUT_TURBO,		// Toggles turbo
+	INPUT_TRACE,		// Toggles the instruction trace
+} input_type_t;
+
+typedef struct {
+	uint8_t type;		// input_type_t
+	uint8_t key;
+	bool down;
+} input_event_t;
+
+#define INPUT_QUEUE_SIZE 256	// Power of two
+
+typedef struct {
+	input_event_t events[INPUT_QUEUE_SIZE];
+	alignas(64) std::atomic<uint32_t> head;	// Next event to read, only advanced by the reader
+	alignas(64) std::atomic<uint32_t> tail;	// Next free slot, only advanced by the writer
+} input_queue_t;
+
+static inline void initInputQueue(input_queue_t *queue) {
+	queue->head.store(0, std::memory_order_relaxed);
+	queue->tail.store(0, std::memory_order_relaxed);
+}
+
+// False when the queue is full
+static inline bool pushInput(input_queue_t *queue, input_event_t event) {
+	const uint32_t tail = queue->tail.load(std::memory_order_relaxed);
+	if (tail - queue->head.load(std::memory_order_acquire) == INPUT_QUEUE_SIZE) return false;
+	queue->events[tail & (INPUT_QUEUE_SIZE - 1)] = event;
+	queue->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+// False when the queue is empty
+static inline bool popInput(input_queue_t *queue, input_event_t *event) {
+	const uint32_t head = queue->head.load(std::memory_order_relaxed);
+	if (head == queue->tail.load(std::memory_order_acquire)) return false;
+	*event = queue->events[head & (INPUT_QUEUE_SIZE - 1)];
+	queue->head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+#endif
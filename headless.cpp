@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "chip8.h"
+#include "batch.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "movie.h"
+#include "pacer.h"
+#include "runahead.h"
+#include "analysis.h"
+#include "gdbstub.h"
+
+// Headless runner: executes a rom with no window or audio, and no frame pacing unless -realtime
+// Usage: headless rom.ch8 [-frames N] [-insts N] [-ips N] [-seed N] [-engine NAME] [-quirks NAME] [-batch N] [-load FILE] [-save FILE] [-rewind KB] [-replay FILE] [-profile] [-trace FILE] [-tracesize N] [-runahead N] [-realtime] [-turbo N] [-noidle] [-analyze] [-gdb PORT|PATH] [-dump]
+
+
+static void printUsage(void) {
+	printf("Usage: headless chip8application [-frames N] [-insts N] [-ips N] [-seed N] [-engine NAME] [-quirks NAME] [-batch N] [-load FILE] [-save FILE] [-rewind KB] [-replay FILE] [-profile] [-trace FILE] [-tracesize N] [-runahead N] [-realtime] [-turbo N] [-noidle] [-analyze] [-gdb PORT|PATH] [-dump]\n"
+		   "  -frames N  Run N 60hz frames (default 600)\n"
+		   "  -insts N   Run exactly N instructions instead of a frame count\n"
+		   "  -ips N     Instructions per emulated second, sets the timer cadence (default 700)\n"
+		   "  -seed N    CXNN random seed (default 0)\n"
+		   "  -engine N  Instruction engine: switch, cached, jit or threaded (default switch)\n"
+		   "  -quirks N  Platform quirks: vip, chip48, schip or xochip (default vip)\n"
+		   "  -batch N   Run N copies of the rom in lockstep on the batch engine, copy n uses seed + n\n"
+		   "  -load F    Start from save state F instead of the rom's entry point\n"
+		   "  -save F    Write a save state to F after the run\n"
+		   "  -rewind K  Snapshot every frame into a K KB rewind history and report its cost\n"
+		   "  -replay F  Replay movie F at full speed, its seed, clock rate and length replace -seed, -ips and -frames\n"
+		   "  -profile   Count executions per address and print the hot spots, runs the reference interpreter\n"
+		   "  -trace F   Record every instruction and write the last -tracesize (default 65536) to F, see tracedump\n"
+		   "  -runahead N  Run N frames ahead after every frame like the window does, report the cost and how often\n"
+		   "             the frame shown matched the one really reached N frames later\n"
+		   "  -realtime  Pace frames at 60hz like the window does and report the achieved rate and jitter\n"
+		   "  -turbo N   With -realtime, run N emulated frames per paced frame, or as many as fit with max\n"
+		   "  -noidle    Run every instruction of timer polls and key waits instead of skipping them\n"
+		   "  -analyze   Print the rom's static analysis and listing, and any code the run rewrote\n"
+		   "  -gdb A     Wait for gdb on localhost port A, or Unix socket A if it has a /, and run under it until\n"
+		   "             it detaches or kills the machine, -frames and -insts don't apply\n"
+		   "  -dump      Print the final framebuffer\n");
+}
+
+static void dumpDisplay(const chip8_t *chip8) {
+	// Plane 1 only is '#', plane 2 only '+' and both '@'
+	for (uint32_t y = 0; y < displayHeight(chip8); y++) {
+		for (uint32_t x = 0; x < displayWidth(chip8); x++)
+			putchar(".#+@"[getPixel(chip8, x, y)]);
+		putchar('\n');
+	}
+}
+
+// Every copy starts from the same rom, copy n with seed + n, and all run the same instruction count
+static int runBatch(char *romName, const config_t *config, uint32_t batchSize, uint64_t frames, uint64_t insts, bool dump) {
+	chip8_t chip8 = {};
+	if (!initChip8(&chip8, config, romName)) return 1;
+
+	batch_t *batch = createBatch(batchSize);
+	if (!batch) {
+		fprintf(stderr, "Could not allocate a batch of %u machines\n", batchSize);
+		return 1;
+	}
+	if (!resetBatch(batch, &chip8)) {
+		fprintf(stderr, "Could not copy %s into the batch\n", romName);
+		destroyBatch(batch);
+		return 1;
+	}
+
+	uint64_t executed = 0, frame = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+	while (insts ? executed < insts : frame < frames) {
+		const uint64_t budget = frameInstructions(config, frame);
+		const uint64_t burst = insts && insts - executed < budget ? insts - executed : budget;
+		emulateBatch(batch, burst);
+		executed += burst;
+		if (burst < budget) break;
+		updateBatchTimers(batch);
+		frame++;
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Machines whose screen ended up the same as machine 0's
+	getBatchMachine(batch, 0, &chip8);
+	const uint64_t hash = hashDisplay(&chip8);
+	uint32_t matching = 1;
+	for (uint32_t lane = 1; lane < batch->count; lane++) {
+		chip8_t other;
+		getBatchMachine(batch, lane, &other);
+		matching += hashDisplay(&other) == hash;
+	}
+
+	const uint64_t machineSteps = batch->vectorSteps + batch->scalarSteps;
+	if (dump) dumpDisplay(&chip8);
+	printf("rom: %s\n", romName);
+	printf("machines: %u (%u lanes, %s)\n", batch->count, batch->stride, batch->avx2 ? "avx2" : "scalar");
+	printf("instructions: %llu per machine, %llu total\n", (unsigned long long)executed, (unsigned long long)(executed * batch->count));
+	printf("frames: %llu\n", (unsigned long long)frame);
+	printf("seconds: %.6f\n", seconds);
+	printf("MIPS: %.2f\n", seconds > 0 ? executed * batch->count / seconds / 1e6 : 0.0);
+	printf("vector share: %.1f%%\n", machineSteps ? 100.0 * batch->vectorSteps / machineSteps : 0.0);
+	printf("display hash: %016llx (machine 0, %u of %u match)\n", (unsigned long long)hash, matching, batch->count);
+	destroyBatch(batch);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printUsage();
+		return 1;
+	}
+
+	config_t config;
+	setDefaultConfig(&config);
+
+	uint64_t frames = 600;
+	uint64_t insts = 0;		// 0 = run by frame count
+	uint32_t batchSize = 0;	// 0 = single machine on config.engine
+	bool dump = false;
+	bool realtime = false;
+	bool turbo = false;
+	bool analyze = false;
+	const char *loadPath = NULL;
+	const char *savePath = NULL;
+	const char *replayPath = NULL;
+	const char *gdbAddress = NULL;
+	config.rewindSize = 0;	// Only measured when asked for
+
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "-frames") && i + 1 < argc) frames = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-insts") && i + 1 < argc) insts = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-ips") && i + 1 < argc) config.instPerSec = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-seed") && i + 1 < argc) config.rngSeed = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-engine") && i + 1 < argc && parseEngine(argv[i + 1], &config.engine)) i++;
+		else if (!strcmp(argv[i], "-quirks") && i + 1 < argc && parseQuirks(argv[i + 1], &config.quirks)) i++;
+		else if (!strcmp(argv[i], "-batch") && i + 1 < argc) batchSize = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-load") && i + 1 < argc) loadPath = argv[++i];
+		else if (!strcmp(argv[i], "-save") && i + 1 < argc) savePath = argv[++i];
+		else if (!strcmp(argv[i], "-rewind") && i + 1 < argc) config.rewindSize = strtoul(argv[++i], NULL, 0) << 10;
+		else if (!strcmp(argv[i], "-replay") && i + 1 < argc) replayPath = argv[++i];
+		else if (!strcmp(argv[i], "-profile")) config.profile = true;
+		else if (!strcmp(argv[i], "-trace") && i + 1 < argc) config.traceFile = argv[++i];
+		else if (!strcmp(argv[i], "-tracesize") && i + 1 < argc) config.traceSize = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-runahead") && i + 1 < argc) config.runAhead = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-realtime")) realtime = true;
+		else if (!strcmp(argv[i], "-turbo") && i + 1 < argc && parseTurbo(argv[i + 1], &config.turbo)) {
+			turbo = true;
+			i++;
+		}
+		else if (!strcmp(argv[i], "-noidle")) config.idleSkip = false;
+		else if (!strcmp(argv[i], "-analyze")) analyze = true;
+		else if (!strcmp(argv[i], "-gdb") && i + 1 < argc) gdbAddress = argv[++i];
+		else if (!strcmp(argv[i], "-dump")) dump = true;
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	movie_t movie = {};
+	if (replayPath) {
+		if (!loadMovie(&movie, replayPath)) return 1;
+		config.rngSeed = movie.header.rngSeed;
+		config.instPerSec = movie.header.instPerSec;
+		config.quirks = (quirk_profile_t)movie.header.quirks;
+		frames = movie.header.frames;
+		insts = 0;
+	}
+
+	if (!config.instPerSec) {
+		fprintf(stderr, "-ips must be at least 1\n");
+		return 1;
+	}
+
+	if (batchSize && config.quirks != QUIRKS_VIP) {
+		fprintf(stderr, "The batch engine only runs the vip quirks\n");
+		return 1;
+	}
+	if (batchSize) return runBatch(argv[1], &config, batchSize, frames, insts, dump);
+
+	chip8_t chip8 = {};
+	if (!(chip8.cache = createDecodeCache())) {
+		fprintf(stderr, "Could not allocate the decode cache\n");
+		return 1;
+	}
+	if (config.engine == ENGINE_JIT) chip8.jit = createJit();
+	if (config.profile) chip8.profile = createProfile(0);
+	if (config.traceFile && !(chip8.trace = createTrace(config.traceSize, 0))) {
+		fprintf(stderr, "Could not allocate a trace of %u records\n", config.traceSize);
+		return 1;
+	}
+	if (!initChip8(&chip8, &config, argv[1])) return 1;
+	if (replayPath && !checkMovieRom(&movie, &chip8)) return 1;
+	// Analyzed as loaded, a state loaded over it is what runs but not what is listed
+	analysis_t *analysis = analyze ? analyzeRom(&chip8) : NULL;
+	if (analysis) {
+		printAnalysis(analysis, stdout);
+		putchar('\n');
+	}
+	if (loadPath && !loadState(&chip8, loadPath)) return 1;
+	rewind_t *rewind = config.rewindSize ? createRewind(config.rewindSize) : NULL;
+	if (config.rewindSize && !rewind) {
+		fprintf(stderr, "Rewind history of %u bytes is too small\n", config.rewindSize);
+		return 1;
+	}
+	gdb_stub_t *gdb = gdbAddress ? createGdbStub(gdbAddress) : NULL;
+	if (gdbAddress && !gdb) return 1;
+	if (gdb) chip8.debug = &gdb->debug;
+
+	// Timers still tick once per emulated frame so timer driven roms behave as they do in the window
+	uint64_t executed = 0, frame = 0;
+	static pacer_t pacer;
+	if (realtime) startPacer(&pacer, 60);
+	// Turbo waits for the pacer once per batch of emulated frames, like the window does
+	const uint32_t speed = turbo ? config.turbo : 1;
+	uint32_t batched = speed;
+	uint64_t budgetEnd = 0;
+	// Each speculative screen is checked against the real one it predicted once that frame has run
+	static runahead_t ahead;
+	ahead.frames = config.runAhead;
+	static uint64_t predicted[64][DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS];
+	static bool predictedHires[64];
+	uint64_t checked = 0, matched = 0;
+	if (ahead.frames >= 64) {
+		fprintf(stderr, "-runahead is limited to 63 frames\n");
+		return 1;
+	}
+
+	const uint64_t idleBefore = chip8.idleInstructions;
+	const auto start = std::chrono::steady_clock::now();
+	// Under gdb each frame starts by reporting where the last one stopped and serving gdb while it is stopped
+	while (gdb ? serveGdb(gdb, &chip8, &config) : insts ? executed < insts : frame < frames) {
+		if (realtime && (speed ? batched == speed : pacerNowNs() >= budgetEnd)) {
+			waitForFrame(&pacer);
+			budgetEnd = frameBudgetEndNs(&pacer);
+			batched = 0;
+		}
+		batched++;
+		const uint64_t budget = frameInstructions(&config, frame);
+		const uint64_t burst = insts && insts - executed < budget ? insts - executed : budget;
+		if (rewind) pushRewind(rewind, &chip8);
+		if (movie.mode == MOVIE_REPLAY) playMovieFrame(&movie, &chip8, &config, frame);
+		else emulateInstructions(&chip8, &config, burst);
+		executed += burst;
+		if (chip8.profile) endProfileFrame(chip8.profile);
+		if (burst < budget) break;
+		if (ahead.frames) {
+			if (frame >= ahead.frames) {
+				checked++;
+				const uint64_t slot = (frame - ahead.frames) % 64;
+				matched += predictedHires[slot] == chip8.hires && !memcmp(predicted[slot], chip8.display, sizeof chip8.display);
+			}
+			runAhead(&ahead, &chip8, &config, frame);
+			memcpy(predicted[frame % 64], ahead.display, sizeof ahead.display);
+			predictedHires[frame % 64] = ahead.hires;
+		}
+		updateTimers(&chip8);
+		frame++;
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (gdb) {
+		chip8.debug = NULL;
+		destroyGdbStub(gdb);
+	}
+
+	if (savePath && !saveState(&chip8, savePath)) return 1;
+	if (dump) dumpDisplay(&chip8);
+	printf("rom: %s\n", chip8.romName);
+	// Skipped idle instructions count towards -insts and the frame budgets but not towards MIPS
+	const uint64_t skipped = chip8.idleInstructions - idleBefore;
+	printf("instructions: %llu (%llu run, %llu skipped)\n", (unsigned long long)executed, (unsigned long long)(executed - skipped),
+		(unsigned long long)skipped);
+	printf("frames: %llu\n", (unsigned long long)frame);
+	printf("seconds: %.6f\n", seconds);
+	printf("MIPS: %.2f\n", seconds > 0 ? (executed - skipped) / seconds / 1e6 : 0.0);
+	printf("idle: %llu instructions skipped (%.1f%%)\n", (unsigned long long)skipped, executed ? 100.0 * skipped / executed : 0.0);
+	printf("display hash: %016llx\n", (unsigned long long)hashDisplay(&chip8));
+	if (rewind) {
+		printf("rewind: %.3f us per snapshot (max %.3f us), %llu frames held in %llu bytes, %llu keyframes\n",
+			rewind->pushNs / 1000.0 / rewind->pushes, rewind->maxPushNs / 1000.0, (unsigned long long)rewindFrames(rewind),
+			(unsigned long long)rewind->bytes, (unsigned long long)rewind->keyframes);
+		destroyRewind(rewind);
+	}
+	if (chip8.profile) {
+		putchar('\n');
+		printProfile(chip8.profile, &chip8, stdout, 20);
+		destroyProfile(chip8.profile);
+	}
+	if (analysis) {
+		uint16_t first = 0;
+		const uint32_t rewritten = rewrittenCode(analysis, &chip8, &first);
+		if (rewritten) printf("self modification: %u code bytes rewritten, the first at 0x%04X\n", rewritten, first);
+		else printf("self modification: none\n");
+		destroyAnalysis(analysis);
+	}
+	if (chip8.trace) {
+		const uint64_t traced = chip8.trace->written.load();
+		if (!saveTrace(chip8.trace, config.traceFile)) return 1;
+		printf("trace: %llu instructions traced, the last %llu written to %s\n", (unsigned long long)traced,
+			(unsigned long long)(traced < chip8.trace->mask + 1ull ? traced : chip8.trace->mask + 1ull), config.traceFile);
+		destroyTrace(chip8.trace);
+	}
+	if (realtime) printPacing(&pacer, stdout);
+	if (realtime && turbo) {
+		printf("turbo: %.1f emulated frames per second, %.2fx\n", frame / seconds, frame / seconds / 60);
+	}
+	if (ahead.runs) {
+		printf("run ahead: %u frames (%.1f ms sooner), %.2f us per frame (max %.2f us, %.2f%% of a frame), %.1f%% of %llu frames predicted right\n",
+			ahead.frames, ahead.frames * 1000.0 / 60, ahead.ns / 1000.0 / ahead.runs, ahead.maxNs / 1000.0,
+			ahead.ns / 1e9 / ahead.runs * 60 * 100, checked ? 100.0 * matched / checked : 0.0, (unsigned long long)checked);
+	}
+	if (replayPath) printf("movie: %u frames, %u key events\n", movie.header.frames, movie.header.eventCount);
+	freeMovie(&movie);
+	if (config.engine == ENGINE_CACHED) printf("decodes: %llu\n", (unsigned long long)chip8.cache->decodes);
+	destroyDecodeCache(chip8.cache);
+	if (chip8.jit) {
+		printf("blocks translated: %llu, invalidated: %llu, buffer flushes: %llu\n",
+			(unsigned long long)chip8.jit->translations, (unsigned long long)chip8.jit->invalidations,
+			(unsigned long long)chip8.jit->flushes);
+		destroyJit(chip8.jit);
+	}
+	return 0;
+}
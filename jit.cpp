@@ -0,0 +1,775 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "chip8.h"
+#include "analysis.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// x86-64 basic block recompiler
+// A block is a straight run of chip8 instructions starting at some address and ending at the first
+// instruction that can change the pc (1NNN, 2NNN, 00EE, BNNN, skips, FX0A, F000 NNNN) or write memory
+// (FX33, FX55, 5XY2). A skip's target depends on whether the next instruction is the 4 byte F000 NNNN,
+// so blocks ending in a skip also cover the next instruction's bytes.
+// Blocks run inside one native entry stub that saves the host registers once: each block checks the
+// remaining instruction budget on entry, subtracts its length, runs with V0-VF cached in host registers,
+// stores the next pc and jumps straight to the next translated block through blocks[]. Anything the native
+// code can't handle (untranslated pc, a block longer than the remaining budget) drops back to
+// emulateInstructionsJit, which translates or single steps so instruction counts stay exact.
+// DXYN, CXNN, FX0A, the timer ops, scrolls and other rare ops call the same handlers the cached engine uses.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_SUPPORTED
+#endif
+
+#define JIT_BUFFER_SIZE (4 * 1024 * 1024)
+#define MAX_BLOCK_INSTS 32
+#define MAX_BLOCK_BYTES (MAX_BLOCK_INSTS * 2 + 2)	// Instructions plus the one after a final skip
+#define MAX_BLOCK_CODE 4096		// Generous upper bound on native bytes for one block
+
+typedef uint32_t (*jit_enter_t)(chip8_t *chip8, const config_t *config, uint32_t budget);
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_C = 0x2, CC_NC = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7 };
+
+// r15 = chip8, r14 = config, r13d = remaining budget, r12 = jit->blocks, rax/rcx/rdx are scratch,
+// the rest cache V registers
+static const uint8_t regPool[] = { RBX, RBP, RSI, RDI, R8, R9, R10, R11 };
+#define POOL_SIZE ((int)sizeof regPool)
+
+// Saved by the entry stub, covers the callee saved registers of both the SysV and Win64 ABIs
+static const uint8_t savedRegs[] = { RBX, RBP, RSI, RDI, R12, R13, R14, R15 };
+
+#if defined(_WIN32)
+static const uint8_t argRegs[] = { RCX, RDX, R8 };
+#else
+static const uint8_t argRegs[] = { RDI, RSI, RDX };
+#endif
+
+static_assert(sizeof(jit_block_t) == 16 && offsetof(jit_block_t, code) == 0, "native dispatch indexes blocks[] by pc << 4");
+
+#define OFF_V(x)	((int32_t)(offsetof(chip8_t, V) + (x)))
+#define OFF_PC		((int32_t)offsetof(chip8_t, pc))
+#define OFF_I		((int32_t)offsetof(chip8_t, I))
+#define OFF_SP		((int32_t)offsetof(chip8_t, sp))
+#define OFF_STACK	((int32_t)offsetof(chip8_t, stack))
+#define OFF_KEYS	((int32_t)offsetof(chip8_t, keys))
+
+// Translation state for the block being emitted
+typedef struct {
+	uint8_t *p;			// Write cursor into the code buffer
+	int8_t host[16];	// Host register caching V[i], -1 if not cached
+	bool dirty[16];		// V[i] was changed in its host register and must be stored back
+	uint16_t freeRegs;	// Bitmask of unused regPool entries
+} block_ctx_t;
+
+
+/*------------------------------------------------------------------------------------------------*/
+// Instruction encoding
+
+static void emit8(block_ctx_t *b, uint8_t v) { *b->p++ = v; }
+static void emit16(block_ctx_t *b, uint16_t v) { memcpy(b->p, &v, 2); b->p += 2; }
+static void emit32(block_ctx_t *b, uint32_t v) { memcpy(b->p, &v, 4); b->p += 4; }
+static void emit64(block_ctx_t *b, uint64_t v) { memcpy(b->p, &v, 8); b->p += 8; }
+
+// force is needed for 8 bit registers so spl/bpl/sil/dil are used instead of ah/ch/dh/bh
+static void emitRex(block_ctx_t *b, bool w, int reg, int index, int rm, bool force) {
+	const uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (rm >> 3);
+	if (force || rex != 0x40) emit8(b, rex);
+}
+
+static void emitModRM(block_ctx_t *b, int mod, int reg, int rm) {
+	emit8(b, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+// [r15 + disp32] operand
+static void emitMem(block_ctx_t *b, int reg, int32_t disp) {
+	emitModRM(b, 2, reg, R15);
+	emit32(b, disp);
+}
+
+// [r15 + index*scale + disp32] operand
+static void emitMemIndex(block_ctx_t *b, int reg, int index, int scaleLog2, int32_t disp) {
+	emitModRM(b, 2, reg, RSP);	// rm = 100 means a SIB byte follows
+	emit8(b, (scaleLog2 << 6) | ((index & 7) << 3) | (R15 & 7));
+	emit32(b, disp);
+}
+
+// movzx reg32, byte [r15 + disp]
+static void emitLoadByte(block_ctx_t *b, int reg, int32_t disp) {
+	emitRex(b, false, reg, 0, R15, false);
+	emit8(b, 0x0F); emit8(b, 0xB6);
+	emitMem(b, reg, disp);
+}
+
+// mov byte [r15 + disp], reg8
+static void emitStoreByte(block_ctx_t *b, int32_t disp, int reg) {
+	emitRex(b, false, reg, 0, R15, true);
+	emit8(b, 0x88);
+	emitMem(b, reg, disp);
+}
+
+// movzx reg32, word [r15 + disp]
+static void emitLoadWord(block_ctx_t *b, int reg, int32_t disp) {
+	emitRex(b, false, reg, 0, R15, false);
+	emit8(b, 0x0F); emit8(b, 0xB7);
+	emitMem(b, reg, disp);
+}
+
+// mov word [r15 + disp], reg16
+static void emitStoreWord(block_ctx_t *b, int32_t disp, int reg) {
+	emit8(b, 0x66);
+	emitRex(b, false, reg, 0, R15, false);
+	emit8(b, 0x89);
+	emitMem(b, reg, disp);
+}
+
+// mov word [r15 + disp], imm16
+static void emitStoreWordImm(block_ctx_t *b, int32_t disp, uint16_t imm) {
+	emit8(b, 0x66);
+	emitRex(b, false, 0, 0, R15, false);
+	emit8(b, 0xC7);
+	emitMem(b, 0, disp);
+	emit16(b, imm);
+}
+
+// add word [r15 + disp], reg16
+static void emitAddWord(block_ctx_t *b, int32_t disp, int reg) {
+	emit8(b, 0x66);
+	emitRex(b, false, reg, 0, R15, false);
+	emit8(b, 0x01);
+	emitMem(b, reg, disp);
+}
+
+// mov reg32, imm32
+static void emitMovImm(block_ctx_t *b, int reg, uint32_t imm) {
+	emitRex(b, false, 0, 0, reg, false);
+	emit8(b, 0xB8 + (reg & 7));
+	emit32(b, imm);
+}
+
+// mov dst32, src32
+static void emitMov32(block_ctx_t *b, int dst, int src) {
+	emitRex(b, false, src, 0, dst, false);
+	emit8(b, 0x89);
+	emitModRM(b, 3, src, dst);
+}
+
+// mov dst64, src64
+static void emitMov64(block_ctx_t *b, int dst, int src) {
+	emitRex(b, true, src, 0, dst, false);
+	emit8(b, 0x89);
+	emitModRM(b, 3, src, dst);
+}
+
+// mov reg64, imm64
+static void emitMovImm64(block_ctx_t *b, int reg, uint64_t imm) {
+	emitRex(b, true, 0, 0, reg, false);
+	emit8(b, 0xB8 + (reg & 7));
+	emit64(b, imm);
+}
+
+// 8 bit register-register ALU op: add 0x00, or 0x08, and 0x20, sub 0x28, xor 0x30, cmp 0x38
+static void emitAlu8(block_ctx_t *b, uint8_t opcode, int dst, int src) {
+	emitRex(b, false, src, 0, dst, true);
+	emit8(b, opcode);
+	emitModRM(b, 3, src, dst);
+}
+
+// 8 bit ALU op with immediate, ext: add 0, cmp 7
+static void emitAlu8Imm(block_ctx_t *b, int ext, int dst, uint8_t imm) {
+	emitRex(b, false, 0, 0, dst, true);
+	emit8(b, 0x80);
+	emitModRM(b, 3, ext, dst);
+	emit8(b, imm);
+}
+
+// 8 bit shift by one, ext: shl 4, shr 5
+static void emitShift8(block_ctx_t *b, int ext, int reg) {
+	emitRex(b, false, 0, 0, reg, true);
+	emit8(b, 0xD0);
+	emitModRM(b, 3, ext, reg);
+}
+
+// setcc reg8; movzx reg32, reg8
+static void emitSetcc(block_ctx_t *b, int cc, int reg) {
+	emitRex(b, false, 0, 0, reg, true);
+	emit8(b, 0x0F); emit8(b, 0x90 + cc);
+	emitModRM(b, 3, 0, reg);
+	emitRex(b, false, reg, 0, reg, true);
+	emit8(b, 0x0F); emit8(b, 0xB6);
+	emitModRM(b, 3, reg, reg);
+}
+
+// cmovcc dst32, src32
+static void emitCmov(block_ctx_t *b, int cc, int dst, int src) {
+	emitRex(b, false, dst, 0, src, false);
+	emit8(b, 0x0F); emit8(b, 0x40 + cc);
+	emitModRM(b, 3, dst, src);
+}
+
+static void emitPush(block_ctx_t *b, int reg) {
+	emitRex(b, false, 0, 0, reg, false);
+	emit8(b, 0x50 + (reg & 7));
+}
+
+static void emitPop(block_ctx_t *b, int reg) {
+	emitRex(b, false, 0, 0, reg, false);
+	emit8(b, 0x58 + (reg & 7));
+}
+
+// jmp rel32 / jcc rel32 to an address inside the code buffer
+static void emitJump(block_ctx_t *b, const uint8_t *target) {
+	emit8(b, 0xE9);
+	emit32(b, (uint32_t)(target - (b->p + 4)));
+}
+
+static void emitJcc(block_ctx_t *b, int cc, const uint8_t *target) {
+	emit8(b, 0x0F); emit8(b, 0x80 + cc);
+	emit32(b, (uint32_t)(target - (b->p + 4)));
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+// V register cache
+
+// Host register holding V[v], loading it from the machine first unless the caller overwrites all of it
+static int getV(block_ctx_t *b, uint8_t v, bool load) {
+	if (b->host[v] < 0) {
+		for (int i = 0; i < POOL_SIZE; i++) {
+			if (b->freeRegs & (1 << i)) {
+				b->freeRegs &= ~(1 << i);
+				b->host[v] = regPool[i];
+				break;
+			}
+		}
+		if (load) emitLoadByte(b, b->host[v], OFF_V(v));
+	}
+	return b->host[v];
+}
+
+// Host registers are kept zero extended, so a full 32 bit move is a valid write of V[v]
+static void setV(block_ctx_t *b, uint8_t v, int src) {
+	emitMov32(b, getV(b, v, false), src);
+	b->dirty[v] = true;
+}
+
+// Can every V in mask be cached at once without spilling
+static bool haveRegsFor(const block_ctx_t *b, uint16_t mask) {
+	int needed = 0;
+	int available = 0;
+	for (int v = 0; v < 16; v++)
+		if ((mask & (1 << v)) && b->host[v] < 0) needed++;
+	for (int i = 0; i < POOL_SIZE; i++)
+		if (b->freeRegs & (1 << i)) available++;
+	return needed <= available;
+}
+
+static void flushRegs(block_ctx_t *b) {
+	for (uint8_t v = 0; v < 16; v++) {
+		if (b->host[v] >= 0 && b->dirty[v]) {
+			emitStoreByte(b, OFF_V(v), b->host[v]);
+			b->dirty[v] = false;
+		}
+	}
+}
+
+static void dropRegs(block_ctx_t *b) {
+	memset(b->host, -1, sizeof b->host);
+	memset(b->dirty, 0, sizeof b->dirty);
+	b->freeRegs = (1 << POOL_SIZE) - 1;
+}
+
+// V registers an inline translation of opcode needs cached at once
+static uint16_t regsUsed(uint16_t opcode, const quirk_set_t *quirks) {
+	const uint16_t X = 1 << ((opcode >> 8) & 0x0F);
+	const uint16_t Y = 1 << ((opcode >> 4) & 0x0F);
+	switch (opcode >> 12) {
+		case 0x3: case 0x4: case 0x6: case 0x7: case 0xE: case 0xF: return X;
+		case 0x5: case 0x9: return X | Y;
+		case 0x8: return X | Y | (1 << 0xF);
+		case 0xB: return quirks->jumpVX ? X : 1 << 0;
+		default: return 0;
+	}
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+// Block translation
+
+// Entry stub: uint32_t enter(chip8, config, budget), returns the budget left when native code bails out.
+// Emitted once at the start of the buffer and followed by the shared dispatch and exit code.
+static void emitEntryStub(jit_t *jit) {
+	block_ctx_t b;
+	b.p = jit->buffer;
+
+	for (uint32_t i = 0; i < sizeof savedRegs; i++) emitPush(&b, savedRegs[i]);
+	// sub rsp, 40: 16 byte call alignment plus the Win64 shadow space
+	emit8(&b, 0x48); emit8(&b, 0x83); emit8(&b, 0xEC); emit8(&b, 40);
+	emitMov64(&b, R15, argRegs[0]);
+	emitMov64(&b, R14, argRegs[1]);
+	emitMov32(&b, R13, argRegs[2]);
+	emitMovImm64(&b, R12, (uint64_t)(uintptr_t)jit->blocks);
+
+	// dispatch: look up blocks[pc].code and jump to it, bail out if pc is out of range or untranslated
+	jit->dispatch = b.p;
+	emitLoadWord(&b, RAX, OFF_PC);
+	emit8(&b, 0x3D); emit32(&b, 0xFFFE);					// cmp eax, 0xFFFE
+	uint8_t *outOfRange = b.p;
+	emitJcc(&b, CC_A, b.p);
+	emit8(&b, 0xC1); emit8(&b, 0xE0); emit8(&b, 4);			// shl eax, 4
+	emit8(&b, 0x49); emit8(&b, 0x8B); emit8(&b, 0x04); emit8(&b, 0x04);	// mov rax, [r12 + rax]
+	emit8(&b, 0x48); emit8(&b, 0x85); emit8(&b, 0xC0);		// test rax, rax
+	uint8_t *untranslated = b.p;
+	emitJcc(&b, CC_E, b.p);
+	emit8(&b, 0xFF); emit8(&b, 0xE0);						// jmp rax
+
+	// exit: return the remaining budget
+	jit->exit = b.p;
+	emitMov32(&b, RAX, R13);
+	emit8(&b, 0x48); emit8(&b, 0x83); emit8(&b, 0xC4); emit8(&b, 40);	// add rsp, 40
+	for (int i = sizeof savedRegs - 1; i >= 0; i--) emitPop(&b, savedRegs[i]);
+	emit8(&b, 0xC3);	// ret
+	jit->stubSize = b.p - jit->buffer;
+
+	// Patch the two forward branches now that exit is known
+	b.p = outOfRange;
+	emitJcc(&b, CC_A, jit->exit);
+	b.p = untranslated;
+	emitJcc(&b, CC_E, jit->exit);
+}
+
+// Call the cached engine's handler for this instruction, V registers are written back before and
+// reloaded lazily after since handlers read and write the machine directly
+static void emitHelper(block_ctx_t *b, jit_t *jit, uint16_t addr, uint16_t opcode) {
+	decoded_t *op = &jit->ops[addr];
+	decodeInstruction(opcode, jit->quirks, op);
+
+	flushRegs(b);
+	dropRegs(b);
+	emitMov64(b, argRegs[0], R15);
+	emitMov64(b, argRegs[1], R14);
+	emitMovImm64(b, argRegs[2], (uint64_t)(uintptr_t)op);
+	emitMovImm64(b, RAX, (uint64_t)(uintptr_t)op->fn);
+	emit8(b, 0xFF); emit8(b, 0xD0);	// call rax
+}
+
+// Flags are already set, pc = condition ? the instruction after next : addr+2
+static void emitSkip(block_ctx_t *b, const chip8_t *chip8, const quirk_set_t *quirks, int cc, uint16_t addr) {
+	const uint16_t next = addr + 2;
+	const bool longNext = quirks->xoChip && chip8->memory[next] == 0xF0 && chip8->memory[(uint16_t)(next + 1)] == 0x00;
+	emitMovImm(b, RCX, next);
+	emitMovImm(b, RDX, (uint16_t)(next + (longNext ? 4 : 2)));
+	emitCmov(b, cc, RCX, RDX);
+	emitStoreWord(b, OFF_PC, RCX);
+	flushRegs(b);
+}
+
+// Translate the block starting at start, returns false if nothing could be translated
+// Quirks are resolved here, the emitted code only does what jit->quirks' platform does
+static bool translateBlock(jit_t *jit, const chip8_t *chip8, uint16_t start) {
+	const quirk_set_t *quirks = &quirkSets[jit->quirks];
+	if (jit->size - jit->used < MAX_BLOCK_CODE) {
+		flushJit(jit);
+		jit->flushes++;
+	}
+
+	block_ctx_t b;
+	uint8_t *code = jit->buffer + jit->used;
+	b.p = code;
+	dropRegs(&b);
+
+	// Header: leave through exit if the whole block doesn't fit in the budget, otherwise charge for it.
+	// The length is patched in once the block is translated.
+	emit8(&b, 0x41); emit8(&b, 0x81); emit8(&b, 0xFD);	// cmp r13d, imm32
+	uint8_t *lengthCheck = b.p;
+	emit32(&b, 0);
+	emitJcc(&b, CC_C, jit->exit);
+	emit8(&b, 0x41); emit8(&b, 0x81); emit8(&b, 0xED);	// sub r13d, imm32
+	uint8_t *lengthCharge = b.p;
+	emit32(&b, 0);
+
+	uint32_t addr = start;	// Wider than a pc so a block can't wrap past the top of memory
+	uint16_t length = 0;
+	bool ended = false;		// Last instruction already stored the next pc
+	uint32_t lookahead = 0;	// Bytes past the last instruction the block depends on
+
+	while (!ended && length < MAX_BLOCK_INSTS && addr <= 0xFFFE) {
+		const uint16_t opcode = (chip8->memory[addr] << 8) | chip8->memory[addr + 1];
+		const uint16_t NNN = opcode & 0x0FFF;
+		const uint8_t NN = opcode & 0xFF;
+		const uint8_t N = opcode & 0x0F;
+		const uint8_t X = (opcode >> 8) & 0x0F;
+		const uint8_t Y = (opcode >> 4) & 0x0F;
+
+		// End the block here rather than spill when the register cache is full
+		if (!haveRegsFor(&b, regsUsed(opcode, quirks))) break;
+
+		switch (opcode >> 12) {
+			case 0x0:
+				if (NN == 0xE0) {
+					// 0x00E0: clear screen
+					emitHelper(&b, jit, addr, opcode);
+				} else if (NN == 0xEE) {
+					// 0x00EE: sp--; pc = stack[sp], or halt here with the stack empty
+					flushRegs(&b);
+					emitLoadWord(&b, RAX, OFF_SP);
+					emitMovImm(&b, RCX, addr);
+					emit8(&b, 0x83); emit8(&b, 0xE8); emit8(&b, 0x01);	// sub eax, 1
+					emit8(&b, 0x83); emit8(&b, 0xF8); emit8(&b, STACK_DEPTH);	// cmp eax, STACK_DEPTH
+					emit8(&b, 0x73); uint8_t *halt = b.p; emit8(&b, 0);	// jae halt
+					emitStoreWord(&b, OFF_SP, RAX);
+					emitRex(&b, false, RCX, RAX, R15, false);
+					emit8(&b, 0x0F); emit8(&b, 0xB7);
+					emitMemIndex(&b, RCX, RAX, 1, OFF_STACK);			// movzx ecx, word [r15 + rax*2 + stack]
+					*halt = (uint8_t)(b.p - halt - 1);
+					emitStoreWord(&b, OFF_PC, RCX);					// halt:
+					ended = true;
+				} else if (quirks->superChip && opcode == 0x00FD) {
+					// 0x00FD: exit, pc stays here
+					emitStoreWordImm(&b, OFF_PC, addr);
+					flushRegs(&b);
+					ended = true;
+				} else if ((quirks->superChip && ((opcode & 0xFFF0) == 0x00C0 || opcode == 0x00FB || opcode == 0x00FC ||
+												  opcode == 0x00FE || opcode == 0x00FF)) ||
+						   (quirks->xoChip && (opcode & 0xFFF0) == 0x00D0)) {
+					// Scrolls and resolution changes
+					emitHelper(&b, jit, addr, opcode);
+				}
+				break;
+
+			case 0x1:
+				// 0x1NNN: jump to NNN
+				emitStoreWordImm(&b, OFF_PC, NNN);
+				flushRegs(&b);
+				ended = true;
+				break;
+
+			case 0x2: {
+				// 0x2NNN: stack[sp++] = pc; pc = NNN, or halt here with the stack full
+				flushRegs(&b);
+				emitLoadWord(&b, RAX, OFF_SP);
+				emitMovImm(&b, RCX, addr);
+				emit8(&b, 0x83); emit8(&b, 0xF8); emit8(&b, STACK_DEPTH);	// cmp eax, STACK_DEPTH
+				emit8(&b, 0x73); uint8_t *halt = b.p; emit8(&b, 0);	// jae halt
+				emit8(&b, 0x66);
+				emitRex(&b, false, 0, RAX, R15, false);
+				emit8(&b, 0xC7);
+				emitMemIndex(&b, 0, RAX, 1, OFF_STACK);				// mov word [r15 + rax*2 + stack], imm16
+				emit16(&b, addr + 2);
+				emit8(&b, 0x83); emit8(&b, 0xC0); emit8(&b, 0x01);	// add eax, 1
+				emitStoreWord(&b, OFF_SP, RAX);
+				emitMovImm(&b, RCX, NNN);
+				*halt = (uint8_t)(b.p - halt - 1);
+				emitStoreWord(&b, OFF_PC, RCX);					// halt:
+				ended = true;
+				break;
+			}
+
+			case 0x3:
+			case 0x4:
+				// 0x3XNN / 0x4XNN: skip if VX == NN / VX != NN
+				emitAlu8Imm(&b, 7, getV(&b, X, true), NN);
+				emitSkip(&b, chip8, quirks, (opcode >> 12) == 0x3 ? CC_E : CC_NE, addr);
+				lookahead = 2;
+				ended = true;
+				break;
+
+			case 0x5:
+			case 0x9:
+				if (quirks->xoChip && (opcode >> 12) == 0x5 && N == 2) {
+					// 0x5XY2 may overwrite this very block
+					emitStoreWordImm(&b, OFF_PC, addr + 2);
+					emitHelper(&b, jit, addr, opcode);
+					ended = true;
+					break;
+				}
+				if (quirks->xoChip && (opcode >> 12) == 0x5 && N == 3) {
+					emitHelper(&b, jit, addr, opcode);
+					break;
+				}
+				// 0x5XY0 / 0x9XY0: skip if VX == VY / VX != VY
+				if ((opcode >> 12) == 0x5 && N != 0) break;	// wrong opcode
+				emitAlu8(&b, 0x38, getV(&b, X, true), getV(&b, Y, true));
+				emitSkip(&b, chip8, quirks, (opcode >> 12) == 0x5 ? CC_E : CC_NE, addr);
+				lookahead = 2;
+				ended = true;
+				break;
+
+			case 0x6:
+				// 0x6XNN: VX = NN
+				emitMovImm(&b, getV(&b, X, false), NN);
+				b.dirty[X] = true;
+				break;
+
+			case 0x7:
+				// 0x7XNN: VX += NN
+				emitAlu8Imm(&b, 0, getV(&b, X, true), NN);
+				b.dirty[X] = true;
+				break;
+
+			case 0x8: {
+				// Result goes through eax and the flag through ecx so VF is written last, as in emulateInstruction
+				const int rx = getV(&b, X, true);
+				const int ry = getV(&b, Y, true);
+				const int rs = quirks->shiftVY ? ry : rx;	// Source of 8XY6/8XYE
+				switch (N) {
+					case 0x0:
+						setV(&b, X, ry);
+						break;
+					case 0x1:
+					case 0x2:
+					case 0x3:
+						emitMov32(&b, RAX, rx);
+						emitAlu8(&b, N == 1 ? 0x08 : N == 2 ? 0x20 : 0x30, RAX, ry);
+						setV(&b, X, RAX);
+						if (quirks->vfReset) {
+							emitMovImm(&b, RCX, 0);
+							setV(&b, 0xF, RCX);
+						}
+						break;
+					case 0x4:
+						emitMov32(&b, RAX, rx);
+						emitAlu8(&b, 0x00, RAX, ry);
+						emitSetcc(&b, CC_C, RCX);
+						setV(&b, X, RAX);
+						setV(&b, 0xF, RCX);
+						break;
+					case 0x5:
+						emitMov32(&b, RAX, rx);
+						emitAlu8(&b, 0x28, RAX, ry);
+						emitSetcc(&b, CC_NC, RCX);
+						setV(&b, X, RAX);
+						setV(&b, 0xF, RCX);
+						break;
+					case 0x6:
+						emitMov32(&b, RAX, rs);
+						emitShift8(&b, 5, RAX);
+						emitSetcc(&b, CC_C, RCX);
+						setV(&b, X, RAX);
+						setV(&b, 0xF, RCX);
+						break;
+					case 0x7:
+						emitMov32(&b, RAX, ry);
+						emitAlu8(&b, 0x28, RAX, rx);
+						emitSetcc(&b, CC_NC, RCX);
+						setV(&b, X, RAX);
+						setV(&b, 0xF, RCX);
+						break;
+					case 0xE:
+						emitMov32(&b, RAX, rs);
+						emitShift8(&b, 4, RAX);
+						emitSetcc(&b, CC_C, RCX);
+						setV(&b, X, RAX);
+						setV(&b, 0xF, RCX);
+						break;
+					default:
+						break;
+				}
+				break;
+			}
+
+			case 0xA:
+				// 0xANNN: I = NNN
+				emitStoreWordImm(&b, OFF_I, NNN);
+				break;
+
+			case 0xB:
+				// 0xBNNN: pc = V0 + NNN, or BXNN: VX + XNN
+				emitMov32(&b, RAX, getV(&b, quirks->jumpVX ? X : 0, true));
+				emit8(&b, 0x05); emit32(&b, NNN);	// add eax, NNN
+				emitStoreWord(&b, OFF_PC, RAX);
+				flushRegs(&b);
+				ended = true;
+				break;
+
+			case 0xC:
+			case 0xD:
+				// 0xCXNN, 0xDXYN
+				emitHelper(&b, jit, addr, opcode);
+				break;
+
+			case 0xE:
+				// 0xEX9E / 0xEXA1: skip if key VX is / is not pressed
+				if (NN == 0x9E || NN == 0xA1) {
+					// Only the low nibble of VX picks the key
+					emitMov32(&b, RAX, getV(&b, X, true));
+					emit8(&b, 0x83); emit8(&b, 0xE0); emit8(&b, 0x0F);	// and eax, 0xF
+					emitRex(&b, false, RAX, RAX, R15, false);
+					emit8(&b, 0x0F); emit8(&b, 0xB6);
+					emitMemIndex(&b, RAX, RAX, 0, OFF_KEYS);	// movzx eax, byte [r15 + rax + keys]
+					emit8(&b, 0x84); emit8(&b, 0xC0);			// test al, al
+					emitSkip(&b, chip8, quirks, NN == 0x9E ? CC_NE : CC_E, addr);
+					lookahead = 2;
+					ended = true;
+				}
+				break;
+
+			case 0xF:
+				switch (NN) {
+					case 0x1E:
+						// 0xFX1E: I += VX
+						emitAddWord(&b, OFF_I, getV(&b, X, true));
+						break;
+					case 0x29: {
+						// 0xFX29: I = VX * 5
+						const int rx = getV(&b, X, true);
+						emitRex(&b, false, RAX, 0, rx, false);
+						emit8(&b, 0x6B); emitModRM(&b, 3, RAX, rx); emit8(&b, 5);	// imul eax, rx, 5
+						emitStoreWord(&b, OFF_I, RAX);
+						break;
+					}
+					case 0x01:
+					case 0x02:
+					case 0x07:
+					case 0x15:
+					case 0x18:
+					case 0x30:
+					case 0x3A:
+					case 0x65:
+					case 0x75:
+					case 0x85:
+						emitHelper(&b, jit, addr, opcode);
+						break;
+					case 0x00:
+						// 0xF000 NNNN: the helper reads NNNN and moves the pc past it
+						if (!quirks->xoChip || X != 0) break;
+						emitStoreWordImm(&b, OFF_PC, addr + 2);
+						emitHelper(&b, jit, addr, opcode);
+						ended = true;
+						break;
+					case 0x0A:
+					case 0x33:
+					case 0x55:
+						// FX0A may rewind the pc, FX33/FX55 may overwrite this very block
+						emitStoreWordImm(&b, OFF_PC, addr + 2);
+						emitHelper(&b, jit, addr, opcode);
+						ended = true;
+						break;
+					default:
+						break;
+				}
+				break;
+		}
+
+		length++;
+		addr += 2;
+	}
+
+	if (length == 0) return false;
+
+	if (!ended) {
+		flushRegs(&b);
+		emitStoreWordImm(&b, OFF_PC, addr);
+	}
+	emitJump(&b, jit->dispatch);
+	memcpy(lengthCheck, &length, 2);
+	memcpy(lengthCharge, &length, 2);
+
+	uint32_t end = addr + lookahead;
+	if (end > sizeof jit->codeRefs) end = sizeof jit->codeRefs;
+	jit->used += b.p - code;
+	jit->blocks[start] = (jit_block_t){ .code = code, .length = length, .end = end };
+	for (uint32_t i = start; i < end; i++) jit->codeRefs[i]++;
+	jit->translations++;
+	return true;
+}
+
+
+/*------------------------------------------------------------------------------------------------*/
+
+jit_t *createJit(void) {
+#ifdef JIT_SUPPORTED
+	jit_t *jit = (jit_t *)calloc(1, sizeof(jit_t));
+	if (!jit) return NULL;
+
+#if defined(_WIN32)
+	jit->buffer = (uint8_t *)VirtualAlloc(NULL, JIT_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	void *mem = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	jit->buffer = mem == MAP_FAILED ? NULL : (uint8_t *)mem;
+#endif
+	if (!jit->buffer) {
+		free(jit);
+		return NULL;
+	}
+	jit->size = JIT_BUFFER_SIZE;
+	emitEntryStub(jit);
+	jit->used = jit->stubSize;
+	return jit;
+#else
+	return NULL;	// No recompiler for this host, ENGINE_JIT runs the reference interpreter
+#endif
+}
+
+
+void destroyJit(jit_t *jit) {
+	if (!jit) return;
+#if defined(_WIN32)
+	VirtualFree(jit->buffer, 0, MEM_RELEASE);
+#else
+	munmap(jit->buffer, jit->size);
+#endif
+	free(jit);
+}
+
+
+void flushJit(jit_t *jit) {
+	memset(jit->blocks, 0, sizeof jit->blocks);
+	memset(jit->codeRefs, 0, sizeof jit->codeRefs);
+	jit->used = jit->stubSize;	// The entry stub stays
+}
+
+
+// Drop every block translated from addr, the native code stays in the buffer until the next flush
+void invalidateJit(jit_t *jit, uint16_t addr) {
+	const int first = addr >= MAX_BLOCK_BYTES - 1 ? addr - (MAX_BLOCK_BYTES - 1) : 0;
+	for (int start = first; start <= addr; start++) {
+		jit_block_t *block = &jit->blocks[start];
+		if (block->code && addr < block->end) {
+			for (uint32_t i = start; i < block->end; i++) jit->codeRefs[i]--;
+			block->code = NULL;
+			jit->invalidations++;
+		}
+	}
+}
+
+
+// Translates every block the load time analysis found, so the rom's first pass already runs native code
+// Blocks the recompiler ends early (memory writes, register pressure) are still picked up as they run
+void pretranslateJit(jit_t *jit, const chip8_t *chip8, const analysis_t *analysis) {
+	for (uint32_t i = 0; i < analysis->blockCount; i++) {
+		const uint16_t start = analysis->blocks[i].start;
+		if (!jit->blocks[start].code) translateBlock(jit, chip8, start);
+	}
+}
+
+
+void emulateInstructionsJit(chip8_t *chip8, const config_t *config, uint32_t count) {
+	// Only input handling can pause the machine, so checking once per burst is enough
+	if (chip8->state == PAUSE) return;
+
+	jit_t *jit = chip8->jit;
+	if (jit->quirks != config->quirks) {
+		flushJit(jit);
+		jit->quirks = config->quirks;
+	}
+	const jit_enter_t enter = (jit_enter_t)jit->buffer;
+	while (count > 0) {
+		const uint16_t pc = chip8->pc;
+		jit_block_t *block = pc <= 0xFFFE ? &jit->blocks[pc] : NULL;
+		if (block && !block->code && !translateBlock(jit, chip8, pc)) block = NULL;
+
+		if (block && block->length <= count) {
+			// Runs blocks back to back until one is untranslated or longer than what is left
+			count = enter(chip8, config, count);
+		} else {
+			emulateInstruction(chip8, config);
+			count--;
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "decode.h"
+
+struct chip8_t;
+struct config_t;
+struct analysis_t;
+
+// Translated basic block, indexed by the chip8 address it starts at
+typedef struct {
+	uint8_t *code;		// Native code, NULL if not translated or invalidated
+	uint16_t length;	// Number of chip8 instructions the block executes
+	uint32_t end;		// One past the last memory byte the block depends on
+} jit_block_t;
+
+// x86-64 basic block recompiler state, one per machine
+typedef struct jit_t {
+	uint8_t *buffer;		// Executable code buffer, starts with the entry stub
+	size_t size;			// Size of buffer in bytes
+	size_t used;			// Bump allocator offset into buffer
+	size_t stubSize;		// Bytes taken by the entry stub
+	uint8_t *dispatch;		// Native code jumps here to continue at the current pc
+	uint8_t *exit;			// Native code jumps here to return to emulateInstructionsJit
+	jit_block_t blocks[65536];
+	uint8_t codeRefs[65536];	// Number of live blocks translated from each memory byte
+	decoded_t ops[65536];	// Operands passed to the helper calls, one per instruction address
+	quirk_profile_t quirks;	// Profile the blocks were translated for, quirks are baked into the code
+
+	uint64_t translations;	// Blocks translated
+	uint64_t invalidations;	// Blocks dropped by writes into their code
+	uint64_t flushes;		// Times the code buffer filled up and was reset
+} jit_t;
+
+jit_t *createJit(void);
+void destroyJit(jit_t *jit);
+void flushJit(jit_t *jit);
+void invalidateJit(jit_t *jit, uint16_t addr);
+void pretranslateJit(jit_t *jit, const struct chip8_t *chip8, const struct analysis_t *analysis);
+void emulateInstructionsJit(struct chip8_t *chip8, const struct config_t *config, uint32_t count);
+
+// Cheap check for the store path, only writes into translated code pay for the block scan
+static inline void jitWriteHook(jit_t *jit, uint16_t addr) {
+	if (jit->codeRefs[addr]) invalidateJit(jit, addr);
+}
+
+#endif
@@ -1,98 +1,76 @@
 #include <stdio.h>
+#include <math.h>
 #include <time.h>
+#include <atomic>
 #include <SDL2/SDL.h>
+#include "chip8.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "movie.h"
+#include "output.h"
+#include "handoff.h"
+#include "pacer.h"
+#include "runahead.h"
 
 
-typedef enum {
-	QUIT,
-	RUNNING,
-	PAUSE,
-	RESTART,
-} emu_state_t;
-
 // SDL Container object
 typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *texture;           // Streaming copy of the framebuffer, scaled up to the window by the renderer
     SDL_AudioSpec want, have;
     SDL_AudioDeviceID dev;
+    audio_stream_t *audio;          // Tone changes the audio callback plays, queued by the emulation thread
 } sdl_t;
 
+// Machine and everything around it, owned by the emulation thread until done is set
+// The window thread only talks to it through frames and input
 typedef struct {
-	uint32_t windowWidth;	//	Emulator window width
-	uint32_t windowHeight;	//	Emulator window height
-	uint32_t fgColor;		// 	Foreground Color RGBA8888 
-	uint32_t bgColor; 		//	Backgorund Color RGBA8888
-	int32_t scaleFactor;	// 	Amount to scale chip8 pixel 
-	uint32_t instPerSec; 	// 	Chip8 CPU Clockrate
-	uint32_t sqrWaveFreq;	// 	Freq of square wave sound
-	int16_t volume;			// 	Sound volume
-	uint32_t audSampleRate;	// 	Audio sample rate
-	bool pixelOutlines;		// 	Draw pixel outlines?
-} config_t;
-
-// CHIP8 instruction format
-typedef struct {
-	uint16_t opcode;	
-	uint16_t NNN;		// 12 bit constant
-	uint8_t NN;			// 8 bit contsant
-	uint8_t N;			// 4 bit contsant
-	uint8_t X;			// 4 bit register identifier
-	uint8_t Y;			// 4 bit register identifier
-} instruction_t;	
-
-// CHIP8 Machine object
-typedef struct {
-	emu_state_t state;
-	uint8_t memory[4096];
-	//Emulate original chip8 pixels
-	bool display[64*32];	// Could be a boolean pointer and dynamically alloacte for different resolutions(super chip)
-	uint16_t stack[12];		// Subroutine stack
-	uint8_t V[16];			// Data registers
-	bool keys[16];			// Hexadecimal keypad 0x0-0xF
-
-	uint16_t pc;			// Program counter
-	uint16_t I;				// Index register
-	uint16_t sp;			// Stack pointer
-	uint8_t delay_timer;	// Decrements at 60hz when >0
-	uint8_t sound_timer;	// Decrements at 60hz and plays tone when >0
-	instruction_t inst;		// currently executing instruction
-
-	bool startup;
-
-	char *romName;			// Currently running rom filepath
-
-} chip8_t;
+	chip8_t *chip8;
+	const config_t *config;
+	char *romName;
+	movie_t *movie;
+	rewind_t *rewind;
+	profile_t *profile;
+	bool heatmap;				// Copy the profiler heat into each frame
+	triple_buffer_t *frames;	// Finished frames out to the window
+	input_queue_t *input;		// Keys and hotkeys in from the window
+	pacer_t *pacer;				// Releases each frame on a 60hz deadline
+	runahead_t *ahead;			// Speculative frames shown instead of the real one, when config.runAhead is set
+	bool turbo;					// Running config.turbo emulated frames per 60hz frame, owned by the emulation thread
+	trace_t *trace;				// Attached to the machine while tracing, when config.traceFile is set
+	uint32_t frame;				// Frames the machine ran in since the last reset, as of the input being applied
+	std::atomic<bool> done;		// Emulation thread has stopped
+	bool failed;				// It stopped because the rom or movie could not be started
+} emulator_t;
 
 
 bool set_config_from_args(config_t* config, int argc, char **argv);
 bool initSDL(sdl_t *sdl, config_t *config);
-void updateScreen(SDL_Renderer* renderer, const chip8_t *chip8, const config_t *config);
-void handleInput(chip8_t *chip8);
-void emulateInstruction(chip8_t *chip8, const config_t *config);
-void updateTimers(const SDL_AudioDeviceID dev, chip8_t *chip8);
+void updateScreen(const sdl_t *sdl, chip8_t *chip8, const config_t *config, const float *heat);
+void handleInput(emulator_t *emu, chip8_t *screen);
 void audioCallback(void *userdata, uint8_t *stream, int len);
-void printDebugInfo(chip8_t *chip8);
+int emulationThread(void *data);
 
 int main(int argc, char **argv) {
 	chip8_t chip8 = {}; 	// Declare chip8 machine
-	bool startup = true; 	// Should the chip8 machine start itself up?
-							// Used for restart functionality
+	chip8.cache = createDecodeCache();	// Predecoded instructions for the cached engine
+	if (!chip8.cache) exit(EXIT_FAILURE);
 	/*****************************************************************************************************************************/
 	// Set configs
-	config_t config = {0};
+	config_t config = {};
 	if (!set_config_from_args(&config, argc, argv)) exit(EXIT_FAILURE);
 	if(argc < 2)
 	{
 		printf("Usage: myChip8.exe chip8application\n");
 	}
-	// Init rand
-	srand(time(NULL));
 		
 
 	// Setup SDL
 	/*------------------------------------------------------------------------------------------------*/
-	sdl_t sdl = {0};
+	static audio_stream_t audio;
+	sdl_t sdl = {};
+	sdl.audio = &audio;
     if (!initSDL(&sdl, &config)) exit(EXIT_FAILURE);
 
 
@@ -106,118 +84,383 @@ int main(int argc, char **argv) {
 	SDL_RenderClear(sdl.renderer);
 	/*------------------------------------------------------------------------------------------------*/
 
-	const uint32_t entryPoint = 0x200; // Roms loaded into 0x200
-
-	// Load Font
-	const uint8_t font[] = {
-		0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0   
-		0x20, 0x60, 0x20, 0x20, 0x70,   // 1  
-		0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2 
-		0xF0, 0x10, 0xF0, 0x10, 0xF0,   // 3
-		0x90, 0x90, 0xF0, 0x10, 0x10,   // 4    
-		0xF0, 0x80, 0xF0, 0x10, 0xF0,   // 5
-		0xF0, 0x80, 0xF0, 0x90, 0xF0,   // 6
-		0xF0, 0x10, 0x20, 0x40, 0x40,   // 7
-		0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 8
-		0xF0, 0x90, 0xF0, 0x10, 0xF0,   // 9
-		0xF0, 0x90, 0xF0, 0x90, 0x90,   // A
-		0xE0, 0x90, 0xE0, 0x90, 0xE0,   // B
-		0xF0, 0x80, 0x80, 0x80, 0xF0,   // C
-		0xE0, 0x90, 0x90, 0x90, 0xE0,   // D
-		0xF0, 0x80, 0xF0, 0x80, 0xF0,   // E
-		0xF0, 0x80, 0xF0, 0x80, 0x80,   // F
-	};
+	// Recompiler is only set up when asked for, it maps an executable buffer
+	if (config.engine == ENGINE_JIT) chip8.jit = createJit();
+	// Profiling runs every instruction through the counting interpreter, only when asked for
+	profile_t *profile = config.profile ? createProfile(SDL_GetPerformanceFrequency()) : NULL;
+	chip8.profile = profile;
+	chip8.audio = &audio;
+
+	// A replay runs with the seed, clock rate and quirks it was recorded with
+	movie_t movie = {};
+	if (config.replayMovie) {
+		if (!loadMovie(&movie, config.replayMovie)) exit(EXIT_FAILURE);
+		config.rngSeed = movie.header.rngSeed;
+		config.instPerSec = movie.header.instPerSec;
+		config.quirks = (quirk_profile_t)movie.header.quirks;
+	}
+	// Per frame snapshots for the rewind key, off when config.rewindSize is 0
+	// Movies only go forward, so there is no rewind while one is recorded or replayed
+	const bool movieActive = config.recordMovie || config.replayMovie;
+	rewind_t *rewind = config.rewindSize && !movieActive ? createRewind(config.rewindSize) : NULL;
+
+	// The machine runs on its own thread so a slow present or a dragged window never stalls emulation
+	static triple_buffer_t frames;		// Static, three frames with heatmaps are too big for the stack
+	static input_queue_t input;
+	static pacer_t pacer;
+	static runahead_t ahead;
+	ahead.frames = config.runAhead;
+	initTripleBuffer(&frames);
+	initInputQueue(&input);
+
+	emulator_t emu = {};
+	emu.chip8 = &chip8;
+	emu.config = &config;
+	emu.romName = argv[1];
+	emu.movie = &movie;
+	emu.rewind = rewind;
+	emu.profile = profile;
+	emu.heatmap = config.heatmap;
+	emu.frames = &frames;
+	emu.input = &input;
+	emu.pacer = &pacer;
+	emu.ahead = &ahead;
+
+	// Tracing runs from the start, the trace key pauses and resumes it
+	trace_t *trace = NULL;
+	if (config.traceFile && !(trace = createTrace(config.traceSize, 0))) {
+		SDL_Log("Could not allocate a trace of %u records\n", config.traceSize);
+		emu.failed = true;
+	}
+	chip8.trace = trace;
+	emu.trace = trace;
+
+	SDL_Thread *thread = NULL;
+	if (!emu.failed && !(thread = SDL_CreateThread(emulationThread, "emulation", &emu))) {
+		SDL_Log("Could not start the emulation thread %s\n", SDL_GetError());
+		emu.failed = true;
+	}
+	// Without the thread the window loop is skipped and SDL shuts down below like after a failed start
+	if (!thread) emu.done.store(true, std::memory_order_release);
+
+	/*****************************************************************************************************************************/
+	// Window loop, shows the newest frame the emulation thread published and forwards input to it
+	chip8_t screen = {};			// Last frame shown, only display, hires and dirtyRows are used
+	screen.dirtyRows = ~0ull;
+	const frame_t *shown = NULL;
+	uint64_t renderTicks = 0;
+	while (!emu.done.load(std::memory_order_acquire)) {
+		handleInput(&emu, &screen);
+
+		const frame_t *next = takeFrame(&frames);
+		if (next) {
+			// Frames the window was too slow for are skipped, so dirty rows come from comparing against what is on screen
+			// A resolution change redraws everything, pixels are a different size
+			if (next->hires != screen.hires) screen.dirtyRows = ~0ull;
+			for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+				for (uint32_t row = 0; row < DISPLAY_HEIGHT; row++)
+					if (memcmp(next->display[plane][row], screen.display[plane][row], sizeof screen.display[plane][row]))
+						screen.dirtyRows |= 1ull << row;
+			memcpy(screen.display, next->display, sizeof screen.display);
+			screen.hires = next->hires;
+			shown = next;
+		}
+
+		if (next || screen.dirtyRows) {
+			const uint64_t renderStartTime = SDL_GetPerformanceCounter();
+			updateScreen(&sdl, &screen, &config, config.heatmap && shown ? shown->heat : NULL);
+			renderTicks += SDL_GetPerformanceCounter() - renderStartTime;
+		}
+		else SDL_Delay(1);
+	}
+	if (thread) SDL_WaitThread(thread, NULL);
+
+	destroyJit(chip8.jit);
+	destroyDecodeCache(chip8.cache);
+	if (profile) {
+		addPhaseTime(profile, PHASE_RENDER, renderTicks);
+		printProfile(profile, &chip8, stdout, 20);
+	}
+	destroyProfile(profile);
+	if (rewind && rewind->pushes) {
+		printf("Rewind: %.2f us per snapshot (max %.2f us), %llu frames held in %llu KB\n",
+			rewind->pushNs / 1000.0 / rewind->pushes, rewind->maxPushNs / 1000.0,
+			(unsigned long long)rewindFrames(rewind), (unsigned long long)(rewind->bytes >> 10));
+	}
+	destroyRewind(rewind);
+	printPacing(&pacer, stdout);
+	if (chip8.idleInstructions)
+		printf("Idle: %llu instructions of timer polls and key waits skipped\n", (unsigned long long)chip8.idleInstructions);
+	if (audio.changes) {
+		printf("Audio: %llu tone changes, %llu found the queue full, %llu clock resyncs\n", (unsigned long long)audio.changes,
+			(unsigned long long)audio.dropped, (unsigned long long)audio.resyncs);
+	}
+	if (ahead.runs) {
+		printf("Run ahead: %u frames (%.1f ms sooner), %.2f us per frame (max %.2f us)\n", ahead.frames,
+			ahead.frames * 1000.0 / 60, ahead.ns / 1000.0 / ahead.runs, ahead.maxNs / 1000.0);
+	}
+	if (trace && saveTrace(trace, config.traceFile)) {
+		printf("Trace: %llu instructions traced, the last %u written to %s\n", (unsigned long long)trace->written.load(),
+			trace->written.load() < trace->mask + 1 ? (uint32_t)trace->written.load() : trace->mask + 1, config.traceFile);
+	}
+	destroyTrace(trace);
+	if (config.recordMovie && !emu.failed && saveMovie(&movie, config.recordMovie))
+		printf("Recorded %u frames, %u key events to %s\n", movie.header.frames, movie.header.eventCount, config.recordMovie);
+	freeMovie(&movie);
+
+	// Shut down SDL, also when the rom or movie could not be started
+	SDL_DestroyTexture(sdl.texture);
+	SDL_DestroyRenderer(sdl.renderer);
+	SDL_CloseAudioDevice(sdl.dev);
+	SDL_DestroyWindow(sdl.window);
+	SDL_Quit();
+	if (emu.failed) return 1;
+	printf("Success!!\n");
+	return 0;
+}
+
+
+// Applies one event from the window, false once it changed the run state and the rest should wait a frame
+// Keypad keys are ignored while a movie drives the keypad, state loads and rewind while any movie runs
+static bool applyInput(emulator_t *emu, const input_event_t *event) {
+	chip8_t *chip8 = emu->chip8;
+	const movie_t *movie = emu->movie;
+	const bool timeTravel = movie->mode == MOVIE_OFF;
+
+	switch (event->type) {
+		case INPUT_KEYPAD:
+			if (movie->mode != MOVIE_REPLAY) chip8->keys[event->key & 0xF] = event->down;
+			return true;
+
+		case INPUT_QUIT:
+			chip8->state = QUIT; // Will exit main emulator loop
+			return false;
+
+		case INPUT_PAUSE:
+			if (chip8->state == RUNNING) {
+				chip8->state = PAUSE;
+				printf("===== PAUSED =====\n");
+			}
+			else chip8->state = RUNNING;
+			return false;
+
+		case INPUT_RESTART:
+			chip8->state = RESTART;
+			return false;
+
+		case INPUT_TRACE:
+			// Picks up at the cycle the frame starts on, each frame runs frameInstructions() of them
+			if (!emu->trace) return true;
+			if (chip8->trace) chip8->trace = NULL;
+			else {
+				emu->trace->cycle = (uint64_t)emu->frame * emu->config->instPerSec / 60;
+				chip8->trace = emu->trace;
+			}
+			printf("===== TRACE %s =====\n", chip8->trace ? "ON" : "OFF");
+			return true;
+
+		case INPUT_TURBO:
+			emu->turbo = !emu->turbo;
+			if (!emu->turbo) printf("===== TURBO OFF =====\n");
+			else if (emu->config->turbo) printf("===== TURBO %ux =====\n", emu->config->turbo);
+			else printf("===== TURBO MAX =====\n");
+			return true;
+
+		case INPUT_REWIND:
+			// Held backspace rewinds, releasing it resumes from wherever it got to
+			if (event->down && chip8->state == RUNNING && timeTravel) chip8->state = REWIND;
+			else if (!event->down && chip8->state == REWIND) chip8->state = RUNNING;
+			return true;
+
+		case INPUT_SAVE_STATE:
+		case INPUT_LOAD_STATE: {
+			// The state file sits next to the rom
+			char path[1024];
+			snprintf(path, sizeof path, "%s.state", chip8->romName);
+			if (event->type == INPUT_SAVE_STATE) {
+				if (saveState(chip8, path)) printf("===== SAVED %s =====\n", path);
+			}
+			else if (timeTravel && loadState(chip8, path)) printf("===== LOADED %s =====\n", path);
+			return true;
+		}
+	}
+	return true;
+}
+
+
+// Ticks the timers at the end of an emulated frame
+static void endFrame(chip8_t *chip8, movie_t *movie, uint32_t *frame) {
+	// Timers only run with the machine, restored snapshots carry their own timer values
+	if (chip8->state == RUNNING) {
+		updateTimers(chip8);
+		(*frame)++;
+	}
+	if (movie->mode == MOVIE_REPLAY && *frame >= movie->header.frames) {
+		movie->mode = MOVIE_OFF;		// Keypad goes back to the player
+		printf("===== REPLAY FINISHED =====\n");
+	}
+}
+
+
+// Runs the machine at 60 frames a second and hands each finished frame to the window
+// The pacer keeps one schedule across restarts, so the rate is measured over the whole session
+int emulationThread(void *data) {
+	emulator_t *emu = (emulator_t *)data;
+	chip8_t *chip8 = emu->chip8;
+	const config_t *config = emu->config;
+	movie_t *movie = emu->movie;
+	rewind_t *rewind = emu->rewind;
+	profile_t *profile = emu->profile;
+	bool startup = true; 	// Should the chip8 machine start itself up?
+							// Used for restart functionality
+	startPacer(emu->pacer, 60);
+
 	// Initialize chip8
 	while (startup) {
 
 		startup = false;
 		
-		memset(&chip8, 0, sizeof(chip8_t));
-		memcpy(&chip8.memory[0], font, sizeof(font));
-
-		// Load ROM
-		chip8.romName = argv[1];
-		FILE *rom = fopen(chip8.romName, "rb");
-		if (!rom) {
-			SDL_Log("Romfile %s is invalid or does not exist\n", chip8.romName);
-			return 1;
-		}
-		fseek(rom, 0, SEEK_END);		// Go to end of file
-		const size_t romSize = ftell(rom);// Get number of bytes we need read into memory
-		const size_t maxSize = sizeof chip8.memory - entryPoint;
-		rewind(rom);					// Go back to behgining of file 
-		if (romSize > maxSize) {
-			SDL_Log("Romfile %s is too big! Rom size: %zu\nMax size allowed: %zu\n", chip8.romName, romSize, maxSize);
-			return 1;
+		if (!initChip8(chip8, config, emu->romName)) {
+			emu->failed = true;
+			break;
 		}
-		if (fread(&chip8.memory[entryPoint], romSize, 1, rom) != 1) {
-			SDL_Log("Could not read Rom file %s into memory\n", chip8.romName);
-			return 1;
+		if (rewind) resetRewind(rewind);
+		// Restarting starts the recording or the replay over
+		if (config->recordMovie) startMovie(movie, chip8, config);
+		if (config->replayMovie) {
+			if (!checkMovieRom(movie, chip8)) {
+				emu->failed = true;
+				break;
+			}
+			movie->mode = MOVIE_REPLAY;
+			movie->cursor = 0;
 		}
-		fclose(rom);
-
-		chip8.state = RUNNING;
-		chip8.pc = entryPoint;
-		chip8.sp = 0;
+		uint32_t frame = 0;		// Frames the machine ran in, pauses don't count
 		/*****************************************************************************************************************************/
 		// Main emulator loop
-		while (chip8.state != QUIT && chip8.state != RESTART) {
-			// Handle user input
-			handleInput(&chip8);
+		while (chip8->state != QUIT && chip8->state != RESTART) {
+			// Sleep to this frame's deadline, wherever the previous frame's work ended
+			const uint64_t sleepStartTime = SDL_GetPerformanceCounter();
+			waitForFrame(emu->pacer);
+			if (chip8->audio) beginAudioFrame(chip8->audio, frameInstructions(config, frame));
+			const uint64_t inputStartTime = SDL_GetPerformanceCounter();
+			// Handle user input the window forwarded since last frame
+			input_event_t event;
+			emu->frame = frame;
+			while (popInput(emu->input, &event) && applyInput(emu, &event));
+			// Pausing, rewinding and state loads change the tone without running anything
+			if (chip8->audio) noteTone(chip8->audio, chip8);
+			// Keypad changes take effect from the first instruction of this frame and are recorded there
+			if (movie->mode == MOVIE_RECORD && chip8->state == RUNNING) recordInputs(movie, chip8, frame, 0);
 
 
 			// Get time() before running inst
 			const uint64_t startFrameTime = SDL_GetPerformanceCounter();
 
-			for (uint32_t i = 0; i < config.instPerSec / 60; i++)
-				emulateInstruction(&chip8, &config);
+			// Turbo runs several emulated frames, each with its own timer tick, and only the last is shown
+			// Only the first is heard, so the tone follows the machine while the audio clock stays on the wall clock
+			const uint32_t speed = emu->turbo ? config->turbo : 1;
+			const uint64_t budgetEnd = frameBudgetEndNs(emu->pacer);
+			audio_stream_t *audio = chip8->audio;
+			for (uint32_t ran = 1; ; ran++) {
+				if (chip8->state == REWIND) {
+					// Holding the rewind key steps back a frame per frame instead of running, stops at the oldest snapshot
+					if (rewind) popRewind(rewind, chip8);
+				}
+				else if (movie->mode == MOVIE_REPLAY && chip8->state == RUNNING) {
+					playMovieFrame(movie, chip8, config, frame);
+				}
+				else if (chip8->state != QUIT && chip8->state != RESTART) {
+					if (rewind && chip8->state == RUNNING) pushRewind(rewind, chip8);
+					emulateInstructions(chip8, config, frameInstructions(config, frame));
+				}
+				if (chip8->state != RUNNING || (speed ? ran >= speed : pacerNowNs() >= budgetEnd)) break;
+				endFrame(chip8, movie, &frame);
+				chip8->audio = NULL;
+			}
+			chip8->audio = audio;
 
-			const uint64_t endFrameTime = SDL_GetPerformanceCounter();
+			// Show where the machine will be a few frames on if the keys stay as they are
+			const bool speculate = emu->ahead->frames && chip8->state == RUNNING;
+			if (speculate) runAhead(emu->ahead, chip8, config, frame);
 
-			const double timeElapsed = (double)((endFrameTime - startFrameTime) * 1000) / SDL_GetPerformanceFrequency();
-			// 60fps = 16.67
-			// 30fps = 33.34
-			// 15fps = 66.68
-			SDL_Delay(16.67f > timeElapsed ? 16.67f - timeElapsed : 0);
+			const uint64_t endFrameTime = SDL_GetPerformanceCounter();
 
-			// update window with changes on each iteration
-			updateScreen(sdl.renderer, &chip8, &config);
-			updateTimers(sdl.dev, &chip8);
+			// Publish the frame
+			frame_t *out = backFrame(emu->frames);
+			memcpy(out->display, speculate ? emu->ahead->display : chip8->display, sizeof out->display);
+			out->hires = speculate ? emu->ahead->hires : chip8->hires;
+			if (emu->heatmap) memcpy(out->heat, profile->heat, sizeof out->heat);
+			publishFrame(emu->frames);
+
+			const uint64_t timersStartTime = SDL_GetPerformanceCounter();
+			endFrame(chip8, movie, &frame);
+			if (profile) {
+				// Rendering happens on the window thread, its time is added in when the run ends
+				addPhaseTime(profile, PHASE_SLEEP, inputStartTime - sleepStartTime);
+				addPhaseTime(profile, PHASE_INPUT, startFrameTime - inputStartTime);
+				addPhaseTime(profile, PHASE_EMULATION, endFrameTime - startFrameTime);
+				addPhaseTime(profile, PHASE_TIMERS, SDL_GetPerformanceCounter() - timersStartTime);
+				endProfileFrame(profile);
+			}
 		}
+		if (movie->mode == MOVIE_RECORD) movie->header.frames = frame;
 		// If the restart key is pressed, the main emulator loop is ended and the the chip-8 startup proccess will be looped through again
-		if (chip8.state == RESTART) {
+		if (chip8->state == RESTART) {
 			startup = true;
 		}
 	}
-	// Shut down SDL
-	SDL_DestroyRenderer(sdl.renderer);
-	SDL_CloseAudioDevice(sdl.dev);
-	SDL_DestroyWindow(sdl.window);
-	SDL_Quit();
-	printf("Success!!\n");
+	emu->done.store(true, std::memory_order_release);
 	return 0;
 }
 
 
 bool set_config_from_args(config_t* config, int argc, char **argv) {
 	// set defaults
-	*config = (config_t){
-		.windowWidth = 64,		// Chip8 original x resolution
-		.windowHeight = 32,		// Chip8 original y resolution
-		.fgColor = 0x00FF00FF,	// GREEN
-		.bgColor = 0x000000FF,	// WHITE
-		.scaleFactor = 20,		// Resolution will be 1280x640
-		.instPerSec = 700,  	// # of instructions to emulate per second
-		.sqrWaveFreq = 440,		// Frequency of sound waves
-		.volume = 3000,			// Volume
-		.audSampleRate = 44100,	// CD Quality
-		.pixelOutlines = true,	// Draw pixel outlines
-	};
-
-	// Overide from passed in args
-	for (int i = 0; i < argc; i++)
+	setDefaultConfig(config);
+	config->rngSeed = time(NULL);	// Different CXNN sequence every run
+
+	// Overide from passed in args, argv[1] is the rom
+	for (int i = 2; i < argc; i++)
 	{
-		(void)argv[i]; // TODO: Get args from commandline
+		if (!strcmp(argv[i], "-engine") && i + 1 < argc) {
+			if (!parseEngine(argv[++i], &config->engine)) {
+				SDL_Log("Unknown engine %s\n", argv[i]);
+				return false;
+			}
+		}
+		else if (!strcmp(argv[i], "-quirks") && i + 1 < argc) {
+			if (!parseQuirks(argv[++i], &config->quirks)) {
+				SDL_Log("Unknown quirks %s, use vip, chip48, schip or xochip\n", argv[i]);
+				return false;
+			}
+		}
+		else if (!strcmp(argv[i], "-profile")) config->profile = true;
+		else if (!strcmp(argv[i], "-heatmap")) config->profile = config->heatmap = true;
+		else if (!strcmp(argv[i], "-record") && i + 1 < argc) config->recordMovie = argv[++i];
+		else if (!strcmp(argv[i], "-replay") && i + 1 < argc) config->replayMovie = argv[++i];
+		else if (!strcmp(argv[i], "-trace") && i + 1 < argc) config->traceFile = argv[++i];
+		else if (!strcmp(argv[i], "-tracesize") && i + 1 < argc) config->traceSize = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-audiobuffer") && i + 1 < argc) {
+			// Device buffer in samples, a power of two, latency is about two of them
+			config->audioBuffer = strtoul(argv[++i], NULL, 0);
+			if (config->audioBuffer < 16 || config->audioBuffer > 8192) {
+				SDL_Log("Audio buffer must be 16 to 8192 samples\n");
+				return false;
+			}
+		}
+		else if (!strcmp(argv[i], "-runahead") && i + 1 < argc) config->runAhead = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-turbo") && i + 1 < argc) {
+			// Speed the turbo key switches to
+			if (!parseTurbo(argv[++i], &config->turbo)) {
+				SDL_Log("Turbo must be a multiple from 1 to 1000 or max\n");
+				return false;
+			}
+		}
+		else if (!strcmp(argv[i], "-rewind") && i + 1 < argc) {
+			// Rewind history in KB, 0 turns it off
+			config->rewindSize = strtoul(argv[++i], NULL, 0) << 10;
+		}
 	}
 	return true; // Success
 }
@@ -244,14 +487,26 @@ bool initSDL(sdl_t *sdl, config_t *config) {
         return false;
     }
 
+    // One texel per hi-res pixel, unless pixel outlines are drawn into the texture too
+    const uint32_t cell = textureCell(config);
+    sdl->texture = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                                     DISPLAY_WIDTH * cell, DISPLAY_HEIGHT * cell);
+    if (!sdl->texture) {
+        SDL_Log("Could not create SDL texture %s\n", SDL_GetError());
+        return false;
+    }
+
     // Init Audio stuff
     sdl->want = (SDL_AudioSpec){
         .freq = 44100,          // 44100hz "CD" quality
         .format = AUDIO_S16LSB, // Signed 16 bit little endian
         .channels = 1,          // Mono, 1 channel
-        .samples = 512,
+        .silence = 0,           // Filled in by SDL
+        .samples = (Uint16)config->audioBuffer,
+        .padding = 0,
+        .size = 0,              // Filled in by SDL
         .callback = audioCallback,
-        .userdata = config,        // Userdata passed to audio callback
+        .userdata = sdl,           // Userdata passed to audio callback
     };
 
     sdl->dev = SDL_OpenAudioDevice(NULL, 0, &sdl->want, &sdl->have, 0);
@@ -268,688 +523,151 @@ bool initSDL(sdl_t *sdl, config_t *config) {
         return false;
     }
 
+    // The device runs for good from here, silence is just the stream having no tone on
+    initAudioStream(sdl->audio, config, sdl->have.freq, sdl->have.samples);
+    SDL_PauseAudioDevice(sdl->dev, 0);
+
     return true;    // Success
 }
 
 
-void updateScreen(SDL_Renderer* renderer, const chip8_t *chip8, const config_t *config) {
-	// Draw each pixel as a rect
-	SDL_Rect rect = {.x = 0, .y = 0, .w = config->scaleFactor, .h = config->scaleFactor};
-
-	// Grab color values to draw
-	const uint8_t fgR = (config->fgColor >> 24) & 0xFF;
-	const uint8_t fgG = (config->fgColor >> 16) & 0xFF; 
-	const uint8_t fgB = (config->fgColor >>  8) & 0xFF; 
-	const uint8_t fgA = (config->fgColor >>  0) & 0xFF;
-
-	const uint8_t bgR = (config->bgColor >> 24) & 0xFF;
-	const uint8_t bgG = (config->bgColor >> 16) & 0xFF; 
-	const uint8_t bgB = (config->bgColor >>  8) & 0xFF; 
-	const uint8_t bgA = (config->bgColor >>  0) & 0xFF;
-
-	// Loop through display pixels, draw a rectangle per pixel to the SDL window
-	for (uint32_t i = 0; i < sizeof chip8->display; i++) {
-
-		// Translate 1D I value to 2D x/y coords
-		// x = i % window width
-		// y = i / window width
-
-		rect.x = (i % config->windowWidth) * config->scaleFactor;
-		rect.y = (i / config->windowWidth) * config->scaleFactor;
-
-		if (chip8->display[i]) {
-			// If pixel is on, draw fg color
-			SDL_SetRenderDrawColor(renderer, fgR, fgG, fgB, fgA);
-			SDL_RenderFillRect(renderer, &rect);
-
-			if (config->pixelOutlines) {
-                // If user requested drawing pixel outlines, draw those here
-                SDL_SetRenderDrawColor(renderer, bgR, bgG, bgB, bgA);
-                SDL_RenderDrawRect(renderer, &rect);
-            }
-		} else {
-			SDL_SetRenderDrawColor(renderer, bgR, bgG, bgB, bgA);
-			SDL_RenderFillRect(renderer, &rect);
-		}
+// Hot instruction slots tinted over the screen, one screen cell per 2 bytes of memory so 0x000 is the
+// top left cell and 0xFFE the bottom right, brighter is hotter on a log scale
+static void drawHeatmap(const sdl_t *sdl, const float *heat, const config_t *config) {
+	float hottest = 0;
+	for (uint32_t slot = 0; slot < HEAT_SLOTS; slot++)
+		if (heat[slot] > hottest) hottest = heat[slot];
+	if (hottest < 1) return;
+
+	const float scale = 1.0f / logf(1 + hottest);
+	const int cell = config->scaleFactor;
+	SDL_SetRenderDrawBlendMode(sdl->renderer, SDL_BLENDMODE_BLEND);
+	for (uint32_t slot = 0; slot < HEAT_SLOTS; slot++) {
+		if (heat[slot] < 0.5f) continue;
+		const float level = logf(1 + heat[slot]) * scale;
+		const SDL_Rect rect = {.x = (int)(slot % LORES_WIDTH) * cell, .y = (int)(slot / LORES_WIDTH) * cell, .w = cell, .h = cell};
+		SDL_SetRenderDrawColor(sdl->renderer, 255, (uint8_t)(160 * (1 - level)), 0, (uint8_t)(48 + 160 * level));
+		SDL_RenderFillRect(sdl->renderer, &rect);
 	}
-	SDL_RenderPresent(renderer);
+	SDL_SetRenderDrawBlendMode(sdl->renderer, SDL_BLENDMODE_NONE);
 }
 
 
-void audioCallback(void *userdata, uint8_t *stream, int len) {
-	config_t *config = (config_t *)userdata;
-	int16_t *audioData = (int16_t *)stream;
-	static uint32_t runningSampleIndex = 0;
-	const int32_t squareWavePeriod = config->audSampleRate / config->sqrWaveFreq;
-	const int32_t halfSqrWavePeriod = squareWavePeriod / 2;
-
-	for (int i = 0; i < len / 2; i++) {
-		audioData[i] = ((runningSampleIndex++ / halfSqrWavePeriod) % 2) ? config->volume : -config->volume;
-	}
+// Write the rows DXYN/00E0 changed into the streaming texture and let the renderer scale it to the window
+// Nothing is uploaded or presented on frames where the framebuffer did not change, unless a heatmap
+// is drawn over it which changes every frame
+void updateScreen(const sdl_t *sdl, chip8_t *chip8, const config_t *config, const float *heat) {
+	const uint32_t height = displayHeight(chip8);
+	const uint64_t dirty = chip8->dirtyRows & (~0ull >> (64 - height));
+	if (!dirty && !heat) return;
 
-}
+	if (dirty) {
+		const uint32_t span = pixelTexels(chip8, config);
 
+		// Only lock the span of rows between the first and last dirty one
+		uint32_t first = 0, last = height - 1;
+		while (!((dirty >> first) & 1)) first++;
+		while (!((dirty >> last) & 1)) last--;
 
-// Handle User input
-// Chip8 Keypad 	QWERTY
-// 123C				1234
-// 456D				QWER
-// 789E				ASDF
-// A0BF				ZXCV
-void handleInput(chip8_t *chip8) {
-	SDL_Event event;
-
-	while (SDL_PollEvent(&event)) {
-		switch (event.type) {
-			case SDL_QUIT:
-				chip8->state = QUIT; // Will exit main emulator loop
-			return;
-
-			case SDL_KEYUP:
-				switch (event.key.keysym.sym) {
-					case SDLK_1: chip8->keys[0x1] = false; break;
-					case SDLK_2: chip8->keys[0x2] = false; break;
-					case SDLK_3: chip8->keys[0x3] = false; break;
-					case SDLK_4: chip8->keys[0xC] = false; break;
-
-					case SDLK_q: chip8->keys[0x4] = false; break;
-					case SDLK_w: chip8->keys[0x5] = false; break;
-					case SDLK_e: chip8->keys[0x6] = false; break;
-					case SDLK_r: chip8->keys[0xD] = false; break;
-
-					case SDLK_a: chip8->keys[0x7] = false; break;
-					case SDLK_s: chip8->keys[0x8] = false; break;
-					case SDLK_d: chip8->keys[0x9] = false; break;
-					case SDLK_f: chip8->keys[0xE] = false; break;
-
-					case SDLK_z: chip8->keys[0xA] = false; break;
-					case SDLK_x: chip8->keys[0x0] = false; break;
-					case SDLK_c: chip8->keys[0xB] = false; break;
-					case SDLK_v: chip8->keys[0xF] = false; break;
-
-					default: break;
-				}
-				break;
+		const SDL_Rect lockRect = {.x = 0, .y = (int)(first * span), .w = (int)(DISPLAY_WIDTH * textureCell(config)), .h = (int)((last - first + 1) * span)};
+		void *pixels;
+		int pitch;
+		if (SDL_LockTexture(sdl->texture, &lockRect, &pixels, &pitch) != 0) return;	// Rows stay dirty, retried next frame
 
-			case SDL_KEYDOWN:
-				switch (event.key.keysym.sym) {
-					case SDLK_ESCAPE:
-						chip8->state = QUIT;
-						return;
-						break;
-					
-					case SDLK_SPACE:
-						// Space bar
-						if (chip8->state == RUNNING) {
-							chip8->state = PAUSE;
-							printf("===== PAUSED =====\n");
-						}
-						else chip8->state = RUNNING;
-						return;
-						break;
-					
-					case SDLK_EQUALS:
-						// "=" is restart
-						chip8->state = RESTART;
-						return;
-						break;
-					
-					case SDLK_1: chip8->keys[0x1] = true; break;
-					case SDLK_2: chip8->keys[0x2] = true; break;
-					case SDLK_3: chip8->keys[0x3] = true; break;
-					case SDLK_4: chip8->keys[0xC] = true; break;
-
-					case SDLK_q: chip8->keys[0x4] = true; break;
-					case SDLK_w: chip8->keys[0x5] = true; break;
-					case SDLK_e: chip8->keys[0x6] = true; break;
-					case SDLK_r: chip8->keys[0xD] = true; break;
-
-					case SDLK_a: chip8->keys[0x7] = true; break;
-					case SDLK_s: chip8->keys[0x8] = true; break;
-					case SDLK_d: chip8->keys[0x9] = true; break;
-					case SDLK_f: chip8->keys[0xE] = true; break;
-
-					case SDLK_z: chip8->keys[0xA] = true; break;
-					case SDLK_x: chip8->keys[0x0] = true; break;
-					case SDLK_c: chip8->keys[0xB] = true; break;
-					case SDLK_v: chip8->keys[0xF] = true; break;
-
-					default: break;
-				}
-				break;
-			
-			default:
-				break;
-
-		}
+		// Locked texels are write only, so every row in the span is rewritten
+		renderRows(chip8, config, first, last, pixels, pitch);
+		SDL_UnlockTexture(sdl->texture);
 	}
-}
-
-
-void emulateInstruction(chip8_t *chip8, const config_t *config) {
-	bool carry;   // Save carry flag/VF value for some instructions
-
-	// get next opcode from ram
-	if (chip8->state != PAUSE) {
-		chip8->inst.opcode = (chip8->memory[chip8->pc] << 8) | chip8->memory[chip8->pc+1];
-		chip8->pc += 2;
-
-		// Fill out instruction format
-		chip8->inst.NNN = chip8->inst.opcode & 0x0FFF;
-		chip8->inst.NN = chip8->inst.opcode & 0x0FF;
-		chip8->inst.N = chip8->inst.opcode & 0x0F;
-		chip8->inst.X = (chip8->inst.opcode >> 8) & 0x0F;
-		chip8->inst.Y = (chip8->inst.opcode >> 4) & 0x0F;
-
-	#ifdef DEBUG
-		printDebugInfo(chip8);
-	#endif
-
-		// Emulate opcode
-		switch ((chip8->inst.opcode >> 12) & 0x0F)
-		{
-		case 0x00:
-			if (chip8->inst.NN == 0xE0) {
-				// 0x00E0: clear screen
-				memset(&chip8->display[0], false, sizeof(chip8->display));
-			} else if (chip8->inst.NN == 0xEE) {
-				// 0x00EE: Return from subroutine
-				chip8->sp--;
-				chip8->pc = chip8->stack[chip8->sp];
-			} else {
-				// Unimplemented /invalid opcode, may be 0xNNN for callling machine code for RCA1802
-			}
-			break;
-		
-		case 0x01:
-			// 0x1NNN jump to adress NNN
-			chip8->pc = chip8->inst.NNN;
-			break;
-		
-		case 0x02:
-			// 0x2NNN: call subroutine at NNN
-			chip8->stack[chip8->sp] = chip8->pc;
-			chip8->sp++;
-			chip8->pc = chip8->inst.NNN;
-			break;
-		
-		case 0x03:
-			// 0x3XNN: check if VX == NN, if so, skip next inst
-			if (chip8->V[chip8->inst.X] == chip8->inst.NN)
-				chip8->pc += 2; // Skip next opcode
-			break;
 
-		case 0x04:
-			// 0x4XNN: check if VX != NN, if so, skip next inst
-			if (chip8->V[chip8->inst.X] != chip8->inst.NN)
-				chip8->pc += 2; // Skip next opcode
-			break;
-		
-		case 0x05:
-			// 0x5XY0: check if VX == VY, skip next inst if so
-			if (chip8->inst.N != 0) break; // wrong opcode
-
-			if (chip8->V[chip8->inst.X] == chip8->V[chip8->inst.Y])
-				chip8->pc += 2; // Skip next opcode
-			break;
-
-		case 0x06:
-			// 0x6XNN: Set register VX to NN
-			chip8->V[chip8->inst.X] = chip8->inst.NN;
-			break;
-		
-		case 0x07:
-			// 076XNN: Set register VX += NN
-			chip8->V[chip8->inst.X] += chip8->inst.NN;
-			break;
-
-		case 0x08:
-			switch(chip8->inst.N) {
-				case 0:
-					// 0x8XY0: Set register VX = VY
-					chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y];
-					break;
-				case 1:
-					// 0x8XY1: Set register VX |= VY
-					chip8->V[chip8->inst.X] |= chip8->V[chip8->inst.Y];
-					chip8->V[0xF] = 0; // CHIP8 Quirk (NO SCHIP)
-					break;
-				case 2:
-					// 0x8XY2: Set register VX &= VY
-					chip8->V[chip8->inst.X] &= chip8->V[chip8->inst.Y];
-					chip8->V[0xF] = 0; // CHIP8 Quirk (NO SCHIP)
-					break;
-				case 3:
-					// 0x8XY3: Set register VX ^= VY
-					chip8->V[chip8->inst.X] ^= chip8->V[chip8->inst.Y];
-					chip8->V[0xF] = 0; // CHIP8 Quirk (NO SCHIP)
-					break;
-				case 4:
-					// 0x8XY4: Set register VX += VY, set VF to 1 if carry
-					carry = ((uint16_t)(chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255);
-
-                    chip8->V[chip8->inst.X] += chip8->V[chip8->inst.Y];
-                    chip8->V[0xF] = carry; 
-					break;
-				case 5:
-					// 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive)
-					// if (chip8->V[chip8->inst.X] >= chip8->V[chip8->inst.Y])
-					// 	chip8->V[0xF] = 1;
-					carry = chip8->V[chip8->inst.X] >= chip8->V[chip8->inst.Y];
-
-					chip8->V[chip8->inst.X] -= chip8->V[chip8->inst.Y];
-					chip8->V[0xF] = carry; 
-					break;
-				case 6:
-					// 0x8XY6: Set register VX >>= 1, Store shifted off bit in VF
-					// NOTE: Using VY is a Chip8 quirk (NOT SCHIP)
-					carry = ((chip8->V[chip8->inst.Y] & 1) << 7) >> 7;
-					chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] >> 1;
-
-					chip8->V[0xF] = carry; 
-					break;
-				case 7:
-					// 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive)
-					carry = chip8->V[chip8->inst.X] <= chip8->V[chip8->inst.Y];
-
-					chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X];
-					chip8->V[0xF] = carry;
-					break;
-				case 0xE:
-					// 0x8XYE: Set register VX <<= 1, Store shifted off bit in VF
-					carry = (chip8->V[chip8->inst.Y] & 0x80) >> 7;
-					chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] << 1;
-
-					chip8->V[0xF] = carry;
-					break;
-				default:
-				 	// Wong/unimplemeted
-					break;
-			}
-			break;
-		
-		case 0x09:
-			// Check if VX != VY; skip next inst if so
-			if (chip8->V[chip8->inst.X] != chip8->V[chip8->inst.Y])
-				chip8->pc += 2; // Skip next opcode
-			break;
-
-		case 0x0A:
-			// 0xANNN: Set index register I to NNN
-			chip8->I = chip8->inst.NNN;
-			break;
-		
-		case 0x0B:
-			// 0xBNNN: Jump to V0 + NNN
-			chip8->pc = chip8->V[0] + chip8->inst.NNN;
-			break;
-
-		case 0x0C:
-			// 0xCXNN: Sets VX = rand(% 256 & NN) bitwise and
-			chip8->V[chip8->inst.X] = (rand() % 256) & chip8->inst.NN;
-			break;
-
-		case 0x0D: {
-			// 0xDXYN, draws N height sprite at coord X,Y, read from mem location I 
-			// Screen pixels are XOR'd with sprite bits, 
-			// VF (carry flag) is set if any screen pixels are set off; useful for collision detection
-			uint8_t Xcoord = chip8->V[chip8->inst.X] % config->windowWidth;
-			uint8_t Ycoord = chip8->V[chip8->inst.Y] % config->windowHeight;
-			const uint8_t origX = Xcoord;
-
-			chip8->V[0xF] = 0; // Init carry flag to zero
-
-			// Read each row of sprite
-			for (uint8_t i = 0; i < chip8->inst.N; i++) {
-				// Get next row of sprite data
-				const uint8_t spriteData = chip8->memory[chip8->I + i];
-				Xcoord = origX; // Reset X for next row to draw
-
-				for (int8_t j = 7; j >= 0; j--) {
-					// If sprite pixel bit is on and display pixel is on, set carry flag
-					bool *pixel = &chip8->display[Ycoord * config->windowWidth + Xcoord];
-					const bool spriteBit = (spriteData & (1 << j));
-
-					if (spriteBit && *pixel) {
-						chip8->V[0xF] = 1;
-					}
-					// XOR display pixel with sprite pixel/bit
-					*pixel ^= spriteBit;
-
-					// Stop drawing if hit right edge of screen
-					if (++Xcoord >= config->windowWidth) break;
-				}
+	SDL_RenderCopy(sdl->renderer, sdl->texture, NULL, NULL);
+	if (heat) drawHeatmap(sdl, heat, config);
+	SDL_RenderPresent(sdl->renderer);
+	chip8->dirtyRows = 0;
+}
 
-				// Stop drawing entire sprite if hit bottom edge of screen 
-				if (++Ycoord >= config->windowHeight) break;	
-			}
-			break;
-		}
 
-		case 0x0E:
-			if (chip8->inst.NN == 0x9E) {
-				// 0xEX9E: Skip next inst if key in VX is pressed
-				if (chip8->keys[chip8->V[chip8->inst.X]])
-					chip8->pc += 2;
-			} else if (chip8->inst.NN == 0xA1) {
-				// 0xEXA1: Skip next inst if key in VX is not pressed
-				if (!chip8->keys[chip8->V[chip8->inst.X]])
-					chip8->pc += 2;
-			}
-			break;
-		
-		case 0x0F:
-			switch(chip8->inst.NN) {
-				case 0x0A: {
-					// 0xFX0A: VX = get_key(); Await until a keypress, and store in VX
-                    static bool anyKeyPressed = false;
-                    static uint8_t key = 0xFF;
-
-                    for (uint8_t i = 0; key == 0xFF && i < sizeof chip8->keys; i++) 
-                        if (chip8->keys[i]) {
-                            key = i;    // Save pressed key to check until it is released
-                            anyKeyPressed = true;
-                            break;
-                        }
-
-                    // If no key has been pressed yet, keep getting the current opcode & running this instruction
-                    if (!anyKeyPressed) chip8->pc -= 2; 
-                    else {
-                        // A key has been pressed, also wait until it is released to set the key in VX
-                        if (chip8->keys[key])     // "Busy loop" CHIP8 emulation until key is released
-                            chip8->pc -= 2;
-                        else {
-                            chip8->V[chip8->inst.X] = key;     	// VX = key 
-                            key = 0xFF;                        	// Reset key to not found 
-                            anyKeyPressed = false;           	// Reset to nothing pressed yet
-                        }
-                    }
-                    break;
-				}
-				
-				case 0x1E:
-					// 0xFX1E: I += VX; For non Amiga Chip-8, does not affect VF
-					chip8->I += chip8->V[chip8->inst.X];
-					break;
-				
-				case 0x07:
-					// 0xFX07: VX = Delay timer
-					chip8->V[chip8->inst.X] = chip8->delay_timer;
-					break;
-				
-				case 0x15:
-					// 0xFX07: Delay timer = VX
-					chip8->delay_timer = chip8->V[chip8->inst.X];
-					break;
-				
-				case 0x18:
-					// 0xFX07: sound timer = VX
-					chip8->sound_timer = chip8->V[chip8->inst.X];
-					break;
-				
-				case 0x29:
-					// 0xFX29: Set register I to sprite location in memory for char in VX (0x0-0xF) 
-					chip8->I = chip8->V[chip8->inst.X] * 5;
-					break;
-				
-				case 0x33: {
-					// 0xFX33: Store BCD representation at memory offset from I
-					// I = Hundreds place, I+1 = tens, I+2 = one's
-					uint8_t bcd = chip8->V[chip8->inst.X];
-					chip8->memory[chip8->I+2] = bcd % 10;
-					bcd /= 10;
-					chip8->memory[chip8->I+1] = bcd % 10;
-					bcd /= 10;
-					chip8->memory[chip8->I] = bcd;
-					break;
-				}
-				case 0x55:
-					// 0xFX55: Register dump V0-VX inclusive to memory offset from I, CHIP8 increments I, SCHIP DOES NOT
-					for (uint8_t i = 0; i <= chip8->inst.X; i++) {
-						chip8->memory[chip8->I] = chip8->V[i];
-						chip8->I++; // CHIP8 Quirk (NO SCHIP)
-					}
-					break;
-
-				case 0x65:
-					// 0xFX65: Register load V0-VX inclusive to memory offset from I, CHIP8 increments I
-					for (uint8_t i = 0; i<= chip8->inst.X; i++) {
-						chip8->V[i] = chip8->memory[chip8->I];
-						chip8->I++; // CHIP8 Quirk (NO SCHIP)
-					}
-					break;
-				default:
-					break;
-			}
-			break;
-		default:
-			break;
-		}
-	}
+void audioCallback(void *userdata, uint8_t *stream, int len) {
+	sdl_t *sdl = (sdl_t *)userdata;
+	renderAudio(sdl->audio, (int16_t *)stream, len / 2);
 }
 
 
-void updateTimers(const SDL_AudioDeviceID dev, chip8_t *chip8) {
-	if (chip8->delay_timer > 0) chip8->delay_timer--;
-	if (chip8->sound_timer > 0) {
-		chip8->sound_timer--;
-		SDL_PauseAudioDevice(dev, 0); // Play sound
-	} else {
-		SDL_PauseAudioDevice(dev, 1); // Pause sound
+// Handle User input
+// Chip8 Keypad 	QWERTY
+// 123C				1234
+// 456D				QWER
+// 789E				ASDF
+// A0BF				ZXCV
+// Keypad key for a QWERTY key, -1 for keys that aren't on the keypad
+static int keypadKey(SDL_Keycode sym) {
+	switch (sym) {
+		case SDLK_1: return 0x1;
+		case SDLK_2: return 0x2;
+		case SDLK_3: return 0x3;
+		case SDLK_4: return 0xC;
+
+		case SDLK_q: return 0x4;
+		case SDLK_w: return 0x5;
+		case SDLK_e: return 0x6;
+		case SDLK_r: return 0xD;
+
+		case SDLK_a: return 0x7;
+		case SDLK_s: return 0x8;
+		case SDLK_d: return 0x9;
+		case SDLK_f: return 0xE;
+
+		case SDLK_z: return 0xA;
+		case SDLK_x: return 0x0;
+		case SDLK_c: return 0xB;
+		case SDLK_v: return 0xF;
+
+		default: return -1;
 	}
 }
 
 
-void printDebugInfo(chip8_t *chip8) {
-	printf("Address 0x%04X, Opcode: 0x%04X Desc: ", chip8->pc-2, chip8->inst.opcode);
-	switch ((chip8->inst.opcode >> 12) & 0x0F)
-	{
-	case 0x00:
-		if (chip8->inst.NN == 0xE0) {
-			// 0x00E0: clear screen
-			printf("Clear Screen\n");
-		} else if (chip8->inst.NN == 0xEE) {
-			// 0x00EE: Return from subroutine
-			printf("Return from subroutine to address 0x0%04X\n", chip8->stack[chip8->sp-1]);
-		}
-		break;
-	case 0x01:
-		// 0x1NNN jump to adress NNN
-		printf("Jump to address 0x%04X\n", chip8->inst.NNN);
-		break;
-	case 0x02:
-		// 0x02NNN: call subroutine at NNN
-		printf("Call subroutine at NNN: 0x%04X\n", chip8->inst.NNN);
-		break;
-	
-	case 0x03:
-		printf("Check if V%X (0x%02X)X == NN (0x%02X), skip next inst if true\n", 
-		chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN);
-		break;
-
-	case 0x04:
-		printf("Check if V%X (0x%02X)X != NN (0x%02X), skip next inst if true\n", 
-		chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN);
-		break;
-
-	case 0x05:
-		printf("Check if V%X (0x%02X)X == V%X (0x%02X)Y, skip next inst if true\n", 
-		chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.Y, chip8->V[chip8->inst.Y]);
-		break;
-
-	case 0x06:
-		// 0x6XNN: Set register VX to NN
-		printf("Set register X: 0x%X = NN: (0x%02X)\n", chip8->inst.X, chip8->inst.NN);
-		break;
-
-	case 0x07:
-			// 076XNN: Set register VX += NN
-			printf("Set register X: 0x%X += NN: (0x%02X)\n", chip8->inst.X, chip8->inst.NN);
-			break;
+// Turns SDL events into input events for the emulation thread, which decides what they do to the machine
+// Only redrawing after window events is handled here
+void handleInput(emulator_t *emu, chip8_t *screen) {
+	SDL_Event event;
 
-	case 0x08:
-			switch(chip8->inst.N) {
-				case 0:
-					// 0x8XY0: Set register VX = VY
-					printf("Set register V%X = V%X (0x%02X)\n", chip8->inst.X, chip8->inst.Y, chip8->V[chip8->inst.Y]);
-					break;
-				case 1:
-					// 0x8XY1: Set register VX |= VY
-					printf("Set register V%X (0x%02X) |= V%X (0x%02X); Result: (0x%02X)\n", 
-					chip8->inst.X, chip8->V[chip8->inst.X], 
-					chip8->inst.Y, chip8->V[chip8->inst.Y], 
-					chip8->V[chip8->inst.X] | chip8->V[chip8->inst.Y]);
-					break;
-				case 2:
-					// 0x8XY2: Set register VX &= VY
-					printf("Set register V%X (0x%02X) &= V%X (0x%02X); Result: (0x%02X)\n", 
-					chip8->inst.X, chip8->V[chip8->inst.X], 
-					chip8->inst.Y, chip8->V[chip8->inst.Y], 
-					chip8->V[chip8->inst.X] & chip8->V[chip8->inst.Y]);
-					break;
-				case 3:
-					// 0x8XY3: Set register VX ^= VY
-					printf("Set register V%X (0x%02X) ^= V%X (0x%02X); Result: (0x%02X)\n", 
-					chip8->inst.X, chip8->V[chip8->inst.X], 
-					chip8->inst.Y, chip8->V[chip8->inst.Y], 
-					chip8->V[chip8->inst.X] ^ chip8->V[chip8->inst.Y]);
-					break;
-				case 4:
-					// 0x8XY4: Set register VX += VY, set VF to 1 if carry
-					printf("Set register V%X (0x%02X) += V%X (0x%02X), VF = 1 if carry; Result: (0x%02X), VF = %X\n", 
-					chip8->inst.X, chip8->V[chip8->inst.X], 
-					chip8->inst.Y, chip8->V[chip8->inst.Y], 
-					chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y],
-					((uint16_t)(chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255));
-					break;
-				case 5:
-					// 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive)
-					printf("Set register V%X (0x%02X) -= V%X (0x%02X), VF = 1 if no borrow; Result: (0x%02X), VF = %X\n", 
-					chip8->inst.X, chip8->V[chip8->inst.X], 
-					chip8->inst.Y, chip8->V[chip8->inst.Y], 
-					chip8->V[chip8->inst.X] - chip8->V[chip8->inst.Y],
-					(chip8->V[chip8->inst.X] >= chip8->V[chip8->inst.Y]));
-					break;
-				case 6:
-					// 0x8XY6: Set register VX >>= 1, Store shifted off bit in VF
-					printf("Set register V%X (0x%02X) >>= 1 VF = Shifted off bits (%X); Result: (0x%02X)\n", 
-					chip8->inst.X, chip8->V[chip8->inst.X],
-					chip8->V[chip8->inst.X] & 1,
-					chip8->V[chip8->inst.X] >> 1);
-					break;
-				case 7:
-					// 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive)
-					printf("Set register V%X = V%X (0x%02X) - V%X (0x%02X), VF = 1 if no borrow; Result: (0x%02X), VF = %X\n", 
-					chip8->inst.X,
-					chip8->inst.Y, chip8->V[chip8->inst.Y],
-					chip8->inst.X, chip8->V[chip8->inst.X], 
-					chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X],
-					(chip8->V[chip8->inst.X] <= chip8->V[chip8->inst.Y]));
-					break;
-				case 0xE:
-					// 0x8XY6: Set register VX <<= 1, Store shifted off bit in VF
-					printf("Set register V%X (0x%02X) <<= 1 VF = Shifted off bits (%X); Result: (0x%02X)\n", 
-					chip8->inst.X, chip8->V[chip8->inst.X],
-					(chip8->V[chip8->inst.X] & 0x80) >> 7,
-					chip8->V[chip8->inst.X] >> 1);
-					break;
-			}
-	
-	case 0x09:
-		// 0x9XY0: Check if VX != VY; skip next inst if so
-		printf("Check if V%X (0x%02X)X != V%X (0x%02X)Y, skip next inst if true\n", 
-		chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.Y, chip8->V[chip8->inst.Y]);
-		break;
-
-	case 0x0A:
-		// 0xANNN: Set index register I to NNN
-		printf("Set index register I to NNN: 0x%04X\n", chip8->inst.NNN);
-	break;
-
-	case 0x0B:
-		// 0xBNNN: Jump to V0 + NNN
-		printf("Set PC to V0 (0x%02X) + NNN (0x%02X); Result PC = 0x%04X\n", chip8->V[0], chip8->inst.NNN, chip8->V[0] + chip8->inst.NNN);
-		break;
-
-	case 0x0C:
-		// 0xCXNN: Sets VX = rand(% 256 & NN) bitwise and
-		printf("Set PC to V%X = rand() %% 256 & NN (0x%02X)", chip8->inst.X, chip8->inst.NN);
-		break;
-
-	case 0x0D:
-		// 0xDXYN, draws N height sprite at coord X,Y, read from mem location I 
-		printf("draws (N) %u height sprite at coord V0x%X (0x%02X), V0x%X (0x%02X),"
-		"from mem location I (0x%04X)\nSet VF = 1 if any pixels are turned off\n",
-		 chip8->inst.N, chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.Y, chip8->V[chip8->inst.Y],
-		 chip8->I);
-	break;
-
-	case 0x0E:
-			if (chip8->inst.NN == 0x9E) {
-				printf("Skip next inst if key in V%X (0x%02X) is pressed; Keypad value: %d\n", 
-				chip8->inst.X, chip8->V[chip8->inst.X], chip8->keys[chip8->V[chip8->inst.X]]);
-			} else if (chip8->inst.NN == 0xA1) {
-				// 0xEXA1: Skip next inst if key in VX is not pressed
-				printf("Skip next inst if key in V%X (0x%02X) is not pressed; Keypad value: %d\n", 
-					chip8->inst.X, chip8->V[chip8->inst.X], chip8->keys[chip8->V[chip8->inst.X]]);
-			}
-			break;
+	while (SDL_PollEvent(&event)) {
+		input_event_t input = { INPUT_KEYPAD, 0, event.type == SDL_KEYDOWN };
 
-	case 0x0F:
-		switch(chip8->inst.NN) {
-			case 0x0A:
-				// 0xFX0A: VX = get_key, wait until key pressed and store in VX
-				printf("Await until key is pressed, store key in V%X\n", chip8->inst.X);
-				break;
-			
-			case 0x1E:
-				// 0xFX1E: I += VX; For non Amiga Chip-8, does not affect VF
-				printf("I (0x%04X) += V%X (0x%02X); Result (I): 0x%04X\n", 
-				chip8->I, chip8->inst.X, chip8->V[chip8->inst.X], chip8->I + chip8->V[chip8->inst.X]);
-				break;
-				
-			case 0x07:
-				// 0xFX07: VX = Delay timer
-				printf("Set V%X to Delay Timer (0x%02X)\n", chip8->V[chip8->inst.X], chip8->delay_timer);
-				break;
-			
-			case 0x15:
-				// 0xFX07: Delay timer = VX
-				printf("Set Delay Timer to V%X (0x%02X)\n", chip8->inst.X, chip8->V[chip8->inst.X]);
-				break;
-			
-			case 0x18:
-				// 0xFX07: sound timer = VX
-				printf("Set Sound Timer to V%X (0x%02X)\n", chip8->inst.X, chip8->V[chip8->inst.X]);
-				break;
-			
-			case 0x29:
-				printf("Set I to sprite location in memory for character in V%X (0x%02X); Result(VX * 5): (0x%02X)\n", 
-						chip8->inst.X, chip8->V[chip8->inst.X], chip8->V[chip8->inst.X] * 5);
-				break;
-			
-			case 0x33:
-				// 0xFX33: Store BCD representation at memory offset from I
-				printf("Store BCD representation of V%X (0x%02X) at memory offset from I (0x%04X)\n", chip8->inst.X, chip8->V[chip8->inst.X], chip8->I);
+		switch (event.type) {
+			case SDL_QUIT:
+				input.type = INPUT_QUIT;
 				break;
 
-			case 0x55:
-				// 0xFX55: Register dump V0-VX inclusive to memory offset from I, CHIP8 increments I
-				printf("Register dump V0-V%X inclusive to memory offset from I (0x%04X)\n", chip8->inst.X, chip8->I);
-				break;
+			case SDL_WINDOWEVENT:
+				// Window was exposed or moved, present the whole screen again
+				screen->dirtyRows = ~0ull;
+				continue;
 
-			case 0x65:
-				// 0xFX65: Register load V0-VX inclusive to memory offset from I, CHIP8 increments I
-				printf("Register load V0-V%X inclusive to memory offset from I (0x%04X)\n", chip8->inst.X, chip8->I);
+			case SDL_KEYUP:
+			case SDL_KEYDOWN: {
+				if (event.key.repeat) continue;		// Held keys auto repeat, only the first press counts
+				const SDL_Keycode sym = event.key.keysym.sym;
+				const int key = keypadKey(sym);
+				if (key >= 0) input.key = (uint8_t)key;
+				else if (sym == SDLK_BACKSPACE) input.type = INPUT_REWIND;	// Rewinds while held
+				else if (!input.down) continue;								// The rest act when pressed
+				else if (sym == SDLK_ESCAPE) input.type = INPUT_QUIT;
+				else if (sym == SDLK_SPACE) input.type = INPUT_PAUSE;
+				else if (sym == SDLK_EQUALS) input.type = INPUT_RESTART;	// "=" is restart
+				else if (sym == SDLK_F5) input.type = INPUT_SAVE_STATE;
+				else if (sym == SDLK_F9) input.type = INPUT_LOAD_STATE;
+				else if (sym == SDLK_TAB) input.type = INPUT_TURBO;
+				else if (sym == SDLK_F7) input.type = INPUT_TRACE;
+				else continue;
 				break;
+			}
 
 			default:
-				break;
+				continue;
 		}
-		break;
 
-	default:
-		printf("Uninplemented or invalid opcode\n");
-		break;
+		// The emulation thread drains the queue every frame, it only fills up if that thread stalls
+		while (!pushInput(emu->input, input) && !emu->done.load(std::memory_order_acquire)) SDL_Delay(1);
 	}
 }
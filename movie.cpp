@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+
+
+// FNV-1a over all of memory, identifies the font and rom a run started from
+uint64_t hashMemory(const chip8_t *chip8) {
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (uint32_t i = 0; i < sizeof chip8->memory; i++) {
+		hash ^= chip8->memory[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+
+// Begin recording from a freshly initialised machine, an earlier recording in movie is thrown away
+void startMovie(movie_t *movie, const chip8_t *chip8, const config_t *config) {
+	movie->mode = MOVIE_RECORD;
+	movie->header = (movie_header_t){
+		.magic = MOVIE_MAGIC,
+		.version = MOVIE_VERSION,
+		.rngSeed = config->rngSeed,
+		.romHash = hashMemory(chip8),
+		.instPerSec = config->instPerSec,
+		.frames = 0,
+		.eventCount = 0,
+		.quirks = config->quirks,
+	};
+	movie->cursor = 0;
+	memcpy(movie->keys, chip8->keys, sizeof movie->keys);
+}
+
+
+// Appends every key that changed since the last call
+void recordInputs(movie_t *movie, const chip8_t *chip8, uint32_t frame, uint16_t inst) {
+	for (uint8_t key = 0; key < 16; key++) {
+		if (chip8->keys[key] == movie->keys[key]) continue;
+		movie->keys[key] = chip8->keys[key];
+
+		if (movie->header.eventCount == movie->capacity) {
+			const uint32_t capacity = movie->capacity ? movie->capacity * 2 : 256;
+			movie_event_t *events = (movie_event_t *)realloc(movie->events, capacity * sizeof(movie_event_t));
+			if (!events) {
+				fprintf(stderr, "Out of memory recording input, the movie stops at frame %u\n", frame);
+				movie->mode = MOVIE_OFF;
+				return;
+			}
+			movie->events = events;
+			movie->capacity = capacity;
+		}
+		movie->events[movie->header.eventCount++] = (movie_event_t){ frame, inst, key, chip8->keys[key] };
+	}
+}
+
+
+// Runs one frame of instructions, splitting it wherever the recording changed a key mid frame
+// Timers are left to the caller like with emulateInstructions
+void playMovieFrame(movie_t *movie, chip8_t *chip8, const config_t *config, uint32_t frame) {
+	const uint32_t instPerFrame = frameInstructions(config, frame);
+	uint32_t done = 0;
+
+	while (movie->cursor < movie->header.eventCount && movie->events[movie->cursor].frame <= frame) {
+		const movie_event_t *event = &movie->events[movie->cursor++];
+		if (event->frame == frame && event->inst > done && event->inst <= instPerFrame) {
+			emulateInstructions(chip8, config, event->inst - done);
+			done = event->inst;
+		}
+		chip8->keys[event->key & 0xF] = event->down != 0;
+	}
+	emulateInstructions(chip8, config, instPerFrame - done);
+}
+
+
+bool checkMovieRom(const movie_t *movie, const chip8_t *chip8) {
+	if (movie->header.romHash == hashMemory(chip8)) return true;
+	fprintf(stderr, "Movie was recorded with a different rom\n");
+	return false;
+}
+
+
+bool saveMovie(const movie_t *movie, const char *path) {
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "Could not open %s for writing\n", path);
+		return false;
+	}
+	bool ok = fwrite(&movie->header, sizeof movie->header, 1, file) == 1;
+	if (ok && movie->header.eventCount)
+		ok = fwrite(movie->events, sizeof(movie_event_t), movie->header.eventCount, file) == movie->header.eventCount;
+	if (fclose(file) != 0 || !ok) {
+		fprintf(stderr, "Could not write movie %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+
+// Loads a recording and arms it for replay from frame 0
+bool loadMovie(movie_t *movie, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Could not open movie %s\n", path);
+		return false;
+	}
+	movie_header_t header;
+	if (fread(&header, sizeof header, 1, file) != 1 || header.magic != MOVIE_MAGIC) {
+		fprintf(stderr, "%s is not a movie\n", path);
+		fclose(file);
+		return false;
+	}
+	if (header.version != MOVIE_VERSION) {
+		fprintf(stderr, "%s is movie version %u, this build reads version %u\n", path, header.version, MOVIE_VERSION);
+		fclose(file);
+		return false;
+	}
+	if (header.quirks >= QUIRKS_COUNT) {
+		fprintf(stderr, "%s was recorded with unknown quirks %u\n", path, header.quirks);
+		fclose(file);
+		return false;
+	}
+	movie_event_t *events = (movie_event_t *)malloc((header.eventCount ? header.eventCount : 1) * sizeof(movie_event_t));
+	if (!events || fread(events, sizeof(movie_event_t), header.eventCount, file) != header.eventCount) {
+		fprintf(stderr, "Movie %s is truncated\n", path);
+		free(events);
+		fclose(file);
+		return false;
+	}
+	fclose(file);
+
+	freeMovie(movie);
+	movie->mode = MOVIE_REPLAY;
+	movie->header = header;
+	movie->events = events;
+	movie->capacity = header.eventCount;
+	movie->cursor = 0;
+	memset(movie->keys, 0, sizeof movie->keys);
+	return true;
+}
+
+
+void freeMovie(movie_t *movie) {
+	free(movie->events);
+	movie->events = NULL;
+	movie->capacity = 0;
+	movie->header.eventCount = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+#define MOVIE_MAGIC 0x564D3843u		// "C8MV" read as a little endian word
+#define MOVIE_VERSION 3		// 2: frames run frameInstructions(), not a truncated instPerSec / 60
+							// 3: memory hash covers 64K and the hi-res font
+
+typedef enum {
+	MOVIE_OFF,
+	MOVIE_RECORD,		// Keypad changes are appended to the movie
+	MOVIE_REPLAY,		// Keypad is driven by the movie, live keys are ignored
+} movie_mode_t;
+
+// One keypad transition, applied before instruction inst of frame
+typedef struct {
+	uint32_t frame;			// 60hz frame, counting only frames the machine ran in
+	uint16_t inst;			// Instructions into the frame, 0 for input read between frames
+	uint8_t key;
+	uint8_t down;
+} movie_event_t;
+
+// File header, followed by eventCount movie_event_t in host (little endian) byte order
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t rngSeed;		// CXNN seed the run started with
+	uint64_t romHash;		// hashMemory() right after initChip8, refuses replays against another rom
+	uint32_t instPerSec;	// Sets instructions per frame through frameInstructions(), replays need the same
+	uint32_t frames;		// Length of the recording
+	uint32_t eventCount;
+	uint32_t quirks;		// quirk_profile_t the run used, replays need the same
+} movie_header_t;
+
+static_assert(sizeof(movie_header_t) == 40 && sizeof(movie_event_t) == 8, "movie files are written straight from these structs");
+
+// Recorded run: everything needed besides the rom to reproduce it bit for bit
+typedef struct {
+	movie_mode_t mode;
+	movie_header_t header;
+	movie_event_t *events;
+	uint32_t capacity;
+	uint32_t cursor;		// Next event to replay
+	bool keys[16];			// Keypad as the recording last saw it
+} movie_t;
+
+uint64_t hashMemory(const chip8_t *chip8);
+void startMovie(movie_t *movie, const chip8_t *chip8, const config_t *config);
+void recordInputs(movie_t *movie, const chip8_t *chip8, uint32_t frame, uint16_t inst);
+void playMovieFrame(movie_t *movie, chip8_t *chip8, const config_t *config, uint32_t frame);
+bool checkMovieRom(const movie_t *movie, const chip8_t *chip8);
+bool saveMovie(const movie_t *movie, const char *path);
+bool loadMovie(movie_t *movie, const char *path);
+void freeMovie(movie_t *movie);
+
+#endif
@@ -0,0 +1,30 @@
+#include "output.h"
+
+
+// Writes framebuffer rows first..last of the current resolution as RGBA8888 texels, pixels points at row first
+// Each pixel is pixelTexels texels square, every texel of the span is written
+void renderRows(const chip8_t *chip8, const config_t *config, uint32_t first, uint32_t last, void *pixels, int pitch) {
+	// Colors are 0xRRGGBBAA which is already the RGBA8888 texel layout, indexed by getPixel
+	const uint32_t colors[4] = { config->bgColor, config->fgColor, config->fg2Color, config->blendColor };
+	const uint32_t bg = config->bgColor;
+	const bool outlines = config->pixelOutlines;
+	const uint32_t cell = pixelTexels(chip8, config);
+	const uint32_t width = displayWidth(chip8);
+
+	for (uint32_t y = first; y <= last; y++) {
+		for (uint32_t py = 0; py < cell; py++) {
+			uint32_t *texel = (uint32_t *)((uint8_t *)pixels + ((y - first) * cell + py) * pitch);
+			const bool edgeY = (py == 0 || py == cell - 1);
+
+			for (uint32_t x = 0; x < width; x++) {
+				const uint8_t color = getPixel(chip8, x, y);
+
+				for (uint32_t px = 0; px < cell; px++) {
+					// If user requested drawing pixel outlines, lit pixels get a bg colored border
+					const bool edge = outlines && (edgeY || px == 0 || px == cell - 1);
+					*texel++ = (color && !edge) ? colors[color] : bg;
+				}
+			}
+		}
+	}
+}
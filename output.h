@@ -0,0 +1,23 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// The SDL independent half of the frontend's video output, audio lives in audio.h
+// main.cpp hands this texture memory, the benchmark hands it plain arrays
+
+// The texture always has DISPLAY_WIDTH x DISPLAY_HEIGHT hi-res cells of textureCell texels a side,
+// pixel outlines need a few texels per pixel to be drawn into
+static inline uint32_t textureCell(const config_t *config) {
+	return config->pixelOutlines ? (config->scaleFactor + 1) / 2 : 1;
+}
+
+// Texels a side of one pixel at the machine's current resolution, a lo-res pixel covers 2x2 cells
+static inline uint32_t pixelTexels(const chip8_t *chip8, const config_t *config) {
+	return textureCell(config) * (DISPLAY_WIDTH / displayWidth(chip8));
+}
+
+void renderRows(const chip8_t *chip8, const config_t *config, uint32_t first, uint32_t last, void *pixels, int pitch);
+
+#endif
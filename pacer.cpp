@@ -0,0 +1,91 @@
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "pacer.h"
+
+
+uint64_t pacerNowNs(void) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Deadline of frame, exact in integers so rounding never accumulates
+static uint64_t deadline(const pacer_t *pacer, uint64_t frame) {
+	return pacer->startNs + frame * 1000000000ull / pacer->hz;
+}
+
+
+// Frame 0 is due right away
+void startPacer(pacer_t *pacer, uint32_t hz) {
+	memset(pacer, 0, sizeof *pacer);
+	pacer->hz = hz ? hz : 60;
+	pacer->startNs = pacer->firstNs = pacerNowNs();
+	pacer->spinNs = 1000000;
+}
+
+
+// Blocks until the next frame is due
+void waitForFrame(pacer_t *pacer) {
+	const uint64_t period = 1000000000ull / pacer->hz;
+	uint64_t due = deadline(pacer, pacer->frame);
+	uint64_t now = pacerNowNs();
+
+	if (now > due + PACER_RESYNC_FRAMES * period) {
+		// Stopped in a debugger or starved of cpu, running the missed frames back to back would only
+		// be a burst of fast forward, so the schedule starts over from now
+		pacer->startNs = pacer->firstNs = due = now;
+		pacer->frame = pacer->released = 0;
+		pacer->resyncs++;
+	}
+
+	if (now + pacer->spinNs < due) {
+		const uint64_t wake = due - pacer->spinNs;
+		std::this_thread::sleep_for(std::chrono::nanoseconds(wake - now));
+		const uint64_t woke = pacerNowNs();
+		pacer->sleptNs += woke - now;
+		// A bigger oversleep raises the margin straight away, smaller ones let it creep back down
+		const uint64_t needed = (woke > wake ? woke - wake : 0) + PACER_SPIN_SLACK_NS;
+		if (needed > pacer->spinNs) pacer->spinNs = std::min(needed, period / 2);
+		else pacer->spinNs -= (pacer->spinNs - needed) / 16;
+		now = woke;
+	}
+	const uint64_t spinStart = now;
+	while (now < due) {
+		std::this_thread::yield();
+		now = pacerNowNs();
+	}
+	pacer->spunNs += now - spinStart;
+
+	const uint64_t late = now - due;
+	pacer->late[pacer->waits % PACER_HISTORY] = late > UINT32_MAX ? UINT32_MAX : (uint32_t)late;
+	pacer->waits++;
+	pacer->lastNs = now;
+	pacer->frame++;
+	pacer->released++;
+}
+
+
+// When the next waitForFrame will start waiting, work squeezed in before the next release should end by then
+uint64_t frameBudgetEndNs(const pacer_t *pacer) {
+	const uint64_t due = deadline(pacer, pacer->frame);
+	return due > pacer->spinNs ? due - pacer->spinNs : 0;
+}
+
+
+// Achieved rate and how late frames were released, over the last PACER_HISTORY frames for the percentiles
+void printPacing(const pacer_t *pacer, FILE *out) {
+	if (pacer->released < 2) return;
+	const double seconds = (pacer->lastNs - pacer->firstNs) / 1e9;
+	uint32_t late[PACER_HISTORY];
+	const uint32_t count = pacer->waits < PACER_HISTORY ? (uint32_t)pacer->waits : PACER_HISTORY;
+	memcpy(late, pacer->late, count * sizeof late[0]);
+	std::sort(late, late + count);
+	const auto percentile = [&](double p) { return late[(uint32_t)(p * (count - 1))] / 1000.0; };
+
+	fprintf(out, "Frame pacing: %.3f hz (target %u), late by p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+			(pacer->released - 1) / seconds, pacer->hz, percentile(0.5), percentile(0.9), percentile(0.99), late[count - 1] / 1000.0);
+	fprintf(out, "  slept %.1f%%, spun %.1f%% with a %.2f ms margin, %llu resyncs\n",
+			100.0 * pacer->sleptNs / 1e9 / seconds, 100.0 * pacer->spunNs / 1e9 / seconds, pacer->spinNs / 1e6,
+			(unsigned long long)pacer->resyncs);
+}
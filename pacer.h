@@ -0,0 +1,34 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PACER_HISTORY 4096			// Release times kept for the percentiles, a bit over a minute at 60hz
+#define PACER_RESYNC_FRAMES 8		// Further behind than this the schedule restarts instead of catching up
+#define PACER_SPIN_SLACK_NS 200000	// Spin margin kept on top of the worst recent oversleep
+
+// Releases frames on absolute deadlines start + n / hz, so a late frame doesn't push back the ones after it
+// and the rate can't drift. Each wait sleeps until shortly before the deadline and spins for the rest, the
+// spin margin follows how much the OS actually oversleeps
+typedef struct {
+	uint32_t hz;
+	uint64_t startNs;		// Deadline of frame 0
+	uint64_t frame;			// Next frame to release
+	uint64_t firstNs;		// When the schedule (re)started, for the achieved rate
+	uint64_t released;		// Frames released since firstNs
+	uint64_t lastNs;		// When the latest one was
+	uint64_t spinNs;		// Margin left for spinning before each deadline
+	uint64_t sleptNs, spunNs;
+	uint64_t resyncs;		// Times the schedule fell too far behind and restarted
+	uint64_t waits;			// Deadlines waited for, counts every entry in late
+	uint32_t late[PACER_HISTORY];	// Release minus deadline in ns, a ring indexed by waits
+} pacer_t;
+
+uint64_t pacerNowNs(void);
+void startPacer(pacer_t *pacer, uint32_t hz);
+void waitForFrame(pacer_t *pacer);
+uint64_t frameBudgetEndNs(const pacer_t *pacer);
+void printPacing(const pacer_t *pacer, FILE *out);
+
+#endif
@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "chip8.h"
+#include "disasm.h"
+
+static const char *const groupNames[16] = {
+	"0 CLS/RET/SYS", "1 JP", "2 CALL", "3 SE imm", "4 SNE imm", "5 SE reg", "6 LD imm", "7 ADD imm",
+	"8 ALU", "9 SNE reg", "A LD I", "B JP V0", "C RND", "D DRW", "E SKP/SKNP", "F timers/memory",
+};
+
+static const char *const phaseNames[PHASE_COUNT] = { "input", "emulation", "render", "timers", "sleep" };
+
+
+profile_t *createProfile(uint64_t tickFreq) {
+	profile_t *profile = (profile_t *)calloc(1, sizeof(profile_t));
+	if (profile) profile->tickFreq = tickFreq;
+	return profile;
+}
+
+
+void destroyProfile(profile_t *profile) {
+	free(profile);
+}
+
+
+// Counts then runs each instruction on the reference interpreter
+void profileInstructions(profile_t *profile, chip8_t *chip8, const config_t *config, uint32_t count) {
+	uint32_t i = 0;
+	for (; i < count && chip8->state != PAUSE; i++) {
+		const uint16_t pc = chip8->pc;
+		profile->pcHits[pc]++;
+		if (pc < HEAT_SLOTS * 2) profile->recent[pc]++;
+		profile->groupHits[chip8->memory[pc] >> 4]++;
+		emulateInstruction(chip8, config);
+	}
+	profile->instructions += i;
+}
+
+
+// Called once per frame, folds the frame's counts into the heatmap
+void endProfileFrame(profile_t *profile) {
+	for (uint32_t slot = 0; slot < HEAT_SLOTS; slot++)
+		profile->heat[slot] = profile->heat[slot] * HEAT_DECAY + profile->recent[2 * slot] + profile->recent[2 * slot + 1];
+	memset(profile->recent, 0, sizeof profile->recent);
+	profile->frames++;
+}
+
+
+// A backward JP is the end of a loop, its weight is everything executed between the target and the jump
+typedef struct {
+	uint16_t start, end;
+	uint64_t hits;
+} hot_loop_t;
+
+
+// Frame time split, opcode groups, hottest loops and hottest addresses with their disassembly
+// Disassembly is of memory as it is now, code a rom rewrote shows its latest bytes
+void printProfile(const profile_t *profile, const chip8_t *chip8, FILE *out, uint32_t top) {
+	const uint64_t total = profile->instructions ? profile->instructions : 1;
+	fprintf(out, "Profile: %llu instructions over %llu frames\n", (unsigned long long)profile->instructions,
+			(unsigned long long)profile->frames);
+
+	uint64_t frameTicks = 0;
+	for (uint32_t p = 0; p < PHASE_COUNT; p++) frameTicks += profile->phaseTicks[p];
+	if (frameTicks && profile->frames && profile->tickFreq) {
+		fprintf(out, "\nFrame time           ms/frame      share\n");
+		for (uint32_t p = 0; p < PHASE_COUNT; p++) {
+			fprintf(out, "  %-16s %10.3f %9.1f%%\n", phaseNames[p],
+					1000.0 * profile->phaseTicks[p] / profile->tickFreq / profile->frames, 100.0 * profile->phaseTicks[p] / frameTicks);
+		}
+	}
+
+	fprintf(out, "\nOpcode group            executed      share\n");
+	for (uint32_t g = 0; g < 16; g++) {
+		if (!profile->groupHits[g]) continue;
+		fprintf(out, "  %-16s %14llu %9.1f%%\n", groupNames[g], (unsigned long long)profile->groupHits[g],
+				100.0 * profile->groupHits[g] / total);
+	}
+
+	std::vector<hot_loop_t> loops;
+	for (uint32_t addr = 0; addr + 1 < MEMORY_SIZE; addr++) {
+		const uint16_t opcode = (chip8->memory[addr] << 8) | chip8->memory[addr + 1];
+		if (!profile->pcHits[addr] || (opcode >> 12) != 0x1 || (opcode & 0xFFF) > addr) continue;
+		hot_loop_t loop = { (uint16_t)(opcode & 0xFFF), (uint16_t)addr, 0 };
+		for (uint32_t a = loop.start; a <= loop.end; a++) loop.hits += profile->pcHits[a];
+		loops.push_back(loop);
+	}
+	const uint32_t loopCount = (uint32_t)loops.size();
+	std::sort(loops.begin(), loops.end(), [](const hot_loop_t &a, const hot_loop_t &b) { return a.hits > b.hits; });
+	if (loopCount) fprintf(out, "\nHot loops               executed      share\n");
+	for (uint32_t i = 0; i < loopCount && i < 8; i++) {
+		fprintf(out, "  0x%04X-0x%04X    %14llu %9.1f%%\n", loops[i].start, loops[i].end,
+				(unsigned long long)loops[i].hits, 100.0 * loops[i].hits / total);
+	}
+
+	std::vector<uint16_t> order;
+	for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++)
+		if (profile->pcHits[addr]) order.push_back(addr);
+	const uint32_t hot = (uint32_t)order.size();
+	std::sort(order.begin(), order.end(), [&](uint16_t a, uint16_t b) {
+		return profile->pcHits[a] != profile->pcHits[b] ? profile->pcHits[a] > profile->pcHits[b] : a < b;
+	});
+
+	fprintf(out, "\nHot spots   addr       executed   share   cumul  opcode  instruction\n");
+	uint64_t cumulative = 0;
+	for (uint32_t i = 0; i < hot && i < top; i++) {
+		const uint16_t addr = order[i];
+		const uint16_t opcode = (chip8->memory[addr] << 8) | chip8->memory[(uint16_t)(addr + 1)];
+		char text[32];
+		disassemble(opcode, text, sizeof text);
+		cumulative += profile->pcHits[addr];
+		fprintf(out, "  %5u   0x%04X %14llu %6.1f%% %6.1f%%    %04X  %s\n", i + 1, addr, (unsigned long long)profile->pcHits[addr],
+				100.0 * profile->pcHits[addr] / total, 100.0 * cumulative / total, opcode, text);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct chip8_t;
+struct config_t;
+
+// Parts of a frame in the window's main loop
+typedef enum {
+	PHASE_INPUT,
+	PHASE_EMULATION,
+	PHASE_RENDER,
+	PHASE_TIMERS,
+	PHASE_SLEEP,
+	PHASE_COUNT,
+} frame_phase_t;
+
+#define HEAT_SLOTS 2048		// One heatmap cell per 2 byte instruction slot of the first 4K, 64x32 like the lo-res screen
+#define HEAT_DECAY 0.9f		// Share of a slot's heat kept from one frame to the next
+
+// Execution profile, attached to a machine like the decode cache and the recompiler
+// While one is attached every instruction runs through the reference interpreter and is counted,
+// so the counts are the same whichever engine was picked
+typedef struct profile_t {
+	uint64_t pcHits[65536];		// Instructions executed at each address
+	uint64_t groupHits[16];		// Instructions executed per opcode group (top nibble)
+	uint64_t instructions;
+	uint32_t recent[HEAT_SLOTS * 2];	// pcHits in the heatmap's 4K since the last endProfileFrame
+	float heat[HEAT_SLOTS];		// Decaying recent execution count per instruction slot
+
+	uint64_t phaseTicks[PHASE_COUNT];	// Frame time spent per phase, in tickFreq units
+	uint64_t tickFreq;
+	uint64_t frames;
+} profile_t;
+
+profile_t *createProfile(uint64_t tickFreq);
+void destroyProfile(profile_t *profile);
+void profileInstructions(profile_t *profile, struct chip8_t *chip8, const struct config_t *config, uint32_t count);
+void endProfileFrame(profile_t *profile);
+void printProfile(const profile_t *profile, const struct chip8_t *chip8, FILE *out, uint32_t top);
+
+static inline void addPhaseTime(profile_t *profile, frame_phase_t phase, uint64_t ticks) {
+	profile->phaseTicks[phase] += ticks;
+}
+
+#endif
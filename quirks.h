@@ -0,0 +1,47 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Platform quirk profiles, picked at load time
+// The platforms disagree on a handful of instructions. Rather than test a flag in every one of them, each
+// engine is a template over the profile and gets one instantiation per profile, so a quirk is a compile
+// time constant wherever it is read and the unused behaviour is not even in the instantiated code
+typedef enum {
+	QUIRKS_VIP,			// COSMAC VIP CHIP-8, the default and what every golden hash was recorded with
+	QUIRKS_CHIP48,		// HP-48 CHIP-48
+	QUIRKS_SCHIP,		// SUPER-CHIP 1.1
+	QUIRKS_XOCHIP,		// XO-CHIP as Octo runs it
+	QUIRKS_COUNT,
+} quirk_profile_t;
+
+// Where FX55/FX65 leave I
+typedef enum {
+	INDEX_PAST,			// I + X + 1, past the last register
+	INDEX_LAST,			// I + X, on the last register (CHIP-48's off by one)
+	INDEX_KEEP,			// I is unchanged
+} index_quirk_t;
+
+typedef struct {
+	bool vfReset;		// 8XY1/8XY2/8XY3 clear VF
+	bool shiftVY;		// 8XY6/8XYE shift VY into VX, otherwise VX is shifted in place
+	index_quirk_t index;// FX55/FX65
+	bool wrap;			// DXYN wraps sprites around the screen edges, otherwise they are clipped
+	bool jumpVX;		// BXNN jumps to XNN + VX, otherwise BNNN jumps to NNN + V0
+	bool superChip;		// 00CN, 00FB-00FF, DXY0 16x16 sprites, FX30, FX75/FX85, otherwise they do nothing
+	bool xoChip;		// 00DN, 5XY2/5XY3, F000 NNNN (and skipping it whole), FN01, F002, FX3A, otherwise they do nothing
+} quirk_set_t;
+
+// Indexed by quirk_profile_t
+static constexpr quirk_set_t quirkSets[QUIRKS_COUNT] = {
+	{ .vfReset = true,  .shiftVY = true,  .index = INDEX_PAST, .wrap = false, .jumpVX = false, .superChip = false, .xoChip = false },	// VIP
+	{ .vfReset = false, .shiftVY = false, .index = INDEX_LAST, .wrap = false, .jumpVX = true,  .superChip = false, .xoChip = false },	// CHIP-48
+	{ .vfReset = false, .shiftVY = false, .index = INDEX_KEEP, .wrap = false, .jumpVX = true,  .superChip = true,  .xoChip = false },	// SUPER-CHIP
+	{ .vfReset = false, .shiftVY = true,  .index = INDEX_PAST, .wrap = true,  .jumpVX = false, .superChip = true,  .xoChip = true },	// XO-CHIP
+};
+
+bool parseQuirks(const char *name, quirk_profile_t *quirks);
+const char *quirksName(quirk_profile_t quirks);
+
+#endif
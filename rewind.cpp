@@ -0,0 +1,283 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "rewind.h"
+
+#define STATE_WORDS (sizeof(savestate_t) / 8)
+
+static_assert(sizeof(savestate_t) % 8 == 0, "deltas are taken a word at a time");
+
+
+rewind_t *createRewind(uint32_t capBytes) {
+	const uint32_t maxFrames = capBytes / REWIND_FRAME_COST;
+	const uint32_t frameBytes = maxFrames * sizeof(rewind_frame_t);
+	const uint32_t dataSize = capBytes > frameBytes ? (capBytes - frameBytes) & ~7u : 0;
+	if (maxFrames < 2 || dataSize < 2 * sizeof(savestate_t)) return NULL;	// Too small to hold a keyframe and its deltas
+
+	rewind_t *rewind = (rewind_t *)calloc(1, sizeof(rewind_t));
+	if (!rewind) return NULL;
+	rewind->data = (uint8_t *)malloc(dataSize);
+	rewind->frames = (rewind_frame_t *)malloc(frameBytes);
+	if (!rewind->data || !rewind->frames) {
+		destroyRewind(rewind);
+		return NULL;
+	}
+	rewind->dataSize = dataSize;
+	rewind->maxFrames = maxFrames;
+	return rewind;
+}
+
+
+void destroyRewind(rewind_t *rewind) {
+	if (!rewind) return;
+	free(rewind->data);
+	free(rewind->frames);
+	free(rewind);
+}
+
+
+// Forget the history, the cost counters keep running
+void resetRewind(rewind_t *rewind) {
+	rewind->first = rewind->next = rewind->key = 0;
+	rewind->writePos = 0;
+	rewind->bytes = 0;
+}
+
+
+static inline rewind_frame_t *getFrame(const rewind_t *rewind, uint64_t seq) {
+	return &rewind->frames[seq % rewind->maxFrames];
+}
+
+
+// Records start on a word boundary so keyframes can be read in place
+static inline uint32_t recordBytes(uint32_t size) {
+	return (size + 7) & ~7u;
+}
+
+
+// The oldest frame is always a keyframe, it goes together with every delta taken against it
+static void dropOldest(rewind_t *rewind) {
+	const uint64_t key = getFrame(rewind, rewind->first)->key;
+	while (rewind->first < rewind->next && getFrame(rewind, rewind->first)->key == key) {
+		rewind->bytes -= recordBytes(getFrame(rewind, rewind->first)->size);
+		rewind->first++;
+	}
+}
+
+
+// Finds room for a record after the newest one, dropping the oldest history until it fits
+static uint32_t allocRecord(rewind_t *rewind, uint32_t size) {
+	size = recordBytes(size);
+	if (rewindFrames(rewind) == rewind->maxFrames) dropOldest(rewind);
+	if (rewind->first == rewind->next) rewind->writePos = 0;
+
+	uint32_t pos = rewind->writePos;
+	if (pos + size > rewind->dataSize) {
+		// Wrap to the start, anything stored past writePos predates the previous wrap and is the oldest history
+		while (rewind->first < rewind->next && getFrame(rewind, rewind->first)->offset >= rewind->writePos)
+			dropOldest(rewind);
+		pos = 0;
+	}
+	// Records are laid out in push order, so the oldest one is the first that can be in the way
+	while (rewind->first < rewind->next) {
+		const rewind_frame_t *oldest = getFrame(rewind, rewind->first);
+		if (oldest->offset >= pos + size || oldest->offset + recordBytes(oldest->size) <= pos) break;
+		dropOldest(rewind);
+	}
+	rewind->writePos = pos + size;
+	rewind->bytes += size;
+	return pos;
+}
+
+
+#define PAGES (MEMORY_SIZE / MEMORY_PAGE)
+#define PAGE_WORDS (MEMORY_PAGE / 8)
+#define MEMORY_WORD (offsetof(savestate_t, memory) / 8)		// Where each part starts in the state, in words
+#define DISPLAY_WORD (offsetof(savestate_t, display) / 8)
+#define REGISTER_WORD (offsetof(savestate_t, rngState) / 8)
+
+static_assert(offsetof(savestate_t, memory) % 8 == 0 && offsetof(savestate_t, display) % 8 == 0 &&
+	offsetof(savestate_t, rngState) % 8 == 0, "memory, display and registers are compared a word at a time");
+
+
+// Appends runs of changed words as (word offset, word count) headers each followed by the XORed words
+// key and now point at count words of the state starting at word, size is what out already holds.
+// Returns the new size, or UINT32_MAX once the encoding would take more than limit bytes
+static uint32_t encodeRange(uint32_t word, uint32_t count, const uint8_t *key, const uint8_t *now,
+							uint8_t *out, uint32_t size, uint32_t limit) {
+	if (size == UINT32_MAX) return size;
+	for (uint32_t w = 0; w < count; ) {
+		uint64_t x, y;
+		memcpy(&x, key + w * 8, 8);
+		memcpy(&y, now + w * 8, 8);
+		if (x == y) {
+			w++;
+			continue;
+		}
+		uint32_t end = w;
+		const uint32_t header = size;
+		size += 4;
+		do {
+			if (size + 8 > limit) return UINT32_MAX;
+			x ^= y;
+			memcpy(out + size, &x, 8);
+			size += 8;
+			if (++end == count) break;
+			memcpy(&x, key + end * 8, 8);
+			memcpy(&y, now + end * 8, 8);
+		} while (x != y);
+
+		const uint16_t run[2] = { (uint16_t)(word + w), (uint16_t)(end - w) };
+		memcpy(out + header, run, 4);
+		w = end;
+	}
+	return size;
+}
+
+
+// Finds the next run of set flags at or after *first, false when there is none
+static bool nextRun(const uint8_t *flags, uint32_t count, uint32_t *first, uint32_t *end) {
+	uint32_t i = *first;
+	while (i < count && !flags[i]) i++;
+	if (i == count) return false;
+	*first = i;
+	while (i < count && flags[i]) i++;
+	*end = i;
+	return true;
+}
+
+
+// Delta of the machine against the keyframe into rewind->delta
+// Memory and display are only compared where they were marked since the keyframe, neighbouring pages
+// and rows as one range so a run can cross from one into the next
+static uint32_t encodeDelta(rewind_t *rewind, const chip8_t *chip8) {
+	const savestate_t *key = &rewind->keyState;
+	const uint32_t limit = sizeof rewind->delta;
+	uint32_t size = 0;
+
+	for (uint32_t page = 0, end; nextRun(rewind->pages, PAGES, &page, &end); page = end)
+		size = encodeRange(MEMORY_WORD + page * PAGE_WORDS, (end - page) * PAGE_WORDS, &key->memory[page * MEMORY_PAGE],
+						   &chip8->memory[page * MEMORY_PAGE], rewind->delta, size, limit);
+	for (uint32_t p = 0; p < DISPLAY_PLANES; p++)
+		for (uint32_t row = 0, end; nextRun(rewind->rows, DISPLAY_HEIGHT, &row, &end); row = end)
+			size = encodeRange(DISPLAY_WORD + (p * DISPLAY_HEIGHT + row) * DISPLAY_WORDS, (end - row) * DISPLAY_WORDS,
+							   (const uint8_t *)key->display[p][row], (const uint8_t *)chip8->display[p][row], rewind->delta, size, limit);
+
+	captureRegisters(chip8, &rewind->scratch);
+	return encodeRange(REGISTER_WORD, STATE_WORDS - REGISTER_WORD, (const uint8_t *)&key->rngState,
+					   (const uint8_t *)&rewind->scratch.rngState, rewind->delta, size, limit);
+}
+
+
+// Marks the pages and rows a delta covers, after restoring it those are what differs from the keyframe
+static void markDelta(rewind_t *rewind, const uint8_t *delta, uint32_t size) {
+	for (uint32_t pos = 0; pos < size; ) {
+		uint16_t run[2];
+		memcpy(run, delta + pos, 4);
+		pos += 4 + run[1] * 8;
+		for (uint32_t w = run[0]; w < (uint32_t)run[0] + run[1]; w++) {
+			if (w >= REGISTER_WORD) break;
+			if (w >= DISPLAY_WORD) rewind->rows[(w - DISPLAY_WORD) / DISPLAY_WORDS % DISPLAY_HEIGHT] = 1;
+			else if (w >= MEMORY_WORD) rewind->pages[(w - MEMORY_WORD) / PAGE_WORDS] = 1;
+		}
+	}
+}
+
+
+static void applyDelta(savestate_t *state, const uint8_t *delta, uint32_t size) {
+	uint8_t *s = (uint8_t *)state;
+	for (uint32_t pos = 0; pos < size; ) {
+		uint16_t run[2];
+		memcpy(run, delta + pos, 4);
+		pos += 4;
+		for (uint32_t w = run[0]; w < (uint32_t)run[0] + run[1]; w++, pos += 8) {
+			uint64_t x, y;
+			memcpy(&x, s + w * 8, 8);
+			memcpy(&y, delta + pos, 8);
+			x ^= y;
+			memcpy(s + w * 8, &x, 8);
+		}
+	}
+}
+
+
+// Snapshot the machine as the newest frame, called once per frame before it runs
+// Takes the machine's dirty pages and rows, so they only cover what changed since the last push
+void pushRewind(rewind_t *rewind, chip8_t *chip8) {
+	const auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < PAGES; i++) rewind->pages[i] |= chip8->dirtyPages[i];
+	for (uint32_t y = 0; y < DISPLAY_HEIGHT; y++) rewind->rows[y] |= (chip8->changedRows >> y) & 1;
+	memset(chip8->dirtyPages, 0, sizeof chip8->dirtyPages);
+	chip8->changedRows = 0;
+
+	uint32_t size = UINT32_MAX;
+	const uint64_t seq = rewind->next;
+	if (rewind->first < rewind->next && seq - rewind->key < REWIND_KEY_INTERVAL) size = encodeDelta(rewind, chip8);
+
+	if (size != UINT32_MAX) {
+		const uint32_t pos = allocRecord(rewind, size);
+		if (rewind->key >= rewind->first) {
+			memcpy(rewind->data + pos, rewind->delta, size);
+			*getFrame(rewind, seq) = (rewind_frame_t){ rewind->key, pos, size };
+		}
+		else {
+			// Making room dropped the keyframe itself, history is empty now
+			rewind->bytes -= recordBytes(size);
+			size = UINT32_MAX;
+		}
+	}
+	if (size == UINT32_MAX) {
+		const uint32_t pos = allocRecord(rewind, sizeof(savestate_t));
+		captureState(chip8, &rewind->keyState);
+		memcpy(rewind->data + pos, &rewind->keyState, sizeof(savestate_t));
+		*getFrame(rewind, seq) = (rewind_frame_t){ seq, pos, (uint32_t)sizeof(savestate_t) };
+		rewind->key = seq;
+		memset(rewind->pages, 0, sizeof rewind->pages);
+		memset(rewind->rows, 0, sizeof rewind->rows);
+		rewind->keyframes++;
+	}
+	rewind->next = seq + 1;
+
+	const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	rewind->pushes++;
+	rewind->pushNs += ns;
+	rewind->lastPushNs = ns;
+	if (ns > rewind->maxPushNs) rewind->maxPushNs = ns;
+}
+
+
+// Restore the newest frame and drop it, false once the history is used up
+// The keypad keeps its live state so keys held while rewinding aren't replaced by recorded ones
+bool popRewind(rewind_t *rewind, chip8_t *chip8) {
+	if (rewind->first == rewind->next) return false;
+	const uint64_t seq = rewind->next - 1;
+	const rewind_frame_t frame = *getFrame(rewind, seq);
+	const rewind_frame_t *key = getFrame(rewind, frame.key);
+
+	memcpy(&rewind->scratch, rewind->data + key->offset, sizeof(savestate_t));
+	if (frame.key != seq) applyDelta(&rewind->scratch, rewind->data + frame.offset, frame.size);
+
+	bool keys[16];
+	memcpy(keys, chip8->keys, sizeof keys);
+	restoreState(chip8, &rewind->scratch);
+	memcpy(chip8->keys, keys, sizeof keys);
+	// The machine is exactly the frame now, it differs from the keyframe where the frame's delta does
+	memset(chip8->dirtyPages, 0, sizeof chip8->dirtyPages);
+	chip8->changedRows = 0;
+	memset(rewind->pages, 0, sizeof rewind->pages);
+	memset(rewind->rows, 0, sizeof rewind->rows);
+	if (frame.key != seq) markDelta(rewind, rewind->data + frame.offset, frame.size);
+
+	rewind->next = seq;
+	rewind->writePos = frame.offset;
+	rewind->bytes -= recordBytes(frame.size);
+	if (frame.key == seq && rewind->first < rewind->next) {
+		// Popped a keyframe, later deltas are taken against the one before it again
+		rewind->key = getFrame(rewind, seq - 1)->key;
+		memcpy(&rewind->keyState, rewind->data + getFrame(rewind, rewind->key)->offset, sizeof(savestate_t));
+		memset(rewind->pages, 1, sizeof rewind->pages);
+		memset(rewind->rows, 1, sizeof rewind->rows);
+	}
+	return true;
+}
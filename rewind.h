@@ -0,0 +1,59 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+#include "savestate.h"
+
+#define REWIND_KEY_INTERVAL 120		// Frames between keyframes, deltas against an old keyframe keep growing
+#define REWIND_FRAME_COST 64		// Bytes of the cap set aside per frame slot, bounds how many frames are kept
+
+// One snapshot in the history
+typedef struct {
+	uint64_t key;			// Sequence number of the keyframe this frame is a delta of, its own for a keyframe
+	uint32_t offset;		// Start of the record in rewind_t::data, 8 byte aligned
+	uint32_t size;			// Record bytes, 0 for a frame identical to its keyframe
+} rewind_frame_t;
+
+// Bounded history of per frame snapshots
+// Keyframes are whole savestate_t records. Every other frame is the XOR of its state with the latest
+// keyframe stored as runs of changed 8 byte words, usually a few registers, the timers and a display row.
+// Only the memory pages and display rows the machine marked since the keyframe are compared, plus the
+// registers. Records live in one circular arena and the oldest keyframe, together with the deltas that
+// need it, is dropped whenever a new record doesn't fit
+typedef struct {
+	uint8_t *data;			// Record arena
+	uint32_t dataSize;
+	uint32_t writePos;		// Where the next record goes
+	rewind_frame_t *frames;	// Ring of frame slots, indexed by sequence number
+	uint32_t maxFrames;
+	uint64_t first;			// Sequence number of the oldest frame held
+	uint64_t next;			// Sequence number the next push gets
+	uint64_t key;			// Sequence number of the newest keyframe
+	savestate_t keyState;	// Copy of the newest keyframe that deltas are taken against
+	savestate_t scratch;
+	uint8_t pages[MEMORY_SIZE / MEMORY_PAGE];	// chip8_t::dirtyPages and changedRows gathered since the keyframe,
+	uint8_t rows[DISPLAY_HEIGHT];				// non zero where the machine may differ from it
+	uint8_t delta[sizeof(savestate_t) / 2];	// A delta over half a keyframe isn't worth keeping as one
+	uint64_t bytes;			// Record bytes currently held
+
+	uint64_t pushes;		// Snapshot cost counters
+	uint64_t keyframes;
+	uint64_t pushNs;		// Total time spent in pushRewind
+	uint64_t lastPushNs;
+	uint64_t maxPushNs;
+} rewind_t;
+
+rewind_t *createRewind(uint32_t capBytes);
+void destroyRewind(rewind_t *rewind);
+void resetRewind(rewind_t *rewind);
+void pushRewind(rewind_t *rewind, chip8_t *chip8);
+bool popRewind(rewind_t *rewind, chip8_t *chip8);
+
+// Frames currently held
+static inline uint64_t rewindFrames(const rewind_t *rewind) {
+	return rewind->next - rewind->first;
+}
+
+#endif
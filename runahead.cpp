@@ -0,0 +1,45 @@
+#include <string.h>
+#include <chrono>
+#include "runahead.h"
+
+
+// Called after the instructions of frame ran and before its timers tick, leaves the machine as it was
+// The speculative frames aren't profiled, traced, debugged, heard or counted as idle, those only follow what really ran
+void runAhead(runahead_t *ahead, chip8_t *chip8, const config_t *config, uint64_t frame) {
+	const auto start = std::chrono::steady_clock::now();
+	profile_t *profile = chip8->profile;
+	trace_t *trace = chip8->trace;
+	debug_t *debug = chip8->debug;
+	audio_stream_t *audio = chip8->audio;
+	const uint64_t idle = chip8->idleInstructions;
+	// Rolled back to the same bytes, so the pages and rows the speculative frames touched aren't changed for rewind
+	uint8_t dirtyPages[sizeof chip8->dirtyPages];
+	memcpy(dirtyPages, chip8->dirtyPages, sizeof dirtyPages);
+	const uint64_t changedRows = chip8->changedRows;
+	chip8->profile = NULL;
+	chip8->trace = NULL;
+	chip8->debug = NULL;
+	chip8->audio = NULL;
+	captureState(chip8, &ahead->saved);
+
+	for (uint32_t i = 1; i <= ahead->frames; i++) {
+		updateTimers(chip8);
+		emulateInstructions(chip8, config, frameInstructions(config, frame + i));
+	}
+	memcpy(ahead->display, chip8->display, sizeof ahead->display);
+	ahead->hires = chip8->hires;
+
+	rollbackState(chip8, &ahead->saved);
+	chip8->profile = profile;
+	chip8->trace = trace;
+	chip8->debug = debug;
+	chip8->audio = audio;
+	chip8->idleInstructions = idle;
+	memcpy(chip8->dirtyPages, dirtyPages, sizeof dirtyPages);
+	chip8->changedRows = changedRows;
+
+	const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	ahead->runs++;
+	ahead->ns += ns;
+	if (ns > ahead->maxNs) ahead->maxNs = ns;
+}
@@ -0,0 +1,25 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include <stdint.h>
+#include "chip8.h"
+#include "savestate.h"
+
+// Run ahead: after each real frame the machine is snapshotted, run some frames further with the keys
+// held right now, and the screen it reaches is what gets shown before rolling back. Whatever the
+// input changes is on screen that many frames sooner, as long as the keys stay put for that long.
+// Sound always comes from the real machine
+typedef struct {
+	uint32_t frames;			// How far ahead to run, 0 is off
+	savestate_t saved;			// Real machine while the speculative frames run
+	uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS];	// Screen of the frame reached
+	bool hires;					// and its resolution
+
+	uint64_t runs;				// Cost counters
+	uint64_t ns;				// Total time spent in runAhead
+	uint64_t maxNs;
+} runahead_t;
+
+void runAhead(runahead_t *ahead, chip8_t *chip8, const config_t *config, uint64_t frame);
+
+#endif
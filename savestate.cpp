@@ -0,0 +1,210 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "savestate.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+void captureState(const chip8_t *chip8, savestate_t *state) {
+	memcpy(state->memory, chip8->memory, sizeof state->memory);
+	memcpy(state->display, chip8->display, sizeof state->display);
+	captureRegisters(chip8, state);
+}
+
+
+// Everything but memory and the display, the few hundred bytes that change every frame
+void captureRegisters(const chip8_t *chip8, savestate_t *state) {
+	// Reserved bytes stay zero so equal machines give equal files
+	memset(state, 0, offsetof(savestate_t, memory));
+	memset(&state->rngState, 0, sizeof *state - offsetof(savestate_t, rngState));
+	state->magic = SAVESTATE_MAGIC;
+	state->version = SAVESTATE_VERSION;
+	state->size = sizeof *state;
+
+	state->rngState = chip8->rngState;
+	memcpy(state->stack, chip8->stack, sizeof state->stack);
+	state->pc = chip8->pc;
+	state->I = chip8->I;
+	state->sp = chip8->sp;
+	memcpy(state->V, chip8->V, sizeof state->V);
+	for (uint32_t i = 0; i < 16; i++) state->keys[i] = chip8->keys[i];
+	state->delayTimer = chip8->delay_timer;
+	state->soundTimer = chip8->sound_timer;
+	state->waitKey = chip8->waitKey;
+	state->waitKeyPressed = chip8->waitKeyPressed;
+	state->pitch = chip8->pitch;
+	state->patternSet = chip8->patternSet;
+	state->hires = chip8->hires;
+	state->planes = chip8->planes;
+	memcpy(state->audioPattern, chip8->audioPattern, sizeof state->audioPattern);
+	memcpy(state->flags, chip8->flags, sizeof state->flags);
+}
+
+
+// Run state, attached caches and the rom name are left alone, whatever was decoded or translated
+// from the old memory is dropped
+void restoreState(chip8_t *chip8, const savestate_t *state) {
+	memcpy(chip8->memory, state->memory, sizeof chip8->memory);
+	memcpy(chip8->display, state->display, sizeof chip8->display);
+	chip8->rngState = state->rngState;
+	memcpy(chip8->stack, state->stack, sizeof chip8->stack);
+	chip8->pc = state->pc;
+	chip8->I = state->I;
+	chip8->sp = state->sp;
+	memcpy(chip8->V, state->V, sizeof chip8->V);
+	for (uint32_t i = 0; i < 16; i++) chip8->keys[i] = state->keys[i] != 0;
+	chip8->delay_timer = state->delayTimer;
+	chip8->sound_timer = state->soundTimer;
+	chip8->waitKey = state->waitKey;
+	chip8->waitKeyPressed = state->waitKeyPressed != 0;
+	chip8->pitch = state->pitch;
+	chip8->patternSet = state->patternSet != 0;
+	chip8->hires = state->hires != 0;
+	chip8->planes = state->planes & 3;
+	memcpy(chip8->audioPattern, state->audioPattern, sizeof chip8->audioPattern);
+	memcpy(chip8->flags, state->flags, sizeof chip8->flags);
+
+	chip8->dirtyRows = ~0ull;
+	chip8->changedRows = ~0ull;
+	memset(chip8->dirtyPages, 1, sizeof chip8->dirtyPages);
+	if (chip8->cache) flushDecodeCache(chip8->cache);
+	if (chip8->jit) flushJit(chip8->jit);
+}
+
+
+// Returns to a state captured from this machine a few frames ago
+// Only the bytes that changed since go back through writeMemory, so decodes and translated blocks of
+// untouched code survive where restoreState would drop them all. Allocates nothing
+void rollbackState(chip8_t *chip8, const savestate_t *state) {
+	// Compared a cache line at a time, a frame rarely writes more than a few of the 1024
+	for (uint32_t line = 0; line < sizeof chip8->memory; line += 64) {
+		if (!memcmp(&chip8->memory[line], &state->memory[line], 64)) continue;
+		for (uint32_t addr = line; addr < line + 64; addr++)
+			if (chip8->memory[addr] != state->memory[addr]) writeMemory(chip8, addr, state->memory[addr]);
+	}
+	if (chip8->hires != (state->hires != 0)) chip8->dirtyRows = ~0ull;	// Every row moves on a resolution change
+	for (uint32_t row = 0; row < DISPLAY_HEIGHT; row++)
+		for (uint32_t p = 0; p < DISPLAY_PLANES; p++)
+			if (memcmp(chip8->display[p][row], state->display[p][row], sizeof state->display[p][row])) {
+				chip8->dirtyRows |= 1ull << row;
+				chip8->changedRows |= 1ull << row;
+			}
+	memcpy(chip8->display, state->display, sizeof chip8->display);
+	chip8->rngState = state->rngState;
+	memcpy(chip8->stack, state->stack, sizeof chip8->stack);
+	chip8->pc = state->pc;
+	chip8->I = state->I;
+	chip8->sp = state->sp;
+	memcpy(chip8->V, state->V, sizeof chip8->V);
+	for (uint32_t i = 0; i < 16; i++) chip8->keys[i] = state->keys[i] != 0;
+	chip8->delay_timer = state->delayTimer;
+	chip8->sound_timer = state->soundTimer;
+	chip8->waitKey = state->waitKey;
+	chip8->waitKeyPressed = state->waitKeyPressed != 0;
+	chip8->pitch = state->pitch;
+	chip8->patternSet = state->patternSet != 0;
+	chip8->hires = state->hires != 0;
+	chip8->planes = state->planes & 3;
+	memcpy(chip8->audioPattern, state->audioPattern, sizeof chip8->audioPattern);
+	memcpy(chip8->flags, state->flags, sizeof chip8->flags);
+}
+
+
+bool saveState(const chip8_t *chip8, const char *path) {
+	savestate_t state;
+	captureState(chip8, &state);
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "Could not open %s for writing\n", path);
+		return false;
+	}
+	const bool ok = fwrite(&state, sizeof state, 1, file) == 1;
+	if (fclose(file) != 0 || !ok) {
+		fprintf(stderr, "Could not write save state %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+
+// Header checks, a file from another version or a truncated write is refused before anything is copied
+// So is one whose index fields point outside what they index, the engines use them unchecked
+static bool validState(const savestate_t *state, size_t fileSize, const char *path) {
+	if (fileSize < sizeof *state || state->magic != SAVESTATE_MAGIC) {
+		fprintf(stderr, "%s is not a save state\n", path);
+		return false;
+	}
+	if (state->version != SAVESTATE_VERSION || state->size != sizeof *state) {
+		fprintf(stderr, "%s is save state version %u, this build reads version %u\n", path, state->version, SAVESTATE_VERSION);
+		return false;
+	}
+	if (state->sp > sizeof state->stack / sizeof state->stack[0]) {
+		fprintf(stderr, "%s has a corrupt stack pointer\n", path);
+		return false;
+	}
+	// FX0A indexes the keys with waitKey once a press has been seen
+	if ((state->waitKey > 0xF && state->waitKey != 0xFF) || (state->waitKeyPressed && state->waitKey == 0xFF)) {
+		fprintf(stderr, "%s has a corrupt key wait\n", path);
+		return false;
+	}
+	return true;
+}
+
+
+// The file is mapped read only and restored straight from the mapping, no intermediate buffer
+bool loadState(chip8_t *chip8, const char *path) {
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "Could not open save state %s\n", path);
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = NULL;
+	const void *view = NULL;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= (LONGLONG)sizeof(savestate_t)) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	const size_t size = view ? (size_t)fileSize.QuadPart : 0;
+#else
+	const int file = open(path, O_RDONLY);
+	if (file < 0) {
+		fprintf(stderr, "Could not open save state %s\n", path);
+		return false;
+	}
+	struct stat info;
+	const void *view = NULL;
+	if (fstat(file, &info) == 0 && (size_t)info.st_size >= sizeof(savestate_t)) {
+		void *mem = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		view = mem == MAP_FAILED ? NULL : mem;
+	}
+	const size_t size = view ? (size_t)info.st_size : 0;
+#endif
+
+	bool ok = false;
+	if (!view) fprintf(stderr, "%s is not a save state\n", path);
+	else if (validState((const savestate_t *)view, size, path)) {
+		restoreState(chip8, (const savestate_t *)view);
+		ok = true;
+	}
+
+#if defined(_WIN32)
+	if (view) UnmapViewOfFile(view);
+	if (mapping) CloseHandle(mapping);
+	CloseHandle(file);
+#else
+	if (view) munmap((void *)view, size);
+	close(file);
+#endif
+	return ok;
+}
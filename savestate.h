@@ -0,0 +1,55 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+#define SAVESTATE_MAGIC 0x53533843u		// "C8SS" read as a little endian word
+#define SAVESTATE_VERSION 3				// Bump whenever savestate_t changes shape, 2 added the XO-CHIP audio registers,
+										// 3 the SUPER-CHIP/XO-CHIP screen, planes, flags and 64K of memory
+
+// Complete machine state, this struct is also the file format
+// A state file is exactly one savestate_t written in host (little endian) byte order, so loading one
+// maps the file and copies straight out of it. Every field has a fixed width and the layout has no
+// implicit padding, reserved bytes are always written as zero
+typedef struct {
+	uint32_t magic;				// SAVESTATE_MAGIC
+	uint32_t version;			// SAVESTATE_VERSION
+	uint32_t size;				// sizeof(savestate_t) of the writer
+	uint32_t reserved;
+
+	uint8_t memory[MEMORY_SIZE];
+	uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS];	// Same layout as chip8_t::display
+	uint64_t rngState;
+	uint16_t stack[STACK_DEPTH];
+	uint16_t pc;
+	uint16_t I;
+	uint16_t sp;
+	uint8_t V[16];
+	uint8_t keys[16];			// 0 or 1 per key
+	uint8_t delayTimer;
+	uint8_t soundTimer;
+	uint8_t waitKey;			// FX0A key being waited on, 0xFF if none yet
+	uint8_t waitKeyPressed;
+	uint8_t pitch;
+	uint8_t patternSet;
+	uint8_t hires;
+	uint8_t planes;
+	uint8_t reserved2[2];
+	uint8_t audioPattern[16];
+	uint8_t flags[16];
+} savestate_t;
+
+static_assert(sizeof(savestate_t) == 67712, "savestate_t is the on disk format, keep it free of implicit padding");
+static_assert(STACK_DEPTH == 12 && sizeof(savestate_t::stack) == sizeof(chip8_t::stack),
+	"the stack depth is part of the state file format, bump SAVESTATE_VERSION along with it");
+
+void captureState(const chip8_t *chip8, savestate_t *state);
+void captureRegisters(const chip8_t *chip8, savestate_t *state);
+void restoreState(chip8_t *chip8, const savestate_t *state);
+void rollbackState(chip8_t *chip8, const savestate_t *state);
+bool saveState(const chip8_t *chip8, const char *path);
+bool loadState(chip8_t *chip8, const char *path);
+
+#endif
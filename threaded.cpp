@@ -0,0 +1,480 @@
+#include <string.h>
+#include "chip8.h"
+#include "threaded.h"
+
+// Threaded code interpreter
+// Every one of the 65536 possible opcodes is classified at compile time into the handler that runs it,
+// invalid encodings (5XY1, 8XY8, EX00, ...) included, so executing an instruction is a fetch, one byte
+// table load and an indirect jump. With GCC/Clang each handler ends in its own copy of the dispatch
+// (computed goto) which gives the branch predictor one indirect jump per handler to learn.
+// The pause check is made once per burst instead of once per instruction, and the whole loop is
+// instantiated once per quirk profile. The table is shared by all profiles, so SUPER-CHIP and XO-CHIP
+// opcodes are classified everywhere and their handlers compile to nothing on profiles without them.
+
+#if defined(__GNUC__)
+#define THREADED_GOTO
+#endif
+
+typedef enum : uint8_t {
+	OP_NOP, OP_CLS, OP_RET, OP_JP, OP_CALL, OP_SE_IMM, OP_SNE_IMM, OP_SE_REG, OP_LD_IMM, OP_ADD_IMM,
+	OP_LD_REG, OP_OR, OP_AND, OP_XOR, OP_ADD_REG, OP_SUB, OP_SHR, OP_SUBN, OP_SHL, OP_SNE_REG,
+	OP_LD_I, OP_JP_V0, OP_RND, OP_DRW, OP_SKP, OP_SKNP, OP_LD_VX_DT, OP_LD_KEY, OP_LD_DT_VX, OP_LD_ST_VX,
+	OP_ADD_I, OP_LD_F, OP_BCD, OP_STORE, OP_LOAD, OP_LD_AUDIO, OP_LD_PITCH,
+	OP_SCD, OP_SCU, OP_SCR, OP_SCL, OP_EXIT, OP_LOW, OP_HIGH, OP_ST_RANGE, OP_LD_RANGE, OP_LD_I_LONG,
+	OP_PLANE, OP_LD_HF, OP_ST_FLAGS, OP_LD_FLAGS,
+	OP_COUNT
+} op_class_t;
+
+// Same decode tree as emulateInstruction
+static constexpr op_class_t classify(uint16_t opcode) {
+	const uint8_t N = opcode & 0x0F;
+	const uint8_t NN = opcode & 0xFF;
+
+	switch ((opcode >> 12) & 0x0F) {
+		case 0x00:
+			if (NN == 0xE0) return OP_CLS;
+			if (NN == 0xEE) return OP_RET;
+			if ((opcode & 0xFFF0) == 0x00C0) return OP_SCD;
+			if ((opcode & 0xFFF0) == 0x00D0) return OP_SCU;
+			switch (opcode) {
+				case 0x00FB: return OP_SCR;
+				case 0x00FC: return OP_SCL;
+				case 0x00FD: return OP_EXIT;
+				case 0x00FE: return OP_LOW;
+				case 0x00FF: return OP_HIGH;
+				default: return OP_NOP;
+			}
+		case 0x01: return OP_JP;
+		case 0x02: return OP_CALL;
+		case 0x03: return OP_SE_IMM;
+		case 0x04: return OP_SNE_IMM;
+		case 0x05: return N == 0 ? OP_SE_REG : N == 2 ? OP_ST_RANGE : N == 3 ? OP_LD_RANGE : OP_NOP;
+		case 0x06: return OP_LD_IMM;
+		case 0x07: return OP_ADD_IMM;
+		case 0x08:
+			switch (N) {
+				case 0x0: return OP_LD_REG;
+				case 0x1: return OP_OR;
+				case 0x2: return OP_AND;
+				case 0x3: return OP_XOR;
+				case 0x4: return OP_ADD_REG;
+				case 0x5: return OP_SUB;
+				case 0x6: return OP_SHR;
+				case 0x7: return OP_SUBN;
+				case 0xE: return OP_SHL;
+				default: return OP_NOP;
+			}
+		case 0x09: return OP_SNE_REG;
+		case 0x0A: return OP_LD_I;
+		case 0x0B: return OP_JP_V0;
+		case 0x0C: return OP_RND;
+		case 0x0D: return OP_DRW;
+		case 0x0E: return NN == 0x9E ? OP_SKP : NN == 0xA1 ? OP_SKNP : OP_NOP;
+		case 0x0F:
+			switch (NN) {
+				case 0x00: return opcode == 0xF000 ? OP_LD_I_LONG : OP_NOP;
+				case 0x01: return OP_PLANE;
+				case 0x07: return OP_LD_VX_DT;
+				case 0x0A: return OP_LD_KEY;
+				case 0x15: return OP_LD_DT_VX;
+				case 0x18: return OP_LD_ST_VX;
+				case 0x02: return opcode == 0xF002 ? OP_LD_AUDIO : OP_NOP;
+				case 0x3A: return OP_LD_PITCH;
+				case 0x1E: return OP_ADD_I;
+				case 0x29: return OP_LD_F;
+				case 0x30: return OP_LD_HF;
+				case 0x33: return OP_BCD;
+				case 0x55: return OP_STORE;
+				case 0x65: return OP_LOAD;
+				case 0x75: return OP_ST_FLAGS;
+				case 0x85: return OP_LD_FLAGS;
+				default: return OP_NOP;
+			}
+	}
+	return OP_NOP;
+}
+
+typedef struct {
+	op_class_t handler[65536];
+} op_table_t;
+
+static constexpr op_table_t buildOpTable() {
+	op_table_t table = {};
+	for (uint32_t opcode = 0; opcode < 65536; opcode++)
+		table.handler[opcode] = classify(opcode);
+	return table;
+}
+
+static constexpr op_table_t opTable = buildOpTable();
+
+
+template <quirk_profile_t P>
+static void runThreaded(chip8_t *chip8, uint32_t count) {
+	constexpr quirk_set_t quirks = quirkSets[P];
+	uint16_t opcode;
+
+	// Operand fields of the current opcode
+	#define X	((opcode >> 8) & 0x0F)
+	#define Y	((opcode >> 4) & 0x0F)
+	#define N	(opcode & 0x0F)
+	#define NN	(opcode & 0xFF)
+	#define NNN	(opcode & 0x0FFF)
+	#define VX	chip8->V[X]
+	#define VY	chip8->V[Y]
+
+	#define FETCH()																			\
+		opcode = (chip8->memory[chip8->pc] << 8) | chip8->memory[(uint16_t)(chip8->pc + 1)];	\
+		chip8->pc += 2
+
+#ifdef THREADED_GOTO
+	// Must stay in op_class_t order
+	static const void *const labels[OP_COUNT] = {
+		&&L_OP_NOP, &&L_OP_CLS, &&L_OP_RET, &&L_OP_JP, &&L_OP_CALL, &&L_OP_SE_IMM, &&L_OP_SNE_IMM,
+		&&L_OP_SE_REG, &&L_OP_LD_IMM, &&L_OP_ADD_IMM, &&L_OP_LD_REG, &&L_OP_OR, &&L_OP_AND, &&L_OP_XOR,
+		&&L_OP_ADD_REG, &&L_OP_SUB, &&L_OP_SHR, &&L_OP_SUBN, &&L_OP_SHL, &&L_OP_SNE_REG, &&L_OP_LD_I,
+		&&L_OP_JP_V0, &&L_OP_RND, &&L_OP_DRW, &&L_OP_SKP, &&L_OP_SKNP, &&L_OP_LD_VX_DT, &&L_OP_LD_KEY,
+		&&L_OP_LD_DT_VX, &&L_OP_LD_ST_VX, &&L_OP_ADD_I, &&L_OP_LD_F, &&L_OP_BCD, &&L_OP_STORE, &&L_OP_LOAD,
+		&&L_OP_LD_AUDIO, &&L_OP_LD_PITCH, &&L_OP_SCD, &&L_OP_SCU, &&L_OP_SCR, &&L_OP_SCL, &&L_OP_EXIT,
+		&&L_OP_LOW, &&L_OP_HIGH, &&L_OP_ST_RANGE, &&L_OP_LD_RANGE, &&L_OP_LD_I_LONG, &&L_OP_PLANE, &&L_OP_LD_HF,
+		&&L_OP_ST_FLAGS, &&L_OP_LD_FLAGS,
+	};
+	#define CASE(cls)	L_##cls:
+	#define NEXT		do { if (count-- == 0) return; FETCH(); goto *labels[opTable.handler[opcode]]; } while (0)
+
+	NEXT;
+	{
+#else
+	#define CASE(cls)	case cls:
+	#define NEXT		continue
+
+	while (count-- > 0) {
+		FETCH();
+		switch (opTable.handler[opcode]) {
+#endif
+
+	CASE(OP_NOP)
+		// Unimplemented /invalid opcode
+		NEXT;
+
+	CASE(OP_CLS)
+		// 0x00E0: clear screen
+		clearDisplay(chip8);
+		NEXT;
+
+	CASE(OP_RET)
+		// 0x00EE: Return from subroutine
+		returnFromSubroutine(chip8);
+		NEXT;
+
+	CASE(OP_SCD)
+		// 0x00CN: SUPER-CHIP, scroll down N pixels
+		if constexpr (quirks.superChip) scrollDown(chip8, N);
+		NEXT;
+
+	CASE(OP_SCU)
+		// 0x00DN: XO-CHIP, scroll up N pixels
+		if constexpr (quirks.xoChip) scrollUp(chip8, N);
+		NEXT;
+
+	CASE(OP_SCR)
+		// 0x00FB: SUPER-CHIP, scroll right 4 pixels
+		if constexpr (quirks.superChip) scrollRight(chip8);
+		NEXT;
+
+	CASE(OP_SCL)
+		// 0x00FC: SUPER-CHIP, scroll left 4 pixels
+		if constexpr (quirks.superChip) scrollLeft(chip8);
+		NEXT;
+
+	CASE(OP_EXIT)
+		// 0x00FD: SUPER-CHIP, exit. The machine stays on this instruction
+		if constexpr (quirks.superChip) chip8->pc -= 2;
+		NEXT;
+
+	CASE(OP_LOW)
+		// 0x00FE: SUPER-CHIP, lo-res 64x32
+		if constexpr (quirks.superChip) setResolution(chip8, false);
+		NEXT;
+
+	CASE(OP_HIGH)
+		// 0x00FF: SUPER-CHIP, hi-res 128x64
+		if constexpr (quirks.superChip) setResolution(chip8, true);
+		NEXT;
+
+	CASE(OP_JP)
+		// 0x1NNN jump to adress NNN
+		chip8->pc = NNN;
+		NEXT;
+
+	CASE(OP_CALL)
+		// 0x2NNN: call subroutine at NNN
+		callSubroutine(chip8, NNN);
+		NEXT;
+
+	CASE(OP_SE_IMM)
+		// 0x3XNN: skip next inst if VX == NN
+		if (VX == NN) skipInstruction<P>(chip8);
+		NEXT;
+
+	CASE(OP_SNE_IMM)
+		// 0x4XNN: skip next inst if VX != NN
+		if (VX != NN) skipInstruction<P>(chip8);
+		NEXT;
+
+	CASE(OP_SE_REG)
+		// 0x5XY0: skip next inst if VX == VY
+		if (VX == VY) skipInstruction<P>(chip8);
+		NEXT;
+
+	CASE(OP_ST_RANGE)
+		// 0x5XY2: XO-CHIP, store VX to VY at I
+		if constexpr (quirks.xoChip) storeRange(chip8, X, Y);
+		NEXT;
+
+	CASE(OP_LD_RANGE)
+		// 0x5XY3: XO-CHIP, load VX to VY from I
+		if constexpr (quirks.xoChip) loadRange(chip8, X, Y);
+		NEXT;
+
+	CASE(OP_LD_IMM)
+		// 0x6XNN: VX = NN
+		VX = NN;
+		NEXT;
+
+	CASE(OP_ADD_IMM)
+		// 0x7XNN: VX += NN
+		VX += NN;
+		NEXT;
+
+	CASE(OP_LD_REG)
+		// 0x8XY0: VX = VY
+		VX = VY;
+		NEXT;
+
+	CASE(OP_OR)
+		// 0x8XY1: VX |= VY
+		VX |= VY;
+		if constexpr (quirks.vfReset) chip8->V[0xF] = 0;
+		NEXT;
+
+	CASE(OP_AND)
+		// 0x8XY2: VX &= VY
+		VX &= VY;
+		if constexpr (quirks.vfReset) chip8->V[0xF] = 0;
+		NEXT;
+
+	CASE(OP_XOR)
+		// 0x8XY3: VX ^= VY
+		VX ^= VY;
+		if constexpr (quirks.vfReset) chip8->V[0xF] = 0;
+		NEXT;
+
+	CASE(OP_ADD_REG) {
+		// 0x8XY4: VX += VY, VF = carry
+		const bool carry = ((uint16_t)(VX + VY) > 255);
+		VX += VY;
+		chip8->V[0xF] = carry;
+		NEXT;
+	}
+
+	CASE(OP_SUB) {
+		// 0x8XY5: VX -= VY, VF = no borrow
+		const bool carry = VX >= VY;
+		VX -= VY;
+		chip8->V[0xF] = carry;
+		NEXT;
+	}
+
+	CASE(OP_SHR) {
+		// 0x8XY6: VX = VY >> 1 (VX >> 1 without shiftVY), VF = shifted off bit
+		const uint8_t source = quirks.shiftVY ? VY : VX;
+		const bool carry = source & 1;
+		VX = source >> 1;
+		chip8->V[0xF] = carry;
+		NEXT;
+	}
+
+	CASE(OP_SUBN) {
+		// 0x8XY7: VX = VY - VX, VF = no borrow
+		const bool carry = VX <= VY;
+		VX = VY - VX;
+		chip8->V[0xF] = carry;
+		NEXT;
+	}
+
+	CASE(OP_SHL) {
+		// 0x8XYE: VX = VY << 1 (VX << 1 without shiftVY), VF = shifted off bit
+		const uint8_t source = quirks.shiftVY ? VY : VX;
+		const bool carry = (source & 0x80) >> 7;
+		VX = source << 1;
+		chip8->V[0xF] = carry;
+		NEXT;
+	}
+
+	CASE(OP_SNE_REG)
+		// 0x9XY0: skip next inst if VX != VY
+		if (VX != VY) skipInstruction<P>(chip8);
+		NEXT;
+
+	CASE(OP_LD_I)
+		// 0xANNN: I = NNN
+		chip8->I = NNN;
+		NEXT;
+
+	CASE(OP_JP_V0)
+		// 0xBNNN: Jump to V0 + NNN, or BXNN: VX + XNN with jumpVX
+		chip8->pc = (quirks.jumpVX ? VX : chip8->V[0]) + NNN;
+		NEXT;
+
+	CASE(OP_RND)
+		// 0xCXNN: VX = rand() & NN
+		VX = nextRandom(&chip8->rngState) & NN;
+		NEXT;
+
+	CASE(OP_DRW)
+		// 0xDXYN, draws N height sprite at coord X,Y, read from mem location I
+		drawSprite<quirks.wrap, quirks.superChip>(chip8, VX, VY, N);
+		NEXT;
+
+	CASE(OP_SKP)
+		// 0xEX9E: Skip next inst if key in VX is pressed, only the low nibble of VX picks the key
+		if (chip8->keys[VX & 0xF]) skipInstruction<P>(chip8);
+		NEXT;
+
+	CASE(OP_SKNP)
+		// 0xEXA1: Skip next inst if key in VX is not pressed
+		if (!chip8->keys[VX & 0xF]) skipInstruction<P>(chip8);
+		NEXT;
+
+	CASE(OP_LD_VX_DT)
+		// 0xFX07: VX = Delay timer
+		VX = chip8->delay_timer;
+		NEXT;
+
+	CASE(OP_LD_KEY)
+		// 0xFX0A: VX = get_key(); Await until a keypress and its release, and store in VX
+		for (uint8_t i = 0; chip8->waitKey == 0xFF && i < sizeof chip8->keys; i++)
+			if (chip8->keys[i]) {
+				chip8->waitKey = i;
+				chip8->waitKeyPressed = true;
+				break;
+			}
+
+		if (!chip8->waitKeyPressed || chip8->keys[chip8->waitKey]) {
+			chip8->pc -= 2;	// Keep re-running this instruction
+		} else {
+			VX = chip8->waitKey;
+			chip8->waitKey = 0xFF;
+			chip8->waitKeyPressed = false;
+		}
+		NEXT;
+
+	CASE(OP_LD_DT_VX)
+		// 0xFX15: Delay timer = VX
+		chip8->delay_timer = VX;
+		NEXT;
+
+	CASE(OP_LD_ST_VX)
+		// 0xFX18: Sound timer = VX
+		chip8->sound_timer = VX;
+		NEXT;
+
+	CASE(OP_LD_AUDIO)
+		// 0xF002: XO-CHIP, audio pattern = 16 bytes at I
+		if constexpr (quirks.xoChip) setAudioPattern(chip8);
+		NEXT;
+
+	CASE(OP_LD_PITCH)
+		// 0xFX3A: XO-CHIP, pattern playback pitch = VX
+		if constexpr (quirks.xoChip) chip8->pitch = VX;
+		NEXT;
+
+	CASE(OP_LD_I_LONG)
+		// 0xF000 NNNN: XO-CHIP, I = NNNN
+		if constexpr (quirks.xoChip) loadLongI(chip8);
+		NEXT;
+
+	CASE(OP_PLANE)
+		// 0xFN01: XO-CHIP, select the planes drawing acts on
+		if constexpr (quirks.xoChip) chip8->planes = X & 3;
+		NEXT;
+
+	CASE(OP_ADD_I)
+		// 0xFX1E: I += VX
+		chip8->I += VX;
+		NEXT;
+
+	CASE(OP_LD_F)
+		// 0xFX29: I = sprite location for char in VX
+		chip8->I = VX * 5;
+		NEXT;
+
+	CASE(OP_LD_HF)
+		// 0xFX30: SUPER-CHIP, I = 10 byte sprite for the digit in VX
+		if constexpr (quirks.superChip) chip8->I = HIRES_FONT + VX * 10;
+		NEXT;
+
+	CASE(OP_BCD) {
+		// 0xFX33: Store BCD representation of VX at I, I+1, I+2
+		uint8_t bcd = VX;
+		writeMemory(chip8, chip8->I+2, bcd % 10);
+		bcd /= 10;
+		writeMemory(chip8, chip8->I+1, bcd % 10);
+		bcd /= 10;
+		writeMemory(chip8, chip8->I, bcd);
+		NEXT;
+	}
+
+	CASE(OP_STORE)
+		// 0xFX55: Register dump V0-VX inclusive to memory offset from I, CHIP8 increments I
+		storeRegisters<P>(chip8, X);
+		NEXT;
+
+	CASE(OP_LOAD)
+		// 0xFX65: Register load V0-VX inclusive from memory offset from I, CHIP8 increments I
+		loadRegisters<P>(chip8, X);
+		NEXT;
+
+	CASE(OP_ST_FLAGS)
+		// 0xFX75: SUPER-CHIP, save V0-VX to the user flags
+		if constexpr (quirks.superChip) memcpy(chip8->flags, chip8->V, X + 1);
+		NEXT;
+
+	CASE(OP_LD_FLAGS)
+		// 0xFX85: SUPER-CHIP, load V0-VX from the user flags
+		if constexpr (quirks.superChip) memcpy(chip8->V, chip8->flags, X + 1);
+		NEXT;
+
+#ifdef THREADED_GOTO
+	}
+#else
+		default:
+			NEXT;
+		}
+	}
+#endif
+
+	#undef X
+	#undef Y
+	#undef N
+	#undef NN
+	#undef NNN
+	#undef VX
+	#undef VY
+	#undef FETCH
+	#undef CASE
+	#undef NEXT
+}
+
+
+// Indexed by quirk_profile_t
+static void (*const threadedLoops[QUIRKS_COUNT])(chip8_t *, uint32_t) = {
+	runThreaded<QUIRKS_VIP>, runThreaded<QUIRKS_CHIP48>, runThreaded<QUIRKS_SCHIP>, runThreaded<QUIRKS_XOCHIP>,
+};
+
+
+void emulateInstructionsThreaded(chip8_t *chip8, const config_t *config, uint32_t count) {
+	// Only input handling can pause the machine, so checking once per burst is enough
+	if (chip8->state == PAUSE) return;
+	threadedLoops[config->quirks](chip8, count);
+}
@@ -0,0 +1,11 @@
+#ifndef THREADED_H
+#define THREADED_H
+
+#include <stdint.h>
+
+struct chip8_t;
+struct config_t;
+
+void emulateInstructionsThreaded(struct chip8_t *chip8, const struct config_t *config, uint32_t count);
+
+#endif
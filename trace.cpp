@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "trace.h"
+
+
+// records is rounded up to a power of two, cycle is how many instructions the machine already ran
+trace_t *createTrace(uint32_t records, uint64_t cycle) {
+	uint32_t size = 1;
+	while (size < records && size < (1u << 30)) size <<= 1;
+	trace_t *trace = (trace_t *)calloc(1, sizeof(trace_t));
+	if (!trace) return NULL;
+	trace->records = (trace_record_t *)calloc(size, sizeof(trace_record_t));
+	if (!trace->records) {
+		free(trace);
+		return NULL;
+	}
+	trace->mask = size - 1;
+	trace->cycle = cycle;
+	trace->written.store(0, std::memory_order_relaxed);
+	return trace;
+}
+
+
+void destroyTrace(trace_t *trace) {
+	if (!trace) return;
+	free(trace->records);
+	free(trace);
+}
+
+
+// Records then runs each instruction on the reference interpreter
+void traceInstructions(trace_t *trace, chip8_t *chip8, const config_t *config, uint32_t count) {
+	uint64_t written = trace->written.load(std::memory_order_relaxed);
+	trace->quirks = config->quirks;
+	for (uint32_t i = 0; i < count && chip8->state != PAUSE; i++) {
+		trace_record_t *record = &trace->records[written & trace->mask];
+		const uint16_t pc = chip8->pc;
+		const uint16_t opcode = (chip8->memory[pc] << 8) | chip8->memory[(uint16_t)(pc + 1)];
+		const uint8_t X = (opcode >> 8) & 0x0F;
+		const uint8_t Y = (opcode >> 4) & 0x0F;
+		uint8_t V[16];
+		memcpy(V, chip8->V, sizeof V);
+
+		record->cycle = trace->cycle++;
+		record->pc = pc;
+		record->opcode = opcode;
+		record->I = chip8->I;
+		record->vx = V[X];
+		record->vy = V[Y];
+		if (opcode == 0x00EE) record->extra = chip8->sp ? chip8->stack[chip8->sp - 1] : 0;
+		else if ((opcode & 0xF0FF) == 0xE09E || (opcode & 0xF0FF) == 0xE0A1) record->extra = chip8->keys[V[X] & 0xF];
+		else if ((opcode & 0xF0FF) == 0xF007) record->extra = chip8->delay_timer;
+		else if (opcode == 0xF000) record->extra = (chip8->memory[(uint16_t)(pc + 2)] << 8) | chip8->memory[(uint16_t)(pc + 3)];
+		else record->extra = 0;
+
+		emulateInstruction(chip8, config);
+
+		record->next = chip8->pc;
+		record->changed = 0;
+		for (uint32_t v = 0; v < 16; v++) record->changed |= (V[v] != chip8->V[v]) << v;
+		record->vxAfter = chip8->V[X];
+		record->vfAfter = chip8->V[0xF];
+		trace->written.store(++written, std::memory_order_release);
+	}
+}
+
+
+// Copies up to max of the newest records into out, oldest first, and returns how many
+// Safe to call while the machine runs, records the writer lapped during the copy are left out
+uint32_t readTrace(const trace_t *trace, trace_record_t *out, uint32_t max) {
+	const uint64_t size = (uint64_t)trace->mask + 1;
+	const uint64_t end = trace->written.load(std::memory_order_acquire);
+	uint64_t start = end > size ? end - size : 0;
+	if (end - start > max) start = end - max;
+	for (uint64_t i = start; i < end; i++) out[i - start] = trace->records[i & trace->mask];
+
+	// Anything the writer got round to again while we copied is torn, drop it from the front
+	const uint64_t after = trace->written.load(std::memory_order_acquire);
+	const uint64_t lapped = after > size ? after - size : 0;
+	if (lapped <= start) return (uint32_t)(end - start);
+	if (lapped >= end) return 0;
+	const uint32_t drop = (uint32_t)(lapped - start);
+	memmove(out, out + drop, (end - lapped) * sizeof *out);
+	return (uint32_t)(end - lapped);
+}
+
+
+bool saveTrace(const trace_t *trace, const char *path) {
+	const uint32_t size = trace->mask + 1;
+	trace_record_t *records = (trace_record_t *)malloc((size_t)size * sizeof(trace_record_t));
+	if (!records) return false;
+	trace_header_t header = { TRACE_MAGIC, TRACE_VERSION, sizeof(trace_record_t), 0, trace->quirks };
+	header.count = readTrace(trace, records, size);
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "Could not open %s for writing\n", path);
+		free(records);
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof header, 1, file) == 1;
+	if (ok && header.count) ok = fwrite(records, sizeof(trace_record_t), header.count, file) == header.count;
+	free(records);
+	if (fclose(file) != 0 || !ok) {
+		fprintf(stderr, "Could not write trace %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+
+// What the instruction did, in words, from what it read and wrote
+void describeTrace(const trace_record_t *record, quirk_profile_t quirks, char *out, size_t size) {
+	const uint16_t opcode = record->opcode;
+	const uint16_t NNN = opcode & 0x0FFF;
+	const uint8_t NN = opcode & 0xFF;
+	const uint8_t N = opcode & 0x0F;
+	const uint8_t X = (opcode >> 8) & 0x0F;
+	const uint8_t Y = (opcode >> 4) & 0x0F;
+	const uint8_t vx = record->vx, vy = record->vy;
+	const bool skipped = record->next != (uint16_t)(record->pc + 2);
+
+	switch (opcode >> 12) {
+		case 0x0:
+			if (opcode == 0x00E0) snprintf(out, size, "Clear screen");
+			else if (opcode == 0x00EE) snprintf(out, size, "Return from subroutine to address 0x%04X", record->extra);
+			else if ((opcode & 0xFFF0) == 0x00C0) snprintf(out, size, "Scroll down %u pixels", N);
+			else if ((opcode & 0xFFF0) == 0x00D0) snprintf(out, size, "Scroll up %u pixels", N);
+			else if (opcode == 0x00FB) snprintf(out, size, "Scroll right 4 pixels");
+			else if (opcode == 0x00FC) snprintf(out, size, "Scroll left 4 pixels");
+			else if (opcode == 0x00FD) snprintf(out, size, "Exit");
+			else if (opcode == 0x00FE || opcode == 0x00FF) snprintf(out, size, "Switch to %s", opcode == 0x00FF ? "hi-res 128x64" : "lo-res 64x32");
+			else snprintf(out, size, "Machine code routine at 0x%03X, ignored", NNN);
+			return;
+		case 0x1: snprintf(out, size, "Jump to address 0x%03X", NNN); return;
+		case 0x2: snprintf(out, size, "Call subroutine at 0x%03X", NNN); return;
+		case 0x3:
+			snprintf(out, size, "Skip next inst if V%X (0x%02X) == 0x%02X; %s", X, vx, NN, skipped ? "skipped" : "not skipped");
+			return;
+		case 0x4:
+			snprintf(out, size, "Skip next inst if V%X (0x%02X) != 0x%02X; %s", X, vx, NN, skipped ? "skipped" : "not skipped");
+			return;
+		case 0x5:
+			if (N == 2 || N == 3) {
+				snprintf(out, size, "%s V%X-V%X %s memory offset I (0x%04X)", N == 2 ? "Store" : "Load", X, Y, N == 2 ? "to" : "from", record->I);
+			} else {
+				snprintf(out, size, "Skip next inst if V%X (0x%02X) == V%X (0x%02X); %s", X, vx, Y, vy, skipped ? "skipped" : "not skipped");
+			}
+			return;
+		case 0x6: snprintf(out, size, "Set V%X = 0x%02X", X, NN); return;
+		case 0x7: snprintf(out, size, "Set V%X (0x%02X) += 0x%02X; Result: 0x%02X", X, vx, NN, record->vxAfter); return;
+		case 0x8: {
+			static const char *const ops[16] = { "=", "|=", "&=", "^=", "+=", "-=", ">>", "=-", NULL, NULL, NULL, NULL, NULL, NULL, "<<", NULL };
+			// VF is written last, so for 8XYN with X = F the result is what VF ended up as
+			const uint8_t result = X == 0xF ? record->vfAfter : record->vxAfter;
+			if (!ops[N]) snprintf(out, size, "Invalid opcode");
+			else if (N == 0) snprintf(out, size, "Set V%X = V%X (0x%02X)", X, Y, vy);
+			else if (N == 6 || N == 0xE) {
+				const bool fromY = quirkSets[quirks].shiftVY;
+				snprintf(out, size, "Set V%X = V%X (0x%02X) %s 1; Result: 0x%02X, VF = shifted out bit (%X)", X, fromY ? Y : X,
+						 fromY ? vy : vx, N == 6 ? ">>" : "<<", result, record->vfAfter);
+			}
+			else if (N == 7)
+				snprintf(out, size, "Set V%X = V%X (0x%02X) - V%X (0x%02X); Result: 0x%02X, VF = %X (1 if no borrow)", X, Y, vy, X, vx, result, record->vfAfter);
+			else if (N >= 4)
+				snprintf(out, size, "Set V%X (0x%02X) %s V%X (0x%02X); Result: 0x%02X, VF = %X (%s)", X, vx, ops[N], Y, vy, result, record->vfAfter,
+						 N == 4 ? "1 if carry" : "1 if no borrow");
+			else snprintf(out, size, "Set V%X (0x%02X) %s V%X (0x%02X); Result: 0x%02X", X, vx, ops[N], Y, vy, result);
+			return;
+		}
+		case 0x9:
+			snprintf(out, size, "Skip next inst if V%X (0x%02X) != V%X (0x%02X); %s", X, vx, Y, vy, skipped ? "skipped" : "not skipped");
+			return;
+		case 0xA: snprintf(out, size, "Set I = 0x%03X", NNN); return;
+		case 0xB:
+			if (quirkSets[quirks].jumpVX) snprintf(out, size, "Jump to 0x%03X + V%X; Result PC = 0x%04X", NNN, X, record->next);
+			else snprintf(out, size, "Jump to 0x%03X + V0; Result PC = 0x%04X", NNN, record->next);
+			return;
+		case 0xC: snprintf(out, size, "Set V%X = random & 0x%02X; Result: 0x%02X", X, NN, record->vxAfter); return;
+		case 0xD:
+			snprintf(out, size, "Draw %u row sprite from I (0x%04X) at V%X (0x%02X), V%X (0x%02X); VF = %X (1 if any pixel turned off)",
+					 N ? N : 16, record->I, X, vx, Y, vy, record->vfAfter);
+			return;
+		case 0xE:
+			if (NN == 0x9E || NN == 0xA1) {
+				snprintf(out, size, "Skip next inst if key in V%X (0x%02X) is %s; key is %s, %s", X, vx, NN == 0x9E ? "pressed" : "not pressed",
+						 record->extra ? "down" : "up", skipped ? "skipped" : "not skipped");
+				return;
+			}
+			break;
+		case 0xF:
+			switch (NN) {
+				case 0x00:
+					if (X) break;
+					snprintf(out, size, "Set I = 0x%04X", record->extra);
+					return;
+				case 0x01: snprintf(out, size, "Select drawing planes %X", X & 3); return;
+				case 0x02: snprintf(out, size, "Load 16 byte audio pattern from memory offset I (0x%04X)", record->I); return;
+				case 0x07: snprintf(out, size, "Set V%X = delay timer (0x%02X)", X, record->extra); return;
+				case 0x0A:
+					if (record->next == record->pc) snprintf(out, size, "Wait for a key to store in V%X; still waiting", X);
+					else snprintf(out, size, "Wait for a key to store in V%X; Result: 0x%02X", X, record->vxAfter);
+					return;
+				case 0x15: snprintf(out, size, "Set delay timer = V%X (0x%02X)", X, vx); return;
+				case 0x18: snprintf(out, size, "Set sound timer = V%X (0x%02X)", X, vx); return;
+				case 0x1E:
+					snprintf(out, size, "Set I (0x%04X) += V%X (0x%02X); Result: 0x%04X", record->I, X, vx, (uint16_t)(record->I + vx));
+					return;
+				case 0x29: snprintf(out, size, "Set I to the digit in V%X (0x%02X); Result: 0x%04X", X, vx, (vx & 0xF) * 5); return;
+				case 0x30:
+					snprintf(out, size, "Set I to the hi-res digit in V%X (0x%02X); Result: 0x%04X", X, vx, HIRES_FONT + (vx & 0xF) * 10);
+					return;
+				case 0x33:
+					snprintf(out, size, "Store BCD of V%X (0x%02X) at memory offset I (0x%04X)", X, vx, record->I);
+					return;
+				case 0x3A: snprintf(out, size, "Set audio pattern pitch = V%X (0x%02X)", X, vx); return;
+				case 0x55: snprintf(out, size, "Store V0-V%X at memory offset I (0x%04X)", X, record->I); return;
+				case 0x65: snprintf(out, size, "Load V0-V%X from memory offset I (0x%04X)", X, record->I); return;
+				case 0x75: snprintf(out, size, "Save V0-V%X to user flags", X); return;
+				case 0x85: snprintf(out, size, "Load V0-V%X from user flags", X); return;
+			}
+			break;
+	}
+	snprintf(out, size, "Unimplemented or invalid opcode");
+}
@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <atomic>
+#include "quirks.h"
+
+struct chip8_t;
+struct config_t;
+
+// Instruction trace, attached to a machine like the profiler
+// While one is attached every instruction runs through the reference interpreter and leaves a fixed size
+// binary record in a ring that keeps the newest ones, nothing is formatted while the machine runs. With no
+// trace attached the only cost is the pointer test once per burst. tracedump turns a saved trace into text.
+
+#define TRACE_MAGIC 0x52543843u		// "C8TR" read as a little endian word
+#define TRACE_VERSION 1
+
+// One executed instruction, values before it ran are what it read, values after are what it did
+typedef struct {
+	uint64_t cycle;			// Instructions since the machine was reset
+	uint16_t pc;			// Address it was fetched from
+	uint16_t opcode;
+	uint16_t next;			// pc after, shows whether a skip or FX0A wait happened
+	uint16_t I;				// I before, what it drew, read or wrote through
+	uint16_t changed;		// Bit v set when V[v] changed
+	uint16_t extra;			// What else it read: the return address for 00EE, the key state for EX9E/EXA1,
+							// the delay timer for FX07 and the address that follows F000
+	uint8_t vx, vy;			// VX and VY before
+	uint8_t vxAfter, vfAfter;
+} trace_record_t;
+
+static_assert(sizeof(trace_record_t) == 24, "trace files are written straight from this struct");
+
+// File header, followed by count trace_record_t oldest first in host (little endian) byte order
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recordSize;	// sizeof(trace_record_t)
+	uint32_t count;
+	uint32_t quirks;		// quirk_profile_t of the run, some descriptions depend on it
+} trace_header_t;
+
+// Single writer ring: the emulation thread fills slot written % size and then publishes written, it never
+// waits. A reader on another thread copies what it wants and checks written again afterwards, dropping any
+// record the writer could have lapped while it was copying.
+typedef struct trace_t {
+	trace_record_t *records;
+	uint32_t mask;						// Records - 1, a power of two
+	uint64_t cycle;						// Cycle of the next record
+	quirk_profile_t quirks;				// Profile the latest records ran with
+	std::atomic<uint64_t> written;		// Records ever written
+} trace_t;
+
+trace_t *createTrace(uint32_t records, uint64_t cycle);
+void destroyTrace(trace_t *trace);
+void traceInstructions(trace_t *trace, struct chip8_t *chip8, const struct config_t *config, uint32_t count);
+uint32_t readTrace(const trace_t *trace, trace_record_t *out, uint32_t max);
+bool saveTrace(const trace_t *trace, const char *path);
+void describeTrace(const trace_record_t *record, quirk_profile_t quirks, char *out, size_t size);
+
+#endif
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "disasm.h"
+
+// Offline trace decoder: prints the records headless -trace or the window's -trace saved as text
+// Usage: tracedump trace.c8t [-last N]
+
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printf("Usage: tracedump trace.c8t [-last N]\n"
+			   "  -last N    Only print the newest N records\n");
+		return 1;
+	}
+	uint32_t last = 0;
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "-last") && i + 1 < argc) last = strtoul(argv[++i], NULL, 0);
+		else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	FILE *file = fopen(argv[1], "rb");
+	if (!file) {
+		fprintf(stderr, "Could not open trace %s\n", argv[1]);
+		return 1;
+	}
+	trace_header_t header;
+	if (fread(&header, sizeof header, 1, file) != 1 || header.magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s is not a trace\n", argv[1]);
+		fclose(file);
+		return 1;
+	}
+	if (header.version != TRACE_VERSION || header.recordSize != sizeof(trace_record_t)) {
+		fprintf(stderr, "%s is trace version %u, this build reads version %u\n", argv[1], header.version, TRACE_VERSION);
+		fclose(file);
+		return 1;
+	}
+	if (header.quirks >= QUIRKS_COUNT) {
+		fprintf(stderr, "%s has unknown quirks %u\n", argv[1], header.quirks);
+		fclose(file);
+		return 1;
+	}
+	if (last && last < header.count && fseek(file, (long)(header.count - last) * sizeof(trace_record_t), SEEK_CUR) == 0)
+		header.count = last;
+
+	printf("       cycle    addr  opcode  instruction           description\n");
+	trace_record_t record;
+	for (uint32_t i = 0; i < header.count && fread(&record, sizeof record, 1, file) == 1; i++) {
+		char text[32], description[160];
+		disassemble(record.opcode, text, sizeof text);
+		describeTrace(&record, (quirk_profile_t)header.quirks, description, sizeof description);
+		printf("%12llu  0x%04X    %04X  %-20s  %s", (unsigned long long)record.cycle, record.pc, record.opcode, text, description);
+		if (record.changed) {
+			printf("; changed");
+			for (uint32_t v = 0; v < 16; v++)
+				if (record.changed & (1 << v)) printf(" V%X", v);
+		}
+		putchar('\n');
+	}
+	fclose(file);
+	return 0;
+}